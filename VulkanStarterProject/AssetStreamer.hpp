@@ -0,0 +1,597 @@
+#ifndef AssetStreamer_hpp
+#define AssetStreamer_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+#include "DescriptorHeap.hpp"
+
+/// Layout of a packed asset archive, little endian: an `AssetArchiveHeader`, `entryCount` `AssetArchiveEntry`s, then the
+/// payloads at the offsets the entries give. Payloads are stored exactly as they're uploaded, apart from 3-channel textures,
+/// which gain an opaque alpha channel on the way into the staging ring.
+struct AssetArchiveHeader {
+    static constexpr char MAGIC[4] = {'V', 'S', 'P', 'K'};
+    static constexpr uint32_t VERSION = 1;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+};
+
+enum class AssetType : uint32_t {
+    Buffer = 0,     // vertex, index or storage data, e.g. a mesh
+    Texture = 1,    // 8 bits per channel, mip level 0 only
+};
+
+struct AssetArchiveEntry {
+    char name[48];      // NUL-terminated
+    uint64_t offset;    // from the start of the archive
+    uint64_t size;
+    AssetType type;
+
+    // Textures only. `format` is the VkFormat of the image and must have 4 bytes per texel; `channels` is 3 or 4.
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t reserved;
+};
+static_assert(sizeof(AssetArchiveHeader) == 16 && sizeof(AssetArchiveEntry) == 88, "Archive structs must match the file layout");
+
+/// A read-only memory mapping of a whole file. Pages are read in on first touch by whichever thread touches them.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    void open(const std::string& path) {
+        close();
+
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::runtime_error("Could not open " + path + ".");
+        }
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+            ::close(descriptor);
+            throw std::runtime_error(path + " is empty or can't be read.");
+        }
+
+        // The mapping keeps its own reference to the file, so the descriptor isn't needed afterwards.
+        void* mapped = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        ::close(descriptor);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("Could not map " + path + ".");
+        }
+        data = static_cast<const char*>(mapped);
+        size = static_cast<size_t>(status.st_size);
+    }
+
+    void close() {
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), size);
+            data = nullptr;
+            size = 0;
+        }
+    }
+
+    /// Asks the kernel to start reading `length` bytes at `offset`, so the copy that follows doesn't stall on every page.
+    void prefetch(size_t offset, size_t length) const {
+        size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t start = offset / pageSize * pageSize;
+        madvise(const_cast<char*>(data) + start, offset + length - start, MADV_WILLNEED);
+    }
+
+    const char* getData() const { return data; }
+    size_t getSize() const { return size; }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+/// The GPU side of a streamed asset. Only valid once its handle is ready.
+struct StreamedAsset {
+    AssetType type = AssetType::Buffer;
+    VkBuffer buffer = VK_NULL_HANDLE;       // Buffer assets
+    VkDeviceSize size = 0;
+    VkImage image = VK_NULL_HANDLE;         // Texture assets, in SHADER_READ_ONLY_OPTIMAL
+    VkImageView view = VK_NULL_HANDLE;
+    VkExtent2D extent{};
+
+    // Index in the descriptor heap (storage buffer or sampled image), or DescriptorHeap::INVALID_INDEX without a heap.
+    uint32_t heapIndex = DescriptorHeap::INVALID_INDEX;
+};
+
+/// Refers to an asset requested from an `AssetStreamer`. Cheap to copy, and safe to poll from any thread.
+class AssetHandle {
+public:
+    bool isValid() const { return record != nullptr; }
+    bool isReady() const { return record != nullptr && record->state.load(std::memory_order_acquire) == State::Ready; }
+    bool hasFailed() const { return record != nullptr && record->state.load(std::memory_order_acquire) == State::Failed; }
+
+    /// Only call once `isReady()` returned true.
+    const StreamedAsset& get() const { return record->asset; }
+
+private:
+    friend class AssetStreamer;
+
+    enum class State {
+        Queued,     // waiting for a streaming thread
+        Streaming,  // being copied into the staging ring, possibly over several frames
+        Uploading,  // every copy is queued; waiting for the GPU to finish them
+        Ready,
+        Failed,
+    };
+
+    struct Record {
+        const AssetArchiveEntry* entry = nullptr;
+        StreamedAsset asset;
+        Allocation allocation;
+        std::atomic<State> state{State::Queued};
+        TimelinePoint uploadTicket;
+    };
+
+    std::shared_ptr<Record> record;
+};
+
+/// Streams buffers and textures out of a memory-mapped archive without blocking the frame loop.
+///
+/// `load()` returns at once. Streaming threads create the resource, then copy the payload straight from the mapping into the
+/// staging ring, in chunks of at most `CHUNK_SIZE` so a large mesh is spread over several frames instead of filling one.
+/// The staging ring may only be written between its `beginFrame()` and `submit()`/`recordCopies()`, so the threads write
+/// during a window the frame loop opens with `beginFrame()` and closes with `endFrame()`, which waits for writes in progress.
+///
+/// The copies go out with the ring's uploads, on the transfer queue when there is one. Destination resources are shared
+/// concurrently with graphics, and the graphics submit waits on the ring's transfer submission, which is what hands them
+/// over; an asset becomes ready once the scheduler reports that submission complete.
+class AssetStreamer {
+public:
+    static constexpr VkDeviceSize CHUNK_SIZE = 256 * 1024;
+
+    struct Stats {
+        uint32_t requested = 0;
+        uint32_t ready = 0;
+        uint32_t failed = 0;
+        VkDeviceSize bytesStaged = 0;
+    };
+
+    /// `bytesPerFrame` caps how much of each frame's staging region streaming may take, leaving the rest to other uploads.
+    /// `queueFamilies` are every family that touches the assets, the staging ring's transfer family included.
+    /// `heap` may be null or invalid, in which case assets aren't registered in it.
+    void init(VkDevice device, GpuMemoryAllocator& allocator, StagingRing& stagingRing, DescriptorHeap* heap,
+              const std::vector<uint32_t>& queueFamilies, uint32_t threadCount, VkDeviceSize bytesPerFrame) {
+        this->device = device;
+        this->allocator = &allocator;
+        this->stagingRing = &stagingRing;
+        this->heap = heap != nullptr && heap->isValid() ? heap : nullptr;
+        this->queueFamilies = queueFamilies;
+        this->bytesPerFrame = std::min(std::max(bytesPerFrame, CHUNK_SIZE), stagingRing.getBytesPerFrame());
+
+        stopping = false;
+        for (uint32_t i = 0; i < std::max(threadCount, 1u); i++) {
+            threads.emplace_back([this] { streamLoop(); });
+        }
+    }
+
+    /// Maps `path` and reads its entry table. Throws if the archive is malformed.
+    void open(const std::string& path) {
+        archive.open(path);
+
+        AssetArchiveHeader header{};
+        if (archive.getSize() >= sizeof(header)) {
+            memcpy(&header, archive.getData(), sizeof(header));
+        }
+        if (memcmp(header.magic, AssetArchiveHeader::MAGIC, 4) != 0 || header.version != AssetArchiveHeader::VERSION ||
+            archive.getSize() < sizeof(header) + uint64_t(header.entryCount) * sizeof(AssetArchiveEntry)) {
+            archive.close();
+            throw std::runtime_error(path + " is not an asset archive.");
+        }
+
+        const auto* entries = reinterpret_cast<const AssetArchiveEntry*>(archive.getData() + sizeof(AssetArchiveHeader));
+        for (uint32_t i = 0; i < header.entryCount; i++) {
+            const AssetArchiveEntry& entry = entries[i];
+            std::string name = entryName(entry);
+            if (entry.offset > archive.getSize() || entry.size > archive.getSize() - entry.offset || isSupported(entry) == false) {
+                std::cerr << "Skipping malformed asset " << name << " in " << path << '\n';
+                continue;
+            }
+            entriesByName[name] = &entry;
+        }
+    }
+
+    /// Stops the streaming threads, dropping queued requests, and destroys every asset. The device must be idle.
+    void destroy() {
+        {
+            // `stopping` is read under either mutex, so it's written under both.
+            std::lock_guard<std::mutex> lock(mutex);
+            std::lock_guard<std::mutex> windowLock(windowMutex);
+            stopping = true;
+            queue.clear();
+        }
+        wake.notify_all();
+        windowChanged.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+
+        for (auto& [name, handle] : handlesByName) {
+            destroyResources(*handle.record);
+        }
+        handlesByName.clear();
+        finishedInWindow.clear();
+        uploading.clear();
+        entriesByName.clear();
+        archive.close();
+    }
+
+    bool isOpen() const { return archive.getData() != nullptr; }
+
+    bool contains(const std::string& name) const { return entriesByName.count(name) != 0; }
+
+    /// Names of every asset in the archive.
+    std::vector<std::string> getAssetNames() const {
+        std::vector<std::string> names;
+        for (const auto& [name, entry] : entriesByName) {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    /// Queues `name` for streaming, or returns the handle of an earlier request for it.
+    AssetHandle load(const std::string& name) {
+        auto entry = entriesByName.find(name);
+        if (entry == entriesByName.end()) {
+            throw std::runtime_error("Asset " + name + " is not in the archive.");
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = handlesByName.find(name);
+        if (existing != handlesByName.end()) {
+            return existing->second;
+        }
+
+        AssetHandle handle;
+        handle.record = std::make_shared<AssetHandle::Record>();
+        handle.record->entry = entry->second;
+        handlesByName[name] = handle;
+        queue.push_back(handle.record);
+        stats.requested++;
+        wake.notify_one();
+        return handle;
+    }
+
+    /// Marks assets whose uploads have finished as ready, then lets the streaming threads write into the staging ring. Call
+    /// right after `StagingRing::beginFrame()`.
+    void beginFrame() {
+        for (size_t i = 0; i < uploading.size();) {
+            if (stagingRing->isUploadComplete(uploading[i]->uploadTicket)) {
+                uploading[i]->state.store(AssetHandle::State::Ready, std::memory_order_release);
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.ready++;
+                uploading[i] = uploading.back();
+                uploading.pop_back();
+            }
+            else {
+                i++;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(windowMutex);
+            if (windowOpen) {
+                return; // the previous frame ended before its uploads went out, so they're still queued
+            }
+            windowOpen = true;
+            windowBytes = 0;
+            windowNumber++;
+        }
+        windowChanged.notify_all();
+    }
+
+    /// Waits for writes in progress and stops new ones until the next `beginFrame()`. Call before
+    /// `StagingRing::recordCopies()` and `StagingRing::submit()`.
+    void endFrame() {
+        std::unique_lock<std::mutex> lock(windowMutex);
+        windowOpen = false;
+        writersDone.wait(lock, [this] { return activeWriters == 0; });
+
+        TimelinePoint ticket = stagingRing->getUploadTicket();
+        for (auto& record : finishedInWindow) {
+            record->uploadTicket = ticket;
+            record->state.store(AssetHandle::State::Uploading, std::memory_order_release);
+            uploading.push_back(record);
+        }
+        finishedInWindow.clear();
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    using Record = AssetHandle::Record;
+    using State = AssetHandle::State;
+
+    VkDevice device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* allocator = nullptr;
+    StagingRing* stagingRing = nullptr;
+    DescriptorHeap* heap = nullptr;
+    std::vector<uint32_t> queueFamilies;
+    VkDeviceSize bytesPerFrame = 0;
+
+    MappedFile archive;
+    std::unordered_map<std::string, const AssetArchiveEntry*> entriesByName;
+
+    // Guards the request queue, the handles and the stats.
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::unordered_map<std::string, AssetHandle> handlesByName;
+    std::deque<std::shared_ptr<Record>> queue;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+    Stats stats;
+
+    // Guards the staging window. Assets whose last chunk was written in the open window wait in `finishedInWindow` for
+    // `endFrame()` to give them the ticket of the submit that carries their copies.
+    std::mutex windowMutex;
+    std::condition_variable windowChanged;
+    std::condition_variable writersDone;
+    bool windowOpen = false;
+    uint64_t windowNumber = 0;
+    VkDeviceSize windowBytes = 0;
+    uint32_t activeWriters = 0;
+    std::vector<std::shared_ptr<Record>> finishedInWindow;
+
+    // Only touched by the frame loop.
+    std::vector<std::shared_ptr<Record>> uploading;
+
+    static std::string entryName(const AssetArchiveEntry& entry) {
+        return std::string(entry.name, strnlen(entry.name, sizeof(entry.name)));
+    }
+
+    static bool isSupported(const AssetArchiveEntry& entry) {
+        if (entry.type == AssetType::Buffer) {
+            return entry.size > 0;
+        }
+        if (entry.type == AssetType::Texture) {
+            VkFormat format = static_cast<VkFormat>(entry.format);
+            bool fourBytesPerTexel = format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB ||
+                                      format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+            return fourBytesPerTexel && (entry.channels == 3 || entry.channels == 4) && entry.width > 0 && entry.height > 0 &&
+                   entry.size == uint64_t(entry.width) * entry.height * entry.channels;
+        }
+        return false;
+    }
+
+    static VkDeviceSize uploadSize(const AssetArchiveEntry& entry) {
+        return entry.type == AssetType::Texture ? VkDeviceSize(entry.width) * entry.height * 4 : entry.size;
+    }
+
+    void streamLoop() {
+        while (true) {
+            std::shared_ptr<Record> record;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || queue.empty() == false; });
+                if (stopping) {
+                    return;
+                }
+                record = queue.front();
+                queue.pop_front();
+            }
+
+            bool streamed = false;
+            try {
+                record->state.store(State::Streaming);
+                createResources(*record);
+                streamed = record->entry->type == AssetType::Texture ? streamTexture(record) : streamBuffer(record);
+            } catch (const std::exception& e) {
+                std::cerr << "Asset " << entryName(*record->entry) << " was not streamed: " << e.what() << '\n';
+            }
+            if (streamed == false) {
+                record->state.store(State::Failed, std::memory_order_release);
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.failed++;
+            }
+        }
+    }
+
+    /// Images are shared with the same families as buffers, deduplicated the same way `createBuffer()` does.
+    std::vector<uint32_t> sharingFamilies() const {
+        std::set<uint32_t> families(queueFamilies.begin(), queueFamilies.end());
+        return std::vector<uint32_t>(families.begin(), families.end());
+    }
+
+    void createResources(Record& record) {
+        const AssetArchiveEntry& entry = *record.entry;
+        StreamedAsset& asset = record.asset;
+        asset.type = entry.type;
+        asset.size = uploadSize(entry);
+
+        if (entry.type == AssetType::Buffer) {
+            allocator->createBuffer(asset.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                    MemoryUsage::GpuOnly, asset.buffer, record.allocation, sharingFamilies());
+            if (heap != nullptr) {
+                asset.heapIndex = heap->registerStorageBuffer(asset.buffer);
+            }
+            return;
+        }
+
+        std::vector<uint32_t> families = sharingFamilies();
+        asset.extent = {entry.width, entry.height};
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = static_cast<VkFormat>(entry.format);
+        imageInfo.extent = {entry.width, entry.height, 1};
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (families.size() > 1) {
+            imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            imageInfo.queueFamilyIndexCount = static_cast<uint32_t>(families.size());
+            imageInfo.pQueueFamilyIndices = families.data();
+        }
+        else {
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+        allocator->createImage(imageInfo, MemoryUsage::GpuOnly, asset.image, record.allocation);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = asset.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = imageInfo.format;
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+        VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &asset.view);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Streamed texture view was not created. Error code " + std::to_string(result));
+        }
+        if (heap != nullptr) {
+            asset.heapIndex = heap->registerSampledImage(asset.view);
+        }
+    }
+
+    void destroyResources(Record& record) {
+        StreamedAsset& asset = record.asset;
+        if (heap != nullptr && asset.heapIndex != DescriptorHeap::INVALID_INDEX) {
+            if (asset.type == AssetType::Texture) {
+                heap->releaseSampledImage(asset.heapIndex);
+            }
+            else {
+                heap->releaseStorageBuffer(asset.heapIndex);
+            }
+        }
+        vkDestroyImageView(device, asset.view, nullptr);
+        if (asset.image != VK_NULL_HANDLE) {
+            allocator->destroyImage(asset.image, record.allocation);
+        }
+        if (asset.buffer != VK_NULL_HANDLE) {
+            allocator->destroyBuffer(asset.buffer, record.allocation);
+        }
+        asset = StreamedAsset{};
+    }
+
+    /// Reserves `size` bytes of staging memory inside an open window, waiting for later frames while this one is full.
+    /// Returns nothing when the streamer is being destroyed. Every successful call must be paired with `endWrite()`.
+    std::optional<StagingAllocation> beginWrite(VkDeviceSize size) {
+        std::unique_lock<std::mutex> lock(windowMutex);
+        while (true) {
+            windowChanged.wait(lock, [this] { return stopping || windowOpen; });
+            if (stopping) {
+                return std::nullopt;
+            }
+            if (windowBytes + size <= bytesPerFrame) {
+                if (auto staging = stagingRing->allocate(size, 16)) {
+                    windowBytes += size;
+                    activeWriters++;
+                    return staging;
+                }
+            }
+
+            uint64_t fullWindow = windowNumber;
+            windowChanged.wait(lock, [&] { return stopping || windowNumber != fullWindow; });
+        }
+    }
+
+    /// Ends a write started by `beginWrite()`. `finished` is the asset whose last byte was just queued, if any.
+    void endWrite(VkDeviceSize size, const std::shared_ptr<Record>& finished) {
+        {
+            std::lock_guard<std::mutex> lock(windowMutex);
+            activeWriters--;
+            if (finished != nullptr) {
+                finishedInWindow.push_back(finished);
+            }
+        }
+        writersDone.notify_all();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.bytesStaged += size;
+    }
+
+    bool streamBuffer(const std::shared_ptr<Record>& record) {
+        const AssetArchiveEntry& entry = *record->entry;
+        const char* source = archive.getData() + entry.offset;
+
+        for (VkDeviceSize offset = 0; offset < entry.size; offset += CHUNK_SIZE) {
+            VkDeviceSize chunkSize = std::min(CHUNK_SIZE, entry.size - offset);
+            archive.prefetch(entry.offset + offset, chunkSize);
+
+            auto staging = beginWrite(chunkSize);
+            if (staging.has_value() == false) {
+                return false;
+            }
+            memcpy(staging->data, source + offset, chunkSize);
+            stagingRing->enqueueBufferCopy(*staging, record->asset.buffer, offset);
+            endWrite(chunkSize, offset + chunkSize == entry.size ? record : nullptr);
+        }
+        return true;
+    }
+
+    /// Textures are copied in one piece, since each queued image copy starts from an undefined layout.
+    bool streamTexture(const std::shared_ptr<Record>& record) {
+        const AssetArchiveEntry& entry = *record->entry;
+        VkDeviceSize size = uploadSize(entry);
+        if (size > bytesPerFrame) {
+            throw std::runtime_error("it is larger than the per-frame streaming budget of " + std::to_string(bytesPerFrame) +
+                                     " bytes");
+        }
+        archive.prefetch(entry.offset, entry.size);
+
+        auto staging = beginWrite(size);
+        if (staging.has_value() == false) {
+            return false;
+        }
+        const char* source = archive.getData() + entry.offset;
+        if (entry.channels == 4) {
+            memcpy(staging->data, source, size);
+        }
+        else {
+            char* destination = static_cast<char*>(staging->data);
+            for (uint64_t texel = 0; texel < uint64_t(entry.width) * entry.height; texel++) {
+                memcpy(destination + texel * 4, source + texel * 3, 3);
+                destination[texel * 4 + 3] = static_cast<char>(0xFF);
+            }
+        }
+        stagingRing->enqueueImageCopy(*staging, record->asset.image, {entry.width, entry.height, 1},
+                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        endWrite(size, record);
+        return true;
+    }
+};
+
+#endif /* AssetStreamer_hpp */
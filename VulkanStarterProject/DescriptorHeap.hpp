@@ -0,0 +1,345 @@
+#ifndef DescriptorHeap_hpp
+#define DescriptorHeap_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// One global, bindless descriptor set holding every sampled image, storage buffer and sampler the renderer uses.
+///
+/// Resources are registered once and get a stable index into their binding's array, which draws pass to shaders through push
+/// constants. The set is bound once per command buffer with `bind()`, so there's no per-draw `vkCmdBindDescriptorSets()` and no
+/// per-frame descriptor pool churn. Every binding is update-after-bind, partially bound and may be updated while unused slots
+/// are pending, so registering a resource never waits for the GPU.
+///
+/// Shaders declare the set as:
+///
+///     layout(set = 0, binding = 0) uniform texture2D sampledImages[];
+///     layout(set = 0, binding = 1) buffer StorageBuffers { uint data[]; } storageBuffers[];
+///     layout(set = 0, binding = 2) uniform sampler samplers[];
+///
+/// Requires VK_EXT_descriptor_indexing or Vulkan 1.2 with runtimeDescriptorArray, descriptorBindingPartiallyBound,
+/// descriptorBindingUpdateUnusedWhilePending, and update-after-bind for sampled images and storage buffers enabled.
+class DescriptorHeap {
+public:
+    static constexpr uint32_t SAMPLED_IMAGE_BINDING = 0;
+    static constexpr uint32_t STORAGE_BUFFER_BINDING = 1;
+    static constexpr uint32_t SAMPLER_BINDING = 2;
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+    /// The smallest maxPushConstantsSize every implementation guarantees.
+    static constexpr uint32_t PUSH_CONSTANT_SIZE = 128;
+
+    /// How many descriptors of each kind to reserve. Each is clamped to the device's update-after-bind limits.
+    struct Capacity {
+        uint32_t sampledImages = 16384;
+        uint32_t storageBuffers = 16384;
+        uint32_t samplers = 256;
+    };
+
+    struct Stats {
+        Capacity capacity;
+        Capacity registered;
+    };
+
+    void init(VkDevice device, const VkPhysicalDeviceDescriptorIndexingProperties& limits, uint32_t framesInFlight) {
+        init(device, limits, framesInFlight, Capacity{});
+    }
+
+    void init(VkDevice device, const VkPhysicalDeviceDescriptorIndexingProperties& limits, uint32_t framesInFlight,
+              const Capacity& requested) {
+        this->device = device;
+        this->framesInFlight = framesInFlight;
+
+        // Every binding is visible to every stage, so all of them count against each stage's resource budget.
+        uint32_t budget = std::min(limits.maxPerStageUpdateAfterBindResources, limits.maxUpdateAfterBindDescriptorsInAllPools);
+        uint32_t samplerCount = std::min({requested.samplers, limits.maxDescriptorSetUpdateAfterBindSamplers,
+                                          limits.maxPerStageDescriptorUpdateAfterBindSamplers, budget / 4});
+        budget -= samplerCount;
+        uint32_t imageCount = std::min({requested.sampledImages, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+                                        limits.maxPerStageDescriptorUpdateAfterBindSampledImages, budget / 2});
+        budget -= imageCount;
+        uint32_t bufferCount = std::min({requested.storageBuffers, limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                                         limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers, budget});
+        if (samplerCount == 0 || imageCount == 0 || bufferCount == 0) {
+            throw std::runtime_error("Descriptor heap does not fit in the device's update-after-bind limits.");
+        }
+
+        sampledImages.capacity = imageCount;
+        storageBuffers.capacity = bufferCount;
+        samplers.capacity = samplerCount;
+
+        createSetLayout();
+        createPipelineLayout();
+        createDescriptorSet();
+    }
+
+    void destroy() {
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, descriptorPool, nullptr); // Also frees the descriptor set
+        vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+        pipelineLayout = VK_NULL_HANDLE;
+        descriptorPool = VK_NULL_HANDLE;
+        descriptorSet = VK_NULL_HANDLE;
+        setLayout = VK_NULL_HANDLE;
+        sampledImages = Slots{};
+        storageBuffers = Slots{};
+        samplers = Slots{};
+    }
+
+    bool isValid() const { return descriptorSet != VK_NULL_HANDLE; }
+
+    /// Makes indices released at least `framesInFlight` frames ago available again. `frameNumber` is the number of the frame
+    /// about to be recorded; call after waiting for its frame slot's previous frame.
+    void beginFrame(uint64_t frameNumber) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->frameNumber = frameNumber;
+        recycle(sampledImages);
+        recycle(storageBuffers);
+        recycle(samplers);
+    }
+
+    /// Returns the index of `view` in binding `SAMPLED_IMAGE_BINDING`. `layout` is the layout the image is in whenever a shader
+    /// reads it. Safe to call from any thread.
+    uint32_t registerSampledImage(VkImageView view, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.imageView = view;
+        imageInfo.imageLayout = layout;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t index = acquire(sampledImages, "sampled image");
+        write(SAMPLED_IMAGE_BINDING, index, VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, &imageInfo, nullptr);
+        return index;
+    }
+
+    /// Returns the index of the buffer range in binding `STORAGE_BUFFER_BINDING`. Safe to call from any thread.
+    uint32_t registerStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE) {
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = buffer;
+        bufferInfo.offset = offset;
+        bufferInfo.range = range;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t index = acquire(storageBuffers, "storage buffer");
+        write(STORAGE_BUFFER_BINDING, index, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, nullptr, &bufferInfo);
+        return index;
+    }
+
+    /// Returns the index of `sampler` in binding `SAMPLER_BINDING`. Safe to call from any thread.
+    uint32_t registerSampler(VkSampler sampler) {
+        VkDescriptorImageInfo imageInfo{};
+        imageInfo.sampler = sampler;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t index = acquire(samplers, "sampler");
+        write(SAMPLER_BINDING, index, VK_DESCRIPTOR_TYPE_SAMPLER, &imageInfo, nullptr);
+        return index;
+    }
+
+    /// The index stays reserved until every frame that could have used it has completed, so the resource itself may be
+    /// destroyed on the same schedule.
+    void releaseSampledImage(uint32_t index) { release(sampledImages, index); }
+    void releaseStorageBuffer(uint32_t index) { release(storageBuffers, index); }
+    void releaseSampler(uint32_t index) { release(samplers, index); }
+
+    /// Binds the heap as set 0. Call once per command buffer, secondaries included, before the first draw or dispatch.
+    void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint) const {
+        vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    }
+
+    /// Writes up to `PUSH_CONSTANT_SIZE` bytes of per-draw data, typically the heap indices a draw reads.
+    void pushConstants(VkCommandBuffer commandBuffer, const void* data, uint32_t size, uint32_t offset = 0) const {
+        vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_ALL, offset, size, data);
+    }
+
+    VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+
+    /// The layout every bindless pipeline is created with: the heap as set 0 and `PUSH_CONSTANT_SIZE` bytes of push
+    /// constants visible to all stages. Sharing one layout keeps the binding valid across pipeline switches.
+    VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats stats{};
+        stats.capacity = {sampledImages.capacity, storageBuffers.capacity, samplers.capacity};
+        stats.registered = {sampledImages.liveCount(), storageBuffers.liveCount(), samplers.liveCount()};
+        return stats;
+    }
+
+private:
+    struct PendingRelease {
+        uint32_t index;
+        uint64_t releasedAtFrame;
+    };
+
+    /// Indices are handed out from `next` until the array is full, then from `freeIndices`.
+    struct Slots {
+        uint32_t capacity = 0;
+        uint32_t next = 0;
+        std::vector<uint32_t> freeIndices;
+        std::vector<PendingRelease> pendingReleases;
+
+        uint32_t liveCount() const {
+            return next - static_cast<uint32_t>(freeIndices.size() + pendingReleases.size());
+        }
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t framesInFlight = 1;
+    uint64_t frameNumber = 0;
+
+    VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    // Guards the slots and descriptor writes: the set has to be externally synchronized for vkUpdateDescriptorSets().
+    mutable std::mutex mutex;
+    Slots sampledImages;
+    Slots storageBuffers;
+    Slots samplers;
+
+    void createSetLayout() {
+        VkDescriptorSetLayoutBinding bindings[3]{};
+        bindings[0].binding = SAMPLED_IMAGE_BINDING;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        bindings[0].descriptorCount = sampledImages.capacity;
+        bindings[1].binding = STORAGE_BUFFER_BINDING;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[1].descriptorCount = storageBuffers.capacity;
+        bindings[2].binding = SAMPLER_BINDING;
+        bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+        bindings[2].descriptorCount = samplers.capacity;
+
+        VkDescriptorBindingFlags bindingFlags[3];
+        for (uint32_t i = 0; i < 3; i++) {
+            bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+            bindingFlags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        }
+
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+        flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flagsInfo.bindingCount = 3;
+        flagsInfo.pBindingFlags = bindingFlags;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.pNext = &flagsInfo;
+        layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        layoutInfo.bindingCount = 3;
+        layoutInfo.pBindings = bindings;
+
+        VkResult result = vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Descriptor heap set layout was not created. Error code " + std::to_string(result));
+        }
+    }
+
+    void createPipelineLayout() {
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_ALL;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = PUSH_CONSTANT_SIZE;
+
+        VkPipelineLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        VkResult result = vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Descriptor heap pipeline layout was not created. Error code " + std::to_string(result));
+        }
+    }
+
+    void createDescriptorSet() {
+        VkDescriptorPoolSize poolSizes[3]{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        poolSizes[0].descriptorCount = sampledImages.capacity;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSizes[1].descriptorCount = storageBuffers.capacity;
+        poolSizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+        poolSizes[2].descriptorCount = samplers.capacity;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = 3;
+        poolInfo.pPoolSizes = poolSizes;
+
+        VkResult result = vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Descriptor heap pool was not created. Error code " + std::to_string(result));
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &setLayout;
+
+        result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Descriptor heap set was not allocated. Error code " + std::to_string(result));
+        }
+    }
+
+    /// Caller holds `mutex`.
+    uint32_t acquire(Slots& slots, const char* kind) {
+        if (slots.freeIndices.empty() == false) {
+            uint32_t index = slots.freeIndices.back();
+            slots.freeIndices.pop_back();
+            return index;
+        }
+        if (slots.next == slots.capacity) {
+            throw std::runtime_error(std::string("Descriptor heap is out of ") + kind + " slots; " +
+                                     std::to_string(slots.capacity) + " are reserved.");
+        }
+        return slots.next++;
+    }
+
+    void release(Slots& slots, uint32_t index) {
+        if (index == INVALID_INDEX) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        slots.pendingReleases.push_back({index, frameNumber});
+    }
+
+    /// Caller holds `mutex`. Waiting for the previous frame of frame F's slot proves frame F - framesInFlight has completed.
+    void recycle(Slots& slots) {
+        slots.pendingReleases.erase(std::remove_if(slots.pendingReleases.begin(), slots.pendingReleases.end(), [&](const PendingRelease& pending) {
+            if (frameNumber < pending.releasedAtFrame + framesInFlight) {
+                return false;
+            }
+            slots.freeIndices.push_back(pending.index);
+            return true;
+        }), slots.pendingReleases.end());
+    }
+
+    /// Caller holds `mutex`.
+    void write(uint32_t binding, uint32_t index, VkDescriptorType type, const VkDescriptorImageInfo* imageInfo,
+               const VkDescriptorBufferInfo* bufferInfo) {
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = descriptorSet;
+        descriptorWrite.dstBinding = binding;
+        descriptorWrite.dstArrayElement = index;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.descriptorType = type;
+        descriptorWrite.pImageInfo = imageInfo;
+        descriptorWrite.pBufferInfo = bufferInfo;
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    }
+};
+
+#endif /* DescriptorHeap_hpp */
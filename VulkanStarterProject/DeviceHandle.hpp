@@ -0,0 +1,101 @@
+#ifndef DeviceHandle_hpp
+#define DeviceHandle_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "SubmissionScheduler.hpp"
+
+/// How many handles `DeviceHandle`s of any type currently own, including ones waiting in a scheduler's deferred
+/// destructions. Must be zero by the time the device is destroyed.
+inline std::atomic<int64_t> liveDeviceHandles{0};
+
+/// Owns one handle created from a `VkDevice` and destroys it with `Destroy`, e.g. `vkDestroySemaphore`. Move-only, so every
+/// handle has exactly one owner and nothing is destroyed twice.
+///
+/// Destroying an empty handle does nothing. A handle the GPU may still be using is given to `destroyAfter()` instead of being
+/// dropped, which defers it to the scheduler's `collect()` rather than waiting for the device.
+template <typename Handle, auto Destroy>
+class DeviceHandle {
+public:
+    DeviceHandle() = default;
+
+    /// Takes ownership of `handle`, which was just created from `device`.
+    DeviceHandle(VkDevice device, Handle handle) : device(device), handle(handle) {
+        if (handle != VK_NULL_HANDLE) {
+            liveDeviceHandles++;
+        }
+    }
+
+    DeviceHandle(DeviceHandle&& other) noexcept
+        : device(other.device), handle(std::exchange(other.handle, VK_NULL_HANDLE)) {}
+
+    DeviceHandle& operator=(DeviceHandle&& other) noexcept {
+        if (this != &other) {
+            reset();
+            device = other.device;
+            handle = std::exchange(other.handle, VK_NULL_HANDLE);
+        }
+        return *this;
+    }
+
+    DeviceHandle(const DeviceHandle&) = delete;
+    DeviceHandle& operator=(const DeviceHandle&) = delete;
+
+    ~DeviceHandle() {
+        reset();
+    }
+
+    Handle get() const { return handle; }
+
+    /// For create infos that take an array of handles, e.g. `VkPresentInfoKHR::pSwapchains`.
+    const Handle* address() const { return &handle; }
+
+    explicit operator bool() const { return handle != VK_NULL_HANDLE; }
+
+    /// Destroys the handle right away. Only for handles no submission can still be using.
+    void reset() {
+        if (handle != VK_NULL_HANDLE) {
+            Destroy(device, handle, nullptr);
+            handle = VK_NULL_HANDLE;
+            liveDeviceHandles--;
+        }
+    }
+
+    /// Hands the handle to `scheduler`, which destroys it once every queue has passed `use`. Leaves this empty.
+    void destroyAfter(SubmissionScheduler& scheduler, const ResourceUse& use) {
+        if (handle == VK_NULL_HANDLE) {
+            return;
+        }
+        VkDevice owner = device;
+        Handle retired = std::exchange(handle, VK_NULL_HANDLE);
+        scheduler.destroyAfter(use, [owner, retired] {
+            Destroy(owner, retired, nullptr);
+            liveDeviceHandles--;
+        });
+    }
+
+    void destroyAfter(SubmissionScheduler& scheduler, TimelinePoint point) {
+        ResourceUse use;
+        use.markUsed(point);
+        destroyAfter(scheduler, use);
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    Handle handle = VK_NULL_HANDLE;
+};
+
+using UniqueSemaphore = DeviceHandle<VkSemaphore, vkDestroySemaphore>;
+using UniqueFence = DeviceHandle<VkFence, vkDestroyFence>;
+using UniqueCommandPool = DeviceHandle<VkCommandPool, vkDestroyCommandPool>;
+using UniqueImageView = DeviceHandle<VkImageView, vkDestroyImageView>;
+using UniqueSwapchain = DeviceHandle<VkSwapchainKHR, vkDestroySwapchainKHR>;
+using UniquePipelineCache = DeviceHandle<VkPipelineCache, vkDestroyPipelineCache>;
+using UniquePipeline = DeviceHandle<VkPipeline, vkDestroyPipeline>;
+using UniqueShaderModule = DeviceHandle<VkShaderModule, vkDestroyShaderModule>;
+
+#endif /* DeviceHandle_hpp */
@@ -0,0 +1,395 @@
+#ifndef DrawList_hpp
+#define DrawList_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+#include "DescriptorHeap.hpp"
+#include "PipelineManager.hpp"
+
+/// Collects a frame's draws as (mesh, material, transform) and turns them into as few state changes and draw calls as
+/// possible.
+///
+/// Draws are pushed into storage reserved once, by any thread, with a bump index and no lock. `prepare()` radix sorts them by
+/// pipeline, then descriptor, then mesh, merges every run with the same key into one instanced draw, and writes the
+/// transforms in that order into the staging ring, from where they're copied into this frame slot's transform buffer.
+///
+/// Transforms are stored as a structure of arrays: the first rows of every instance, then all second rows, then all third
+/// rows, each row a vec4. Row r of instance i is at `r * transformStride + i`, where instance i is `gl_InstanceIndex`. The
+/// bottom row of an affine transform is always (0, 0, 0, 1) and isn't stored. Shaders read them through the heap with the
+/// push constants laid out as `Constants`:
+///
+///     layout(push_constant) uniform Constants {
+///         mat4 viewProjection;
+///         uint transformIndex;    // heap index of the transforms
+///         uint transformStride;
+///         uint descriptorIndex;   // the draw's material
+///     } constants;
+///
+/// Per frame:
+/// 1. call `beginFrame()` after waiting for the frame slot's previous frame,
+/// 2. `push()` the frame's draws,
+/// 3. call `prepare()` after the staging ring's `beginFrame()` and before its copies are submitted or recorded,
+/// 4. `record()` into one or more command buffers inside the render pass.
+///
+/// Meshes and materials are added up front, not while draws are being pushed.
+class DrawList {
+public:
+    /// A range of an index buffer. The vertex shader finds the vertices, e.g. by `gl_VertexIndex`.
+    struct Mesh {
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+        uint32_t indexCount = 0;
+        uint32_t firstIndex = 0;
+        int32_t vertexOffset = 0;
+    };
+
+    /// A pipeline built with `DescriptorHeap::getPipelineLayout()`, and the heap index its shaders find the material at.
+    struct Material {
+        PipelineHandle pipeline;
+        uint32_t descriptorIndex = 0;
+    };
+
+    /// Laid out as the shaders' push constants.
+    struct Constants {
+        float viewProjection[16];
+        uint32_t transformIndex;
+        uint32_t transformStride;
+        uint32_t descriptorIndex;
+    };
+    static_assert(sizeof(Constants) <= DescriptorHeap::PUSH_CONSTANT_SIZE, "Draw list constants don't fit in push constants.");
+
+    /// Bytes of transform data per instance: three vec4 rows.
+    static constexpr VkDeviceSize TRANSFORM_SIZE = 3 * 4 * sizeof(float);
+
+    /// Sort key bits; pipelines, descriptors and meshes beyond these can't be told apart and are rejected.
+    static constexpr uint32_t PIPELINE_BITS = 16;
+    static constexpr uint32_t DESCRIPTOR_BITS = 24;
+    static constexpr uint32_t MESH_BITS = 24;
+
+    /// Draws and state changes of the last prepared frame.
+    struct Stats {
+        uint32_t commands = 0;          // draws pushed
+        uint32_t droppedCommands = 0;   // pushed over capacity, or not drawn because the staging ring was full
+        uint32_t draws = 0;             // instanced draws they were merged into
+        uint32_t pipelineChanges = 0;
+        uint32_t descriptorChanges = 0;
+    };
+
+    /// - Parameter capacity: the most draws one frame can push.
+    /// - Parameter sharingFamilies: the queue families using the transform buffers, i.e. graphics and transfer.
+    void init(GpuMemoryAllocator& allocator, DescriptorHeap& heap, PipelineManager& pipelines, uint32_t capacity,
+              uint32_t frameCount, const std::vector<uint32_t>& sharingFamilies) {
+        this->allocator = &allocator;
+        this->heap = &heap;
+        this->pipelines = &pipelines;
+        this->capacity = capacity;
+
+        keys.resize(capacity);
+        transforms.resize(capacity);
+        sorted.resize(capacity);
+        scratch.resize(capacity);
+        batches.reserve(capacity);
+
+        frames.resize(frameCount);
+        for (auto& frame : frames) {
+            allocator.createBuffer(capacity * TRANSFORM_SIZE, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                   MemoryUsage::GpuOnly, frame.buffer, frame.allocation, sharingFamilies);
+            frame.heapIndex = heap.registerStorageBuffer(frame.buffer);
+        }
+    }
+
+    /// The device must be idle.
+    void destroy() {
+        for (auto& frame : frames) {
+            heap->releaseStorageBuffer(frame.heapIndex);
+            allocator->destroyBuffer(frame.buffer, frame.allocation);
+        }
+        frames.clear();
+        meshes.clear();
+        materialKeys.clear();
+    }
+
+    uint32_t addMesh(const Mesh& mesh) {
+        if (meshes.size() >= (1u << MESH_BITS)) {
+            throw std::runtime_error("Draw list has too many meshes.");
+        }
+        meshes.push_back(mesh);
+        return static_cast<uint32_t>(meshes.size() - 1);
+    }
+
+    uint32_t addMaterial(const Material& material) {
+        materialKeys.push_back(materialKey(material));
+        return static_cast<uint32_t>(materialKeys.size() - 1);
+    }
+
+    /// A material's pipeline may change, e.g. when it's requested again for a new swap chain format. Call between frames.
+    void setMaterial(uint32_t material, const Material& description) {
+        materialKeys.at(material) = materialKey(description);
+    }
+
+    /// Empties the list and sets the frame slot whose transform buffer `prepare()` fills and `record()` draws from.
+    void beginFrame(uint32_t frameIndex) {
+        currentFrame = frameIndex % frames.size();
+        head.store(0, std::memory_order_relaxed);
+        batches.clear();
+        ready = false;
+    }
+
+    /// Adds a draw of `mesh` with `material`, placed by the column-major affine `transform`. Safe to call from any thread
+    /// between `beginFrame()` and `prepare()`. Returns false when this frame's capacity is used up, and throws for a mesh or
+    /// material that wasn't added, which would otherwise corrupt the sort key.
+    bool push(uint32_t mesh, uint32_t material, const float* transform) {
+        if (mesh >= meshes.size() || material >= materialKeys.size()) {
+            throw std::runtime_error("Draw list was pushed a mesh or material it doesn't have.");
+        }
+        uint32_t slot = head.fetch_add(1, std::memory_order_relaxed);
+        if (slot >= capacity) {
+            return false;
+        }
+        keys[slot] = materialKeys[material] | mesh;
+        std::memcpy(transforms[slot].values, transform, sizeof(Transform::values));
+        return true;
+    }
+
+    /// Sorts and merges the frame's draws and queues their transforms' upload. If the staging ring is full, this frame draws
+    /// nothing. Returns whether it draws.
+    bool prepare(StagingRing& stagingRing) {
+        uint32_t pushed = head.load(std::memory_order_relaxed);
+        uint32_t count = std::min(pushed, capacity);
+        stats = Stats{};
+        stats.commands = pushed;
+        stats.droppedCommands = pushed - count;
+        if (count == 0) {
+            return false;
+        }
+
+        sortCommands(count);
+
+        auto staging = stagingRing.allocate(count * TRANSFORM_SIZE, 16);
+        if (staging.has_value() == false) {
+            stats.droppedCommands = pushed;
+            return false;
+        }
+        float* rows[3];
+        for (uint32_t r = 0; r < 3; r++) {
+            rows[r] = static_cast<float*>(staging->data) + r * count * 4;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            packRows(transforms[sorted[i].command], rows[0] + i * 4, rows[1] + i * 4, rows[2] + i * 4);
+        }
+#if defined(__SSE__) || defined(_M_X64)
+        // The streaming stores bypass the cache; they have to land before the copy is submitted.
+        _mm_sfence();
+#endif
+        stagingRing.enqueueBufferCopy(*staging, frames[currentFrame].buffer, 0);
+        transformStride = count;
+
+        uint64_t previousKey = ~0ull;
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t key = sorted[i].key;
+            if (key == previousKey) {
+                batches.back().instanceCount++;
+                continue;
+            }
+            if (stats.draws == 0 || pipelineOf(key) != pipelineOf(previousKey)) {
+                stats.pipelineChanges++;
+            }
+            if (stats.draws == 0 || descriptorOf(key) != descriptorOf(previousKey)) {
+                stats.descriptorChanges++;
+            }
+            batches.push_back({key, i, 1});
+            stats.draws++;
+            previousKey = key;
+        }
+        ready = true;
+        return true;
+    }
+
+    /// Records part `part` of `partCount` of the frame's batches, so several threads can each record a share into their own
+    /// secondary. The caller binds the heap and sets the viewport and scissor. Batches whose pipeline hasn't compiled yet are
+    /// skipped.
+    void record(VkCommandBuffer commandBuffer, const float* viewProjection, uint32_t part = 0, uint32_t partCount = 1) const {
+        if (ready == false) {
+            return;
+        }
+        size_t begin = batches.size() * part / partCount;
+        size_t end = batches.size() * (part + 1) / partCount;
+        if (begin == end) {
+            return;
+        }
+
+        Constants constants{};
+        std::memcpy(constants.viewProjection, viewProjection, sizeof(constants.viewProjection));
+        constants.transformIndex = frames[currentFrame].heapIndex;
+        constants.transformStride = transformStride;
+        constants.descriptorIndex = DescriptorHeap::INVALID_INDEX;
+        heap->pushConstants(commandBuffer, &constants, sizeof(constants));
+
+        uint32_t boundPipeline = UINT32_MAX;
+        uint32_t boundDescriptor = DescriptorHeap::INVALID_INDEX;
+        const Mesh* boundMesh = nullptr;
+        for (size_t b = begin; b < end; b++) {
+            const Batch& batch = batches[b];
+            uint32_t pipelineIndex = pipelineOf(batch.key);
+            VkPipeline pipeline = pipelines->get(PipelineHandle{pipelineIndex});
+            if (pipeline == VK_NULL_HANDLE) {
+                continue;
+            }
+            if (pipelineIndex != boundPipeline) {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                boundPipeline = pipelineIndex;
+            }
+
+            uint32_t descriptorIndex = descriptorOf(batch.key);
+            if (descriptorIndex != boundDescriptor) {
+                heap->pushConstants(commandBuffer, &descriptorIndex, sizeof(descriptorIndex), offsetof(Constants, descriptorIndex));
+                boundDescriptor = descriptorIndex;
+            }
+
+            const Mesh& mesh = meshes[meshOf(batch.key)];
+            if (boundMesh == nullptr || mesh.indexBuffer != boundMesh->indexBuffer || mesh.indexType != boundMesh->indexType) {
+                vkCmdBindIndexBuffer(commandBuffer, mesh.indexBuffer, 0, mesh.indexType);
+            }
+            boundMesh = &mesh;
+
+            vkCmdDrawIndexed(commandBuffer, mesh.indexCount, batch.instanceCount, mesh.firstIndex, mesh.vertexOffset,
+                             batch.firstInstance);
+        }
+    }
+
+    Stats getStats() const { return stats; }
+
+private:
+    struct alignas(16) Transform {
+        float values[16];
+    };
+
+    struct SortEntry {
+        uint64_t key;
+        uint32_t command;
+    };
+
+    /// Instances `firstInstance` to `firstInstance + instanceCount - 1` of the sorted transforms, all with the same key.
+    struct Batch {
+        uint64_t key;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    struct FrameData {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation{};
+        uint32_t heapIndex = DescriptorHeap::INVALID_INDEX;
+    };
+
+    GpuMemoryAllocator* allocator = nullptr;
+    DescriptorHeap* heap = nullptr;
+    PipelineManager* pipelines = nullptr;
+    uint32_t capacity = 0;
+
+    std::vector<Mesh> meshes;
+    std::vector<uint64_t> materialKeys;    // pipeline and descriptor bits of each material's sort key
+
+    // The frame's draws in push order. Sized to `capacity` once, so pushing never allocates.
+    std::atomic<uint32_t> head{0};
+    std::vector<uint64_t> keys;
+    std::vector<Transform> transforms;
+
+    std::vector<SortEntry> sorted;
+    std::vector<SortEntry> scratch;
+    std::vector<Batch> batches;
+    uint32_t transformStride = 0;
+    bool ready = false;
+    Stats stats;
+
+    std::vector<FrameData> frames;
+    size_t currentFrame = 0;
+
+    static uint64_t materialKey(const Material& material) {
+        if (material.pipeline.index >= (1u << PIPELINE_BITS) || material.descriptorIndex >= (1u << DESCRIPTOR_BITS)) {
+            throw std::runtime_error("Draw list material doesn't fit in a sort key.");
+        }
+        return static_cast<uint64_t>(material.pipeline.index) << (DESCRIPTOR_BITS + MESH_BITS) |
+            static_cast<uint64_t>(material.descriptorIndex) << MESH_BITS;
+    }
+
+    static uint32_t pipelineOf(uint64_t key) { return static_cast<uint32_t>(key >> (DESCRIPTOR_BITS + MESH_BITS)); }
+    static uint32_t descriptorOf(uint64_t key) { return static_cast<uint32_t>(key >> MESH_BITS) & ((1u << DESCRIPTOR_BITS) - 1); }
+    static uint32_t meshOf(uint64_t key) { return static_cast<uint32_t>(key) & ((1u << MESH_BITS) - 1); }
+
+    /// Least significant digit first, eight bits a pass, into `sorted`. Stable, so draws with the same key stay in push order.
+    /// Passes over a digit that every key shares are skipped, which with few pipelines and descriptors is most of them.
+    void sortCommands(uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            sorted[i] = {keys[i], i};
+        }
+        for (uint32_t shift = 0; shift < 64; shift += 8) {
+            std::array<uint32_t, 256> offsets{};
+            for (uint32_t i = 0; i < count; i++) {
+                offsets[(sorted[i].key >> shift) & 0xff]++;
+            }
+            if (offsets[(sorted[0].key >> shift) & 0xff] == count) {
+                continue;
+            }
+            uint32_t sum = 0;
+            for (auto& offset : offsets) {
+                uint32_t digitCount = offset;
+                offset = sum;
+                sum += digitCount;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                scratch[offsets[(sorted[i].key >> shift) & 0xff]++] = sorted[i];
+            }
+            std::swap(sorted, scratch);
+        }
+    }
+
+    /// Transposes the column-major 4x4 matrix and writes its top three rows. The destinations are 16-byte aligned staging
+    /// memory, which is often write-combined, so on x86 they're written with streaming stores.
+    static void packRows(const Transform& transform, float* row0, float* row1, float* row2) {
+#if defined(__SSE__) || defined(_M_X64)
+        __m128 c0 = _mm_load_ps(transform.values);
+        __m128 c1 = _mm_load_ps(transform.values + 4);
+        __m128 c2 = _mm_load_ps(transform.values + 8);
+        __m128 c3 = _mm_load_ps(transform.values + 12);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        _mm_stream_ps(row0, c0);
+        _mm_stream_ps(row1, c1);
+        _mm_stream_ps(row2, c2);
+#elif defined(__ARM_NEON)
+        // Loading with a stride of four deinterleaves the columns into rows.
+        float32x4x4_t rows = vld4q_f32(transform.values);
+        vst1q_f32(row0, rows.val[0]);
+        vst1q_f32(row1, rows.val[1]);
+        vst1q_f32(row2, rows.val[2]);
+#else
+        float* rows[3] = {row0, row1, row2};
+        for (int r = 0; r < 3; r++) {
+            for (int column = 0; column < 4; column++) {
+                rows[r][column] = transform.values[column * 4 + r];
+            }
+        }
+#endif
+    }
+};
+
+#endif /* DrawList_hpp */
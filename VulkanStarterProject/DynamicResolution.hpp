@@ -0,0 +1,97 @@
+#ifndef DynamicResolution_hpp
+#define DynamicResolution_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/// Chooses the scale the scene renders at so that GPU frame time holds a target. The scaled image is upscaled into the swap
+/// chain image, so the window's size is unaffected.
+///
+/// GPU time is taken to grow with the number of pixels, i.e. with the square of the scale. Every `ADJUST_INTERVAL` frames
+/// the average is compared to the target: over it, the scale drops right away to what should meet it; under
+/// `HEADROOM` of it, the scale grows by at most `MAX_GROWTH`. Scales are multiples of `STEP`, so the render targets, which are
+/// reallocated whenever the scale changes, settle instead of changing size every time.
+///
+/// Without a target the scale stays at its initial value.
+class DynamicResolution {
+public:
+    static constexpr float STEP = 0.05f;
+    static constexpr float MAX_GROWTH = 0.1f;
+    static constexpr uint32_t ADJUST_INTERVAL = 8;
+    static constexpr double HEADROOM = 0.85;
+
+    /// - Parameter targetMilliseconds: GPU frame time to hold. Zero keeps the scale fixed.
+    void init(double targetMilliseconds, float initialScale, float minScale = 0.5f, float maxScale = 1.0f) {
+        this->targetMilliseconds = targetMilliseconds;
+        this->minScale = minScale;
+        this->maxScale = maxScale;
+        scale = quantize(std::clamp(initialScale, minScale, maxScale));
+        accumulatedMilliseconds = 0.0;
+        accumulatedFrames = 0;
+    }
+
+    bool isAdaptive() const { return targetMilliseconds > 0.0; }
+
+    float getScale() const { return scale; }
+
+    /// Feeds the GPU time of one completed frame.
+    /// - Returns: true if the scale changed.
+    bool addFrameTime(double gpuMilliseconds) {
+        if (isAdaptive() == false) {
+            return false;
+        }
+        accumulatedMilliseconds += gpuMilliseconds;
+        accumulatedFrames++;
+        if (accumulatedFrames < ADJUST_INTERVAL) {
+            return false;
+        }
+
+        double average = accumulatedMilliseconds / accumulatedFrames;
+        accumulatedMilliseconds = 0.0;
+        accumulatedFrames = 0;
+        if (average <= 0.0) {
+            return false;
+        }
+
+        float next = scale;
+        if (average > targetMilliseconds) {
+            next = std::floor(scale * static_cast<float>(std::sqrt(targetMilliseconds / average)) / STEP) * STEP;
+        }
+        else if (average < targetMilliseconds * HEADROOM) {
+            float wanted = scale * static_cast<float>(std::sqrt(targetMilliseconds * HEADROOM / average));
+            next = std::floor(std::min(wanted, scale + MAX_GROWTH) / STEP) * STEP;
+        }
+        next = quantize(std::clamp(next, minScale, maxScale));
+
+        if (next == scale) {
+            return false;
+        }
+        scale = next;
+        return true;
+    }
+
+    /// `extent` at the current scale, at least one pixel each way.
+    VkExtent2D scaledExtent(VkExtent2D extent) const {
+        return {std::max(1u, static_cast<uint32_t>(std::lround(extent.width * scale))),
+                std::max(1u, static_cast<uint32_t>(std::lround(extent.height * scale)))};
+    }
+
+private:
+    double targetMilliseconds = 0.0;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float scale = 1.0f;
+
+    double accumulatedMilliseconds = 0.0;
+    uint32_t accumulatedFrames = 0;
+
+    /// Rounds to a multiple of `STEP`, so equal scales compare equal.
+    static float quantize(float value) {
+        return std::round(value / STEP) * STEP;
+    }
+};
+
+#endif /* DynamicResolution_hpp */
@@ -0,0 +1,221 @@
+#ifndef FrameArena_hpp
+#define FrameArena_hpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Linear allocator for CPU data that only lives while a frame is recorded, such as the barrier, attachment and semaphore
+/// arrays handed to `vkCmd*` and `vkQueue*` calls, which copy what they need. Allocating bumps a pointer, nothing is freed on
+/// its own, and `reset()` at the start of the next frame frees everything at once.
+///
+/// A frame that outgrows the current block gets another one. The next `reset()` replaces them with a single block that
+/// fits the whole frame, so once frames stop growing the arena doesn't touch the heap.
+///
+/// Not thread-safe: an arena belongs to one thread, or to whatever lock serializes its users.
+class FrameArena {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    explicit FrameArena(size_t capacity = DEFAULT_CAPACITY) {
+        addBlock(capacity);
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    /// Frees everything allocated since the last reset. Nothing allocated before may be used afterwards.
+    void reset() {
+        if (blocks.size() > 1) {
+            size_t capacity = getCapacity();
+            blocks.clear();
+            addBlock(capacity);
+        }
+        head = 0;
+        peakBytes = std::max(peakBytes, bytesUsed);
+        bytesUsed = 0;
+    }
+
+    /// `alignment` must be a power of two.
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+        size_t offset = alignedOffset(blocks.back(), alignment);
+        if (offset + size > blocks.back().size) {
+            addBlock(std::max(size + alignment, blocks.back().size * 2));
+            offset = alignedOffset(blocks.back(), alignment);
+        }
+        bytesUsed += offset - head + size;
+        head = offset + size;
+        return blocks.back().data.get() + offset;
+    }
+
+    /// Uninitialized storage for `count` objects of a type that needs no constructor or destructor.
+    template <typename T>
+    T* allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena memory is never destroyed.");
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /// Bytes allocated since the last reset, including alignment padding.
+    size_t getBytesUsed() const { return bytesUsed; }
+
+    /// The most bytes any frame has allocated.
+    size_t getPeakBytes() const { return std::max(peakBytes, bytesUsed); }
+
+    size_t getCapacity() const {
+        size_t capacity = 0;
+        for (const auto& block : blocks) {
+            capacity += block.size;
+        }
+        return capacity;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t head = 0;        // offset of the first free byte in the last block
+    size_t bytesUsed = 0;
+    size_t peakBytes = 0;
+
+    void addBlock(size_t size) {
+        blocks.push_back({std::make_unique<char[]>(size), size});
+        head = 0;
+    }
+
+    size_t alignedOffset(const Block& block, size_t alignment) const {
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+        return ((base + head + alignment - 1) & ~(alignment - 1)) - base;
+    }
+};
+
+/// A `std::vector` look-alike for Vulkan structs and other trivially copyable types that keeps its elements in a
+/// `FrameArena`. Growing copies the elements into a block twice the size and leaves the old one to the arena's next reset.
+/// The vector must not be used after that reset.
+///
+/// A default-constructed vector has no arena and stays empty until it's assigned one that has.
+template <typename T>
+class FrameVector {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>,
+                  "FrameVector elements are copied with memcpy and never destroyed.");
+
+public:
+    static constexpr size_t INITIAL_CAPACITY = 8;
+
+    FrameVector() = default;
+
+    explicit FrameVector(FrameArena& arena, size_t capacity = 0) : arena(&arena) {
+        reserve(capacity);
+    }
+
+    FrameVector(FrameVector&& other) noexcept { *this = std::move(other); }
+
+    FrameVector& operator=(FrameVector&& other) noexcept {
+        arena = other.arena;
+        elements = other.elements;
+        count = other.count;
+        capacity = other.capacity;
+        other.elements = nullptr;
+        other.count = 0;
+        other.capacity = 0;
+        return *this;
+    }
+
+    // Copies would share elements.
+    FrameVector(const FrameVector&) = delete;
+    FrameVector& operator=(const FrameVector&) = delete;
+
+    void reserve(size_t newCapacity) {
+        if (newCapacity <= capacity) {
+            return;
+        }
+        if (arena == nullptr) {
+            throw std::logic_error("FrameVector has no arena to allocate from.");
+        }
+        T* grown = arena->allocateArray<T>(newCapacity);
+        if (count > 0) {
+            std::memcpy(grown, elements, count * sizeof(T));
+        }
+        elements = grown;
+        capacity = newCapacity;
+    }
+
+    void push_back(const T& value) {
+        if (count == capacity) {
+            reserve(capacity == 0 ? INITIAL_CAPACITY : capacity * 2);
+        }
+        elements[count++] = value;
+    }
+
+    /// Replaces the contents with `newCount` copies of `value`.
+    void assign(size_t newCount, const T& value) {
+        count = 0;
+        reserve(newCount);
+        std::fill_n(elements, newCount, value);
+        count = newCount;
+    }
+
+    void clear() { count = 0; }
+
+    T* data() { return elements; }
+    const T* data() const { return elements; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    T& operator[](size_t index) { return elements[index]; }
+    const T& operator[](size_t index) const { return elements[index]; }
+    T& back() { return elements[count - 1]; }
+    const T& back() const { return elements[count - 1]; }
+
+    T* begin() { return elements; }
+    T* end() { return elements + count; }
+    const T* begin() const { return elements; }
+    const T* end() const { return elements + count; }
+
+private:
+    FrameArena* arena = nullptr;
+    T* elements = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+};
+
+/// A callable copied into a `FrameArena`, for callbacks that are stored while a frame is declared and called while it's
+/// recorded. Like `FrameVector` elements, the callable is never destroyed, so only lambdas capturing handles, pointers and
+/// other plain values fit. It must not be called after the arena's next reset.
+template <typename Signature>
+class FrameFunction;
+
+template <typename Result, typename... Args>
+class FrameFunction<Result(Args...)> {
+public:
+    FrameFunction() = default;
+
+    template <typename Function>
+    FrameFunction(FrameArena& arena, Function&& function) {
+        using Callable = std::decay_t<Function>;
+        static_assert(std::is_trivially_destructible_v<Callable>, "Arena memory is never destroyed.");
+        callable = new (arena.allocate(sizeof(Callable), alignof(Callable))) Callable(std::forward<Function>(function));
+        invoke = [](void* callable, Args... args) -> Result {
+            return (*static_cast<Callable*>(callable))(std::forward<Args>(args)...);
+        };
+    }
+
+    explicit operator bool() const { return invoke != nullptr; }
+
+    Result operator()(Args... args) const { return invoke(callable, std::forward<Args>(args)...); }
+
+private:
+    void* callable = nullptr;
+    Result (*invoke)(void* callable, Args... args) = nullptr;
+};
+
+#endif /* FrameArena_hpp */
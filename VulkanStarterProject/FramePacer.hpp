@@ -0,0 +1,160 @@
+#ifndef FramePacer_hpp
+#define FramePacer_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/// Measures when presented frames reach the display with VK_KHR_present_id and VK_KHR_present_wait, and optionally paces
+/// the CPU so that input is sampled as late as possible before the frame that uses it is recorded.
+///
+/// Every present is tagged with an increasing id, and the time input was polled for it is kept. Once a present has been
+/// waited on, the time from that poll to the wait returning is the frame's input-to-display latency. Only pacing blocks on
+/// the present, so only then is that the time it reached the display. Otherwise presents are polled without waiting
+/// before the next frame's input, and the latency is an upper bound, up to a frame above the real one.
+///
+/// When pacing, `waitBeforeInput()` blocks until the previous frame is on the display, so no finished frame queues up behind
+/// the display, and then sleeps until the next refresh is no further away than the estimated cost of a frame. The refresh
+/// interval is the shortest time between two consecutive presents reaching the display over a window of `INTERVAL_WINDOW`.
+///
+/// Per frame:
+/// 1. call `waitBeforeInput()`, then poll input and call `inputSampled()`,
+/// 2. call `preparePresent()` on the `VkPresentInfoKHR` of the frame's present.
+///
+/// Only one swap chain is paced. In a present of several, the others get no id.
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr uint32_t INTERVAL_WINDOW = 32;
+
+    /// Subtracted from the time until the next refresh on top of the frame's estimated cost, for scheduling jitter.
+    static constexpr double MARGIN_MILLISECONDS = 1.0;
+
+    /// How long `waitBeforeInput()` waits for a present at most, so a hidden window or a stalled compositor can't hang it.
+    static constexpr uint64_t WAIT_TIMEOUT_NANOSECONDS = 100'000'000;
+
+    /// - Parameter waitForPresent: null if the device lacks present waits, which makes every call a no-op.
+    /// - Parameter pace: sleep in `waitBeforeInput()`; otherwise presents are only measured.
+    void init(VkDevice device, PFN_vkWaitForPresentKHR waitForPresent, bool pace) {
+        this->device = device;
+        this->waitForPresent = waitForPresent;
+        this->pace = pace && waitForPresent != nullptr;
+        intervalCount = 0;
+    }
+
+    bool isAvailable() const { return waitForPresent != nullptr; }
+
+    bool isPacing() const { return pace; }
+
+    /// Whether `latestLatency()` is when presents reached the display, rather than when that was next noticed.
+    bool isLatencyExact() const { return pace; }
+
+    /// Present ids belong to a swap chain, so presents made to the previous one are no longer waited on.
+    void setSwapchain(VkSwapchainKHR swapchain) {
+        this->swapchain = swapchain;
+        lastPresented = 0;
+        lastDisplayed = 0;
+        intervalCount = 0;
+    }
+
+    /// Waits for the previous present to reach the display and, when pacing, sleeps until input should be sampled.
+    /// - Parameter frameCostMilliseconds: how long the next frame is expected to take from polling input until its GPU
+    ///   work is done.
+    void waitBeforeInput(double frameCostMilliseconds) {
+        if (waitForPresent == nullptr || lastPresented == 0) {
+            return;
+        }
+
+        // Without pacing, only presents that are already on the display are measured.
+        uint64_t timeout = pace ? WAIT_TIMEOUT_NANOSECONDS : 0;
+        while (lastDisplayed < lastPresented) {
+            uint64_t id = pace ? lastPresented : lastDisplayed + 1;
+            if (waitForPresent(device, swapchain, id, timeout) != VK_SUCCESS) {
+                return;
+            }
+            displayed(id, Clock::now());
+        }
+
+        if (pace == false || intervalCount == 0) {
+            return;
+        }
+        double interval = *std::min_element(intervals.begin(), intervals.begin() + std::min(intervalCount, INTERVAL_WINDOW));
+        double slack = interval - frameCostMilliseconds - MARGIN_MILLISECONDS;
+        if (slack > 0.0) {
+            std::this_thread::sleep_until(lastDisplayTime + std::chrono::duration<double, std::milli>(slack));
+        }
+    }
+
+    /// Call right after input was polled for the next frame.
+    void inputSampled() {
+        inputTimes[(lastPresented + 1) % inputTimes.size()] = Clock::now();
+    }
+
+    /// Tags entry `swapchainIndex` of the present, which must be the paced swap chain, with the next id.
+    /// `presentInfo.pNext` must be null, or a chain this may be prepended to.
+    void preparePresent(VkPresentInfoKHR& presentInfo, uint32_t swapchainIndex = 0) {
+        if (waitForPresent == nullptr) {
+            return;
+        }
+        lastPresented++;
+        presentIds.assign(presentInfo.swapchainCount, 0);
+        presentIds[swapchainIndex] = lastPresented;
+        presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentId.pNext = presentInfo.pNext;
+        presentId.swapchainCount = presentInfo.swapchainCount;
+        presentId.pPresentIds = presentIds.data();
+        presentInfo.pNext = &presentId;
+    }
+
+    /// Input-to-display latency of the newest present known to have reached the display, and how many have been measured.
+    /// False if none has yet. Without pacing it's an upper bound; see `isLatencyExact()`.
+    bool latestLatency(double& milliseconds, uint64_t& measured) const {
+        if (latencyCount == 0) {
+            return false;
+        }
+        milliseconds = latestLatencyMilliseconds;
+        measured = latencyCount;
+        return true;
+    }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+    PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+    bool pace = false;
+
+    VkPresentIdKHR presentId{};
+    std::vector<uint64_t> presentIds;   // one per swap chain of the present; zero means no id
+    uint64_t lastPresented = 0;     // id of the newest present; ids start at 1
+    uint64_t lastDisplayed = 0;     // every present up to this one has reached the display
+    Clock::time_point lastDisplayTime;
+
+    // Indexed by present id. Presents further apart than this are never outstanding at the same time.
+    std::array<Clock::time_point, 16> inputTimes{};
+
+    std::array<double, INTERVAL_WINDOW> intervals{};
+    uint32_t intervalCount = 0;
+
+    double latestLatencyMilliseconds = 0.0;
+    uint64_t latencyCount = 0;
+
+    /// A wait on `id` returning also means every earlier present is done, including ones the display skipped.
+    void displayed(uint64_t id, Clock::time_point now) {
+        if (id == lastDisplayed + 1 && lastDisplayed > 0) {
+            intervals[intervalCount % INTERVAL_WINDOW] = std::chrono::duration<double, std::milli>(now - lastDisplayTime).count();
+            intervalCount++;
+        }
+        latestLatencyMilliseconds = std::chrono::duration<double, std::milli>(now - inputTimes[id % inputTimes.size()]).count();
+        latencyCount++;
+        lastDisplayed = id;
+        lastDisplayTime = now;
+    }
+};
+
+#endif /* FramePacer_hpp */
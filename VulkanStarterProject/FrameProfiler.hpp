@@ -0,0 +1,576 @@
+#ifndef FrameProfiler_hpp
+#define FrameProfiler_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// Heap allocations made since startup by threads that count them. The application's replacement of the global
+/// `operator new` counts them; without it the count stays at zero.
+inline std::atomic<uint64_t> heapAllocationCount{0};
+
+/// Whether this thread's allocations go into `heapAllocationCount`. `FrameProfiler` sets it on the thread drawing frames from
+/// `beginFrame()` to `endFrame()`, and threads that record for it, such as `JobSystem` workers, set it for good with
+/// `FrameProfiler::countAllocationsOnThisThread()`. Background threads, e.g. the shader watcher, pipeline compiles and asset
+/// streaming, aren't counted since frames don't wait for them.
+inline thread_local bool countsHeapAllocations = false;
+
+/// CPU stages of `drawFrame()` that are timed every frame.
+enum class CpuStage {
+    FrameInterval,  // start of one frame to the start of the next, i.e. what the user sees
+    FenceWait,      // waiting for the frame slot to be free
+    Pacing,         // `FramePacer` holding back input sampling until closer to the display's refresh
+    Acquire,        // vkAcquireNextImageKHR, including waiting for the image's previous frame
+    Record,
+    Submit,
+    Present,
+    Count,
+};
+
+inline const char* cpuStageName(CpuStage stage) {
+    switch (stage) {
+        case CpuStage::FrameInterval: return "cpu:frame";
+        case CpuStage::FenceWait: return "cpu:fence-wait";
+        case CpuStage::Pacing: return "cpu:pacing";
+        case CpuStage::Acquire: return "cpu:acquire";
+        case CpuStage::Record: return "cpu:record";
+        case CpuStage::Submit: return "cpu:submit";
+        case CpuStage::Present: return "cpu:present";
+        case CpuStage::Count: break;
+    }
+    return "cpu:unknown";
+}
+
+/// Frame timing instrumentation: CPU stages timed with `std::chrono::steady_clock` and GPU passes timed with
+/// `VK_QUERY_TYPE_TIMESTAMP` queries. Each metric keeps a rolling window of samples for p50/p95/p99, and every frame can be
+/// kept for `writeDump()`. Heap allocations per frame are counted from `heapAllocationCount`.
+///
+/// Each frame slot has its own query pool. GPU results are read back in `beginFrame()`, after the slot's previous frame
+/// has been waited on, so reading them never stalls; they're attributed to the frame that wrote them, `framesInFlight` frames late.
+///
+/// Per frame:
+/// 1. time the wait for the slot's previous frame with `CpuScope`, then call `beginFrame()`,
+/// 2. call `resetQueries()` at the start of the command buffer, outside any render pass,
+/// 3. bracket passes with `beginGpuScope()`/`endGpuScope()`; scopes may nest,
+/// 4. call `endFrame()`, passing whether the command buffer was submitted.
+class FrameProfiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Adds the time between construction and destruction to a CPU stage of the current frame.
+    class CpuScope {
+    public:
+        CpuScope(FrameProfiler& profiler, CpuStage stage) : profiler(profiler), stage(stage), start(Clock::now()) {}
+        ~CpuScope() { stop(); }
+        CpuScope(const CpuScope&) = delete;
+        CpuScope& operator=(const CpuScope&) = delete;
+
+        /// Ends the scope early.
+        void stop() {
+            if (stopped == false) {
+                profiler.addCpuTime(stage, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+                stopped = true;
+            }
+        }
+
+    private:
+        FrameProfiler& profiler;
+        CpuStage stage;
+        Clock::time_point start;
+        bool stopped = false;
+    };
+
+    /// Counts the calling thread's heap allocations from now on, e.g. on worker threads that record frames.
+    static void countAllocationsOnThisThread() { countsHeapAllocations = true; }
+
+    /// Maximum number of GPU scopes per frame. Further scopes are ignored.
+    static constexpr uint32_t MAX_GPU_SCOPES = 32;
+
+    /// Number of samples per metric that percentiles are computed over.
+    static constexpr size_t WINDOW_SIZE = 1024;
+
+    /// - Parameter timestampValidBits: from the graphics queue family. Zero disables GPU timing.
+    /// - Parameter keepHistory: keep every frame for `writeDump()`.
+    void init(VkDevice device, const VkPhysicalDeviceLimits& limits, uint32_t timestampValidBits, uint32_t frameCount,
+              bool keepHistory) {
+        this->device = device;
+        this->keepHistory = keepHistory;
+        timestampPeriod = limits.timestampPeriod;
+        timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+        gpuTimingSupported = timestampValidBits > 0;
+
+        for (int i = 0; i < static_cast<int>(CpuStage::Count); i++) {
+            metricIndex(cpuStageName(static_cast<CpuStage>(i)));
+        }
+
+        frames.resize(frameCount);
+        if (gpuTimingSupported) {
+            for (auto& frame : frames) {
+                VkQueryPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+                poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+                poolInfo.queryCount = MAX_GPU_SCOPES * 2;
+
+                VkResult result = vkCreateQueryPool(device, &poolInfo, nullptr, &frame.queryPool);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Timestamp query pool was not created. Error code " + std::to_string(result));
+                }
+            }
+        }
+        else {
+            std::cout << "Timestamps aren't supported on the graphics queue; GPU timings are disabled.\n";
+        }
+
+        lastFrameStart = Clock::now();
+        lastReport = lastFrameStart;
+        allocationsCounted = heapAllocationCount.load(std::memory_order_relaxed);
+    }
+
+    void destroy() {
+        for (auto& frame : frames) {
+            if (frame.queryPool != VK_NULL_HANDLE) {
+                vkDestroyQueryPool(device, frame.queryPool, nullptr);
+            }
+        }
+        frames.clear();
+    }
+
+    /// Starts timing a frame in slot `frameIndex` and collects the GPU timings the slot's previous frame left behind. Call
+    /// after waiting for the slot's previous frame. The calling thread's heap allocations count until `endFrame()`.
+    void beginFrame(uint32_t frameIndex) {
+        countsHeapAllocations = true;
+        currentFrame = frameIndex % frames.size();
+        collectGpuResults(frames[currentFrame]);
+
+        Clock::time_point now = Clock::now();
+        frameCpu[static_cast<int>(CpuStage::FrameInterval)] = std::chrono::duration<double, std::milli>(now - lastFrameStart).count();
+        lastFrameStart = now;
+    }
+
+    /// Resets this frame's queries. Must be recorded before any `beginGpuScope()` and outside a render pass.
+    void resetQueries(VkCommandBuffer commandBuffer) {
+        FrameData& frame = frames[currentFrame];
+        frame.scopes.clear();
+        openScopes.clear();
+        if (gpuTimingSupported) {
+            vkCmdResetQueryPool(commandBuffer, frame.queryPool, 0, MAX_GPU_SCOPES * 2);
+        }
+    }
+
+    /// Writes a timestamp once all previously recorded commands have started. The scope is reported as `gpu:<name>`.
+    void beginGpuScope(VkCommandBuffer commandBuffer, const char* name) {
+        FrameData& frame = frames[currentFrame];
+        if (gpuTimingSupported == false || frame.scopes.size() == MAX_GPU_SCOPES) {
+            openScopes.push_back(std::numeric_limits<uint32_t>::max());
+            return;
+        }
+
+        uint32_t scope = static_cast<uint32_t>(frame.scopes.size());
+        frame.scopes.push_back(gpuMetricIndex(name));
+        openScopes.push_back(scope);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.queryPool, scope * 2);
+    }
+
+    /// Closes the innermost open scope once all previously recorded commands have finished.
+    void endGpuScope(VkCommandBuffer commandBuffer) {
+        if (openScopes.empty()) {
+            throw std::runtime_error("endGpuScope() without a matching beginGpuScope().");
+        }
+        uint32_t scope = openScopes.back();
+        openScopes.pop_back();
+        if (scope != std::numeric_limits<uint32_t>::max()) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frames[currentFrame].queryPool, scope * 2 + 1);
+        }
+    }
+
+    void addCpuTime(CpuStage stage, double milliseconds) {
+        frameCpu[static_cast<int>(stage)] += milliseconds;
+    }
+
+    /// Adds a sample of a metric that's neither a CPU stage nor a GPU scope, e.g. a latency measured by the caller, to the
+    /// current frame.
+    void addSample(std::string_view name, double milliseconds) {
+        frameSamples.push_back({metricIndex(name), milliseconds});
+    }
+
+    /// Commits the frame's CPU timings. If `submitted` is false the frame's GPU scopes are dropped, since they never ran.
+    /// What the calling thread allocates between frames, e.g. for window titles and reports, isn't counted.
+    void endFrame(bool submitted) {
+        countsHeapAllocations = false;
+        FrameData& frame = frames[currentFrame];
+
+        uint64_t allocations = heapAllocationCount.load(std::memory_order_relaxed) - allocationsCounted;
+        allocationStats.frames++;
+        allocationStats.total += allocations;
+        allocationStats.maxPerFrame = std::max(allocationStats.maxPerFrame, allocations);
+        allocationStats.framesWithAllocations += allocations > 0 ? 1 : 0;
+
+        size_t row = NO_ROW;
+        if (keepHistory) {
+            row = history.size();
+            history.push_back({frameCount, std::vector<double>(metrics.size(), NAN)});
+        }
+
+        for (int i = 0; i < static_cast<int>(CpuStage::Count); i++) {
+            addSample(i, frameCpu[i], row);
+            frameCpu[i] = 0.0;
+        }
+        for (const auto& [metric, milliseconds] : frameSamples) {
+            addSample(metric, milliseconds, row);
+        }
+        frameSamples.clear();
+
+        if (submitted == false) {
+            frame.scopes.clear();
+        }
+        frame.historyRow = row;
+        frameCount++;
+
+        // Counting threads may have allocated in the meantime, but not for this frame.
+        allocationsCounted = heapAllocationCount.load(std::memory_order_relaxed);
+    }
+
+    /// True once per `interval`. Meant for periodic logging and window title updates.
+    bool isReportDue(std::chrono::milliseconds interval = std::chrono::milliseconds(1000)) {
+        Clock::time_point now = Clock::now();
+        if (now - lastReport < interval) {
+            return false;
+        }
+        lastReport = now;
+        return true;
+    }
+
+    /// The newest sample of metric `name`, e.g. "gpu:frame", and how many samples the metric has had, which tells a new
+    /// sample from one already seen. False if there's none yet. GPU scopes get their samples in the `beginFrame()` that
+    /// reuses their slot.
+    bool latestSample(std::string_view name, double& milliseconds, uint64_t& sampleCount) const {
+        size_t metric = findMetric(name);
+        if (metric == metrics.size() || metrics[metric].count == 0) {
+            return false;
+        }
+        const Metric& m = metrics[metric];
+        milliseconds = m.samples[(m.next + WINDOW_SIZE - 1) % WINDOW_SIZE];
+        sampleCount = m.total;
+        return true;
+    }
+
+    /// A one-line summary of frame time, e.g. for the window title.
+    std::string summary() const {
+        std::string text = formatPercentiles(static_cast<size_t>(CpuStage::FrameInterval), "frame");
+        size_t gpuFrame = findMetric("gpu:frame");
+        if (gpuFrame != metrics.size()) {
+            text += " | " + formatPercentiles(gpuFrame, "gpu");
+        }
+        return text;
+    }
+
+    /// Prints p50/p95/p99/max of every metric over the rolling window.
+    void printReport(std::ostream& out) const {
+        out << "Frame timings over the last " << metrics[0].count << " frames (ms):\n";
+        for (size_t i = 0; i < metrics.size(); i++) {
+            if (metrics[i].count > 0) {
+                out << '\t' << formatPercentiles(i, metrics[i].name) << '\n';
+            }
+        }
+        if (allocationStats.frames > 0) {
+            out << "\tHeap allocations: " << allocationStats.total << " in " << allocationStats.framesWithAllocations << " of "
+                << allocationStats.frames << " frames, at most " << allocationStats.maxPerFrame << " per frame\n";
+        }
+    }
+
+    /// Writes every frame kept since `init()`. A path ending in `.json` gets a JSON object with a percentile summary and
+    /// the per-frame samples; anything else gets CSV with one row per frame. Missing samples are empty (CSV) or null (JSON).
+    void writeDump(const std::string& path) const {
+        std::ofstream file(path, std::ios::trunc);
+        if (file.is_open() == false) {
+            throw std::runtime_error("Profile dump could not be written to " + path + ".");
+        }
+
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        if (json) {
+            writeJson(file);
+        }
+        else {
+            writeCsv(file);
+        }
+        std::cout << "Wrote " << history.size() << " frames of timings to " << path << '\n';
+    }
+
+    /// Percentiles of a metric over every frame kept since `init()` or `resetStatistics()`.
+    struct Percentiles {
+        size_t count = 0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+        double mean = 0.0;
+    };
+
+    /// Heap allocations of the frames since `init()` or `resetStatistics()`. A frame's are those any thread made between the
+    /// previous `endFrame()` and its own, so a steady state that allocates nothing has a `total` of zero.
+    struct AllocationStats {
+        uint64_t frames = 0;
+        uint64_t total = 0;
+        uint64_t maxPerFrame = 0;
+        uint64_t framesWithAllocations = 0;
+    };
+
+    AllocationStats getAllocationStats() const { return allocationStats; }
+
+    /// Requires `keepHistory`. Returns a zero count for unknown metrics.
+    Percentiles historyPercentiles(std::string_view name) const {
+        Percentiles result;
+        size_t metric = findMetric(name);
+        if (metric == metrics.size()) {
+            return result;
+        }
+
+        std::vector<double> sorted;
+        for (const auto& row : history) {
+            if (metric < row.values.size() && std::isnan(row.values[metric]) == false) {
+                sorted.push_back(row.values[metric]);
+            }
+        }
+        if (sorted.empty()) {
+            return result;
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+        result.count = sorted.size();
+        result.p50 = percentile(sorted, 0.50);
+        result.p95 = percentile(sorted, 0.95);
+        result.p99 = percentile(sorted, 0.99);
+        result.max = sorted.back();
+        for (double sample : sorted) {
+            result.mean += sample;
+        }
+        result.mean /= sorted.size();
+        return result;
+    }
+
+    /// Writes `historyPercentiles()` of every metric as a JSON object. Nested lines are prefixed with `indent`.
+    void writeJsonSummary(std::ostream& out, const std::string& indent) const {
+        out << '{';
+        for (size_t i = 0; i < metrics.size(); i++) {
+            Percentiles stats = historyPercentiles(metrics[i].name);
+            out << (i == 0 ? "\n" : ",\n") << indent << "  \"" << metrics[i].name << "\": ";
+            if (stats.count == 0) {
+                out << "null";
+                continue;
+            }
+            out << "{\"count\": " << stats.count << ", \"p50\": " << stats.p50 << ", \"p95\": " << stats.p95
+                << ", \"p99\": " << stats.p99 << ", \"max\": " << stats.max << ", \"mean\": " << stats.mean << '}';
+        }
+        out << '\n' << indent << '}';
+    }
+
+    /// Collects the GPU timings of every frame slot. Call once the device is idle, e.g. before writing a dump.
+    void flush() {
+        for (auto& frame : frames) {
+            collectGpuResults(frame);
+        }
+    }
+
+    /// Forgets every sample taken so far, e.g. after warm-up frames. GPU timings of frames still in flight are dropped.
+    void resetStatistics() {
+        for (auto& metric : metrics) {
+            metric.next = 0;
+            metric.count = 0;
+        }
+        for (auto& frame : frames) {
+            frame.scopes.clear();
+            frame.historyRow = NO_ROW;
+        }
+        history.clear();
+        allocationStats = AllocationStats{};
+        allocationsCounted = heapAllocationCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t NO_ROW = std::numeric_limits<size_t>::max();
+
+    struct FrameData {
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        std::vector<size_t> scopes; // metric index of each scope written this frame
+        size_t historyRow = NO_ROW;
+    };
+
+    /// A rolling window of samples in milliseconds.
+    struct Metric {
+        std::string name;
+        std::vector<double> samples;
+        size_t next = 0;
+        size_t count = 0;
+        uint64_t total = 0;     // every sample ever added, not just the window's
+    };
+
+    struct HistoryRow {
+        uint64_t frame;
+        std::vector<double> values; // indexed by metric; may be shorter than `metrics` if a metric appeared later
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    float timestampPeriod = 1.0f;
+    uint64_t timestampMask = ~0ull;
+    bool gpuTimingSupported = false;
+    bool keepHistory = false;
+
+    std::vector<FrameData> frames;
+    uint32_t currentFrame = 0;
+    uint64_t frameCount = 0;
+    std::vector<uint32_t> openScopes;
+    double frameCpu[static_cast<int>(CpuStage::Count)] = {};
+    std::vector<std::pair<size_t, double>> frameSamples;    // from `addSample()`, by metric index
+    Clock::time_point lastFrameStart;
+    Clock::time_point lastReport;
+
+    std::vector<Metric> metrics;
+    std::vector<HistoryRow> history;
+
+    AllocationStats allocationStats;
+    uint64_t allocationsCounted = 0;    // `heapAllocationCount` when the last frame was committed
+
+    size_t findMetric(std::string_view name) const {
+        for (size_t i = 0; i < metrics.size(); i++) {
+            if (metrics[i].name == name) {
+                return i;
+            }
+        }
+        return metrics.size();
+    }
+
+    size_t metricIndex(std::string_view name) {
+        size_t index = findMetric(name);
+        if (index == metrics.size()) {
+            metrics.push_back({std::string(name), std::vector<double>(WINDOW_SIZE), 0, 0, 0});
+        }
+        return index;
+    }
+
+    /// `metricIndex("gpu:" + name)` without building the name, which would allocate for most scopes every frame.
+    size_t gpuMetricIndex(const char* name) {
+        for (size_t i = 0; i < metrics.size(); i++) {
+            const std::string& metric = metrics[i].name;
+            if (metric.compare(0, 4, "gpu:") == 0 && metric.compare(4, std::string::npos, name) == 0) {
+                return i;
+            }
+        }
+        return metricIndex(std::string("gpu:") + name);
+    }
+
+    void addSample(size_t metric, double milliseconds, size_t row) {
+        Metric& m = metrics[metric];
+        m.samples[m.next] = milliseconds;
+        m.next = (m.next + 1) % WINDOW_SIZE;
+        m.count = std::min(m.count + 1, WINDOW_SIZE);
+        m.total++;
+
+        if (row != NO_ROW) {
+            std::vector<double>& values = history[row].values;
+            if (values.size() <= metric) {
+                values.resize(metric + 1, NAN);
+            }
+            values[metric] = milliseconds;
+        }
+    }
+
+    void collectGpuResults(FrameData& frame) {
+        if (frame.scopes.empty()) {
+            return;
+        }
+
+        uint32_t queryCount = static_cast<uint32_t>(frame.scopes.size()) * 2;
+        uint64_t timestamps[MAX_GPU_SCOPES * 2];
+        VkResult result = vkGetQueryPoolResults(device, frame.queryPool, 0, queryCount, queryCount * sizeof(uint64_t),
+                                                timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result == VK_SUCCESS) {
+            for (size_t i = 0; i < frame.scopes.size(); i++) {
+                uint64_t ticks = ((timestamps[i * 2 + 1] & timestampMask) - (timestamps[i * 2] & timestampMask)) & timestampMask;
+                addSample(frame.scopes[i], ticks * static_cast<double>(timestampPeriod) / 1e6, frame.historyRow);
+            }
+        }
+        frame.scopes.clear();
+    }
+
+    /// Nearest-rank percentile of the rolling window.
+    static double percentile(std::vector<double>& sorted, double fraction) {
+        size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+    }
+
+    std::string formatPercentiles(size_t metric, const std::string& label) const {
+        const Metric& m = metrics[metric];
+        if (m.count == 0) {
+            return label + " n/a";
+        }
+
+        std::vector<double> sorted(m.samples.begin(), m.samples.begin() + m.count);
+        std::sort(sorted.begin(), sorted.end());
+
+        char text[128];
+        snprintf(text, sizeof(text), "%s p50 %.2f p95 %.2f p99 %.2f max %.2f", label.c_str(), percentile(sorted, 0.50),
+                 percentile(sorted, 0.95), percentile(sorted, 0.99), sorted.back());
+        return text;
+    }
+
+    void writeCsv(std::ostream& out) const {
+        out << "frame";
+        for (const auto& metric : metrics) {
+            out << ',' << metric.name;
+        }
+        out << '\n';
+
+        for (const auto& row : history) {
+            out << row.frame;
+            for (size_t i = 0; i < metrics.size(); i++) {
+                out << ',';
+                if (i < row.values.size() && std::isnan(row.values[i]) == false) {
+                    out << row.values[i];
+                }
+            }
+            out << '\n';
+        }
+    }
+
+    void writeJson(std::ostream& out) const {
+        out << "{\n  \"units\": \"ms\",\n  \"columns\": [\"frame\"";
+        for (const auto& metric : metrics) {
+            out << ", \"" << metric.name << '"';
+        }
+        out << "],\n  \"summary\": ";
+        writeJsonSummary(out, "  ");
+        out << ",\n  \"frames\": [";
+
+        for (size_t r = 0; r < history.size(); r++) {
+            const HistoryRow& row = history[r];
+            out << (r == 0 ? "\n" : ",\n") << "    [" << row.frame;
+            for (size_t i = 0; i < metrics.size(); i++) {
+                out << ", ";
+                if (i < row.values.size() && std::isnan(row.values[i]) == false) {
+                    out << row.values[i];
+                }
+                else {
+                    out << "null";
+                }
+            }
+            out << ']';
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+#endif /* FrameProfiler_hpp */
@@ -0,0 +1,398 @@
+#ifndef GpuCulling_hpp
+#define GpuCulling_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+#include "DescriptorHeap.hpp"
+#include "PipelineManager.hpp"
+#include "SubmissionScheduler.hpp"
+
+/// The six planes of a view frustum, each as (normal, distance) with the normal pointing inwards.
+struct Frustum {
+    float planes[6][4];
+
+    /// Extracts the planes from a column-major view-projection matrix with Vulkan's clip space: x and y in [-w, w], z in [0, w].
+    static Frustum fromViewProjection(const float* matrix) {
+        auto row = [&](int i, float* out) {
+            for (int column = 0; column < 4; column++) {
+                out[column] = matrix[column * 4 + i];
+            }
+        };
+        float r0[4], r1[4], r2[4], r3[4];
+        row(0, r0);
+        row(1, r1);
+        row(2, r2);
+        row(3, r3);
+
+        Frustum frustum{};
+        for (int i = 0; i < 4; i++) {
+            frustum.planes[0][i] = r3[i] + r0[i];   // left
+            frustum.planes[1][i] = r3[i] - r0[i];   // right
+            frustum.planes[2][i] = r3[i] + r1[i];   // bottom
+            frustum.planes[3][i] = r3[i] - r1[i];   // top
+            frustum.planes[4][i] = r2[i];           // near
+            frustum.planes[5][i] = r3[i] - r2[i];   // far
+        }
+        for (auto& plane : frustum.planes) {
+            float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            for (float& value : plane) {
+                value /= length;
+            }
+        }
+        return frustum;
+    }
+};
+
+/// GPU-driven culling: a compute shader tests every instance's bounding sphere against the frustum and appends an indexed
+/// indirect draw for each visible one, which a single `vkCmdDrawIndexedIndirectCount()` consumes. The CPU does no work per
+/// instance once the scene is uploaded.
+///
+/// Instance data is kept as a structure of arrays, one storage buffer per field, so the shader reads only what it needs.
+/// All buffers are reached through the `DescriptorHeap` by indices passed in push constants. Each draw has an instance count
+/// of one and a first instance equal to the instance's index, which is how the vertex shader finds its instance data through
+/// `gl_InstanceIndex`; this needs the drawIndirectFirstInstance feature.
+///
+/// When the device has a dedicated compute family, `submit()` culls on the compute queue and returns the point the frame's
+/// graphics submit waits on at `CONSUMER_STAGES`, so culling overlaps with the previous frame's rendering. Otherwise `record()`
+/// culls on the graphics queue, e.g. from a render graph pass. The output buffers exist once per frame in flight and are shared
+/// concurrently between the families, so no ownership transfers are recorded.
+class GpuCuller {
+public:
+    /// The draw the graphics queue consumes waits for the culling at this stage.
+    static constexpr VkPipelineStageFlags CONSUMER_STAGES = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+
+    /// Must match `local_size_x` in cull.comp.
+    static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+    /// A range of the scene's index buffer. Laid out as cull.comp reads it.
+    struct Mesh {
+        uint32_t indexCount;
+        uint32_t firstIndex;
+        int32_t vertexOffset;
+        uint32_t padding = 0;
+    };
+
+    /// One instance as the application describes it. Split into one array per field on upload.
+    struct Instance {
+        float center[3];
+        float radius;
+        uint32_t mesh;          // index into the meshes passed to `setScene()`
+    };
+
+    void init(VkDevice device, GpuMemoryAllocator& allocator, DescriptorHeap& heap, PipelineManager& pipelines,
+              const std::vector<uint32_t>& cullShader, uint32_t frameCount, uint32_t graphicsFamily, uint32_t computeFamily,
+              uint32_t transferFamily, SubmissionScheduler& scheduler, PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount) {
+        this->device = device;
+        this->allocator = &allocator;
+        this->heap = &heap;
+        this->pipelines = &pipelines;
+        this->scheduler = &scheduler;
+        this->cmdDrawIndexedIndirectCount = cmdDrawIndexedIndirectCount;
+        useComputeQueue = computeFamily != graphicsFamily;
+
+        sharingFamilies = {graphicsFamily, computeFamily, transferFamily};
+
+        pipeline = pipelines.request(pipelineDesc(cullShader));
+
+        frames.resize(frameCount);
+        if (useComputeQueue) {
+            for (auto& frame : frames) {
+                VkCommandPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                poolInfo.queueFamilyIndex = computeFamily;
+
+                VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Culling command pool was not created. Error code " + std::to_string(result));
+                }
+
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = frame.commandPool;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandBufferCount = 1;
+
+                result = vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Culling command buffer was not allocated. Error code " + std::to_string(result));
+                }
+            }
+        }
+    }
+
+    /// The device must be idle.
+    void destroy() {
+        destroySceneBuffers();
+        for (auto& frame : frames) {
+            if (frame.commandPool != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(device, frame.commandPool, nullptr); // Also frees the command buffer
+            }
+        }
+        frames.clear();
+    }
+
+    /// Replaces the scene. The instances are uploaded over the next frames by `upload()`; culling starts once the last of
+    /// those uploads has completed. The device must be idle if a scene was set before.
+    void setScene(const std::vector<Instance>& instances, const std::vector<Mesh>& meshes) {
+        destroySceneBuffers();
+
+        instanceCount = static_cast<uint32_t>(instances.size());
+        if (instanceCount == 0 || meshes.empty()) {
+            instanceCount = 0;
+            return;
+        }
+
+        bounds.resize(instanceCount * 4);
+        meshIds.resize(instanceCount);
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            std::copy(instances[i].center, instances[i].center + 3, &bounds[i * 4]);
+            bounds[i * 4 + 3] = instances[i].radius;
+            meshIds[i] = std::min(instances[i].mesh, static_cast<uint32_t>(meshes.size() - 1));
+        }
+        this->meshes = meshes;
+
+        const VkBufferUsageFlags inputUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        createStorageBuffer(boundsBuffer, bounds.size() * sizeof(float), inputUsage);
+        createStorageBuffer(meshIdBuffer, meshIds.size() * sizeof(uint32_t), inputUsage);
+        createStorageBuffer(meshBuffer, meshes.size() * sizeof(Mesh), inputUsage);
+
+        for (auto& frame : frames) {
+            createStorageBuffer(frame.drawCommands, instanceCount * sizeof(VkDrawIndexedIndirectCommand),
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+            createStorageBuffer(frame.drawCount, sizeof(uint32_t),
+                                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                                VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        }
+
+        uploadedBytes = 0;
+        uploadDone.reset();
+    }
+
+    /// Sets the frame slot the next `record()`, `submit()` and `draw()` use and decides whether this frame culls. Call after
+    /// waiting for that slot's previous frame.
+    void beginFrame(uint32_t frameIndex) {
+        currentFrame = frameIndex % frames.size();
+        if (frames[currentFrame].commandPool != VK_NULL_HANDLE) {
+            vkResetCommandPool(device, frames[currentFrame].commandPool, 0);
+        }
+
+        // Uploads queued this frame can't change the outcome.
+        active = instanceCount > 0 && uploadDone.has_value() && scheduler->isComplete(*uploadDone) && pipelines->isReady(pipeline);
+    }
+
+    /// Queues as much of the scene's remaining upload as fits in this frame's staging region.
+    void upload(StagingRing& stagingRing) {
+        if (instanceCount == 0 || uploadDone.has_value()) {
+            return;
+        }
+
+        struct Stream {
+            const void* data;
+            VkDeviceSize size;
+            VkBuffer buffer;
+        };
+        const Stream streams[] = {
+            {meshes.data(), meshes.size() * sizeof(Mesh), meshBuffer.buffer},
+            {meshIds.data(), meshIds.size() * sizeof(uint32_t), meshIdBuffer.buffer},
+            {bounds.data(), bounds.size() * sizeof(float), boundsBuffer.buffer},
+        };
+
+        // The streams are uploaded one after the other, as if they were one buffer, in pieces small enough to share the ring.
+        const VkDeviceSize chunkSize = std::max<VkDeviceSize>(stagingRing.getBytesPerFrame() / 4, 16);
+        VkDeviceSize streamStart = 0;
+        for (const auto& stream : streams) {
+            while (uploadedBytes < streamStart + stream.size) {
+                VkDeviceSize offset = uploadedBytes - streamStart;
+                VkDeviceSize size = std::min(chunkSize, stream.size - offset);
+                if (stagingRing.uploadBuffer(static_cast<const char*>(stream.data) + offset, size, stream.buffer, offset) == false) {
+                    return;
+                }
+                uploadedBytes += size;
+            }
+            streamStart += stream.size;
+        }
+        uploadDone = stagingRing.getUploadTicket();
+    }
+
+    /// Whether this frame culls and draws: the scene has been uploaded and the compute pipeline has compiled. Until then
+    /// `record()`, `submit()` and `draw()` do nothing. Fixed by `beginFrame()`, so every caller in a frame agrees, including
+    /// recording threads.
+    bool isActive() const { return active; }
+
+    bool usesComputeQueue() const { return useComputeQueue; }
+
+    /// Recompiles the culling pipeline from new cull.comp SPIR-V. The current pipeline keeps culling until the pipeline
+    /// manager's `applyReplacements()` swaps the new one in.
+    void reloadShader(const std::vector<uint32_t>& cullShader) {
+        pipelines->replace(pipeline, pipelineDesc(cullShader));
+    }
+
+    /// Records the culling of this frame against `frustum`: resets the draw count, then dispatches cull.comp. Must be outside
+    /// a render pass. The draw commands and count are afterwards written at the compute shader stage.
+    void record(VkCommandBuffer commandBuffer, const Frustum& frustum) {
+        if (isActive() == false) {
+            return;
+        }
+        FrameData& frame = frames[currentFrame];
+
+        vkCmdFillBuffer(commandBuffer, frame.drawCount.buffer, 0, sizeof(uint32_t), 0);
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        CullConstants constants{};
+        std::copy(&frustum.planes[0][0], &frustum.planes[0][0] + 24, &constants.planes[0][0]);
+        constants.instanceCount = instanceCount;
+        constants.boundsIndex = boundsBuffer.heapIndex;
+        constants.meshIdIndex = meshIdBuffer.heapIndex;
+        constants.meshIndex = meshBuffer.heapIndex;
+        constants.drawCommandsIndex = frame.drawCommands.heapIndex;
+        constants.drawCountIndex = frame.drawCount.heapIndex;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines->get(pipeline));
+        heap->bind(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE);
+        heap->pushConstants(commandBuffer, &constants, sizeof(constants));
+        vkCmdDispatch(commandBuffer, (instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+    }
+
+    /// With a dedicated compute family, records and submits this frame's culling on the compute queue and returns the point
+    /// the graphics submit must wait on at `CONSUMER_STAGES`. The point's value is 0 when there's nothing to wait for.
+    TimelinePoint submit(const Frustum& frustum) {
+        if (useComputeQueue == false || isActive() == false) {
+            return {};
+        }
+        FrameData& frame = frames[currentFrame];
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+        record(frame.commandBuffer, frustum);
+        vkEndCommandBuffer(frame.commandBuffer);
+
+        // The frame's graphics submit waits on this one, so waiting on the frame also covers the command buffer.
+        submission.commandBuffers.assign(1, frame.commandBuffer);
+        submission.signalsOtherQueues = true;
+        return scheduler->submit(QueueType::Compute, submission);
+    }
+
+    /// Draws every instance that survived this frame's culling. The caller binds the graphics pipeline, the index buffer the
+    /// meshes refer to, and the heap.
+    void draw(VkCommandBuffer commandBuffer) const {
+        if (isActive() == false) {
+            return;
+        }
+        const FrameData& frame = frames[currentFrame];
+        cmdDrawIndexedIndirectCount(commandBuffer, frame.drawCommands.buffer, 0, frame.drawCount.buffer, 0, instanceCount,
+                                    sizeof(VkDrawIndexedIndirectCommand));
+    }
+
+    /// This frame's outputs, e.g. to declare them to a render graph.
+    VkBuffer getDrawCommands() const { return frames[currentFrame].drawCommands.buffer; }
+    VkBuffer getDrawCount() const { return frames[currentFrame].drawCount.buffer; }
+
+    /// Heap index of the centers and radii, as vec4s, for vertex shaders that place instances by `gl_InstanceIndex`.
+    uint32_t getBoundsIndex() const { return boundsBuffer.heapIndex; }
+
+    uint32_t getInstanceCount() const { return instanceCount; }
+
+private:
+    /// Laid out as cull.comp's push constants.
+    struct CullConstants {
+        float planes[6][4];
+        uint32_t instanceCount;
+        uint32_t boundsIndex;
+        uint32_t meshIdIndex;
+        uint32_t meshIndex;
+        uint32_t drawCommandsIndex;
+        uint32_t drawCountIndex;
+    };
+    static_assert(sizeof(CullConstants) <= DescriptorHeap::PUSH_CONSTANT_SIZE, "Cull constants don't fit in push constants.");
+
+    struct StorageBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation{};
+        uint32_t heapIndex = DescriptorHeap::INVALID_INDEX;
+    };
+
+    struct FrameData {
+        StorageBuffer drawCommands;
+        StorageBuffer drawCount;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* allocator = nullptr;
+    DescriptorHeap* heap = nullptr;
+    PipelineManager* pipelines = nullptr;
+    PipelineHandle pipeline;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+    uint32_t currentFrame = 0;
+    bool active = false;
+    bool useComputeQueue = false;
+    SubmissionScheduler* scheduler = nullptr;
+    SubmissionScheduler::Submission submission;     // reused, so that submitting doesn't allocate
+    std::vector<uint32_t> sharingFamilies;
+    std::vector<FrameData> frames;
+
+    // The scene, kept on the CPU until it's uploaded.
+    uint32_t instanceCount = 0;
+    std::vector<float> bounds;
+    std::vector<uint32_t> meshIds;
+    std::vector<Mesh> meshes;
+    StorageBuffer boundsBuffer;
+    StorageBuffer meshIdBuffer;
+    StorageBuffer meshBuffer;
+    VkDeviceSize uploadedBytes = 0;
+    std::optional<TimelinePoint> uploadDone;   // set once the last upload is queued
+
+    PipelineDesc pipelineDesc(const std::vector<uint32_t>& cullShader) const {
+        PipelineDesc desc;
+        desc.stages.push_back({VK_SHADER_STAGE_COMPUTE_BIT, cullShader});
+        desc.layout = heap->getPipelineLayout();
+        return desc;
+    }
+
+    void createStorageBuffer(StorageBuffer& storage, VkDeviceSize size, VkBufferUsageFlags usage) {
+        allocator->createBuffer(size, usage, MemoryUsage::GpuOnly, storage.buffer, storage.allocation, sharingFamilies);
+        storage.heapIndex = heap->registerStorageBuffer(storage.buffer);
+    }
+
+    void destroyStorageBuffer(StorageBuffer& storage) {
+        if (storage.buffer != VK_NULL_HANDLE) {
+            heap->releaseStorageBuffer(storage.heapIndex);
+            allocator->destroyBuffer(storage.buffer, storage.allocation);
+        }
+        storage = StorageBuffer{};
+    }
+
+    void destroySceneBuffers() {
+        destroyStorageBuffer(boundsBuffer);
+        destroyStorageBuffer(meshIdBuffer);
+        destroyStorageBuffer(meshBuffer);
+        for (auto& frame : frames) {
+            destroyStorageBuffer(frame.drawCommands);
+            destroyStorageBuffer(frame.drawCount);
+        }
+        instanceCount = 0;
+        active = false;
+    }
+};
+
+#endif /* GpuCulling_hpp */
@@ -0,0 +1,616 @@
+#ifndef GpuWorkers_hpp
+#define GpuWorkers_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MemoryAllocator.hpp"
+#include "FrameProfiler.hpp"
+#include "GpuCulling.hpp"
+
+/// Offscreen work on the GPUs that don't render, or on all of them in a compute batch: one `VkDevice` per physical device,
+/// each with a single compute queue and its own memory allocator, running visibility queries of the scene against any
+/// number of views with visibility.comp.
+///
+/// A query goes to the worker expected to finish it first: the one with the fewest queries in flight, weighted by how long
+/// its queries have been taking on its GPU. Each worker has `SLOTS_PER_WORKER` query slots; when every slot of every worker
+/// is busy, `submit()` refuses the query rather than waiting, so the render loop never stalls on another GPU.
+///
+/// Each query is bracketed by timestamps when the worker's queue has them, and reported as `gpu<N>:visibility`, N counting
+/// workers from 1.
+///
+/// Every slot has its own persistently mapped view and result buffers, so while the GPU runs one slot's query the host can
+/// write the next slot's views and read back a finished slot's counts; nothing is copied or mapped per query.
+///
+/// Per frame, call `collect()` between the profiler's `beginFrame()` and `endFrame()`, then `submit()` the frame's queries.
+/// A batch that isn't tied to frames keeps every slot busy instead: submit while `hasFreeSlot()`, `collect()`, and
+/// `waitForAny()` when nothing has finished. Not thread-safe.
+class GpuWorkerPool {
+public:
+    static constexpr uint32_t SLOTS_PER_WORKER = 4;
+    static constexpr uint32_t MAX_VIEWS = 16;
+
+    /// Must match `local_size_x` in visibility.comp.
+    static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+    /// How long `waitForAny()` waits on one worker before trying the next.
+    static constexpr uint64_t POLL_NANOSECONDS = 100'000;
+
+    /// Creates a device on each of `physicalDevices` that has a compute queue. The others are skipped.
+    void init(const std::vector<VkPhysicalDevice>& physicalDevices, const std::vector<uint32_t>& visibilityShader) {
+        for (VkPhysicalDevice physicalDevice : physicalDevices) {
+            auto worker = std::make_unique<Worker>();
+            if (createDevice(*worker, physicalDevice) == false) {
+                continue;
+            }
+            worker->metricName = "gpu" + std::to_string(workers.size() + 1) + ":visibility";
+            createPipeline(*worker, visibilityShader);
+            createSlots(*worker);
+            workers.push_back(std::move(worker));
+        }
+    }
+
+    /// Waits for every worker, then destroys its device and everything on it.
+    void destroy() {
+        for (auto& worker : workers) {
+            vkDeviceWaitIdle(worker->device);
+            destroyBuffer(*worker, worker->bounds);
+            for (auto& slot : worker->slots) {
+                destroyBuffer(*worker, slot.views);
+                destroyBuffer(*worker, slot.counts);
+                vkDestroyFence(worker->device, slot.fence, nullptr);
+            }
+            worker->allocator.destroy();
+            vkDestroyQueryPool(worker->device, worker->queryPool, nullptr);
+            vkDestroyCommandPool(worker->device, worker->commandPool, nullptr);
+            vkDestroyDescriptorPool(worker->device, worker->descriptorPool, nullptr);
+            vkDestroyPipeline(worker->device, worker->pipeline, nullptr);
+            vkDestroyPipelineLayout(worker->device, worker->pipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(worker->device, worker->setLayout, nullptr);
+            vkDestroyDevice(worker->device, nullptr);
+        }
+        workers.clear();
+    }
+
+    size_t getWorkerCount() const { return workers.size(); }
+
+    const std::string& getWorkerName(size_t worker) const { return workers[worker]->name; }
+
+    /// Uploads the bounding spheres queries are tested against, as (center, radius) vec4s, to every worker and waits for
+    /// the uploads. Waits for queries in flight first; their results are dropped.
+    void setScene(const std::vector<float>& bounds) {
+        instanceCount = static_cast<uint32_t>(bounds.size() / 4);
+        for (auto& worker : workers) {
+            vkDeviceWaitIdle(worker->device);
+            for (auto& slot : worker->slots) {
+                slot.busy = false;
+            }
+            destroyBuffer(*worker, worker->bounds);
+            if (instanceCount > 0) {
+                uploadBounds(*worker, bounds);
+            }
+        }
+    }
+
+    /// Queues a query of how many instances are inside each of `views` on the worker expected to finish it first.
+    /// - Parameter tag: handed back with the result.
+    /// - Returns: false if there's no scene, more than `MAX_VIEWS` views, or no free slot; the query is dropped.
+    bool submit(const std::vector<Frustum>& views, uint64_t tag) {
+        if (instanceCount == 0 || views.empty() || views.size() > MAX_VIEWS) {
+            return false;
+        }
+
+        Worker* chosen = nullptr;
+        Slot* chosenSlot = nullptr;
+        double chosenCost = 0.0;
+        for (auto& worker : workers) {
+            Slot* freeSlot = nullptr;
+            uint32_t busySlots = 0;
+            for (auto& slot : worker->slots) {
+                if (slot.busy) {
+                    busySlots++;
+                }
+                else if (freeSlot == nullptr) {
+                    freeSlot = &slot;
+                }
+            }
+            if (freeSlot == nullptr) {
+                continue;
+            }
+            // Workers that haven't been measured yet look fast, so each gets measured early on.
+            double cost = (busySlots + 1) * std::max(worker->averageMilliseconds, 0.001);
+            if (chosen == nullptr || cost < chosenCost) {
+                chosen = worker.get();
+                chosenSlot = freeSlot;
+                chosenCost = cost;
+            }
+        }
+        if (chosen == nullptr) {
+            droppedQueries++;
+            return false;
+        }
+
+        record(*chosen, *chosenSlot, views);
+        chosenSlot->busy = true;
+        chosenSlot->tag = tag;
+        chosenSlot->viewCount = static_cast<uint32_t>(views.size());
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &chosenSlot->commandBuffer;
+
+        VkResult result = vkQueueSubmit(chosen->queue, 1, &submitInfo, chosenSlot->fence);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Visibility query was not submitted to " + chosen->name + ". Error code " + std::to_string(result));
+        }
+        return true;
+    }
+
+    /// Whether some worker could take a query right now.
+    bool hasFreeSlot() const {
+        for (const auto& worker : workers) {
+            for (const auto& slot : worker->slots) {
+                if (slot.busy == false) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /// Blocks until some query in flight has finished; returns right away if none is in flight. A single worker is waited on
+    /// outright. With several, each is waited on briefly in turn, so a fast GPU's result isn't held up behind a slow one.
+    void waitForAny() {
+        const uint64_t timeout = workers.size() == 1 ? UINT64_MAX : POLL_NANOSECONDS;
+        for (;;) {
+            bool inFlight = false;
+            for (auto& worker : workers) {
+                VkFence fences[SLOTS_PER_WORKER];
+                uint32_t fenceCount = 0;
+                for (auto& slot : worker->slots) {
+                    if (slot.busy) {
+                        fences[fenceCount++] = slot.fence;
+                    }
+                }
+                if (fenceCount == 0) {
+                    continue;
+                }
+                inFlight = true;
+                VkResult result = vkWaitForFences(worker->device, fenceCount, fences, VK_FALSE, timeout);
+                if (result == VK_SUCCESS) {
+                    return;
+                }
+                if (result != VK_TIMEOUT) {
+                    throw std::runtime_error("Waiting for a visibility query on " + worker->name + " failed. Error code " +
+                                             std::to_string(result));
+                }
+            }
+            if (inFlight == false) {
+                return;
+            }
+        }
+    }
+
+    /// Hands every finished query's visible instance count per view to `onResult(tag, counts)` and adds its GPU time to the
+    /// profiler's current frame, if there is a profiler. `counts` is reused for the next result.
+    template <typename OnResult>
+    void collect(FrameProfiler* profiler, OnResult onResult) {
+        for (auto& worker : workers) {
+            for (uint32_t i = 0; i < SLOTS_PER_WORKER; i++) {
+                Slot& slot = worker->slots[i];
+                if (slot.busy == false || vkGetFenceStatus(worker->device, slot.fence) != VK_SUCCESS) {
+                    continue;
+                }
+                slot.busy = false;
+
+                if (worker->queryPool != VK_NULL_HANDLE) {
+                    uint64_t timestamps[2];
+                    VkResult result = vkGetQueryPoolResults(worker->device, worker->queryPool, i * 2, 2, sizeof(timestamps),
+                                                            timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+                    if (result == VK_SUCCESS) {
+                        double milliseconds = ((timestamps[1] - timestamps[0]) & worker->timestampMask) *
+                            worker->timestampPeriod / 1e6;
+                        if (profiler != nullptr) {
+                            profiler->addSample(worker->metricName, milliseconds);
+                        }
+                        worker->busyMilliseconds += milliseconds;
+                        worker->averageMilliseconds = worker->completedQueries == 0 ? milliseconds :
+                            worker->averageMilliseconds * 0.9 + milliseconds * 0.1;
+                    }
+                }
+                worker->completedQueries++;
+
+                worker->allocator.invalidate(slot.counts.allocation);
+                collectedCounts.resize(slot.viewCount);
+                std::memcpy(collectedCounts.data(), slot.counts.allocation.mappedData, collectedCounts.size() * sizeof(uint32_t));
+                onResult(slot.tag, collectedCounts);
+            }
+        }
+    }
+
+    /// Clears the per-worker totals, e.g. at the end of a benchmark's warm-up.
+    void resetStatistics() {
+        for (auto& worker : workers) {
+            worker->completedQueries = 0;
+            worker->busyMilliseconds = 0.0;
+        }
+        droppedQueries = 0;
+    }
+
+    /// Writes every worker's totals since the last `resetStatistics()` as a JSON array. Utilization is GPU busy time over
+    /// `seconds` of wall-clock time.
+    void writeJson(std::ostream& out, double seconds) const {
+        out << '[';
+        for (size_t i = 0; i < workers.size(); i++) {
+            const Worker& worker = *workers[i];
+            out << (i == 0 ? "" : ", ") << "{\"metric\": \"" << worker.metricName << "\", \"device\": \"" << worker.name
+                << "\", \"queries\": " << worker.completedQueries << ", \"busyMs\": " << worker.busyMilliseconds
+                << ", \"utilization\": " << (seconds > 0.0 ? worker.busyMilliseconds / (seconds * 1000.0) : 0.0) << '}';
+        }
+        out << ']';
+    }
+
+    uint64_t getDroppedQueries() const { return droppedQueries; }
+
+private:
+    /// Laid out as visibility.comp's push constants.
+    struct VisibilityConstants {
+        uint32_t instanceCount;
+        uint32_t viewCount;
+    };
+
+    struct Buffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation{};
+    };
+
+    struct Slot {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        Buffer views;           // six planes per view, written by the host
+        Buffer counts;          // one count per view, read back by the host
+        bool busy = false;
+        uint64_t tag = 0;
+        uint32_t viewCount = 0;
+    };
+
+    struct Worker {
+        std::string name;
+        std::string metricName;
+        VkDevice device = VK_NULL_HANDLE;
+        VkQueue queue = VK_NULL_HANDLE;
+        GpuMemoryAllocator allocator;
+
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+
+        // Two timestamps per slot. Null if the queue has no timestamps.
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        double timestampPeriod = 0.0;
+        uint64_t timestampMask = 0;
+
+        Buffer bounds;
+        std::array<Slot, SLOTS_PER_WORKER> slots;
+
+        uint64_t completedQueries = 0;
+        double busyMilliseconds = 0.0;
+        double averageMilliseconds = 0.0;   // moving average of the GPU time per query
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint32_t instanceCount = 0;
+    uint64_t droppedQueries = 0;
+    std::vector<uint32_t> collectedCounts;  // handed to `collect()`'s callback
+
+    /// Prefers a compute family without graphics, which nothing else on that GPU is likely to submit to.
+    static bool createDevice(Worker& worker, VkPhysicalDevice physicalDevice) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        worker.name = properties.deviceName;
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+        std::optional<uint32_t> family;
+        for (uint32_t i = 0; i < familyCount; i++) {
+            if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0) {
+                continue;
+            }
+            if (family.has_value() == false || (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0) {
+                family = i;
+            }
+        }
+        if (family.has_value() == false) {
+            return false;
+        }
+
+        float priority = 1.0f;
+        VkDeviceQueueCreateInfo queueInfo{};
+        queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queueInfo.queueFamilyIndex = *family;
+        queueInfo.queueCount = 1;
+        queueInfo.pQueuePriorities = &priority;
+
+        VkDeviceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.queueCreateInfoCount = 1;
+        createInfo.pQueueCreateInfos = &queueInfo;
+
+        VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &worker.device);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Device for GPU worker " + worker.name + " was not created. Error code " + std::to_string(result));
+        }
+        vkGetDeviceQueue(worker.device, *family, 0, &worker.queue);
+        worker.allocator.init(physicalDevice, worker.device);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = *family;
+
+        result = vkCreateCommandPool(worker.device, &poolInfo, nullptr, &worker.commandPool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("GPU worker command pool was not created. Error code " + std::to_string(result));
+        }
+
+        uint32_t timestampValidBits = families[*family].timestampValidBits;
+        if (timestampValidBits > 0) {
+            VkQueryPoolCreateInfo queryInfo{};
+            queryInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            queryInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            queryInfo.queryCount = SLOTS_PER_WORKER * 2;
+
+            result = vkCreateQueryPool(worker.device, &queryInfo, nullptr, &worker.queryPool);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("GPU worker query pool was not created. Error code " + std::to_string(result));
+            }
+            worker.timestampPeriod = properties.limits.timestampPeriod;
+            worker.timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+        }
+        return true;
+    }
+
+    static void createPipeline(Worker& worker, const std::vector<uint32_t>& shader) {
+        std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); i++) {
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+        setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        setLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        setLayoutInfo.pBindings = bindings.data();
+
+        VkResult result = vkCreateDescriptorSetLayout(worker.device, &setLayoutInfo, nullptr, &worker.setLayout);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Visibility descriptor set layout was not created. Error code " + std::to_string(result));
+        }
+
+        VkPushConstantRange pushConstants{};
+        pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstants.size = sizeof(VisibilityConstants);
+
+        VkPipelineLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &worker.setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstants;
+
+        result = vkCreatePipelineLayout(worker.device, &layoutInfo, nullptr, &worker.pipelineLayout);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Visibility pipeline layout was not created. Error code " + std::to_string(result));
+        }
+
+        VkShaderModuleCreateInfo moduleInfo{};
+        moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        moduleInfo.codeSize = shader.size() * sizeof(uint32_t);
+        moduleInfo.pCode = shader.data();
+
+        VkShaderModule module;
+        result = vkCreateShaderModule(worker.device, &moduleInfo, nullptr, &module);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Visibility shader module was not created. Error code " + std::to_string(result));
+        }
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = module;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = worker.pipelineLayout;
+
+        result = vkCreateComputePipelines(worker.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &worker.pipeline);
+        vkDestroyShaderModule(worker.device, module, nullptr);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Visibility pipeline was not created on " + worker.name + ". Error code " + std::to_string(result));
+        }
+    }
+
+    static void createSlots(Worker& worker) {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = SLOTS_PER_WORKER * 3;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = SLOTS_PER_WORKER;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+
+        VkResult result = vkCreateDescriptorPool(worker.device, &poolInfo, nullptr, &worker.descriptorPool);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Visibility descriptor pool was not created. Error code " + std::to_string(result));
+        }
+
+        for (auto& slot : worker.slots) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = worker.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+
+            result = vkAllocateCommandBuffers(worker.device, &allocInfo, &slot.commandBuffer);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("GPU worker command buffer was not allocated. Error code " + std::to_string(result));
+            }
+
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            result = vkCreateFence(worker.device, &fenceInfo, nullptr, &slot.fence);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("GPU worker fence was not created. Error code " + std::to_string(result));
+            }
+
+            VkDescriptorSetAllocateInfo setInfo{};
+            setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            setInfo.descriptorPool = worker.descriptorPool;
+            setInfo.descriptorSetCount = 1;
+            setInfo.pSetLayouts = &worker.setLayout;
+
+            result = vkAllocateDescriptorSets(worker.device, &setInfo, &slot.descriptorSet);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Visibility descriptor set was not allocated. Error code " + std::to_string(result));
+            }
+
+            worker.allocator.createBuffer(MAX_VIEWS * sizeof(Frustum), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemoryUsage::CpuToGpu,
+                                          slot.views.buffer, slot.views.allocation);
+            worker.allocator.createBuffer(MAX_VIEWS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          MemoryUsage::GpuToCpu, slot.counts.buffer, slot.counts.allocation);
+        }
+    }
+
+    /// Copies `bounds` into a device-local buffer through a temporary staging buffer, and points every slot's descriptor
+    /// set at it. Blocks until the copy is done; it only happens when the scene changes.
+    void uploadBounds(Worker& worker, const std::vector<float>& bounds) {
+        VkDeviceSize size = bounds.size() * sizeof(float);
+        worker.allocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                      MemoryUsage::GpuOnly, worker.bounds.buffer, worker.bounds.allocation);
+
+        Buffer staging;
+        worker.allocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CpuToGpu, staging.buffer,
+                                      staging.allocation);
+        std::memcpy(staging.allocation.mappedData, bounds.data(), size);
+        worker.allocator.flush(staging.allocation);
+
+        Slot& slot = worker.slots[0];
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(slot.commandBuffer, &beginInfo);
+        VkBufferCopy copy{0, 0, size};
+        vkCmdCopyBuffer(slot.commandBuffer, staging.buffer, worker.bounds.buffer, 1, &copy);
+        vkEndCommandBuffer(slot.commandBuffer);
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &slot.commandBuffer;
+
+        vkResetFences(worker.device, 1, &slot.fence);
+        VkResult result = vkQueueSubmit(worker.queue, 1, &submitInfo, slot.fence);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Scene upload was not submitted to " + worker.name + ". Error code " + std::to_string(result));
+        }
+        vkWaitForFences(worker.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        destroyBuffer(worker, staging);
+
+        for (auto& each : worker.slots) {
+            VkDescriptorBufferInfo bufferInfos[3] = {
+                {worker.bounds.buffer, 0, VK_WHOLE_SIZE},
+                {each.views.buffer, 0, VK_WHOLE_SIZE},
+                {each.counts.buffer, 0, VK_WHOLE_SIZE},
+            };
+            std::array<VkWriteDescriptorSet, 3> writes{};
+            for (uint32_t i = 0; i < writes.size(); i++) {
+                writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                writes[i].dstSet = each.descriptorSet;
+                writes[i].dstBinding = i;
+                writes[i].descriptorCount = 1;
+                writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+                writes[i].pBufferInfo = &bufferInfos[i];
+            }
+            vkUpdateDescriptorSets(worker.device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+        }
+    }
+
+    /// Writes the views into the slot and records clearing the counts, the dispatch, and making the counts visible to the
+    /// host, between the slot's two timestamps.
+    void record(Worker& worker, Slot& slot, const std::vector<Frustum>& views) {
+        std::memcpy(slot.views.allocation.mappedData, views.data(), views.size() * sizeof(Frustum));
+        worker.allocator.flush(slot.views.allocation);
+
+        uint32_t slotIndex = static_cast<uint32_t>(&slot - worker.slots.data());
+        uint32_t viewCount = static_cast<uint32_t>(views.size());
+        VkCommandBuffer commandBuffer = slot.commandBuffer;
+
+        vkResetFences(worker.device, 1, &slot.fence);
+        vkResetCommandBuffer(commandBuffer, 0);
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+        if (worker.queryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, worker.queryPool, slotIndex * 2, 2);
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, worker.queryPool, slotIndex * 2);
+        }
+
+        vkCmdFillBuffer(commandBuffer, slot.counts.buffer, 0, viewCount * sizeof(uint32_t), 0);
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        VisibilityConstants constants{instanceCount, viewCount};
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, worker.pipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, worker.pipelineLayout, 0, 1, &slot.descriptorSet,
+                                0, nullptr);
+        vkCmdPushConstants(commandBuffer, worker.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+        vkCmdDispatch(commandBuffer, (instanceCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, viewCount, 1);
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        if (worker.queryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, worker.queryPool, slotIndex * 2 + 1);
+        }
+        vkEndCommandBuffer(commandBuffer);
+    }
+
+    static void destroyBuffer(Worker& worker, Buffer& buffer) {
+        if (buffer.buffer != VK_NULL_HANDLE) {
+            worker.allocator.destroyBuffer(buffer.buffer, buffer.allocation);
+        }
+        buffer = Buffer{};
+    }
+};
+
+#endif /* GpuWorkers_hpp */
@@ -0,0 +1,221 @@
+#ifndef JobSystem_hpp
+#define JobSystem_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// A reference to a callable owned by someone else, for callbacks that are only called before the function taking them
+/// returns. Unlike `std::function` it never allocates, however much the callable captures.
+template <typename Signature>
+class FunctionRef;
+
+template <typename Result, typename... Args>
+class FunctionRef<Result(Args...)> {
+public:
+    template <typename Function, typename = std::enable_if_t<std::is_same_v<std::decay_t<Function>, FunctionRef> == false>>
+    FunctionRef(Function&& function)
+        : callable(const_cast<void*>(static_cast<const void*>(&function))),
+          invoke([](void* callable, Args... args) -> Result {
+              return (*static_cast<std::remove_reference_t<Function>*>(callable))(std::forward<Args>(args)...);
+          }) {}
+
+    Result operator()(Args... args) const { return invoke(callable, std::forward<Args>(args)...); }
+
+private:
+    void* callable;
+    Result (*invoke)(void* callable, Args... args);
+};
+
+/// A work-stealing thread pool. Every thread, including the one calling `parallelFor()`, owns a task queue: it takes work from
+/// the back of its own queue and, when that's empty, steals from the front of the others. Stealing from the opposite end keeps
+/// contention low because the owner and the thief rarely touch the same task.
+///
+/// Jobs receive a thread index in [0, `getThreadCount()`), which is stable for the lifetime of the pool. It's meant for indexing
+/// per-thread resources such as command pools, which Vulkan requires to be externally synchronized.
+class JobSystem {
+public:
+    using Job = FunctionRef<void(uint32_t index, uint32_t threadIndex)>;
+
+    /// Starts `workerCount` threads. Zero runs every job on the calling thread. `onWorkerStart`, if any, runs first on each
+    /// worker, e.g. to set up thread-local state.
+    void init(uint32_t workerCount, void (*onWorkerStart)() = nullptr) {
+        queues.clear();
+        for (uint32_t i = 0; i <= workerCount; i++) {
+            queues.push_back(std::make_unique<TaskQueue>());
+        }
+
+        stopping = false;
+        for (uint32_t i = 0; i < workerCount; i++) {
+            threads.emplace_back([this, i, onWorkerStart] {
+                if (onWorkerStart != nullptr) {
+                    onWorkerStart();
+                }
+                workerLoop(i);
+            });
+        }
+    }
+
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        queues.clear();
+    }
+
+    /// Worker threads plus the thread that calls `parallelFor()`, whose thread index is the last one.
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(queues.size()); }
+
+    /// Runs `job(i, threadIndex)` for every i in [0, count) and returns once all of them have finished. The calling thread
+    /// works on the batch too instead of sleeping. The first exception thrown by a job is rethrown here.
+    /// Must not be called from inside a job.
+    void parallelFor(uint32_t count, Job job) {
+        if (count == 0) {
+            return;
+        }
+
+        Batch batch;
+        batch.job = &job;
+        batch.remaining = count;
+
+        // Deal the work out round-robin so every thread starts with its share and stealing only evens out the tail.
+        uint32_t threadCount = getThreadCount();
+        for (uint32_t i = 0; i < count; i++) {
+            TaskQueue& queue = *queues[i % threadCount];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({&batch, i});
+        }
+        pendingTasks += count;
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_all();
+
+        uint32_t callerIndex = threadCount - 1;
+        while (batch.remaining.load() > 0) {
+            if (runOne(callerIndex) == false) {
+                std::this_thread::yield();
+            }
+        }
+
+        if (batch.error) {
+            std::rethrow_exception(batch.error);
+        }
+    }
+
+private:
+    struct Batch {
+        const Job* job;
+        std::atomic<uint32_t> remaining;
+        std::mutex errorMutex;
+        std::exception_ptr error;
+    };
+
+    struct Task {
+        Batch* batch;
+        uint32_t index;
+    };
+
+    /// Owners push to and pop from the back, thieves take from `front`. Both ends meet once it's drained, and it starts over
+    /// from the beginning of the vector, so after the first few batches queuing never allocates.
+    struct TaskQueue {
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        size_t front = 0;
+
+        bool empty() const { return front == tasks.size(); }
+
+        void restartIfDrained() {
+            if (empty()) {
+                tasks.clear();
+                front = 0;
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::vector<std::thread> threads;
+
+    // Tasks queued but not yet taken. Workers sleep while it's zero.
+    std::atomic<uint32_t> pendingTasks{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void workerLoop(uint32_t threadIndex) {
+        while (true) {
+            if (runOne(threadIndex)) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || pendingTasks.load() > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    /// Runs one task from this thread's queue, or one stolen from another thread. Returns false if every queue was empty.
+    bool runOne(uint32_t threadIndex) {
+        Task task;
+        if (pop(threadIndex, task) == false) {
+            return false;
+        }
+
+        try {
+            (*task.batch->job)(task.index, threadIndex);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(task.batch->errorMutex);
+            if (task.batch->error == nullptr) {
+                task.batch->error = std::current_exception();
+            }
+        }
+
+        // Last touch of the batch: once this reaches zero the caller may return and destroy it.
+        task.batch->remaining--;
+        return true;
+    }
+
+    bool pop(uint32_t threadIndex, Task& task) {
+        {
+            TaskQueue& own = *queues[threadIndex];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (own.empty() == false) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                own.restartIfDrained();
+                pendingTasks--;
+                return true;
+            }
+        }
+
+        uint32_t threadCount = getThreadCount();
+        for (uint32_t offset = 1; offset < threadCount; offset++) {
+            TaskQueue& victim = *queues[(threadIndex + offset) % threadCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.empty() == false) {
+                task = victim.tasks[victim.front++];
+                victim.restartIfDrained();
+                pendingTasks--;
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+#endif /* JobSystem_hpp */
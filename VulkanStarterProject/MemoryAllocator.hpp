@@ -0,0 +1,584 @@
+#ifndef MemoryAllocator_hpp
+#define MemoryAllocator_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <set>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <algorithm>
+
+/// What a resource's memory is used for. Decides which memory type backs it.
+enum class MemoryUsage {
+    GpuOnly,    // DEVICE_LOCAL. Render targets, static vertex/index buffers, textures.
+    CpuToGpu,   // HOST_VISIBLE | HOST_COHERENT, persistently mapped. Staging and per-frame uniforms.
+    GpuToCpu,   // HOST_VISIBLE, HOST_CACHED if possible, persistently mapped. Readback.
+    GpuLazy,    // DEVICE_LOCAL | LAZILY_ALLOCATED if there is such a type, else GpuOnly. Transient attachments, which tile-based
+                // GPUs keep in tile memory and may never back at all.
+};
+
+/// Linear resources (buffers, linear images) and optimal-tiling images live in separate blocks. Neighbours in a block are
+/// then always the same kind, so `bufferImageGranularity` never has to be honored between them.
+enum class ResourceKind {
+    Linear,
+    Optimal,
+};
+
+class BuddyBlock;
+
+/// A range of device memory handed out by `GpuMemoryAllocator`. Bind resources to `memory` at `offset`.
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;          // the size that was requested
+    void* mappedData = nullptr;     // non-null for host-visible memory; already offset
+    uint32_t memoryTypeIndex = 0;
+
+    // Bookkeeping for `GpuMemoryAllocator::free()`. A null block means the allocation owns `memory` outright.
+    BuddyBlock* block = nullptr;
+    uint32_t level = 0;
+};
+
+/// Allocator counters. `bytesReserved` is what was taken from Vulkan, `bytesUsed` what callers asked for.
+struct MemoryStats {
+    uint32_t deviceMemoryCount = 0;     // live vkAllocateMemory calls, limited by maxMemoryAllocationCount
+    uint32_t allocationCount = 0;
+    VkDeviceSize bytesReserved = 0;
+    VkDeviceSize bytesUsed = 0;
+    VkDeviceSize peakBytesReserved = 0;
+
+    // 0 when all free space in block allocations is one contiguous range, approaching 1 as it splinters.
+    double fragmentation = 0.0;
+};
+
+/// One `VkDeviceMemory` managed as a binary buddy allocator. The block's size is a power of two and every node is aligned to its
+/// own size, which satisfies any Vulkan alignment requirement not larger than the node. Freed nodes merge with their buddy,
+/// so long-lived allocations don't fragment the block permanently.
+class BuddyBlock {
+public:
+    static constexpr VkDeviceSize MIN_NODE_SIZE = 256;
+
+    BuddyBlock(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryTypeIndex, void* mappedData)
+        : memory(memory), size(size), memoryTypeIndex(memoryTypeIndex), mappedData(mappedData) {
+        uint32_t levels = 1;
+        while ((size >> (levels - 1)) > MIN_NODE_SIZE) {
+            levels++;
+        }
+        freeLists.resize(levels);
+        freeLists[0].insert(0);
+    }
+
+    /// Returns the offset of a free node of `nodeSize` bytes (a power of two), splitting larger nodes as needed.
+    std::optional<VkDeviceSize> allocate(VkDeviceSize nodeSize, uint32_t& level) {
+        uint32_t targetLevel = levelForSize(nodeSize);
+
+        // Find the smallest free node that is at least as big as requested.
+        int32_t current = static_cast<int32_t>(targetLevel);
+        while (current >= 0 && freeLists[current].empty()) {
+            current--;
+        }
+        if (current < 0) {
+            return std::nullopt;
+        }
+
+        VkDeviceSize offset = *freeLists[current].begin();
+        freeLists[current].erase(freeLists[current].begin());
+
+        // Split it down to the requested size, keeping the upper halves free.
+        while (static_cast<uint32_t>(current) < targetLevel) {
+            current++;
+            freeLists[current].insert(offset + (size >> current));
+        }
+
+        level = targetLevel;
+        usedBytes += nodeSize;
+        return offset;
+    }
+
+    void free(VkDeviceSize offset, uint32_t level) {
+        usedBytes -= size >> level;
+
+        // Merge with the buddy for as long as it is free too.
+        while (level > 0) {
+            VkDeviceSize buddy = offset ^ (size >> level);
+            auto it = freeLists[level].find(buddy);
+            if (it == freeLists[level].end()) {
+                break;
+            }
+            freeLists[level].erase(it);
+            offset = std::min(offset, buddy);
+            level--;
+        }
+        freeLists[level].insert(offset);
+    }
+
+    VkDeviceSize largestFreeNode() const {
+        for (size_t level = 0; level < freeLists.size(); level++) {
+            if (freeLists[level].empty() == false) {
+                return size >> level;
+            }
+        }
+        return 0;
+    }
+
+    bool isEmpty() const { return usedBytes == 0; }
+
+    const VkDeviceMemory memory;
+    const VkDeviceSize size;
+    const uint32_t memoryTypeIndex;
+    void* const mappedData;
+    VkDeviceSize usedBytes = 0;
+
+private:
+    uint32_t levelForSize(VkDeviceSize nodeSize) const {
+        uint32_t level = 0;
+        while ((size >> level) > nodeSize && level + 1 < freeLists.size()) {
+            level++;
+        }
+        return level;
+    }
+
+    // Offsets of the free nodes at each level. Level 0 is the whole block, level n has nodes of `size >> n` bytes.
+    std::vector<std::set<VkDeviceSize>> freeLists;
+};
+
+/// Bump allocator over one persistent block, split into one region per frame in flight. Each region is reset wholesale when its
+/// frame slot comes around again, so per-frame data costs a pointer increment and nothing is ever freed individually.
+class LinearPool {
+public:
+    LinearPool(VkDeviceMemory memory, VkDeviceSize regionSize, uint32_t regionCount, uint32_t memoryTypeIndex, void* mappedData)
+        : memory(memory), regionSize(regionSize), memoryTypeIndex(memoryTypeIndex), mappedData(mappedData),
+          regionOffsets(regionCount, 0) {}
+
+    /// Starts reusing the region of `frameIndex`. Only call this once the GPU is done with that frame.
+    void reset(uint32_t frameIndex) {
+        currentRegion = frameIndex % regionOffsets.size();
+        regionOffsets[currentRegion] = 0;
+    }
+
+    /// Returns std::nullopt when the current region is full.
+    std::optional<Allocation> allocate(VkDeviceSize size, VkDeviceSize alignment) {
+        VkDeviceSize offset = (regionOffsets[currentRegion] + alignment - 1) / alignment * alignment;
+        if (offset + size > regionSize) {
+            return std::nullopt;
+        }
+        regionOffsets[currentRegion] = offset + size;
+
+        Allocation allocation;
+        allocation.memory = memory;
+        allocation.offset = currentRegion * regionSize + offset;
+        allocation.size = size;
+        allocation.memoryTypeIndex = memoryTypeIndex;
+        allocation.mappedData = mappedData == nullptr ? nullptr : static_cast<char*>(mappedData) + allocation.offset;
+        return allocation;
+    }
+
+    VkDeviceSize usedBytes() const { return regionOffsets[currentRegion]; }
+
+    const VkDeviceMemory memory;
+    const VkDeviceSize regionSize;
+    const uint32_t memoryTypeIndex;
+    void* const mappedData;
+
+private:
+    std::vector<VkDeviceSize> regionOffsets;
+    size_t currentRegion = 0;
+};
+
+/// Sub-allocates resources out of large `VkDeviceMemory` blocks instead of calling `vkAllocateMemory` per resource, which is
+/// slow and limited by `maxMemoryAllocationCount` (as low as 4096).
+/// - Long-lived resources go into buddy-allocated blocks, one set per memory type and `ResourceKind`.
+/// - Resources larger than half a block get their own dedicated `VkDeviceMemory`.
+/// - Per-frame data goes into `LinearPool`s created with `createLinearPool()`.
+/// Host-visible memory is mapped once when the block is created and stays mapped. All methods are thread-safe.
+class GpuMemoryAllocator {
+public:
+    static constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+    void init(VkPhysicalDevice physicalDevice, VkDevice device) {
+        this->device = device;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+        nonCoherentAtomSize = properties.limits.nonCoherentAtomSize;
+
+        // Small heaps (e.g. a 256 MiB BAR window) get smaller blocks so one block can't take a large share of the heap.
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size;
+            VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE;
+            while (blockSize > 1024 * 1024 && blockSize > heapSize / 8) {
+                blockSize /= 2;
+            }
+            blockSizes[i] = blockSize;
+        }
+    }
+
+    /// Frees every block and pool. All allocations must have been freed or become unused by then.
+    void destroy() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& typeBlocks : blocks) {
+            for (auto& kindBlocks : typeBlocks) {
+                for (auto& block : kindBlocks) {
+                    vkFreeMemory(device, block->memory, nullptr);
+                }
+                kindBlocks.clear();
+            }
+        }
+        for (auto& pool : linearPools) {
+            vkFreeMemory(device, pool->memory, nullptr);
+        }
+        linearPools.clear();
+    }
+
+    /// Finds a memory type allowed by `typeBits` that has all `required` flags, preferring one that also has `preferred`.
+    std::optional<uint32_t> findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) const {
+        std::optional<uint32_t> fallback;
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+            if ((typeBits & (1u << i)) == 0 || (flags & required) != required) {
+                continue;
+            }
+            if ((flags & preferred) == preferred) {
+                return i;
+            }
+            if (fallback.has_value() == false) {
+                fallback = i;
+            }
+        }
+        return fallback;
+    }
+
+    Allocation allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, ResourceKind kind) {
+        uint32_t memoryTypeIndex = memoryTypeForUsage(requirements.memoryTypeBits, usage);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Big resources would waste most of a block to buddy rounding, so they get their own memory. So does lazily allocated
+        // memory: a block of it would only count bytes as reserved that the device never commits.
+        if (requirements.size > blockSizes[memoryTypeIndex] / 2 || isLazilyAllocated(memoryTypeIndex)) {
+            return allocateDedicated(requirements.size, memoryTypeIndex);
+        }
+
+        VkDeviceSize nodeSize = BuddyBlock::MIN_NODE_SIZE;
+        while (nodeSize < requirements.size || nodeSize < requirements.alignment) {
+            nodeSize *= 2;
+        }
+
+        auto& candidates = blocks[memoryTypeIndex][static_cast<size_t>(kind)];
+        for (auto& block : candidates) {
+            uint32_t level;
+            if (auto offset = block->allocate(nodeSize, level)) {
+                return makeAllocation(*block, *offset, level, requirements.size);
+            }
+        }
+
+        BuddyBlock& block = createBlock(memoryTypeIndex, kind);
+        uint32_t level;
+        auto offset = block.allocate(nodeSize, level);
+        return makeAllocation(block, offset.value(), level, requirements.size);
+    }
+
+    void free(Allocation& allocation) {
+        if (allocation.memory == VK_NULL_HANDLE) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        stats.allocationCount--;
+        stats.bytesUsed -= allocation.size;
+
+        if (allocation.block == nullptr) {
+            vkFreeMemory(device, allocation.memory, nullptr);
+            stats.deviceMemoryCount--;
+            stats.bytesReserved -= allocation.size;
+        }
+        else {
+            allocation.block->free(allocation.offset, allocation.level);
+            releaseEmptyBlocks(allocation.memoryTypeIndex);
+        }
+
+        allocation = {};
+    }
+
+    /// Creates a buffer and binds it to freshly allocated memory.
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage, VkBuffer& buffer, Allocation& allocation,
+                      const std::vector<uint32_t>& sharingQueueFamilies = {}) {
+        VkBufferCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        createInfo.size = size;
+        createInfo.usage = usage;
+
+        // Buffers used by more than one queue family are shared concurrently, so no ownership transfers are needed. The same
+        // family may be passed more than once, e.g. when the device has no dedicated transfer family.
+        std::set<uint32_t> uniqueFamilies(sharingQueueFamilies.begin(), sharingQueueFamilies.end());
+        std::vector<uint32_t> families(uniqueFamilies.begin(), uniqueFamilies.end());
+        if (families.size() > 1) {
+            createInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            createInfo.queueFamilyIndexCount = static_cast<uint32_t>(families.size());
+            createInfo.pQueueFamilyIndices = families.data();
+        }
+        else {
+            createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+
+        VkResult result = vkCreateBuffer(device, &createInfo, nullptr, &buffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Buffer was not created. Error code " + std::to_string(result));
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &requirements);
+        allocation = allocate(requirements, memoryUsage, ResourceKind::Linear);
+        vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+    }
+
+    /// Creates an image and binds it to freshly allocated memory.
+    void createImage(const VkImageCreateInfo& createInfo, MemoryUsage memoryUsage, VkImage& image, Allocation& allocation) {
+        VkResult result = vkCreateImage(device, &createInfo, nullptr, &image);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Image was not created. Error code " + std::to_string(result));
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, image, &requirements);
+        ResourceKind kind = createInfo.tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceKind::Optimal : ResourceKind::Linear;
+        allocation = allocate(requirements, memoryUsage, kind);
+        vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+    }
+
+    void destroyBuffer(VkBuffer buffer, Allocation& allocation) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        free(allocation);
+    }
+
+    void destroyImage(VkImage image, Allocation& allocation) {
+        vkDestroyImage(device, image, nullptr);
+        free(allocation);
+    }
+
+    /// Creates a `LinearPool` with `regionCount` regions of `regionSize` bytes. The pool is owned by the allocator and lives until
+    /// `destroy()`.
+    LinearPool& createLinearPool(VkDeviceSize regionSize, uint32_t regionCount, MemoryUsage usage) {
+        uint32_t memoryTypeIndex = memoryTypeForUsage(~0u, usage);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkDeviceSize size = regionSize * regionCount;
+        void* mappedData = nullptr;
+        VkDeviceMemory memory = allocateDeviceMemory(size, memoryTypeIndex, mappedData);
+
+        linearPools.push_back(std::make_unique<LinearPool>(memory, regionSize, regionCount, memoryTypeIndex, mappedData));
+        return *linearPools.back();
+    }
+
+    /// Makes CPU writes visible to the GPU. Does nothing for host-coherent memory.
+    void flush(const Allocation& allocation) {
+        if (isCoherent(allocation.memoryTypeIndex) == false) {
+            VkMappedMemoryRange range = mappedRange(allocation);
+            vkFlushMappedMemoryRanges(device, 1, &range);
+        }
+    }
+
+    /// Makes GPU writes visible to the CPU. Does nothing for host-coherent memory.
+    void invalidate(const Allocation& allocation) {
+        if (isCoherent(allocation.memoryTypeIndex) == false) {
+            VkMappedMemoryRange range = mappedRange(allocation);
+            vkInvalidateMappedMemoryRanges(device, 1, &range);
+        }
+    }
+
+    MemoryStats getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkDeviceSize freeBytes = 0;
+        VkDeviceSize largestFree = 0;
+        for (auto& typeBlocks : blocks) {
+            for (auto& kindBlocks : typeBlocks) {
+                for (auto& block : kindBlocks) {
+                    freeBytes += block->size - block->usedBytes;
+                    largestFree = std::max(largestFree, block->largestFreeNode());
+                }
+            }
+        }
+
+        MemoryStats result = stats;
+        result.fragmentation = freeBytes == 0 ? 0.0 : 1.0 - static_cast<double>(largestFree) / static_cast<double>(freeBytes);
+        return result;
+    }
+
+    void printStats(std::ostream& out) {
+        MemoryStats current = getStats();
+        out << "GPU memory: " << current.bytesUsed / 1024 << " KiB used of " << current.bytesReserved / 1024
+            << " KiB reserved (peak " << current.peakBytesReserved / 1024 << " KiB), " << current.allocationCount
+            << " allocations in " << current.deviceMemoryCount << " device memory objects, fragmentation "
+            << current.fragmentation << '\n';
+    }
+
+    const VkPhysicalDeviceMemoryProperties& getMemoryProperties() const { return memoryProperties; }
+
+    bool isLazilyAllocated(uint32_t memoryTypeIndex) const {
+        return (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+    }
+
+private:
+    uint32_t memoryTypeForUsage(uint32_t typeBits, MemoryUsage usage) const {
+        std::optional<uint32_t> index;
+        switch (usage) {
+            case MemoryUsage::GpuOnly:
+                index = findMemoryType(typeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+                break;
+            case MemoryUsage::CpuToGpu:
+                index = findMemoryType(typeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0);
+                break;
+            case MemoryUsage::GpuToCpu:
+                index = findMemoryType(typeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                break;
+            case MemoryUsage::GpuLazy:
+                index = findMemoryType(typeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, 0);
+                if (index.has_value() == false) {
+                    index = findMemoryType(typeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+                }
+                break;
+        }
+
+        // Anything allowed by the resource is better than failing, e.g. on devices without a distinct device-local type.
+        if (index.has_value() == false) {
+            index = findMemoryType(typeBits, 0, 0);
+        }
+        if (index.has_value() == false) {
+            throw std::runtime_error("No memory type is suitable for the resource.");
+        }
+        return *index;
+    }
+
+    bool isCoherent(uint32_t memoryTypeIndex) const {
+        return (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    }
+
+    VkMappedMemoryRange mappedRange(const Allocation& allocation) const {
+        // Flushed ranges must be aligned to nonCoherentAtomSize.
+        VkDeviceSize begin = allocation.offset / nonCoherentAtomSize * nonCoherentAtomSize;
+        VkDeviceSize end = (allocation.offset + allocation.size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+
+        VkMappedMemoryRange range{};
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.memory = allocation.memory;
+        range.offset = begin;
+        range.size = allocation.block == nullptr ? VK_WHOLE_SIZE : std::min(end, allocation.block->size) - begin;
+        return range;
+    }
+
+    // Expects `mutex` to be held.
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void*& mappedData) {
+        if (stats.deviceMemoryCount >= maxMemoryAllocationCount) {
+            throw std::runtime_error("maxMemoryAllocationCount reached.");
+        }
+
+        VkMemoryAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocateInfo.allocationSize = size;
+        allocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+        VkDeviceMemory memory;
+        VkResult result = vkAllocateMemory(device, &allocateInfo, nullptr, &memory);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Device memory was not allocated. Error code " + std::to_string(result));
+        }
+
+        mappedData = nullptr;
+        if ((memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+            result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mappedData);
+            if (result != VK_SUCCESS) {
+                vkFreeMemory(device, memory, nullptr);
+                throw std::runtime_error("Device memory was not mapped. Error code " + std::to_string(result));
+            }
+        }
+
+        stats.deviceMemoryCount++;
+        stats.bytesReserved += size;
+        stats.peakBytesReserved = std::max(stats.peakBytesReserved, stats.bytesReserved);
+        return memory;
+    }
+
+    // Expects `mutex` to be held.
+    Allocation allocateDedicated(VkDeviceSize size, uint32_t memoryTypeIndex) {
+        Allocation allocation;
+        allocation.memory = allocateDeviceMemory(size, memoryTypeIndex, allocation.mappedData);
+        allocation.size = size;
+        allocation.memoryTypeIndex = memoryTypeIndex;
+
+        stats.allocationCount++;
+        stats.bytesUsed += size;
+        return allocation;
+    }
+
+    // Expects `mutex` to be held.
+    BuddyBlock& createBlock(uint32_t memoryTypeIndex, ResourceKind kind) {
+        void* mappedData = nullptr;
+        VkDeviceMemory memory = allocateDeviceMemory(blockSizes[memoryTypeIndex], memoryTypeIndex, mappedData);
+
+        auto& kindBlocks = blocks[memoryTypeIndex][static_cast<size_t>(kind)];
+        kindBlocks.push_back(std::make_unique<BuddyBlock>(memory, blockSizes[memoryTypeIndex], memoryTypeIndex, mappedData));
+        return *kindBlocks.back();
+    }
+
+    // Expects `mutex` to be held.
+    Allocation makeAllocation(BuddyBlock& block, VkDeviceSize offset, uint32_t level, VkDeviceSize size) {
+        Allocation allocation;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.memoryTypeIndex = block.memoryTypeIndex;
+        allocation.mappedData = block.mappedData == nullptr ? nullptr : static_cast<char*>(block.mappedData) + offset;
+        allocation.block = &block;
+        allocation.level = level;
+
+        stats.allocationCount++;
+        stats.bytesUsed += size;
+        return allocation;
+    }
+
+    // Keeps one empty block per memory type and kind around, so alternating allocate/free at a block boundary doesn't thrash
+    // vkAllocateMemory. Expects `mutex` to be held.
+    void releaseEmptyBlocks(uint32_t memoryTypeIndex) {
+        for (auto& kindBlocks : blocks[memoryTypeIndex]) {
+            bool keptOne = false;
+            for (auto it = kindBlocks.begin(); it != kindBlocks.end();) {
+                if ((*it)->isEmpty() && keptOne) {
+                    vkFreeMemory(device, (*it)->memory, nullptr);
+                    stats.deviceMemoryCount--;
+                    stats.bytesReserved -= (*it)->size;
+                    it = kindBlocks.erase(it);
+                    continue;
+                }
+                keptOne |= (*it)->isEmpty();
+                ++it;
+            }
+        }
+    }
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    uint32_t maxMemoryAllocationCount = 4096;
+    VkDeviceSize nonCoherentAtomSize = 1;
+    std::array<VkDeviceSize, VK_MAX_MEMORY_TYPES> blockSizes{};
+
+    std::array<std::array<std::vector<std::unique_ptr<BuddyBlock>>, 2>, VK_MAX_MEMORY_TYPES> blocks;
+    std::vector<std::unique_ptr<LinearPool>> linearPools;
+
+    MemoryStats stats;
+    std::mutex mutex;
+};
+
+#endif /* MemoryAllocator_hpp */
@@ -0,0 +1,129 @@
+#ifndef ParallelRecorder_hpp
+#define ParallelRecorder_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "JobSystem.hpp"
+
+/// Records secondary command buffers on every thread of a `JobSystem`, to be stitched into a primary command buffer with
+/// `vkCmdExecuteCommands()`.
+///
+/// Each thread owns one `VkCommandPool` per frame in flight, so recording never takes a lock, and `beginFrame()` resets a
+/// slot's pools wholesale instead of resetting buffers one by one. Buffers are kept and reused once allocated.
+class ParallelRecorder {
+public:
+    using RecordChunk = FunctionRef<void(VkCommandBuffer commandBuffer, uint32_t chunk)>;
+
+    void init(VkDevice device, uint32_t queueFamily, uint32_t frameCount, JobSystem& jobs) {
+        this->device = device;
+        this->jobs = &jobs;
+
+        frames.resize(frameCount);
+        for (auto& threadPools : frames) {
+            threadPools.resize(jobs.getThreadCount());
+            for (auto& threadPool : threadPools) {
+                VkCommandPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                poolInfo.queueFamilyIndex = queueFamily;
+
+                VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &threadPool.commandPool);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Recording thread command pool was not created. Error code " + std::to_string(result));
+                }
+            }
+        }
+    }
+
+    void destroy() {
+        for (auto& threadPools : frames) {
+            for (auto& threadPool : threadPools) {
+                vkDestroyCommandPool(device, threadPool.commandPool, nullptr); // Also frees the command buffers
+            }
+        }
+        frames.clear();
+    }
+
+    /// Resets every thread's pool for slot `frameIndex`. Call after waiting for that slot's previous frame.
+    void beginFrame(uint32_t frameIndex) {
+        currentFrame = frameIndex % frames.size();
+        for (auto& threadPool : frames[currentFrame]) {
+            vkResetCommandPool(device, threadPool.commandPool, 0);
+            threadPool.usedCount = 0;
+        }
+    }
+
+    /// Records `chunkCount` secondary command buffers that continue the render pass, or dynamic rendering instance, described
+    /// by `inheritance`, calling `record` for each chunk in parallel. Returns them in chunk order, ready for a render pass begun
+    /// with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS or VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT.
+    /// The returned vector is reused by the next call.
+    const std::vector<VkCommandBuffer>& recordRenderPass(const VkCommandBufferInheritanceInfo& inheritance, uint32_t chunkCount,
+                                                         RecordChunk record) {
+        recorded.assign(chunkCount, VK_NULL_HANDLE);
+
+        jobs->parallelFor(chunkCount, [&](uint32_t chunk, uint32_t threadIndex) {
+            VkCommandBuffer commandBuffer = acquireBuffer(frames[currentFrame][threadIndex]);
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            beginInfo.pInheritanceInfo = &inheritance;
+
+            VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Secondary command buffer recording did not begin. Error code " + std::to_string(result));
+            }
+
+            record(commandBuffer, chunk);
+
+            result = vkEndCommandBuffer(commandBuffer);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Secondary command buffer was not recorded. Error code " + std::to_string(result));
+            }
+
+            recorded[chunk] = commandBuffer;
+        });
+
+        return recorded;
+    }
+
+private:
+    struct ThreadPool {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> commandBuffers;
+        size_t usedCount = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    JobSystem* jobs = nullptr;
+
+    // frames[frame slot][thread index]
+    std::vector<std::vector<ThreadPool>> frames;
+    uint32_t currentFrame = 0;
+    std::vector<VkCommandBuffer> recorded;
+
+    /// Only ever called from the thread that owns `threadPool`.
+    VkCommandBuffer acquireBuffer(ThreadPool& threadPool) {
+        if (threadPool.usedCount == threadPool.commandBuffers.size()) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = threadPool.commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            VkCommandBuffer commandBuffer;
+            VkResult result = vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Secondary command buffer was not allocated. Error code " + std::to_string(result));
+            }
+            threadPool.commandBuffers.push_back(commandBuffer);
+        }
+        return threadPool.commandBuffers[threadPool.usedCount++];
+    }
+};
+
+#endif /* ParallelRecorder_hpp */
@@ -0,0 +1,477 @@
+#ifndef PipelineManager_hpp
+#define PipelineManager_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// One shader of a pipeline, as SPIR-V.
+struct ShaderStage {
+    VkShaderStageFlagBits stage;
+    std::vector<uint32_t> code;
+    std::string entryPoint = "main";
+};
+
+/// Everything that determines a pipeline. Two descriptions with the same contents always map to the same pipeline.
+///
+/// A description with a single compute stage makes a compute pipeline and ignores the fixed-function state. Viewport and
+/// scissor are always dynamic, so pipelines survive swap chain resizes.
+struct PipelineDesc {
+    std::vector<ShaderStage> stages;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+
+    std::vector<VkVertexInputBindingDescription> vertexBindings;
+    std::vector<VkVertexInputAttributeDescription> vertexAttributes;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPolygonMode polygonMode = VK_POLYGON_MODE_FILL;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    bool depthTest = false;
+    bool depthWrite = false;
+    VkCompareOp depthCompare = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+    // One per color attachment. Missing entries are opaque, writing every component.
+    std::vector<VkPipelineColorBlendAttachmentState> blendAttachments;
+
+    // Render target formats, e.g. `swapChainImageFormat`. With dynamic rendering these are all the pipeline needs to know
+    // about the targets; otherwise `renderPass` must be set to a compatible render pass too.
+    std::vector<VkFormat> colorFormats;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+
+    bool isCompute() const { return stages.size() == 1 && stages[0].stage == VK_SHADER_STAGE_COMPUTE_BIT; }
+
+    /// FNV-1a over every field that ends up in the pipeline create info.
+    uint64_t hash() const {
+        uint64_t value = 14695981039346656037ull;
+        auto mix = [&](const void* data, size_t size) {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++) {
+                value = (value ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        auto mixValue = [&](const auto& field) { mix(&field, sizeof(field)); };
+        auto mixVector = [&](const auto& fields) {
+            mixValue(fields.size());
+            for (const auto& field : fields) {
+                mixValue(field);
+            }
+        };
+
+        mixValue(stages.size());
+        for (const auto& stage : stages) {
+            mixValue(stage.stage);
+            mixValue(stage.code.size());
+            mix(stage.code.data(), stage.code.size() * sizeof(uint32_t));
+            mix(stage.entryPoint.data(), stage.entryPoint.size());
+        }
+        mixValue(layout);
+        if (isCompute()) {
+            return value;
+        }
+
+        mixVector(vertexBindings);
+        mixVector(vertexAttributes);
+        mixValue(topology);
+        mixValue(polygonMode);
+        mixValue(cullMode);
+        mixValue(frontFace);
+        mixValue(depthTest);
+        mixValue(depthWrite);
+        mixValue(depthCompare);
+        mixVector(blendAttachments);
+        mixVector(colorFormats);
+        mixValue(depthFormat);
+        mixValue(renderPass);
+        mixValue(subpass);
+        return value;
+    }
+};
+
+/// Refers to a pipeline of a `PipelineManager`, whether it's compiled yet or not.
+struct PipelineHandle {
+    uint32_t index = std::numeric_limits<uint32_t>::max();
+    bool isValid() const { return index != std::numeric_limits<uint32_t>::max(); }
+};
+
+/// Compiles pipelines on background threads so that the render loop never waits for one.
+///
+/// `request()` returns a handle right away. Requests are deduplicated by `PipelineDesc::hash()`, so asking for the same
+/// state again, e.g. once per material or per frame, is cheap and returns the same handle. Until a pipeline is ready,
+/// `get()` returns its fallback's pipeline, or VK_NULL_HANDLE if there is none, in which case the caller skips the draw.
+///
+/// Compiles go through the persistent `VkPipelineCache`, which the implementation synchronizes internally, so warm runs
+/// mostly just fetch from it.
+///
+/// `replace()` recompiles an existing handle from a new description, e.g. after a shader was reloaded. The old pipeline keeps
+/// being returned until `applyReplacements()` swaps the new one in, so the swap happens at a point the caller chooses.
+class PipelineManager {
+public:
+    struct Stats {
+        uint32_t requested = 0;             // distinct pipelines
+        uint32_t deduplicated = 0;          // requests answered with an existing handle
+        uint32_t compiled = 0;
+        uint32_t replaced = 0;              // swapped in by `applyReplacements()`
+        uint32_t failed = 0;
+        uint32_t pending = 0;
+        double totalCompileMilliseconds = 0.0;
+        double maxCompileMilliseconds = 0.0;
+    };
+
+    void init(VkDevice device, VkPipelineCache pipelineCache, uint32_t threadCount) {
+        this->device = device;
+        this->pipelineCache = pipelineCache;
+
+        stopping = false;
+        for (uint32_t i = 0; i < std::max(threadCount, 1u); i++) {
+            threads.emplace_back([this] { compileLoop(); });
+        }
+    }
+
+    /// Stops the compile threads, dropping queued requests, and destroys every pipeline. The device must be idle.
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+
+        for (auto& entry : entries) {
+            VkPipeline pipeline = entry.pipeline.load();
+            if (pipeline != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device, pipeline, nullptr);
+            }
+            if (entry.replacement != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device, entry.replacement, nullptr);
+            }
+        }
+        entries.clear();
+        handlesByHash.clear();
+    }
+
+    /// Queues `desc` for compilation unless it's already known. `fallback` is used by `get()` until the pipeline is ready.
+    PipelineHandle request(const PipelineDesc& desc, PipelineHandle fallback = {}) {
+        uint64_t hash = desc.hash();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = handlesByHash.find(hash);
+        if (existing != handlesByHash.end()) {
+            stats.deduplicated++;
+            return existing->second;
+        }
+
+        PipelineHandle handle{static_cast<uint32_t>(entries.size())};
+        entries.emplace_back();
+        entries.back().desc = desc;
+        entries.back().fallback = fallback;
+        handlesByHash[hash] = handle;
+
+        queue.push_back(handle.index);
+        stats.requested++;
+        stats.pending++;
+        wake.notify_one();
+        return handle;
+    }
+
+    /// Queues `handle` to be compiled again from `desc`. Until `applyReplacements()` picks the result up, `get()` keeps
+    /// returning the current pipeline. A replacement that fails to compile leaves the current one in place.
+    void replace(PipelineHandle handle, const PipelineDesc& desc) {
+        uint64_t hash = desc.hash();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry& entry = entries[handle.index];
+        auto previous = handlesByHash.find(entry.desc.hash());
+        if (previous != handlesByHash.end() && previous->second.index == handle.index) {
+            handlesByHash.erase(previous);
+        }
+        entry.desc = desc;
+        entry.generation++;
+        handlesByHash[hash] = handle;
+
+        queue.push_back(handle.index);
+        stats.pending++;
+        wake.notify_one();
+    }
+
+    /// Swaps in every replacement that has finished compiling and hands each pipeline it replaces to `retire`. Call it
+    /// where no command buffer recorded with the old pipelines is still waiting to be submitted, so `retire` can defer
+    /// their destruction past the submissions made so far.
+    /// - Returns: how many pipelines were swapped.
+    uint32_t applyReplacements(const std::function<void(VkPipeline)>& retire) {
+        std::vector<VkPipeline> retired;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& entry : entries) {
+                if (entry.replacement != VK_NULL_HANDLE) {
+                    retired.push_back(entry.pipeline.exchange(entry.replacement, std::memory_order_acq_rel));
+                    entry.replacement = VK_NULL_HANDLE;
+                }
+            }
+            stats.replaced += static_cast<uint32_t>(retired.size());
+        }
+        for (auto pipeline : retired) {
+            retire(pipeline);
+        }
+        return static_cast<uint32_t>(retired.size());
+    }
+
+    /// The pipeline if it's ready, otherwise what its fallback chain has to offer, otherwise VK_NULL_HANDLE.
+    /// Safe to call from recording threads.
+    VkPipeline get(PipelineHandle handle) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (handle.isValid()) {
+            const Entry& entry = entries[handle.index];
+            VkPipeline pipeline = entry.pipeline.load(std::memory_order_acquire);
+            if (pipeline != VK_NULL_HANDLE) {
+                return pipeline;
+            }
+            handle = entry.fallback;
+        }
+        return VK_NULL_HANDLE;
+    }
+
+    bool isReady(PipelineHandle handle) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return handle.isValid() && entries[handle.index].pipeline.load(std::memory_order_acquire) != VK_NULL_HANDLE;
+    }
+
+    /// Blocks until every queued pipeline has compiled or failed, e.g. behind a loading screen or before a benchmark.
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return stats.pending == 0; });
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    struct Entry {
+        PipelineDesc desc;
+        PipelineHandle fallback;
+        std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+
+        // Compiled by `replace()` and waiting for `applyReplacements()`.
+        VkPipeline replacement = VK_NULL_HANDLE;
+
+        // Bumped by every `replace()`, so a compile of an older description that finishes late can tell.
+        uint64_t generation = 0;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+    // A deque so entries never move while compile threads fill them in.
+    std::deque<Entry> entries;
+    std::unordered_map<uint64_t, PipelineHandle> handlesByHash;
+    Stats stats;
+
+    std::deque<uint32_t> queue;
+    std::vector<std::thread> threads;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool stopping = false;
+
+    void compileLoop() {
+        while (true) {
+            uint32_t index;
+            PipelineDesc desc;      // a copy, since `replace()` may change the entry's description mid-compile
+            uint64_t generation;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || queue.empty() == false; });
+                if (stopping) {
+                    return;
+                }
+                index = queue.front();
+                queue.pop_front();
+                desc = entries[index].desc;
+                generation = entries[index].generation;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            VkResult result = compile(desc, pipeline);
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Entry& entry = entries[index];
+                bool stale = generation != entry.generation;
+                if (result == VK_SUCCESS && entry.pipeline.load(std::memory_order_relaxed) == VK_NULL_HANDLE) {
+                    // Even an outdated pipeline beats the fallback until the newer compile finishes.
+                    entry.pipeline.store(pipeline, std::memory_order_release);
+                }
+                else if (result == VK_SUCCESS && stale) {
+                    // With several compile threads a newer `replace()` may finish first; it must not be overwritten.
+                    vkDestroyPipeline(device, pipeline, nullptr);
+                }
+                else if (result == VK_SUCCESS) {
+                    // Nothing has seen an unapplied replacement yet, so a newer one can simply take its place.
+                    if (entry.replacement != VK_NULL_HANDLE) {
+                        vkDestroyPipeline(device, entry.replacement, nullptr);
+                    }
+                    entry.replacement = pipeline;
+                }
+                stats.pending--;
+                if (result == VK_SUCCESS) {
+                    stats.compiled++;
+                    stats.totalCompileMilliseconds += milliseconds;
+                    stats.maxCompileMilliseconds = std::max(stats.maxCompileMilliseconds, milliseconds);
+                }
+                else {
+                    // The fallback, or the pipeline being replaced, stays in place until the description changes again.
+                    stats.failed++;
+                    std::cerr << "Pipeline " << index << " was not created. Error code " << result << '\n';
+                }
+            }
+            idle.notify_all();
+        }
+    }
+
+    /// Runs on a compile thread. Shader modules only live for the duration of the compile.
+    VkResult compile(const PipelineDesc& desc, VkPipeline& pipeline) {
+        std::vector<VkShaderModule> modules;
+        std::vector<VkPipelineShaderStageCreateInfo> stageInfos;
+        VkResult result = VK_SUCCESS;
+
+        for (const auto& stage : desc.stages) {
+            VkShaderModuleCreateInfo moduleInfo{};
+            moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+            moduleInfo.codeSize = stage.code.size() * sizeof(uint32_t);
+            moduleInfo.pCode = stage.code.data();
+
+            VkShaderModule module;
+            result = vkCreateShaderModule(device, &moduleInfo, nullptr, &module);
+            if (result != VK_SUCCESS) {
+                break;
+            }
+            modules.push_back(module);
+
+            VkPipelineShaderStageCreateInfo stageInfo{};
+            stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stageInfo.stage = stage.stage;
+            stageInfo.module = module;
+            stageInfo.pName = stage.entryPoint.c_str();
+            stageInfos.push_back(stageInfo);
+        }
+
+        if (result == VK_SUCCESS) {
+            result = desc.isCompute() ? compileCompute(desc, stageInfos[0], pipeline) : compileGraphics(desc, stageInfos, pipeline);
+        }
+
+        for (auto module : modules) {
+            vkDestroyShaderModule(device, module, nullptr);
+        }
+        return result;
+    }
+
+    VkResult compileCompute(const PipelineDesc& desc, const VkPipelineShaderStageCreateInfo& stage, VkPipeline& pipeline) {
+        VkComputePipelineCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        createInfo.stage = stage;
+        createInfo.layout = desc.layout;
+        return vkCreateComputePipelines(device, pipelineCache, 1, &createInfo, nullptr, &pipeline);
+    }
+
+    VkResult compileGraphics(const PipelineDesc& desc, const std::vector<VkPipelineShaderStageCreateInfo>& stages,
+                             VkPipeline& pipeline) {
+        VkPipelineVertexInputStateCreateInfo vertexInput{};
+        vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInput.vertexBindingDescriptionCount = static_cast<uint32_t>(desc.vertexBindings.size());
+        vertexInput.pVertexBindingDescriptions = desc.vertexBindings.data();
+        vertexInput.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertexAttributes.size());
+        vertexInput.pVertexAttributeDescriptions = desc.vertexAttributes.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = desc.topology;
+
+        VkPipelineViewportStateCreateInfo viewport{};
+        viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewport.viewportCount = 1;
+        viewport.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterization{};
+        rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterization.polygonMode = desc.polygonMode;
+        rasterization.cullMode = desc.cullMode;
+        rasterization.frontFace = desc.frontFace;
+        rasterization.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo multisample{};
+        multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = desc.depthTest ? VK_TRUE : VK_FALSE;
+        depthStencil.depthWriteEnable = desc.depthWrite ? VK_TRUE : VK_FALSE;
+        depthStencil.depthCompareOp = desc.depthCompare;
+
+        std::vector<VkPipelineColorBlendAttachmentState> blendAttachments = desc.blendAttachments;
+        VkPipelineColorBlendAttachmentState opaque{};
+        opaque.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        blendAttachments.resize(desc.colorFormats.size(), opaque);
+
+        VkPipelineColorBlendStateCreateInfo colorBlend{};
+        colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlend.attachmentCount = static_cast<uint32_t>(blendAttachments.size());
+        colorBlend.pAttachments = blendAttachments.data();
+
+        VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = 2;
+        dynamicState.pDynamicStates = dynamicStates;
+
+        // Ignored by drivers when a render pass is given.
+        VkPipelineRenderingCreateInfo rendering{};
+        rendering.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+        rendering.colorAttachmentCount = static_cast<uint32_t>(desc.colorFormats.size());
+        rendering.pColorAttachmentFormats = desc.colorFormats.data();
+        rendering.depthAttachmentFormat = desc.depthFormat;
+
+        VkGraphicsPipelineCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        createInfo.pNext = desc.renderPass == VK_NULL_HANDLE ? &rendering : nullptr;
+        createInfo.stageCount = static_cast<uint32_t>(stages.size());
+        createInfo.pStages = stages.data();
+        createInfo.pVertexInputState = &vertexInput;
+        createInfo.pInputAssemblyState = &inputAssembly;
+        createInfo.pViewportState = &viewport;
+        createInfo.pRasterizationState = &rasterization;
+        createInfo.pMultisampleState = &multisample;
+        createInfo.pDepthStencilState = &depthStencil;
+        createInfo.pColorBlendState = &colorBlend;
+        createInfo.pDynamicState = &dynamicState;
+        createInfo.layout = desc.layout;
+        createInfo.renderPass = desc.renderPass;
+        createInfo.subpass = desc.subpass;
+        return vkCreateGraphicsPipelines(device, pipelineCache, 1, &createInfo, nullptr, &pipeline);
+    }
+};
+
+#endif /* PipelineManager_hpp */
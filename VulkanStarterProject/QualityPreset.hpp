@@ -0,0 +1,177 @@
+#ifndef QualityPreset_hpp
+#define QualityPreset_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/// Coarse classes of machines. Each one maps to a `QualitySettings` preset through `qualityPreset()`.
+enum class QualityTier {
+    Low,
+    Medium,
+    High,
+};
+
+inline const char* qualityTierName(QualityTier tier) {
+    switch (tier) {
+        case QualityTier::Low: return "low";
+        case QualityTier::Medium: return "medium";
+        case QualityTier::High: return "high";
+    }
+    return "unknown";
+}
+
+/// Defaults that depend on how capable the machine is. Settings given on the command line take precedence.
+struct QualitySettings {
+    float resolutionScale = 1.0f;                       // of the window's size, for the scene's render targets
+    VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
+    uint32_t framesInFlight = 2;
+    VkDeviceSize stagingBytesPerFrame = 8 * 1024 * 1024;
+    uint32_t recordingThreads = 0;
+    uint32_t pipelineCompileThreads = 1;
+    uint32_t streamingThreads = 1;
+};
+
+/// What the capability probe read from the device and the host. Everything the presets are chosen from is in here, so
+/// the report explains the choice.
+struct HardwareReport {
+    std::string deviceName;
+    VkPhysicalDeviceType deviceType = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+    uint32_t vendorID = 0;
+    uint32_t apiVersion = 0;
+    uint32_t driverVersion = 0;
+
+    VkDeviceSize deviceLocalBytes = 0;                  // largest device-local heap
+    VkDeviceSize hostVisibleBytes = 0;                  // largest heap with a host-visible memory type
+    bool unifiedMemory = false;                         // some device-local memory is also host-visible
+
+    uint32_t maxImageDimension2D = 0;
+    VkSampleCountFlags colorSampleCounts = 0;           // usable for both color and depth framebuffer attachments
+    uint32_t maxComputeWorkGroupInvocations = 0;
+    float timestampPeriod = 0.0f;
+    uint32_t dedicatedQueueFamilies = 0;                // compute-only and transfer-only
+
+    uint32_t cpuThreads = 0;
+
+    QualityTier tier = QualityTier::Low;
+
+    /// Writes the report as one JSON object.
+    void writeJson(std::ostream& out) const {
+        out << "{\"device\": \"" << deviceName << "\", \"type\": " << deviceType << ", \"vendorID\": " << vendorID
+            << ", \"api\": \"" << VK_API_VERSION_MAJOR(apiVersion) << '.' << VK_API_VERSION_MINOR(apiVersion) << '.'
+            << VK_API_VERSION_PATCH(apiVersion) << "\", \"driverVersion\": " << driverVersion
+            << ", \"deviceLocalMiB\": " << deviceLocalBytes / (1024 * 1024)
+            << ", \"hostVisibleMiB\": " << hostVisibleBytes / (1024 * 1024)
+            << ", \"unifiedMemory\": " << (unifiedMemory ? "true" : "false")
+            << ", \"maxImageDimension2D\": " << maxImageDimension2D << ", \"sampleCounts\": " << colorSampleCounts
+            << ", \"maxComputeWorkGroupInvocations\": " << maxComputeWorkGroupInvocations
+            << ", \"timestampPeriodNs\": " << timestampPeriod << ", \"dedicatedQueueFamilies\": " << dedicatedQueueFamilies
+            << ", \"cpuThreads\": " << cpuThreads << ", \"tier\": \"" << qualityTierName(tier) << "\"}";
+    }
+};
+
+/// Reads the limits and heaps the presets depend on and classifies the machine:
+/// - high: a discrete GPU with at least 6 GiB of device-local memory and 8 CPU threads
+/// - medium: any other discrete GPU, or an integrated one with at least 4 CPU threads
+/// - low: everything else, including software and virtual devices
+inline HardwareReport probeHardware(const VkPhysicalDeviceProperties& properties,
+                                    const VkPhysicalDeviceMemoryProperties& memoryProperties, uint32_t apiVersion,
+                                    uint32_t dedicatedQueueFamilies, uint32_t cpuThreads) {
+    HardwareReport report;
+    report.deviceName = properties.deviceName;
+    report.deviceType = properties.deviceType;
+    report.vendorID = properties.vendorID;
+    report.apiVersion = apiVersion;
+    report.driverVersion = properties.driverVersion;
+
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        const VkMemoryHeap& heap = memoryProperties.memoryHeaps[i];
+        if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0) {
+            report.deviceLocalBytes = std::max(report.deviceLocalBytes, heap.size);
+        }
+    }
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        const VkMemoryType& type = memoryProperties.memoryTypes[i];
+        if ((type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0) {
+            continue;
+        }
+        report.hostVisibleBytes = std::max(report.hostVisibleBytes, memoryProperties.memoryHeaps[type.heapIndex].size);
+        if ((type.propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0) {
+            report.unifiedMemory = true;
+        }
+    }
+
+    const VkPhysicalDeviceLimits& limits = properties.limits;
+    report.maxImageDimension2D = limits.maxImageDimension2D;
+    report.colorSampleCounts = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+    report.maxComputeWorkGroupInvocations = limits.maxComputeWorkGroupInvocations;
+    report.timestampPeriod = limits.timestampPeriod;
+    report.dedicatedQueueFamilies = dedicatedQueueFamilies;
+    report.cpuThreads = std::max(cpuThreads, 1u);
+
+    const VkDeviceSize gibibyte = 1024ull * 1024 * 1024;
+    if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+        report.tier = report.deviceLocalBytes >= 6 * gibibyte && report.cpuThreads >= 8 ? QualityTier::High : QualityTier::Medium;
+    }
+    else if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU && report.cpuThreads >= 4) {
+        report.tier = QualityTier::Medium;
+    }
+    else {
+        report.tier = QualityTier::Low;
+    }
+    return report;
+}
+
+/// The preset for `tier`, fitted to what `report` says the machine has: MSAA is capped at what the device supports, the
+/// staging ring at a sixteenth of host-visible memory, and threads at the CPU's. One CPU thread is always left to the
+/// main thread.
+inline QualitySettings qualityPreset(QualityTier tier, const HardwareReport& report) {
+    QualitySettings settings;
+    uint32_t workerThreads = report.cpuThreads > 1 ? report.cpuThreads - 1 : 0;
+    VkSampleCountFlagBits msaa = VK_SAMPLE_COUNT_1_BIT;
+
+    switch (tier) {
+        case QualityTier::Low:
+            settings.resolutionScale = 0.75f;
+            settings.framesInFlight = 2;
+            settings.stagingBytesPerFrame = 4 * 1024 * 1024;
+            settings.recordingThreads = std::min(workerThreads, 2u);
+            settings.pipelineCompileThreads = 1;
+            settings.streamingThreads = 1;
+            break;
+        case QualityTier::Medium:
+            settings.resolutionScale = 1.0f;
+            msaa = VK_SAMPLE_COUNT_2_BIT;
+            settings.framesInFlight = 2;
+            settings.stagingBytesPerFrame = 8 * 1024 * 1024;
+            settings.recordingThreads = std::min(workerThreads, 4u);
+            settings.pipelineCompileThreads = 2;
+            settings.streamingThreads = 2;
+            break;
+        case QualityTier::High:
+            // A third frame in flight keeps a fast GPU fed when a frame's CPU time spikes.
+            settings.resolutionScale = 1.0f;
+            msaa = VK_SAMPLE_COUNT_4_BIT;
+            settings.framesInFlight = 3;
+            settings.stagingBytesPerFrame = 32 * 1024 * 1024;
+            settings.recordingThreads = workerThreads;
+            settings.pipelineCompileThreads = std::clamp(report.cpuThreads / 4, 2u, 4u);
+            settings.streamingThreads = 2;
+            break;
+    }
+
+    while (msaa > VK_SAMPLE_COUNT_1_BIT && (report.colorSampleCounts & msaa) == 0) {
+        msaa = static_cast<VkSampleCountFlagBits>(msaa >> 1);
+    }
+    settings.msaaSamples = msaa;
+
+    if (report.hostVisibleBytes > 0) {
+        settings.stagingBytesPerFrame = std::min(settings.stagingBytesPerFrame, report.hostVisibleBytes / 16);
+    }
+    return settings;
+}
+
+#endif /* QualityPreset_hpp */
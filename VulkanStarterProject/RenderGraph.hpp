@@ -0,0 +1,1362 @@
+#ifndef RenderGraph_hpp
+#define RenderGraph_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "FrameArena.hpp"
+#include "MemoryAllocator.hpp"
+#include "FrameProfiler.hpp"
+
+/// How a pass uses a resource. `RenderGraph` derives pipeline stages, access flags, image layouts and image usage flags from it.
+enum class ResourceUsage {
+    ColorAttachment,
+    DepthStencilAttachment,
+    SampledImage,           // sampled in fragment or compute shaders
+    StorageImageRead,       // compute or fragment shaders
+    StorageImageWrite,
+    TransferSource,
+    TransferDestination,
+    StorageBufferRead,      // vertex, fragment or compute shaders
+    StorageBufferWrite,     // fragment or compute shaders
+    UniformBuffer,
+    VertexBuffer,
+    IndexBuffer,
+    IndirectBuffer,
+};
+
+/// Where a resource is in its history: the stages and accesses that last touched it and, for images, its layout.
+struct ResourceState {
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags access = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+/// A frame graph. Each frame, passes are declared along with the images and buffers they read and write, then `compile()`:
+/// - culls passes whose results nothing depends on,
+/// - computes the barriers and layout transitions between passes, batched into one `vkCmdPipelineBarrier` per pass,
+/// - places transient images in memory, aliasing the memory of images whose lifetimes don't overlap,
+/// and `execute()` records everything, beginning a render pass for every pass that has attachments.
+///
+/// Imported resources (e.g. swap chain images) are owned by the caller; they enter the frame in an initial state and are left
+/// in a final state. Transient images are owned by the graph, never keep their contents from one frame to the next, and are
+/// reused across frames as long as the set of transient images doesn't change.
+///
+/// Render passes and framebuffers are cached. A framebuffer is destroyed once it's been unused for a while, or after
+/// `releaseImageView()` is called for one of its views, in both cases only once the frames that used it have completed.
+///
+/// Given the entry points of dynamic rendering and synchronization2, passes are recorded with `vkCmdBeginRendering` instead
+/// of render pass and framebuffer objects, and every barrier carries its own stage masks instead of sharing the union of
+/// all of them. Without them the graph sticks to Vulkan 1.0.
+class RenderGraph {
+public:
+    /// Optional device entry points, from Vulkan 1.3 or the KHR extensions. Null ones fall back to their 1.0 equivalent.
+    struct DeviceFunctions {
+        PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+        PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+        PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2 = nullptr;
+    };
+
+    /// Color attachments plus a depth attachment a pass may have. Bounds the render pass and framebuffer cache keys, so looking
+    /// them up needs no heap memory.
+    static constexpr uint32_t MAX_ATTACHMENTS = 9;
+
+    struct ResourceHandle {
+        uint32_t index = std::numeric_limits<uint32_t>::max();
+        bool isValid() const { return index != std::numeric_limits<uint32_t>::max(); }
+    };
+
+    /// Passed to a pass's execute callback.
+    struct PassContext {
+        VkCommandBuffer commandBuffer;
+        VkRenderPass renderPass;    // VK_NULL_HANDLE for passes without attachments, or with dynamic rendering
+        VkFramebuffer framebuffer;
+        VkExtent2D extent;          // of the attachments
+        const RenderGraph* graph;
+        
+        // What secondary command buffers executed by the pass must inherit. Null for passes without attachments.
+        const VkCommandBufferInheritanceInfo* inheritance;
+
+        VkImage image(ResourceHandle handle) const { return graph->resources[handle.index].image; }
+        VkImageView imageView(ResourceHandle handle) const { return graph->resources[handle.index].view; }
+        VkBuffer buffer(ResourceHandle handle) const { return graph->resources[handle.index].buffer; }
+    };
+
+    using ExecuteCallback = FrameFunction<void(const PassContext& context)>;
+
+    /// Declares what a pass accesses. Returned by `addPass()`; valid until the next `addPass()`.
+    class PassBuilder {
+    public:
+        /// `usage` must only read, e.g. `SampledImage` or `IndirectBuffer`.
+        PassBuilder& read(ResourceHandle resource, ResourceUsage usage) {
+            graph.checkDirection(passIndex, usage, false);
+            graph.addAccess(passIndex, resource, usage, false);
+            return *this;
+        }
+
+        /// `usage` must write, e.g. `StorageBufferWrite` or `TransferDestination`.
+        PassBuilder& write(ResourceHandle resource, ResourceUsage usage) {
+            graph.checkDirection(passIndex, usage, true);
+            graph.addAccess(passIndex, resource, usage, false);
+            return *this;
+        }
+
+        /// `VK_ATTACHMENT_LOAD_OP_LOAD` makes the pass depend on the previous contents; the other load ops discard them.
+        PassBuilder& colorAttachment(ResourceHandle resource, VkAttachmentLoadOp loadOp, VkClearValue clearValue = {},
+                                     VkAttachmentStoreOp storeOp = VK_ATTACHMENT_STORE_OP_STORE) {
+            return attachment(resource, ResourceUsage::ColorAttachment, loadOp, clearValue, storeOp);
+        }
+
+        PassBuilder& depthStencilAttachment(ResourceHandle resource, VkAttachmentLoadOp loadOp, VkClearValue clearValue = {},
+                                            VkAttachmentStoreOp storeOp = VK_ATTACHMENT_STORE_OP_STORE) {
+            return attachment(resource, ResourceUsage::DepthStencilAttachment, loadOp, clearValue, storeOp);
+        }
+
+        /// The render pass is begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS; the pass may only execute secondaries.
+        PassBuilder& secondaryCommandBuffers() {
+            graph.passes[passIndex].secondaryContents = true;
+            return *this;
+        }
+
+        /// The pass is never culled, e.g. because it writes something only the CPU reads.
+        PassBuilder& sideEffects() {
+            graph.passes[passIndex].sideEffects = true;
+            return *this;
+        }
+
+        /// The callback is copied into the graph's frame arena, so it may only capture plain values such as handles and pointers.
+        template <typename Callback>
+        PassBuilder& execute(Callback&& callback) {
+            graph.passes[passIndex].execute = ExecuteCallback(*graph.frameArena, std::forward<Callback>(callback));
+            return *this;
+        }
+
+    private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph& graph, uint32_t passIndex) : graph(graph), passIndex(passIndex) {}
+
+        PassBuilder& attachment(ResourceHandle resource, ResourceUsage usage, VkAttachmentLoadOp loadOp, VkClearValue clearValue,
+                                VkAttachmentStoreOp storeOp) {
+            Pass& pass = graph.passes[passIndex];
+            if (pass.attachments.size() == MAX_ATTACHMENTS) {
+                throw std::runtime_error("Pass " + pass.name + " has more than " + std::to_string(MAX_ATTACHMENTS) + " attachments.");
+            }
+            graph.addAccess(passIndex, resource, usage, loadOp != VK_ATTACHMENT_LOAD_OP_LOAD);
+            pass.attachments.push_back({resource, loadOp, storeOp, clearValue});
+            return *this;
+        }
+
+        RenderGraph& graph;
+        uint32_t passIndex;
+    };
+
+    /// - Parameter frameArena: holds the barriers and attachment arrays of the frame being compiled and executed. Reset it
+    ///   no earlier than the next frame.
+    void init(VkDevice device, GpuMemoryAllocator& allocator, uint32_t framesInFlight, const DeviceFunctions& functions,
+              FrameArena& frameArena) {
+        this->device = device;
+        this->allocator = &allocator;
+        this->framesInFlight = framesInFlight;
+        this->functions = functions;
+        this->frameArena = &frameArena;
+    }
+    
+    bool usesDynamicRendering() const { return functions.cmdBeginRendering != nullptr; }
+
+    /// Times every pass as a GPU scope named after it.
+    void setProfiler(FrameProfiler* profiler) {
+        this->profiler = profiler;
+    }
+
+    /// Logs every rebuild of the transient images. They're rebuilt whenever their sizes change, e.g. with the render scale.
+    void setVerbose(bool verbose) {
+        this->verbose = verbose;
+    }
+
+    /// Destroys everything the graph owns. The device must be idle.
+    void destroy() {
+        for (auto& entry : framebuffers) {
+            vkDestroyFramebuffer(device, entry.second.framebuffer, nullptr);
+        }
+        framebuffers.clear();
+        for (auto& retired : retiredFramebuffers) {
+            vkDestroyFramebuffer(device, retired.framebuffer, nullptr);
+        }
+        retiredFramebuffers.clear();
+
+        for (auto& entry : renderPasses) {
+            vkDestroyRenderPass(device, entry.second, nullptr);
+        }
+        renderPasses.clear();
+
+        destroyTransientSet(transients);
+        for (auto& retired : retiredTransients) {
+            destroyTransientSet(retired);
+        }
+        retiredTransients.clear();
+    }
+
+    /// Clears last frame's declarations and destroys cached objects that are no longer used. `frameNumber` is the number of
+    /// the frame about to be recorded; call after waiting for its frame slot's previous frame.
+    void beginFrame(uint64_t frameNumber) {
+        this->frameNumber = frameNumber;
+        compiled = false;
+
+        // Names and access lists keep their memory for the next frame's declarations.
+        for (auto& pass : passes) {
+            spareNames.push_back(std::move(pass.name));
+            spareAccesses.push_back(std::move(pass.accesses));
+            spareAttachments.push_back(std::move(pass.attachments));
+        }
+        for (auto& node : resources) {
+            spareNames.push_back(std::move(node.name));
+        }
+        passes.clear();
+        resources.clear();
+
+        for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+            if (it->second.lastUsedFrame + FRAMEBUFFER_IDLE_FRAMES <= frameNumber) {
+                retiredFramebuffers.push_back(it->second);
+                it = framebuffers.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        retiredFramebuffers.erase(std::remove_if(retiredFramebuffers.begin(), retiredFramebuffers.end(), [&](const CachedFramebuffer& retired) {
+            if (isFrameComplete(retired.lastUsedFrame) == false) {
+                return false;
+            }
+            vkDestroyFramebuffer(device, retired.framebuffer, nullptr);
+            return true;
+        }), retiredFramebuffers.end());
+
+        retiredTransients.erase(std::remove_if(retiredTransients.begin(), retiredTransients.end(), [&](TransientSet& retired) {
+            if (isFrameComplete(retired.lastUsedFrame) == false) {
+                return false;
+            }
+            destroyTransientSet(retired);
+            return true;
+        }), retiredTransients.end());
+    }
+
+    /// Stops using framebuffers created with `view`, e.g. because the swap chain that owns it was replaced. They're destroyed
+    /// once the frames that used them have completed, and a new view that happens to get the same handle gets new framebuffers.
+    void releaseImageView(VkImageView view) {
+        for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+            const FramebufferKey& key = it->first;
+            auto views = key.views.begin() + key.viewCount;
+            if (std::find(key.views.begin(), views, view) != views) {
+                retiredFramebuffers.push_back(it->second);
+                it = framebuffers.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+    /// Adds an image owned by the caller. It's in `initialState` when the frame starts and is left in `finalState`.
+    /// Passes that write it are never culled.
+    ResourceHandle importImage(std::string_view name, VkImage image, VkImageView view, VkFormat format, VkExtent2D extent,
+                               ResourceState initialState, ResourceState finalState) {
+        ResourceNode node;
+        node.isImage = true;
+        node.imported = true;
+        node.image = image;
+        node.view = view;
+        node.format = format;
+        node.extent = extent;
+        node.aspect = aspectForFormat(format);
+        node.initialState = initialState;
+        node.finalState = finalState;
+        return addResource(std::move(node), name);
+    }
+
+    /// Adds a buffer range owned by the caller. Writes to it would be lost otherwise, so passes that write it are never culled.
+    ResourceHandle importBuffer(std::string_view name, VkBuffer buffer, ResourceState initialState) {
+        ResourceNode node;
+        node.isImage = false;
+        node.imported = true;
+        node.buffer = buffer;
+        node.initialState = initialState;
+        node.finalState = initialState;
+        return addResource(std::move(node), name);
+    }
+
+    /// Adds an image the graph allocates. Its usage flags are collected from the passes that access it.
+    ///
+    /// An image that's only ever used as an attachment, e.g. a depth buffer, is created with
+    /// VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT in lazily allocated memory where the device has it: tile-based GPUs then keep
+    /// it in tile memory and never write it out. The last pass using any graph-owned image as an attachment stores it with
+    /// VK_ATTACHMENT_STORE_OP_DONT_CARE, as nothing reads it afterwards.
+    ResourceHandle createImage(std::string_view name, VkFormat format, VkExtent2D extent) {
+        ResourceNode node;
+        node.isImage = true;
+        node.imported = false;
+        node.format = format;
+        node.extent = extent;
+        node.aspect = aspectForFormat(format);
+        return addResource(std::move(node), name);
+    }
+
+    PassBuilder addPass(std::string_view name) {
+        Pass pass;
+        pass.name = takeSpareName(name);
+        if (spareAccesses.empty() == false) {
+            pass.accesses = std::move(spareAccesses.back());
+            pass.accesses.clear();
+            spareAccesses.pop_back();
+        }
+        if (spareAttachments.empty() == false) {
+            pass.attachments = std::move(spareAttachments.back());
+            pass.attachments.clear();
+            spareAttachments.pop_back();
+        }
+        passes.push_back(std::move(pass));
+        return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+    }
+
+    /// Culls passes, allocates transient images and plans barriers. Call once all passes of the frame have been added.
+    void compile() {
+        cullPasses();
+        computeLifetimes();
+        discardDeadAttachments();
+        allocateTransients();
+        planBarriers();
+        compiled = true;
+    }
+
+    /// Records every pass that survived culling, followed by the transitions into the imported resources' final states.
+    /// Must be outside of a render pass.
+    void execute(VkCommandBuffer commandBuffer) {
+        if (compiled == false) {
+            throw std::runtime_error("RenderGraph::execute() called before compile().");
+        }
+
+        for (auto& pass : passes) {
+            if (pass.culled) {
+                continue;
+            }
+
+            pass.barriers.record(commandBuffer, functions, *frameArena);
+
+            if (profiler != nullptr) {
+                profiler->beginGpuScope(commandBuffer, pass.name.c_str());
+            }
+
+            PassContext context{commandBuffer, VK_NULL_HANDLE, VK_NULL_HANDLE, {0, 0}, this, nullptr};
+            if (pass.attachments.empty() == false) {
+                beginRenderPass(pass, context);
+            }
+            if (pass.execute) {
+                pass.execute(context);
+            }
+            if (pass.attachments.empty() == false) {
+                if (usesDynamicRendering()) {
+                    functions.cmdEndRendering(commandBuffer);
+                }
+                else {
+                    vkCmdEndRenderPass(commandBuffer);
+                }
+            }
+
+            if (profiler != nullptr) {
+                profiler->endGpuScope(commandBuffer);
+            }
+        }
+
+        finalBarriers.record(commandBuffer, functions, *frameArena);
+
+        if (transients.images.empty() == false) {
+            transients.lastUsedFrame = frameNumber;
+        }
+    }
+
+    /// Passes, culled passes and barrier commands of the last compiled frame.
+    struct Stats {
+        uint32_t passCount = 0;
+        uint32_t culledPassCount = 0;
+        uint32_t barrierCount = 0;          // vkCmdPipelineBarrier calls
+        uint32_t imageBarrierCount = 0;
+        VkDeviceSize transientBytes = 0;    // memory actually allocated for transient images
+        VkDeviceSize unaliasedBytes = 0;    // what it would be without aliasing
+        VkDeviceSize lazyBytes = 0;         // of transientBytes, in lazily allocated memory
+        uint32_t transientAttachmentCount = 0;  // transient images with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT
+        uint32_t transientRebuildCount = 0;     // transient sets built since `init()`
+    };
+
+    Stats getStats() const {
+        Stats stats;
+        stats.passCount = static_cast<uint32_t>(passes.size());
+        for (const auto& pass : passes) {
+            stats.culledPassCount += pass.culled ? 1 : 0;
+            stats.barrierCount += pass.barriers.isEmpty() ? 0 : 1;
+            stats.imageBarrierCount += static_cast<uint32_t>(pass.barriers.images.size());
+        }
+        stats.barrierCount += finalBarriers.isEmpty() ? 0 : 1;
+        stats.imageBarrierCount += static_cast<uint32_t>(finalBarriers.images.size());
+        stats.transientBytes = transients.allocatedBytes;
+        stats.unaliasedBytes = transients.unaliasedBytes;
+        stats.lazyBytes = transients.lazyBytes;
+        stats.transientAttachmentCount = transients.attachmentOnlyCount;
+        stats.transientRebuildCount = transientRebuildCount;
+        return stats;
+    }
+
+    /// A render pass compatible with those the graph creates for passes with these attachments, for building pipelines when
+    /// dynamic rendering isn't used. Owned by the graph.
+    VkRenderPass getCompatibleRenderPass(const std::vector<VkFormat>& colorFormats, VkFormat depthFormat = VK_FORMAT_UNDEFINED) {
+        if (colorFormats.size() + (depthFormat != VK_FORMAT_UNDEFINED ? 1 : 0) > MAX_ATTACHMENTS) {
+            throw std::runtime_error("A compatible render pass can't have more than " + std::to_string(MAX_ATTACHMENTS) +
+                                     " attachments.");
+        }
+
+        // Compatibility only depends on formats and sample counts, not on load and store operations.
+        RenderPassKey key;
+        for (VkFormat format : colorFormats) {
+            key.add(format, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        }
+        if (depthFormat != VK_FORMAT_UNDEFINED) {
+            key.add(depthFormat, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE,
+                             VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        }
+        return getRenderPass(key, "a compatible pass");
+    }
+
+private:
+    // Long enough that framebuffers of every swap chain image survive while the swap chain does.
+    static constexpr uint64_t FRAMEBUFFER_IDLE_FRAMES = 120;
+
+    static constexpr VkAccessFlags WRITE_ACCESS =
+        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    /// Stages, accesses and layout of a `ResourceUsage`.
+    struct UsageInfo {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        VkImageUsageFlags imageUsage;
+    };
+
+    static UsageInfo usageInfo(ResourceUsage usage) {
+        const VkPipelineStageFlags shaderStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        const VkPipelineStageFlags imageShaderStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+        switch (usage) {
+            case ResourceUsage::ColorAttachment:
+                return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT};
+            case ResourceUsage::DepthStencilAttachment:
+                return {VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT};
+            case ResourceUsage::SampledImage:
+                return {imageShaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                        VK_IMAGE_USAGE_SAMPLED_BIT};
+            case ResourceUsage::StorageImageRead:
+                return {imageShaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT};
+            case ResourceUsage::StorageImageWrite:
+                return {imageShaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                        VK_IMAGE_USAGE_STORAGE_BIT};
+            case ResourceUsage::TransferSource:
+                return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT};
+            case ResourceUsage::TransferDestination:
+                return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        VK_IMAGE_USAGE_TRANSFER_DST_BIT};
+            case ResourceUsage::StorageBufferRead:
+                return {shaderStages, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+            case ResourceUsage::StorageBufferWrite:
+                return {imageShaderStages, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+            case ResourceUsage::UniformBuffer:
+                return {shaderStages, VK_ACCESS_UNIFORM_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+            case ResourceUsage::VertexBuffer:
+                return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+            case ResourceUsage::IndexBuffer:
+                return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+            case ResourceUsage::IndirectBuffer:
+                return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, 0};
+        }
+        throw std::runtime_error("Unknown resource usage.");
+    }
+
+    static VkImageAspectFlags aspectForFormat(VkFormat format) {
+        switch (format) {
+            case VK_FORMAT_D16_UNORM:
+            case VK_FORMAT_X8_D24_UNORM_PACK32:
+            case VK_FORMAT_D32_SFLOAT:
+                return VK_IMAGE_ASPECT_DEPTH_BIT;
+            case VK_FORMAT_D16_UNORM_S8_UINT:
+            case VK_FORMAT_D24_UNORM_S8_UINT:
+            case VK_FORMAT_D32_SFLOAT_S8_UINT:
+                return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+            case VK_FORMAT_S8_UINT:
+                return VK_IMAGE_ASPECT_STENCIL_BIT;
+            default:
+                return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+    }
+
+    /// Everything recorded by one `vkCmdPipelineBarrier`. Buffer hazards and execution-only dependencies are folded into a
+    /// single global memory barrier, which is as precise as buffer barriers on current drivers and cheaper to record.
+    ///
+    /// Barriers are kept in their synchronization2 form, where each one has its own stage masks. The 1.0 path can only
+    /// express one pair of stage masks per command, so it records the union of them.
+    ///
+    /// Image barriers are kept in the graph's frame arena, so a batch lasts until the arena's next reset.
+    struct BarrierBatch {
+        VkMemoryBarrier2 memory{VK_STRUCTURE_TYPE_MEMORY_BARRIER_2, nullptr, 0, 0, 0, 0};
+        FrameVector<VkImageMemoryBarrier2> images;
+
+        BarrierBatch() = default;
+        explicit BarrierBatch(FrameArena& arena) : images(arena) {}
+
+        bool hasMemoryBarrier() const { return memory.srcStageMask != 0 || memory.dstStageMask != 0; }
+        bool isEmpty() const { return hasMemoryBarrier() == false && images.empty(); }
+
+        void record(VkCommandBuffer commandBuffer, const DeviceFunctions& functions, FrameArena& arena) const {
+            if (isEmpty()) {
+                return;
+            }
+
+            if (functions.cmdPipelineBarrier2 != nullptr) {
+                VkDependencyInfo dependencyInfo{};
+                dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+                dependencyInfo.memoryBarrierCount = hasMemoryBarrier() ? 1 : 0;
+                dependencyInfo.pMemoryBarriers = &memory;
+                dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(images.size());
+                dependencyInfo.pImageMemoryBarriers = images.data();
+                functions.cmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+                return;
+            }
+
+            // Only stage and access bits that exist in 1.0 are ever set, so they convert without loss.
+            VkPipelineStageFlags srcStages = static_cast<VkPipelineStageFlags>(memory.srcStageMask);
+            VkPipelineStageFlags dstStages = static_cast<VkPipelineStageFlags>(memory.dstStageMask);
+
+            VkMemoryBarrier memoryBarrier{};
+            memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            memoryBarrier.srcAccessMask = static_cast<VkAccessFlags>(memory.srcAccessMask);
+            memoryBarrier.dstAccessMask = static_cast<VkAccessFlags>(memory.dstAccessMask);
+
+            FrameVector<VkImageMemoryBarrier> imageBarriers(arena, images.size());
+            for (const auto& image : images) {
+                srcStages |= static_cast<VkPipelineStageFlags>(image.srcStageMask);
+                dstStages |= static_cast<VkPipelineStageFlags>(image.dstStageMask);
+
+                VkImageMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcAccessMask = static_cast<VkAccessFlags>(image.srcAccessMask);
+                barrier.dstAccessMask = static_cast<VkAccessFlags>(image.dstAccessMask);
+                barrier.oldLayout = image.oldLayout;
+                barrier.newLayout = image.newLayout;
+                barrier.srcQueueFamilyIndex = image.srcQueueFamilyIndex;
+                barrier.dstQueueFamilyIndex = image.dstQueueFamilyIndex;
+                barrier.image = image.image;
+                barrier.subresourceRange = image.subresourceRange;
+                imageBarriers.push_back(barrier);
+            }
+
+            // 1.0 has no "no stage"; the top and bottom of the pipe are the equivalent that waits for and blocks nothing.
+            vkCmdPipelineBarrier(commandBuffer,
+                                 srcStages != 0 ? srcStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT),
+                                 dstStages != 0 ? dstStages : static_cast<VkPipelineStageFlags>(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT), 0,
+                                 hasMemoryBarrier() ? 1 : 0, &memoryBarrier, 0, nullptr,
+                                 static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        }
+    };
+
+    struct Access {
+        uint32_t resource;
+        ResourceUsage usage;
+        bool discard;   // previous contents aren't needed, so the image may start in VK_IMAGE_LAYOUT_UNDEFINED
+    };
+
+    struct Attachment {
+        ResourceHandle resource;
+        VkAttachmentLoadOp loadOp;
+        VkAttachmentStoreOp storeOp;
+        VkClearValue clearValue;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<Access> accesses;
+        std::vector<Attachment> attachments;
+        ExecuteCallback execute;
+        bool secondaryContents = false;
+        bool sideEffects = false;
+        bool culled = false;
+        BarrierBatch barriers;
+    };
+
+    /// Hazard tracking while planning barriers. Reads since the last write are accumulated so a later write waits for all of
+    /// them, and stages that have already been synchronized with the last write don't get a second barrier.
+    struct TrackedState {
+        VkImageLayout layout;
+        VkPipelineStageFlags writeStages;
+        VkAccessFlags writeAccess;
+        VkPipelineStageFlags readStages;
+        VkPipelineStageFlags visibleStages;
+        VkAccessFlags visibleAccess;
+    };
+
+    struct ResourceNode {
+        std::string name;
+        bool isImage = true;
+        bool imported = true;
+
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent = {0, 0};
+        VkImageAspectFlags aspect = 0;
+        VkImageUsageFlags usage = 0;
+
+        VkBuffer buffer = VK_NULL_HANDLE;
+
+        ResourceState initialState;
+        ResourceState finalState;
+
+        // Transient images only: first and last pass using it, and the physical image backing it.
+        int firstPass = -1;
+        int lastPass = -1;
+        uint32_t physicalIndex = 0;
+
+        TrackedState tracked{};
+    };
+
+    /// A range of memory shared by transient images whose lifetimes don't overlap. `lastStages`/`lastAccess` remember the last
+    /// use of any of them, possibly in an earlier frame, so the next image placed there waits for it.
+    struct MemoryBucket {
+        VkMemoryRequirements requirements;
+        bool lazy = false;          // only holds images with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT
+        std::vector<std::pair<int, int>> lifetimes;
+        Allocation allocation;
+        VkPipelineStageFlags lastStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        VkAccessFlags lastAccess = 0;
+    };
+
+    struct PhysicalImage {
+        VkImage image = VK_NULL_HANDLE;
+        VkImageView view = VK_NULL_HANDLE;
+        uint32_t bucket = 0;
+    };
+
+    /// What a transient image's placement depends on.
+    struct TransientDescription {
+        VkFormat format;
+        VkExtent2D extent;
+        VkImageUsageFlags usage;
+        int firstPass;
+        int lastPass;
+
+        bool operator==(const TransientDescription& other) const {
+            return format == other.format && extent.width == other.extent.width && extent.height == other.extent.height &&
+                usage == other.usage && firstPass == other.firstPass && lastPass == other.lastPass;
+        }
+    };
+
+    /// The transient images of one graph layout. Kept as long as every frame declares the same transients, which
+    /// `signature` describes in declaration order.
+    struct TransientSet {
+        std::vector<TransientDescription> signature;
+        std::vector<PhysicalImage> images;
+        std::vector<MemoryBucket> buckets;
+        VkDeviceSize allocatedBytes = 0;
+        VkDeviceSize unaliasedBytes = 0;
+        VkDeviceSize lazyBytes = 0;
+        uint32_t attachmentOnlyCount = 0;
+        uint64_t lastUsedFrame = 0;
+    };
+
+    struct CachedFramebuffer {
+        VkFramebuffer framebuffer;
+        uint64_t lastUsedFrame;
+    };
+
+    /// Format, load and store ops, and layout of each attachment. Unused entries stay zeroed, so keys compare by value.
+    struct RenderPassKey {
+        std::array<std::tuple<VkFormat, VkAttachmentLoadOp, VkAttachmentStoreOp, VkImageLayout>, MAX_ATTACHMENTS> attachments{};
+        uint32_t count = 0;
+
+        void add(VkFormat format, VkAttachmentLoadOp loadOp, VkAttachmentStoreOp storeOp, VkImageLayout layout) {
+            attachments[count++] = {format, loadOp, storeOp, layout};
+        }
+
+        bool operator<(const RenderPassKey& other) const {
+            return std::tie(count, attachments) < std::tie(other.count, other.attachments);
+        }
+    };
+
+    struct FramebufferKey {
+        VkRenderPass renderPass = VK_NULL_HANDLE;
+        std::array<VkImageView, MAX_ATTACHMENTS> views{};
+        uint32_t viewCount = 0;
+        VkExtent2D extent = {0, 0};
+
+        bool operator<(const FramebufferKey& other) const {
+            return std::tie(renderPass, viewCount, views, extent.width, extent.height) <
+                std::tie(other.renderPass, other.viewCount, other.views, other.extent.width, other.extent.height);
+        }
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* allocator = nullptr;
+    FrameProfiler* profiler = nullptr;
+    FrameArena* frameArena = nullptr;
+    bool verbose = false;
+    DeviceFunctions functions;
+    uint32_t framesInFlight = 1;
+    uint64_t frameNumber = 0;
+    bool compiled = false;
+
+    std::vector<Pass> passes;
+    std::vector<ResourceNode> resources;
+
+    // Storage of last frame's declarations, handed to this frame's.
+    std::vector<std::string> spareNames;
+    std::vector<std::vector<Access>> spareAccesses;
+    std::vector<std::vector<Attachment>> spareAttachments;
+    BarrierBatch finalBarriers;
+
+    TransientSet transients;
+    std::vector<TransientSet> retiredTransients;
+    uint32_t transientRebuildCount = 0;
+
+    std::map<RenderPassKey, VkRenderPass> renderPasses;
+    std::map<FramebufferKey, CachedFramebuffer> framebuffers;
+    std::vector<CachedFramebuffer> retiredFramebuffers;
+
+    // Inheritance of the pass being executed, pointed to by its `PassContext`.
+    VkCommandBufferInheritanceInfo inheritance{};
+    VkCommandBufferInheritanceRenderingInfo inheritanceRendering{};
+    std::vector<VkFormat> inheritanceColorFormats;
+
+    /// Waiting for the previous frame of frame F's slot proves frame F - framesInFlight has completed.
+    bool isFrameComplete(uint64_t usedAtFrame) const {
+        return frameNumber >= usedAtFrame + framesInFlight;
+    }
+
+    std::string takeSpareName(std::string_view name) {
+        std::string spare;
+        if (spareNames.empty() == false) {
+            spare = std::move(spareNames.back());
+            spareNames.pop_back();
+        }
+        spare = name;
+        return spare;
+    }
+
+    ResourceHandle addResource(ResourceNode node, std::string_view name) {
+        node.name = takeSpareName(name);
+        resources.push_back(std::move(node));
+        return ResourceHandle{static_cast<uint32_t>(resources.size() - 1)};
+    }
+
+    /// Catches a `read()` given a usage that writes, or the reverse, which would leave the pass ordered and culled wrongly.
+    void checkDirection(uint32_t passIndex, ResourceUsage usage, bool write) const {
+        bool writes = (usageInfo(usage).access & WRITE_ACCESS) != 0;
+        if (writes != write) {
+            throw std::runtime_error("Pass " + passes[passIndex].name + (write ? " writes with a usage that only reads."
+                                                                               : " reads with a usage that writes."));
+        }
+    }
+
+    void addAccess(uint32_t passIndex, ResourceHandle resource, ResourceUsage usage, bool discard) {
+        if (resource.index >= resources.size()) {
+            throw std::runtime_error("Pass " + passes[passIndex].name + " uses a resource that doesn't exist.");
+        }
+        ResourceNode& node = resources[resource.index];
+        UsageInfo info = usageInfo(usage);
+        if (node.isImage != (info.layout != VK_IMAGE_LAYOUT_UNDEFINED)) {
+            throw std::runtime_error("Pass " + passes[passIndex].name + " uses " + node.name + " in a way that doesn't fit its type.");
+        }
+        node.usage |= info.imageUsage;
+        passes[passIndex].accesses.push_back({resource.index, usage, discard});
+    }
+
+    /// Walks the passes backwards, keeping a pass if it has side effects, writes an imported resource, or writes something a
+    /// kept pass reads.
+    void cullPasses() {
+        FrameVector<bool> needed(*frameArena);
+        needed.assign(resources.size(), false);
+        for (size_t i = passes.size(); i-- > 0;) {
+            Pass& pass = passes[i];
+
+            bool keep = pass.sideEffects;
+            for (const auto& access : pass.accesses) {
+                bool written = (usageInfo(access.usage).access & WRITE_ACCESS) != 0;
+                if (written && (resources[access.resource].imported || needed[access.resource])) {
+                    keep = true;
+                }
+            }
+            pass.culled = keep == false;
+            if (pass.culled) {
+                continue;
+            }
+
+            // Writing a resource without discarding it keeps whatever produced its previous contents alive too.
+            for (const auto& access : pass.accesses) {
+                bool written = (usageInfo(access.usage).access & WRITE_ACCESS) != 0;
+                if (written && access.discard) {
+                    needed[access.resource] = false;
+                }
+            }
+            for (const auto& access : pass.accesses) {
+                bool written = (usageInfo(access.usage).access & WRITE_ACCESS) != 0;
+                if (written == false || access.discard == false) {
+                    needed[access.resource] = true;
+                }
+            }
+        }
+    }
+
+    void computeLifetimes() {
+        for (int i = 0; i < static_cast<int>(passes.size()); i++) {
+            if (passes[i].culled) {
+                continue;
+            }
+            for (const auto& access : passes[i].accesses) {
+                ResourceNode& node = resources[access.resource];
+                if (node.firstPass < 0) {
+                    node.firstPass = i;
+                }
+                node.lastPass = i;
+            }
+        }
+    }
+
+    /// Graph-owned images aren't kept past their last pass, so that pass needn't store the attachment.
+    void discardDeadAttachments() {
+        for (int i = 0; i < static_cast<int>(passes.size()); i++) {
+            for (auto& attachment : passes[i].attachments) {
+                const ResourceNode& node = resources[attachment.resource.index];
+                if (node.imported == false && node.lastPass == i) {
+                    attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                }
+            }
+        }
+    }
+
+    /// Transient attachment images may have no usage but that of attachments.
+    static bool isAttachmentOnly(VkImageUsageFlags usage) {
+        const VkImageUsageFlags attachmentUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+        return (usage & ~attachmentUsage) == 0;
+    }
+
+    /// Reuses last frame's transient images if the same ones were declared, otherwise builds a new set and retires the old one
+    /// until the frames using it have completed.
+    void allocateTransients() {
+        if (matchesTransients() == false) {
+            if (transients.images.empty() == false) {
+                retiredTransients.push_back(std::move(transients));
+            }
+            transients = TransientSet{};
+            for (const auto& node : resources) {
+                if (node.imported == false && node.firstPass >= 0) {
+                    transients.signature.push_back(describeTransient(node));
+                }
+            }
+            buildTransientSet();
+        }
+
+        uint32_t physicalIndex = 0;
+        for (auto& node : resources) {
+            if (node.imported || node.firstPass < 0) {
+                continue;
+            }
+            node.physicalIndex = physicalIndex;
+            node.image = transients.images[physicalIndex].image;
+            node.view = transients.images[physicalIndex].view;
+            physicalIndex++;
+        }
+    }
+
+    static TransientDescription describeTransient(const ResourceNode& node) {
+        return {node.format, node.extent, node.usage, node.firstPass, node.lastPass};
+    }
+
+    /// Compares this frame's transient images with the current set's signature in place.
+    bool matchesTransients() const {
+        size_t count = 0;
+        for (const auto& node : resources) {
+            if (node.imported || node.firstPass < 0) {
+                continue;
+            }
+            if (count == transients.signature.size() || (describeTransient(node) == transients.signature[count]) == false) {
+                return false;
+            }
+            count++;
+        }
+        return count == transients.signature.size();
+    }
+
+    void buildTransientSet() {
+        struct Candidate {
+            uint32_t resource;
+            VkMemoryRequirements requirements;
+            bool lazy;
+        };
+        std::vector<Candidate> candidates;
+
+        for (uint32_t i = 0; i < resources.size(); i++) {
+            ResourceNode& node = resources[i];
+            if (node.imported || node.firstPass < 0) {
+                continue;
+            }
+
+            VkImageCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            createInfo.imageType = VK_IMAGE_TYPE_2D;
+            createInfo.format = node.format;
+            createInfo.extent = {node.extent.width, node.extent.height, 1};
+            createInfo.mipLevels = 1;
+            createInfo.arrayLayers = 1;
+            createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            createInfo.usage = node.usage;
+            bool lazy = isAttachmentOnly(node.usage);
+            if (lazy) {
+                createInfo.usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+                transients.attachmentOnlyCount++;
+            }
+            createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            PhysicalImage physical;
+            VkResult result = vkCreateImage(device, &createInfo, nullptr, &physical.image);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Transient image " + node.name + " was not created. Error code " + std::to_string(result));
+            }
+            transients.images.push_back(physical);
+
+            VkMemoryRequirements requirements;
+            vkGetImageMemoryRequirements(device, physical.image, &requirements);
+            candidates.push_back({i, requirements, lazy});
+            transients.unaliasedBytes += requirements.size;
+        }
+
+        // Largest first, each into the first bucket whose occupants are all dead while it's alive.
+        std::vector<uint32_t> order(candidates.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return candidates[a].requirements.size > candidates[b].requirements.size;
+        });
+
+        for (uint32_t candidateIndex : order) {
+            const Candidate& candidate = candidates[candidateIndex];
+            const ResourceNode& node = resources[candidate.resource];
+            std::pair<int, int> lifetime = {node.firstPass, node.lastPass};
+
+            uint32_t chosen = static_cast<uint32_t>(transients.buckets.size());
+            for (uint32_t b = 0; b < transients.buckets.size(); b++) {
+                MemoryBucket& bucket = transients.buckets[b];
+                bool overlaps = std::any_of(bucket.lifetimes.begin(), bucket.lifetimes.end(), [&](const std::pair<int, int>& other) {
+                    return lifetime.first <= other.second && other.first <= lifetime.second;
+                });
+                if (overlaps == false && bucket.lazy == candidate.lazy &&
+                    (bucket.requirements.memoryTypeBits & candidate.requirements.memoryTypeBits) != 0) {
+                    chosen = b;
+                    break;
+                }
+            }
+
+            if (chosen == transients.buckets.size()) {
+                MemoryBucket bucket;
+                bucket.requirements = candidate.requirements;
+                bucket.lazy = candidate.lazy;
+                transients.buckets.push_back(std::move(bucket));
+            }
+
+            MemoryBucket& bucket = transients.buckets[chosen];
+            bucket.requirements.size = std::max(bucket.requirements.size, candidate.requirements.size);
+            bucket.requirements.alignment = std::max(bucket.requirements.alignment, candidate.requirements.alignment);
+            bucket.requirements.memoryTypeBits &= candidate.requirements.memoryTypeBits;
+            bucket.lifetimes.push_back(lifetime);
+            transients.images[candidateIndex].bucket = chosen;
+        }
+
+        for (auto& bucket : transients.buckets) {
+            bucket.allocation = allocator->allocate(bucket.requirements, bucket.lazy ? MemoryUsage::GpuLazy : MemoryUsage::GpuOnly,
+                                                    ResourceKind::Optimal);
+            transients.allocatedBytes += bucket.requirements.size;
+            if (allocator->isLazilyAllocated(bucket.allocation.memoryTypeIndex)) {
+                transients.lazyBytes += bucket.requirements.size;
+            }
+        }
+
+        for (uint32_t i = 0; i < candidates.size(); i++) {
+            const ResourceNode& node = resources[candidates[i].resource];
+            PhysicalImage& physical = transients.images[i];
+            const Allocation& allocation = transients.buckets[physical.bucket].allocation;
+            vkBindImageMemory(device, physical.image, allocation.memory, allocation.offset);
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = physical.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = node.format;
+            viewInfo.subresourceRange = {node.aspect, 0, 1, 0, 1};
+
+            VkResult result = vkCreateImageView(device, &viewInfo, nullptr, &physical.view);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Transient image view " + node.name + " was not created. Error code " + std::to_string(result));
+            }
+        }
+
+        transientRebuildCount++;
+        if (verbose && candidates.empty() == false) {
+            std::cout << "Render graph: " << candidates.size() << " transient images in " << transients.buckets.size()
+                      << " memory ranges, " << transients.allocatedBytes / 1024 << " KiB ("
+                      << transients.unaliasedBytes / 1024 << " KiB without aliasing), " << transients.attachmentOnlyCount
+                      << " transient attachments, " << transients.lazyBytes / 1024 << " KiB lazily allocated\n";
+        }
+    }
+
+    void destroyTransientSet(TransientSet& set) {
+        for (auto& physical : set.images) {
+            vkDestroyImageView(device, physical.view, nullptr);
+            vkDestroyImage(device, physical.image, nullptr);
+        }
+        for (auto& bucket : set.buckets) {
+            allocator->free(bucket.allocation);
+        }
+        set.images.clear();
+        set.buckets.clear();
+    }
+
+    void planBarriers() {
+        for (auto& node : resources) {
+            node.tracked = {node.initialState.layout, node.initialState.stages, node.initialState.access, 0, 0, 0};
+        }
+
+        for (int passIndex = 0; passIndex < static_cast<int>(passes.size()); passIndex++) {
+            Pass& pass = passes[passIndex];
+            pass.barriers = BarrierBatch(*frameArena);
+            if (pass.culled) {
+                continue;
+            }
+
+            for (const auto& access : pass.accesses) {
+                ResourceNode& node = resources[access.resource];
+                UsageInfo info = usageInfo(access.usage);
+
+                bool discard = access.discard;
+                if (node.imported == false) {
+                    // Whatever used this memory last, in this frame or an earlier one, must finish before the image takes
+                    // it over. Its previous contents are gone, since the memory may have held another image.
+                    const MemoryBucket& bucket = transients.buckets[transients.images[node.physicalIndex].bucket];
+                    if (node.firstPass == passIndex && node.tracked.layout == VK_IMAGE_LAYOUT_UNDEFINED) {
+                        node.tracked = {VK_IMAGE_LAYOUT_UNDEFINED, bucket.lastStages, bucket.lastAccess, 0, 0, 0};
+                    }
+                    discard = discard || node.firstPass == passIndex;
+                }
+                transition(pass.barriers, node, info, discard);
+
+                if (node.imported == false) {
+                    MemoryBucket& bucket = transients.buckets[transients.images[node.physicalIndex].bucket];
+                    bucket.lastStages = node.tracked.writeStages | node.tracked.readStages;
+                    bucket.lastAccess = node.tracked.writeAccess;
+                }
+            }
+        }
+
+        finalBarriers = BarrierBatch(*frameArena);
+        for (auto& node : resources) {
+            if (node.imported && node.isImage && node.firstPass >= 0) {
+                UsageInfo info = {node.finalState.stages, node.finalState.access, node.finalState.layout, 0};
+                transition(finalBarriers, node, info, false);
+            }
+        }
+    }
+
+    /// Adds whatever barrier `node` needs before it's accessed as `info` to `batch`, and updates its tracked state.
+    void transition(BarrierBatch& batch, ResourceNode& node, const UsageInfo& info, bool discard) {
+        TrackedState& state = node.tracked;
+        bool write = (info.access & WRITE_ACCESS) != 0;
+        bool layoutChange = node.isImage && info.layout != state.layout;
+
+        VkPipelineStageFlags srcStages = 0;
+        VkAccessFlags srcAccess = 0;
+        bool needed = false;
+
+        if (layoutChange || write) {
+            // Write after write, write after read, or a layout transition: wait for everything since the last write.
+            srcStages = state.writeStages | state.readStages;
+            srcAccess = state.writeAccess;
+            needed = layoutChange || srcStages != 0;
+        }
+        else {
+            // Read after write: only stages and accesses that haven't seen the write yet need a barrier.
+            srcStages = state.writeStages;
+            srcAccess = state.writeAccess;
+            needed = srcStages != 0 && ((info.stages & ~state.visibleStages) != 0 || (info.access & ~state.visibleAccess) != 0);
+        }
+
+        if (needed) {
+            // TOP_OF_PIPE and BOTTOM_OF_PIPE only stand for "no stage", which synchronization2 spells as NONE.
+            const VkPipelineStageFlags noStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            VkPipelineStageFlags2 srcStages2 = srcStages & ~noStage;
+            VkPipelineStageFlags2 dstStages2 = info.stages & ~noStage;
+
+            if (node.isImage && layoutChange) {
+                VkImageMemoryBarrier2 barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+                barrier.srcStageMask = srcStages2;
+                barrier.srcAccessMask = srcAccess;
+                barrier.dstStageMask = dstStages2;
+                barrier.dstAccessMask = info.access;
+                barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+                barrier.newLayout = info.layout;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = node.image;
+                barrier.subresourceRange = {node.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+                batch.images.push_back(barrier);
+            }
+            else {
+                batch.memory.srcStageMask |= srcStages2;
+                batch.memory.dstStageMask |= dstStages2;
+                if (srcAccess != 0) {
+                    batch.memory.srcAccessMask |= srcAccess;
+                    batch.memory.dstAccessMask |= info.access;
+                }
+            }
+        }
+
+        if (layoutChange || write) {
+            state.layout = info.layout;
+            state.writeStages = info.stages;
+            state.writeAccess = info.access & WRITE_ACCESS;
+            state.readStages = write ? 0 : info.stages;
+            state.visibleStages = info.stages;
+            state.visibleAccess = info.access;
+        }
+        else {
+            state.readStages |= info.stages;
+            if (needed) {
+                state.visibleStages |= info.stages;
+                state.visibleAccess |= info.access;
+            }
+        }
+    }
+
+    VkRenderPass getRenderPass(const Pass& pass) {
+        RenderPassKey key;
+        for (const auto& attachment : pass.attachments) {
+            const ResourceNode& node = resources[attachment.resource.index];
+            UsageInfo info = usageInfo(node.aspect == VK_IMAGE_ASPECT_COLOR_BIT ? ResourceUsage::ColorAttachment
+                                                                                : ResourceUsage::DepthStencilAttachment);
+            key.add(node.format, attachment.loadOp, attachment.storeOp, info.layout);
+        }
+        return getRenderPass(key, pass.name);
+    }
+
+    VkRenderPass getRenderPass(const RenderPassKey& key, const std::string& name) {
+        auto cached = renderPasses.find(key);
+        if (cached != renderPasses.end()) {
+            return cached->second;
+        }
+
+        // Layout transitions are done by the graph's barriers, so attachments start and end in their attachment layout and
+        // the render pass needs no external subpass dependencies.
+        std::vector<VkAttachmentDescription> descriptions;
+        std::vector<VkAttachmentReference> colorReferences;
+        std::optional<VkAttachmentReference> depthReference;
+        for (uint32_t i = 0; i < key.count; i++) {
+            const auto& [format, loadOp, storeOp, layout] = key.attachments[i];
+            VkAttachmentDescription description{};
+            description.format = format;
+            description.samples = VK_SAMPLE_COUNT_1_BIT;
+            description.loadOp = loadOp;
+            description.storeOp = storeOp;
+            description.stencilLoadOp = loadOp;
+            description.stencilStoreOp = storeOp;
+            description.initialLayout = layout;
+            description.finalLayout = layout;
+            descriptions.push_back(description);
+
+            if (layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) {
+                colorReferences.push_back({i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL});
+            }
+            else {
+                depthReference = VkAttachmentReference{i, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+            }
+        }
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+        subpass.pColorAttachments = colorReferences.data();
+        subpass.pDepthStencilAttachment = depthReference.has_value() ? &*depthReference : nullptr;
+
+        VkRenderPassCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        createInfo.attachmentCount = static_cast<uint32_t>(descriptions.size());
+        createInfo.pAttachments = descriptions.data();
+        createInfo.subpassCount = 1;
+        createInfo.pSubpasses = &subpass;
+
+        VkRenderPass renderPass;
+        VkResult result = vkCreateRenderPass(device, &createInfo, nullptr, &renderPass);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Render pass for " + name + " was not created. Error code " + std::to_string(result));
+        }
+        renderPasses[key] = renderPass;
+        return renderPass;
+    }
+
+    VkFramebuffer getFramebuffer(const FramebufferKey& key) {
+        auto cached = framebuffers.find(key);
+        if (cached != framebuffers.end()) {
+            cached->second.lastUsedFrame = frameNumber;
+            return cached->second.framebuffer;
+        }
+
+        VkFramebufferCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        createInfo.renderPass = key.renderPass;
+        createInfo.attachmentCount = key.viewCount;
+        createInfo.pAttachments = key.views.data();
+        createInfo.width = key.extent.width;
+        createInfo.height = key.extent.height;
+        createInfo.layers = 1;
+
+        VkFramebuffer framebuffer;
+        VkResult result = vkCreateFramebuffer(device, &createInfo, nullptr, &framebuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Framebuffer was not created. Error code " + std::to_string(result));
+        }
+        framebuffers[key] = {framebuffer, frameNumber};
+        return framebuffer;
+    }
+
+    void beginRenderPass(const Pass& pass, PassContext& context) {
+        VkExtent2D extent = resources[pass.attachments[0].resource.index].extent;
+        for (const auto& attachment : pass.attachments) {
+            const ResourceNode& node = resources[attachment.resource.index];
+            if (node.extent.width != extent.width || node.extent.height != extent.height) {
+                throw std::runtime_error("Attachments of pass " + pass.name + " don't have the same size.");
+            }
+        }
+        context.extent = extent;
+
+        inheritance = VkCommandBufferInheritanceInfo{};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        context.inheritance = &inheritance;
+
+        if (usesDynamicRendering()) {
+            beginRendering(pass, context);
+            return;
+        }
+
+        FramebufferKey framebufferKey;
+        FrameVector<VkClearValue> clearValues(*frameArena, pass.attachments.size());
+        for (const auto& attachment : pass.attachments) {
+            framebufferKey.views[framebufferKey.viewCount++] = resources[attachment.resource.index].view;
+            clearValues.push_back(attachment.clearValue);
+        }
+
+        context.renderPass = getRenderPass(pass);
+        framebufferKey.renderPass = context.renderPass;
+        framebufferKey.extent = extent;
+        context.framebuffer = getFramebuffer(framebufferKey);
+
+        // The framebuffer is optional, but knowing it lets some drivers record secondaries more efficiently.
+        inheritance.renderPass = context.renderPass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = context.framebuffer;
+
+        VkRenderPassBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        beginInfo.renderPass = context.renderPass;
+        beginInfo.framebuffer = context.framebuffer;
+        beginInfo.renderArea.offset = {0, 0};
+        beginInfo.renderArea.extent = extent;
+        beginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+        beginInfo.pClearValues = clearValues.data();
+
+        vkCmdBeginRenderPass(context.commandBuffer, &beginInfo,
+                             pass.secondaryContents ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+    }
+
+    /// The dynamic rendering equivalent of `vkCmdBeginRenderPass`; needs neither a render pass nor a framebuffer.
+    void beginRendering(const Pass& pass, PassContext& context) {
+        FrameVector<VkRenderingAttachmentInfo> colorAttachments(*frameArena, pass.attachments.size());
+        std::optional<VkRenderingAttachmentInfo> depthAttachment;
+        VkImageAspectFlags depthAspect = 0;
+
+        inheritanceColorFormats.clear();
+        inheritanceRendering = VkCommandBufferInheritanceRenderingInfo{};
+        inheritanceRendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        inheritanceRendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        for (const auto& attachment : pass.attachments) {
+            const ResourceNode& node = resources[attachment.resource.index];
+
+            VkRenderingAttachmentInfo info{};
+            info.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+            info.imageView = node.view;
+            info.resolveMode = VK_RESOLVE_MODE_NONE;
+            info.loadOp = attachment.loadOp;
+            info.storeOp = attachment.storeOp;
+            info.clearValue = attachment.clearValue;
+
+            if (node.aspect == VK_IMAGE_ASPECT_COLOR_BIT) {
+                info.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                colorAttachments.push_back(info);
+                inheritanceColorFormats.push_back(node.format);
+            }
+            else {
+                info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+                depthAttachment = info;
+                depthAspect = node.aspect;
+                if (node.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) {
+                    inheritanceRendering.depthAttachmentFormat = node.format;
+                }
+                if (node.aspect & VK_IMAGE_ASPECT_STENCIL_BIT) {
+                    inheritanceRendering.stencilAttachmentFormat = node.format;
+                }
+            }
+        }
+
+        inheritanceRendering.colorAttachmentCount = static_cast<uint32_t>(inheritanceColorFormats.size());
+        inheritanceRendering.pColorAttachmentFormats = inheritanceColorFormats.data();
+        inheritance.pNext = &inheritanceRendering;
+
+        VkRenderingInfo renderingInfo{};
+        renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+        renderingInfo.flags = pass.secondaryContents ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+        renderingInfo.renderArea.offset = {0, 0};
+        renderingInfo.renderArea.extent = context.extent;
+        renderingInfo.layerCount = 1;
+        renderingInfo.colorAttachmentCount = static_cast<uint32_t>(colorAttachments.size());
+        renderingInfo.pColorAttachments = colorAttachments.data();
+        renderingInfo.pDepthAttachment = (depthAspect & VK_IMAGE_ASPECT_DEPTH_BIT) ? &*depthAttachment : nullptr;
+        renderingInfo.pStencilAttachment = (depthAspect & VK_IMAGE_ASPECT_STENCIL_BIT) ? &*depthAttachment : nullptr;
+
+        functions.cmdBeginRendering(context.commandBuffer, &renderingInfo);
+    }
+};
+
+#endif /* RenderGraph_hpp */
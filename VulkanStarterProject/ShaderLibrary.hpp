@@ -0,0 +1,311 @@
+#ifndef ShaderLibrary_hpp
+#define ShaderLibrary_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// Loads shaders as SPIR-V, compiling GLSL sources with an external compiler (glslc by default) only when nothing compiled
+/// from the same source exists yet.
+///
+/// Compiled SPIR-V is cached on disk under the FNV-1a hash of the source and the compiler flags, so a source that's
+/// unchanged, or changed back, loads from the cache in well under a millisecond. `#include`d files aren't part of the hash.
+///
+/// `startWatching()` polls the sources of every loaded shader on a background thread and recompiles the ones whose contents
+/// changed; the main thread picks the results up with `takeReloads()`. A source that fails to compile is reported by the
+/// compiler and leaves the previous SPIR-V in use.
+class ShaderLibrary {
+public:
+    struct Stats {
+        uint32_t cacheHits = 0;
+        uint32_t prebuilt = 0;              // read from the `<name>.spv` next to the source
+        uint32_t compiled = 0;
+        uint32_t failed = 0;
+        uint32_t reloaded = 0;              // recompiled or fetched from the cache while watching
+        double totalCompileMilliseconds = 0.0;
+    };
+
+    struct Reload {
+        std::string name;
+        std::vector<uint32_t> code;
+    };
+
+    /// Sources are `<sourceDirectory>/<name>`, with optional prebuilt SPIR-V as `<name>.spv` beside them. `compiler` is
+    /// invoked like glslc.
+    void init(const std::string& sourceDirectory, const std::string& cacheDirectory, const std::string& compiler = "glslc") {
+        this->sourceDirectory = sourceDirectory;
+        this->cacheDirectory = cacheDirectory;
+        this->compiler = compiler;
+
+        // Without a cache directory every shader is compiled each run, which is slow but still works.
+        std::error_code error;
+        std::filesystem::create_directories(cacheDirectory, error);
+    }
+
+    /// Stops watching. Reloads that weren't taken are dropped.
+    void destroy() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (watcher.joinable()) {
+            watcher.join();
+        }
+        shaders.clear();
+        reloads.clear();
+    }
+
+    /// Returns the SPIR-V of `name`, e.g. "scene.vert": from the cache, else from an up-to-date `<name>.spv`, else compiled
+    /// from the source. Without a source, only `<name>.spv` is read. Returns nothing if none of them works out.
+    std::vector<uint32_t> load(const std::string& name) {
+        std::string sourcePath = sourceDirectory + "/" + name;
+        std::string prebuiltPath = sourcePath + ".spv";
+
+        std::error_code error;
+        std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(sourcePath, error);
+        std::string source;
+        if (error || readFile(sourcePath, source) == false) {
+            std::vector<uint32_t> code = readSpirv(prebuiltPath);
+            if (code.empty() == false) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.prebuilt++;
+            }
+            return code;
+        }
+
+        uint64_t hash = hashSource(source);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shaders[name] = {sourceTime, hash};
+        }
+
+        std::vector<uint32_t> code = readSpirv(cachePath(hash));
+        if (code.empty() == false) {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.cacheHits++;
+            return code;
+        }
+
+        // E.g. from the README's glslc loop. Trusted only if it isn't older than the source.
+        std::filesystem::file_time_type prebuiltTime = std::filesystem::last_write_time(prebuiltPath, error);
+        if (static_cast<bool>(error) == false && prebuiltTime >= sourceTime) {
+            code = readSpirv(prebuiltPath);
+            if (code.empty() == false) {
+                writeCache(hash, code);
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.prebuilt++;
+                return code;
+            }
+        }
+
+        code = compile(sourcePath, source, hash);
+        if (code.empty()) {
+            code = readSpirv(prebuiltPath);
+            if (code.empty() == false) {
+                std::cerr << "Using " << prebuiltPath << ", which is older than its source.\n";
+            }
+        }
+        return code;
+    }
+
+    /// Starts polling the sources of loaded shaders every `interval`.
+    void startWatching(std::chrono::milliseconds interval = std::chrono::milliseconds(250)) {
+        stopping = false;
+        watcher = std::thread([this, interval] { watchLoop(interval); });
+    }
+
+    /// Shaders recompiled since the last call, most recent last. Main thread only.
+    std::vector<Reload> takeReloads() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Reload> taken;
+        taken.swap(reloads);
+        return taken;
+    }
+
+    Stats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    // Part of the cache key, so changing them recompiles everything.
+    static constexpr const char* COMPILE_FLAGS = "--target-env=vulkan1.1";
+
+    struct Shader {
+        std::filesystem::file_time_type sourceTime;
+        uint64_t hash = 0;                  // of the source the current SPIR-V was built from
+    };
+
+    std::string sourceDirectory;
+    std::string cacheDirectory;
+    std::string compiler;
+
+    // Keyed by name. Only shaders with a source are watched.
+    std::unordered_map<std::string, Shader> shaders;
+    std::vector<Reload> reloads;
+    Stats stats;
+
+    std::thread watcher;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static uint64_t hashSource(const std::string& source) {
+        uint64_t value = 14695981039346656037ull;
+        auto mix = [&](const std::string& text) {
+            for (unsigned char byte : text) {
+                value = (value ^ byte) * 1099511628211ull;
+            }
+        };
+        mix(COMPILE_FLAGS);
+        mix(source);
+        return value;
+    }
+
+    std::string cachePath(uint64_t hash) const {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(hash));
+        return cacheDirectory + "/" + name;
+    }
+
+    static bool readFile(const std::string& path, std::string& contents) {
+        std::ifstream file(path, std::ios::binary);
+        if (file.is_open() == false) {
+            return false;
+        }
+        contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return file.bad() == false;
+    }
+
+    /// Returns nothing if the file is missing or isn't SPIR-V.
+    static std::vector<uint32_t> readSpirv(const std::string& path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (file.is_open() == false) {
+            return {};
+        }
+        size_t size = static_cast<size_t>(file.tellg());
+        std::vector<uint32_t> code(size / sizeof(uint32_t));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(code.data()), static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+
+        const uint32_t spirvMagic = 0x07230203;
+        if (file.good() == false || size % sizeof(uint32_t) != 0 || code.empty() || code[0] != spirvMagic) {
+            return {};
+        }
+        return code;
+    }
+
+    /// Written to a temporary file that's renamed into place, so a concurrent reader never sees half a shader.
+    void writeCache(uint64_t hash, const std::vector<uint32_t>& code) const {
+        std::string path = cachePath(hash);
+        std::string temporaryPath = path + ".tmp";
+
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(code.data()), static_cast<std::streamsize>(code.size() * sizeof(uint32_t)));
+        file.close();
+        if (file.good() == false || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+        }
+    }
+
+    /// Runs the compiler straight into the cache. Its diagnostics go to the console.
+    ///
+    /// `source` is what `hash` was computed from. The compiler gets a copy of it next to the cache entry rather than
+    /// `sourcePath`, which an editor may have saved again since, so SPIR-V of a different source never lands under the hash.
+    /// The copy keeps the source's extension, which tells the compiler the stage, and includes are still looked up next to
+    /// the source.
+    std::vector<uint32_t> compile(const std::string& sourcePath, const std::string& source, uint64_t hash) {
+        std::string path = cachePath(hash);
+        std::string temporaryPath = path + ".tmp";
+        std::filesystem::path sourceFile(sourcePath);
+        std::string sourceCopyPath = path + ".src" + sourceFile.extension().string();
+        std::string command = compiler + " " + COMPILE_FLAGS + " -I \"" + sourceFile.parent_path().string() + "\" -o \"" +
+            temporaryPath + "\" \"" + sourceCopyPath + "\"";
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int status = -1;
+        {
+            std::ofstream copy(sourceCopyPath, std::ios::binary | std::ios::trunc);
+            copy.write(source.data(), static_cast<std::streamsize>(source.size()));
+            copy.close();
+            if (copy.good()) {
+                status = std::system(command.c_str());
+            }
+        }
+        std::remove(sourceCopyPath.c_str());
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::vector<uint32_t> code = status == 0 ? readSpirv(temporaryPath) : std::vector<uint32_t>{};
+        if (code.empty() || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (code.empty()) {
+            stats.failed++;
+            std::cerr << sourcePath << " was not compiled. Exit status " << status << '\n';
+        }
+        else {
+            stats.compiled++;
+            stats.totalCompileMilliseconds += milliseconds;
+        }
+        return code;
+    }
+
+    void watchLoop(std::chrono::milliseconds interval) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait_for(lock, interval, [this] { return stopping; });
+            if (stopping) {
+                return;
+            }
+
+            std::vector<std::pair<std::string, Shader>> watched(shaders.begin(), shaders.end());
+            lock.unlock();
+
+            for (const auto& [name, shader] : watched) {
+                std::string sourcePath = sourceDirectory + "/" + name;
+                std::error_code error;
+                std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(sourcePath, error);
+                std::string source;
+                if (error || sourceTime == shader.sourceTime || readFile(sourcePath, source) == false) {
+                    continue;
+                }
+
+                // Saving without changes touches the file but needs no compile.
+                uint64_t hash = hashSource(source);
+                std::vector<uint32_t> code;
+                if (hash != shader.hash) {
+                    code = readSpirv(cachePath(hash));
+                    if (code.empty()) {
+                        code = compile(sourcePath, source, hash);
+                    }
+                }
+
+                std::lock_guard<std::mutex> update(mutex);
+                Shader& current = shaders[name];
+                current.sourceTime = sourceTime;
+                if (code.empty() == false) {
+                    current.hash = hash;
+                    reloads.push_back({name, std::move(code)});
+                    stats.reloaded++;
+                }
+            }
+            lock.lock();
+        }
+    }
+};
+
+#endif /* ShaderLibrary_hpp */
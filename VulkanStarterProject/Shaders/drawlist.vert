@@ -0,0 +1,32 @@
+#version 450
+
+// Draws the `--draw-list` objects: unit cubes placed by DrawList's transforms and tinted by their material. As in scene.vert,
+// bit 0, 1 and 2 of the vertex index select the x, y and z side of the cube's corner.
+
+layout(set = 0, binding = 1) readonly buffer Vectors { vec4 data[]; } buffers[];
+
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    uint transformIndex;
+    uint transformStride;
+    uint descriptorIndex;
+} constants;
+
+layout(location = 0) out vec3 color;
+
+void main() {
+    vec4 corner = vec4((gl_VertexIndex & 1) != 0 ? 0.5 : -0.5,
+                       (gl_VertexIndex & 2) != 0 ? 0.5 : -0.5,
+                       (gl_VertexIndex & 4) != 0 ? 0.5 : -0.5, 1.0);
+
+    // The transform's rows, stored as three arrays one after the other.
+    uint instance = uint(gl_InstanceIndex);
+    vec4 row0 = buffers[constants.transformIndex].data[instance];
+    vec4 row1 = buffers[constants.transformIndex].data[constants.transformStride + instance];
+    vec4 row2 = buffers[constants.transformIndex].data[constants.transformStride * 2 + instance];
+    vec3 position = vec3(dot(row0, corner), dot(row1, corner), dot(row2, corner));
+    gl_Position = constants.viewProjection * vec4(position, 1.0);
+
+    vec3 tint = buffers[constants.descriptorIndex].data[0].rgb;
+    color = tint * (0.6 + 0.4 * (corner.xyz + 0.5));
+}
@@ -0,0 +1,29 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Draws the `--instances` test scene: a cube inscribed in each instance's bounding sphere. The cube's corners aren't stored
+// anywhere; bit 0, 1 and 2 of the vertex index select the x, y and z side.
+
+layout(set = 0, binding = 1) readonly buffer Bounds { vec4 bounds[]; } boundsBuffers[];
+
+layout(push_constant) uniform Constants {
+    mat4 viewProjection;
+    uint boundsIndex;
+} constants;
+
+layout(location = 0) out vec3 color;
+
+void main() {
+    vec3 corner = vec3((gl_VertexIndex & 1) != 0 ? 1.0 : -1.0,
+                       (gl_VertexIndex & 2) != 0 ? 1.0 : -1.0,
+                       (gl_VertexIndex & 4) != 0 ? 1.0 : -1.0);
+
+    // gl_InstanceIndex is the culling pass's first instance, i.e. the instance's index in the scene.
+    vec4 sphere = boundsBuffers[constants.boundsIndex].bounds[gl_InstanceIndex];
+    vec3 position = sphere.xyz + corner * (sphere.w * 0.57735);
+    gl_Position = constants.viewProjection * vec4(position, 1.0);
+
+    uint hash = uint(gl_InstanceIndex) * 2654435761u;
+    vec3 instanceColor = vec3(hash & 255u, (hash >> 8) & 255u, (hash >> 16) & 255u) / 255.0;
+    color = instanceColor * (0.6 + 0.4 * (corner * 0.5 + 0.5));
+}
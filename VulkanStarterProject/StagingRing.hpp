@@ -0,0 +1,328 @@
+#ifndef StagingRing_hpp
+#define StagingRing_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "FrameArena.hpp"
+#include "MemoryAllocator.hpp"
+#include "SubmissionScheduler.hpp"
+
+/// A region of the staging ring returned by `StagingRing::allocate()`. Write `size` bytes to `data`.
+struct StagingAllocation {
+    void* data;
+    VkDeviceSize offset;    // offset into `StagingRing::getBuffer()`
+    VkDeviceSize size;
+};
+
+/// Persistently mapped, host-visible upload buffer split into one region per frame in flight.
+///
+/// An upload is a bump-pointer allocation plus a `memcpy`; the matching `vkCmdCopyBuffer`/`vkCmdCopyBufferToImage` is queued and
+/// recorded once per frame, so there's no `vkMapMemory` and no fence wait per upload. Each region is reused only after
+/// `beginFrame()` is called for its slot, which must happen after that slot's previous frame has completed.
+///
+/// When the device has a dedicated transfer queue, `submit()` records the copies into a transfer command buffer, submits it on
+/// the transfer queue, and returns the point that the frame's graphics submit must wait on. Otherwise `recordCopies()` puts
+/// them at the start of the graphics command buffer. Either way `getUploadTicket()` names the point at which they're done.
+///
+/// With a dedicated transfer queue, destination resources must be created with concurrent sharing between the transfer and
+/// graphics families (see `GpuMemoryAllocator::createBuffer()`), since no queue family ownership transfers are recorded.
+///
+/// `allocate()` and the `upload*()` methods are thread-safe. Allocations are valid only until the end of the frame they were
+/// made in, i.e. between `beginFrame()` and `submit()`/`recordCopies()`.
+class StagingRing {
+public:
+    /// Stages accessed by the copied data may only start after the uploads. The frame's graphics submit waits on
+    /// `submit()`'s semaphore at these stages.
+    static constexpr VkPipelineStageFlags CONSUMER_STAGES =
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    /// - Parameter frameArena: holds the barriers of the copies being recorded. Reset it no earlier than the next frame.
+    void init(VkDevice device, GpuMemoryAllocator& allocator, VkDeviceSize bytesPerFrame, uint32_t frameCount,
+              uint32_t graphicsFamily, uint32_t transferFamily, SubmissionScheduler& scheduler, FrameArena& frameArena) {
+        this->device = device;
+        this->allocator = &allocator;
+        this->bytesPerFrame = bytesPerFrame;
+        this->scheduler = &scheduler;
+        this->frameArena = &frameArena;
+        useTransferQueue = transferFamily != graphicsFamily;
+
+        allocator.createBuffer(bytesPerFrame * frameCount, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CpuToGpu, buffer, allocation);
+        if (allocation.mappedData == nullptr) {
+            throw std::runtime_error("Staging ring memory is not host visible.");
+        }
+
+        frames.resize(frameCount);
+        if (useTransferQueue) {
+            for (auto& frame : frames) {
+                VkCommandPoolCreateInfo poolInfo{};
+                poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+                poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+                poolInfo.queueFamilyIndex = transferFamily;
+
+                VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Transfer command pool was not created. Error code " + std::to_string(result));
+                }
+
+                VkCommandBufferAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                allocInfo.commandPool = frame.commandPool;
+                allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+                allocInfo.commandBufferCount = 1;
+                vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer);
+            }
+        }
+    }
+
+    void destroy() {
+        for (auto& frame : frames) {
+            if (frame.commandPool != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(device, frame.commandPool, nullptr);
+            }
+        }
+        frames.clear();
+        allocator->destroyBuffer(buffer, allocation);
+    }
+
+    /// Starts reusing the region of `frameIndex`. Call after waiting for that frame slot's previous frame.
+    /// Beginning the same slot again before its copies were submitted or recorded, e.g. after an out of date swap chain ended
+    /// the frame early, keeps what was already queued.
+    void beginFrame(uint32_t frameIndex) {
+        if (frameIndex % frames.size() == currentFrame && copiesConsumed == false) {
+            return;
+        }
+        currentFrame = frameIndex % frames.size();
+        head.store(0);
+        copiesConsumed = false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        bufferCopies.clear();
+        imageCopies.clear();
+
+        if (frames[currentFrame].commandPool != VK_NULL_HANDLE) {
+            vkResetCommandPool(device, frames[currentFrame].commandPool, 0);
+        }
+    }
+
+    /// Reserves `size` bytes in the current frame's region. Returns std::nullopt when the region is full; the upload can be
+    /// retried next frame. `alignment` must be a power of two.
+    std::optional<StagingAllocation> allocate(VkDeviceSize size, VkDeviceSize alignment = 16) {
+        VkDeviceSize offset = head.load();
+        VkDeviceSize alignedOffset;
+        do {
+            alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+            if (alignedOffset + size > bytesPerFrame) {
+                return std::nullopt;
+            }
+        } while (head.compare_exchange_weak(offset, alignedOffset + size) == false);
+
+        VkDeviceSize ringOffset = currentFrame * bytesPerFrame + alignedOffset;
+        return StagingAllocation{static_cast<char*>(allocation.mappedData) + ringOffset, ringOffset, size};
+    }
+
+    /// Queues a copy out of memory previously returned by `allocate()`.
+    void enqueueBufferCopy(const StagingAllocation& source, VkBuffer destination, VkDeviceSize destinationOffset) {
+        std::lock_guard<std::mutex> lock(mutex);
+        bufferCopies.push_back({destination, {source.offset, destinationOffset, source.size}});
+    }
+
+    /// Queues a copy into mip level 0 / layer 0 of a color image. The image is moved to `finalLayout` afterwards.
+    void enqueueImageCopy(const StagingAllocation& source, VkImage destination, VkExtent3D extent, VkImageLayout finalLayout) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = source.offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = extent;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        imageCopies.push_back({destination, region, finalLayout});
+    }
+
+    /// Copies `size` bytes into the ring and queues the upload to `destination`. Returns false if the region is full.
+    bool uploadBuffer(const void* data, VkDeviceSize size, VkBuffer destination, VkDeviceSize destinationOffset = 0) {
+        auto staging = allocate(size, 16);
+        if (staging.has_value() == false) {
+            return false;
+        }
+        memcpy(staging->data, data, size);
+        enqueueBufferCopy(*staging, destination, destinationOffset);
+        return true;
+    }
+
+    /// Copies tightly packed texels into the ring and queues the upload to `destination`. Returns false if the region is full.
+    bool uploadImage(const void* data, VkDeviceSize size, VkImage destination, VkExtent3D extent,
+                     VkImageLayout finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        auto staging = allocate(size, 16);
+        if (staging.has_value() == false) {
+            return false;
+        }
+        memcpy(staging->data, data, size);
+        enqueueImageCopy(*staging, destination, extent, finalLayout);
+        return true;
+    }
+
+    bool usesTransferQueue() const { return useTransferQueue; }
+    /// The point at which the copies queued so far in the current frame will have finished: the transfer submission that
+    /// `submit()` is about to make, or the graphics submission that `recordCopies()` records into. Call from the thread that
+    /// calls `beginFrame()` and `submit()`, before the frame's copies are submitted, and only when copies were queued.
+    TimelinePoint getUploadTicket() const {
+        return scheduler->getNextPoint(useTransferQueue ? QueueType::Transfer : QueueType::Graphics);
+    }
+
+    bool isUploadComplete(TimelinePoint ticket) const { return scheduler->isComplete(ticket); }
+
+    /// With a dedicated transfer queue, submits this frame's copies there and returns the point the graphics submit must wait
+    /// on at `CONSUMER_STAGES`. The point's value is 0 when there's nothing to wait for.
+    TimelinePoint submit() {
+        if (useTransferQueue == false) {
+            return {};
+        }
+        copiesConsumed = true;
+        if (hasPendingCopies() == false) {
+            return {};
+        }
+
+        FrameData& frame = frames[currentFrame];
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(frame.commandBuffer, &beginInfo);
+        recordPendingCopies(frame.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+        vkEndCommandBuffer(frame.commandBuffer);
+
+        // The frame's graphics submit waits on this one, so waiting on the frame also covers the command buffer and region.
+        submission.commandBuffers.assign(1, frame.commandBuffer);
+        submission.signalsOtherQueues = true;
+        return scheduler->submit(QueueType::Transfer, submission);
+    }
+
+    /// Without a dedicated transfer queue, records this frame's copies into `commandBuffer`, followed by a barrier that makes
+    /// them visible to `CONSUMER_STAGES`. Call before the render pass begins.
+    void recordCopies(VkCommandBuffer commandBuffer) {
+        if (useTransferQueue) {
+            return;
+        }
+        copiesConsumed = true;
+        if (hasPendingCopies()) {
+            recordPendingCopies(commandBuffer, CONSUMER_STAGES,
+                                VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+                                VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+        }
+    }
+
+    VkBuffer getBuffer() const { return buffer; }
+    VkDeviceSize getBytesPerFrame() const { return bytesPerFrame; }
+    VkDeviceSize getBytesUsed() const { return head.load(); }
+
+private:
+    struct FrameData {
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    };
+
+    struct BufferCopy {
+        VkBuffer destination;
+        VkBufferCopy region;
+    };
+
+    struct ImageCopy {
+        VkImage destination;
+        VkBufferImageCopy region;
+        VkImageLayout finalLayout;
+    };
+
+    bool hasPendingCopies() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bufferCopies.empty() == false || imageCopies.empty() == false;
+    }
+
+    static VkImageMemoryBarrier imageBarrier(VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                                             VkAccessFlags srcAccess, VkAccessFlags dstAccess) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstAccessMask = dstAccess;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        return barrier;
+    }
+
+    void recordPendingCopies(VkCommandBuffer commandBuffer, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Move every destination image into TRANSFER_DST in one batch.
+        FrameVector<VkImageMemoryBarrier> barriers(*frameArena, imageCopies.size());
+        for (const auto& copy : imageCopies) {
+            barriers.push_back(imageBarrier(copy.destination, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                            0, VK_ACCESS_TRANSFER_WRITE_BIT));
+        }
+        if (barriers.empty() == false) {
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+        }
+
+        for (const auto& copy : bufferCopies) {
+            vkCmdCopyBuffer(commandBuffer, buffer, copy.destination, 1, &copy.region);
+        }
+        for (const auto& copy : imageCopies) {
+            vkCmdCopyBufferToImage(commandBuffer, buffer, copy.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy.region);
+        }
+
+        // Then make the writes visible and move images to their final layouts, again in one batch.
+        barriers.clear();
+        for (const auto& copy : imageCopies) {
+            barriers.push_back(imageBarrier(copy.destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy.finalLayout,
+                                            VK_ACCESS_TRANSFER_WRITE_BIT, dstAccess));
+        }
+
+        VkMemoryBarrier memoryBarrier{};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = dstAccess;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0,
+                             bufferCopies.empty() ? 0 : 1, &memoryBarrier, 0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        bufferCopies.clear();
+        imageCopies.clear();
+    }
+
+    VkDevice device = VK_NULL_HANDLE;
+    GpuMemoryAllocator* allocator = nullptr;
+    SubmissionScheduler* scheduler = nullptr;
+    FrameArena* frameArena = nullptr;
+    bool useTransferQueue = false;
+    SubmissionScheduler::Submission submission;     // reused, so that submitting doesn't allocate
+
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation allocation;
+    VkDeviceSize bytesPerFrame = 0;
+
+    std::vector<FrameData> frames;
+    size_t currentFrame = 0;
+    std::atomic<VkDeviceSize> head{0};
+
+    // False until the current frame's copies were submitted or recorded.
+    bool copiesConsumed = true;
+
+    std::mutex mutex;
+    std::vector<BufferCopy> bufferCopies;
+    std::vector<ImageCopy> imageCopies;
+};
+
+#endif /* StagingRing_hpp */
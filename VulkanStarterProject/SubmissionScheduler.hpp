@@ -0,0 +1,488 @@
+#ifndef SubmissionScheduler_hpp
+#define SubmissionScheduler_hpp
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "FrameArena.hpp"
+
+/// The queues work is submitted to. Presentation isn't one of them: presents can only wait on binary semaphores and signal
+/// nothing the host can observe, so they're ordered after the graphics submission that renders the image.
+enum class QueueType : uint32_t {
+    Graphics,
+    Compute,
+    Transfer,
+};
+constexpr uint32_t QUEUE_TYPE_COUNT = 3;
+
+/// A point on one queue's timeline. It's reached once every submission on that queue up to `value` has completed; value 0
+/// is reached from the start.
+struct TimelinePoint {
+    QueueType queue = QueueType::Graphics;
+    uint64_t value = 0;
+};
+
+/// The last point on each queue at which a resource was used. It can be destroyed once all of them are reached.
+struct ResourceUse {
+    std::array<uint64_t, QUEUE_TYPE_COUNT> lastUsed{};
+
+    void markUsed(TimelinePoint point) {
+        uint64_t& value = lastUsed[static_cast<uint32_t>(point.queue)];
+        value = std::max(value, point.value);
+    }
+};
+
+/// Submits to the graphics, compute and transfer queues and tracks each queue's progress as a monotonically increasing value.
+///
+/// With timeline semaphores (Vulkan 1.2 or VK_KHR_timeline_semaphore), every queue signals one timeline semaphore, so
+/// waiting on another queue's work, on the GPU or the host, is a matter of naming a `TimelinePoint`. Without them, each
+/// submission signals a pooled fence for the host side, and a submission that other queues wait on signals a pooled binary
+/// semaphore, which exactly one later submission may wait on.
+///
+/// Resources handed to `destroyAfter()` are destroyed by `collect()` once the queues have passed their last use.
+/// All methods are thread-safe.
+class SubmissionScheduler {
+public:
+    struct Wait {
+        TimelinePoint point;
+        VkPipelineStageFlags stages;
+    };
+
+    struct BinaryWait {
+        VkSemaphore semaphore;
+        VkPipelineStageFlags stages;
+    };
+
+    struct Submission {
+        std::vector<VkCommandBuffer> commandBuffers;
+        std::vector<Wait> waits;                    // points on other queues, or earlier points on this one
+        std::vector<BinaryWait> binaryWaits;        // e.g. a swap chain image being acquired
+        std::vector<VkSemaphore> binarySignals;     // e.g. for the present
+
+        // Set when another queue will wait on this submission. Only matters without timeline semaphores.
+        bool signalsOtherQueues = false;
+    };
+
+    /// `queues` are indexed by `QueueType` and may alias one another. Pass the timeline semaphore entry points when the
+    /// feature is enabled, otherwise null.
+    void init(VkDevice device, const std::array<VkQueue, QUEUE_TYPE_COUNT>& queues,
+              PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue, PFN_vkWaitSemaphoresKHR waitSemaphores) {
+        this->device = device;
+        bool useTimelines = getSemaphoreCounterValue != nullptr && waitSemaphores != nullptr;
+        this->getSemaphoreCounterValue = useTimelines ? getSemaphoreCounterValue : nullptr;
+        this->waitForSemaphores = useTimelines ? waitSemaphores : nullptr;
+
+        for (uint32_t i = 0; i < QUEUE_TYPE_COUNT; i++) {
+            timelines[i] = Timeline{};
+            timelines[i].queue = queues[i];
+            if (useTimelines) {
+                VkSemaphoreTypeCreateInfo typeInfo{};
+                typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+                typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+                typeInfo.initialValue = 0;
+
+                VkSemaphoreCreateInfo semaphoreInfo{};
+                semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+                semaphoreInfo.pNext = &typeInfo;
+
+                VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timelines[i].semaphore);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Queue timeline semaphore was not created. Error code " + std::to_string(result));
+                }
+            }
+        }
+    }
+
+    /// Waits for every queue, runs every deferred destruction, and destroys the semaphores and fences.
+    void destroy() {
+        waitIdle();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& deferred : deferredDestructions) {
+            deferred.destroy();
+        }
+        deferredDestructions.clear();
+
+        for (auto& timeline : timelines) {
+            vkDestroySemaphore(device, timeline.semaphore, nullptr);
+            for (auto& pending : timeline.pending) {
+                vkDestroyFence(device, pending.fence, nullptr);
+                vkDestroySemaphore(device, pending.crossQueueSemaphore, nullptr);
+                for (auto semaphore : pending.consumedSemaphores) {
+                    vkDestroySemaphore(device, semaphore, nullptr);
+                }
+            }
+            timeline = Timeline{};
+        }
+        for (auto fence : freeFences) {
+            vkDestroyFence(device, fence, nullptr);
+        }
+        for (auto semaphore : freeSemaphores) {
+            vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        freeFences.clear();
+        freeSemaphores.clear();
+    }
+
+    bool usesTimelineSemaphores() const { return getSemaphoreCounterValue != nullptr; }
+
+    /// Submits `submission` to `queue` and returns the point it signals.
+    TimelinePoint submit(QueueType queue, const Submission& submission) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Timeline& timeline = timelines[static_cast<uint32_t>(queue)];
+        uint64_t value = timeline.submittedValue + 1;
+
+        // Everything the submit info points to is copied by vkQueueSubmit, so the arena can be reset by the next submit.
+        scratch.reset();
+        FrameVector<VkSemaphore> waitSemaphores(scratch);
+        FrameVector<uint64_t> waitValues(scratch);
+        FrameVector<VkPipelineStageFlags> waitStages(scratch);
+        FrameVector<VkSemaphore> signalSemaphores(scratch);
+        FrameVector<uint64_t> signalValues(scratch);
+        PendingSubmission pending;
+        pending.value = value;
+        if (usesTimelineSemaphores() == false && spareSemaphoreLists.empty() == false) {
+            pending.consumedSemaphores = std::move(spareSemaphoreLists.back());
+            spareSemaphoreLists.pop_back();
+        }
+
+        for (const auto& wait : submission.waits) {
+            if (wait.point.value == 0) {
+                continue;
+            }
+            if (usesTimelineSemaphores()) {
+                waitSemaphores.push_back(timelines[static_cast<uint32_t>(wait.point.queue)].semaphore);
+                waitValues.push_back(wait.point.value);
+                waitStages.push_back(wait.stages);
+            }
+            else if (VkSemaphore semaphore = takeCrossQueueSemaphore(wait.point)) {
+                waitSemaphores.push_back(semaphore);
+                waitValues.push_back(0);
+                waitStages.push_back(wait.stages);
+                pending.consumedSemaphores.push_back(semaphore);
+            }
+        }
+        for (const auto& wait : submission.binaryWaits) {
+            waitSemaphores.push_back(wait.semaphore);
+            waitValues.push_back(0);
+            waitStages.push_back(wait.stages);
+        }
+
+        if (usesTimelineSemaphores()) {
+            signalSemaphores.push_back(timeline.semaphore);
+            signalValues.push_back(value);
+        }
+        else {
+            pending.fence = acquireFence();
+            if (submission.signalsOtherQueues) {
+                pending.crossQueueSemaphore = acquireSemaphore();
+                signalSemaphores.push_back(pending.crossQueueSemaphore);
+                signalValues.push_back(0);
+            }
+        }
+        for (auto semaphore : submission.binarySignals) {
+            signalSemaphores.push_back(semaphore);
+            signalValues.push_back(0);
+        }
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.pNext = usesTimelineSemaphores() ? &timelineInfo : nullptr;
+        submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.commandBufferCount = static_cast<uint32_t>(submission.commandBuffers.size());
+        submitInfo.pCommandBuffers = submission.commandBuffers.data();
+        submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+        submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+        VkResult result = vkQueueSubmit(timeline.queue, 1, &submitInfo, pending.fence);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Queue submission failed. Error code " + std::to_string(result));
+        }
+
+        timeline.submittedValue = value;
+        if (usesTimelineSemaphores() == false) {
+            timeline.pending.push_back(std::move(pending));
+        }
+        return {queue, value};
+    }
+
+    /// The point the next submission to `queue` will signal.
+    TimelinePoint getNextPoint(QueueType queue) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {queue, timelines[static_cast<uint32_t>(queue)].submittedValue + 1};
+    }
+
+    TimelinePoint getLastSubmitted(QueueType queue) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return {queue, timelines[static_cast<uint32_t>(queue)].submittedValue};
+    }
+
+    /// Everything submitted so far, on every queue.
+    ResourceUse getAllSubmitted() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        ResourceUse use;
+        for (uint32_t i = 0; i < QUEUE_TYPE_COUNT; i++) {
+            use.lastUsed[i] = timelines[i].submittedValue;
+        }
+        return use;
+    }
+
+    bool isComplete(TimelinePoint point) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return isCompleteLocked(point);
+    }
+
+    bool isComplete(const ResourceUse& use) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return isCompleteLocked(use);
+    }
+
+    /// Blocks until `point` is reached.
+    void wait(TimelinePoint point) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (point.value == 0 || isCompleteLocked(point)) {
+            return;
+        }
+        Timeline& timeline = timelines[static_cast<uint32_t>(point.queue)];
+        if (point.value > timeline.submittedValue) {
+            throw std::runtime_error("Waiting on a queue timeline value that was never submitted.");
+        }
+
+        if (usesTimelineSemaphores()) {
+            VkSemaphore semaphore = timeline.semaphore;
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = &semaphore;
+            waitInfo.pValues = &point.value;
+
+            // Other threads may submit meanwhile; the semaphore itself can't go away while anyone waits.
+            lock.unlock();
+            waitForSemaphores(device, &waitInfo, std::numeric_limits<uint64_t>::max());
+            return;
+        }
+
+        for (const auto& pending : timeline.pending) {
+            if (pending.value == point.value && pending.fence != VK_NULL_HANDLE) {
+                VkFence fence = pending.fence;
+                vkWaitForFences(device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+                break;
+            }
+        }
+        updateFallbackProgress(timeline);
+    }
+
+    /// Blocks until everything submitted so far on every queue has completed.
+    void waitIdle() {
+        for (uint32_t i = 0; i < QUEUE_TYPE_COUNT; i++) {
+            wait(getLastSubmitted(static_cast<QueueType>(i)));
+        }
+    }
+
+    /// Calls `destroy` from `collect()` once every queue has passed `use`.
+    void destroyAfter(const ResourceUse& use, std::function<void()> destroy) {
+        std::lock_guard<std::mutex> lock(mutex);
+        deferredDestructions.push_back({use, std::move(destroy)});
+    }
+
+    void destroyAfter(TimelinePoint point, std::function<void()> destroy) {
+        ResourceUse use;
+        use.markUsed(point);
+        destroyAfter(use, std::move(destroy));
+    }
+
+    /// Runs the deferred destructions whose resources are no longer in use. Call once per frame, from one thread.
+    void collect() {
+        {
+            // Compacts the list in place, keeping the order, so a frame with nothing to destroy doesn't allocate.
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t kept = 0;
+            for (size_t i = 0; i < deferredDestructions.size(); i++) {
+                if (isCompleteLocked(deferredDestructions[i].use)) {
+                    readyDestructions.push_back(std::move(deferredDestructions[i]));
+                }
+                else {
+                    if (kept != i) {
+                        deferredDestructions[kept] = std::move(deferredDestructions[i]);
+                    }
+                    kept++;
+                }
+            }
+            deferredDestructions.erase(deferredDestructions.begin() + kept, deferredDestructions.end());
+        }
+
+        // Outside the lock, so destructors may defer more work.
+        for (auto& deferred : readyDestructions) {
+            deferred.destroy();
+        }
+        readyDestructions.clear();
+    }
+
+    size_t getPendingDestructionCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return deferredDestructions.size();
+    }
+
+private:
+    /// Fallback bookkeeping for one submission.
+    struct PendingSubmission {
+        uint64_t value = 0;
+        VkFence fence = VK_NULL_HANDLE;                     // returned to the pool once signaled
+        VkSemaphore crossQueueSemaphore = VK_NULL_HANDLE;   // until another submission waits on it
+        std::vector<VkSemaphore> consumedSemaphores;        // waited on by this submission; reusable once it completes
+    };
+
+    struct Timeline {
+        VkQueue queue = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;     // timeline mode
+        uint64_t submittedValue = 0;
+        uint64_t completedValue = 0;                // cached; may lag behind the device
+
+        // Fallback mode, in submission order. Only a few frames' worth, so retiring from the front shifts little.
+        std::vector<PendingSubmission> pending;
+    };
+
+    struct DeferredDestruction {
+        ResourceUse use;
+        std::function<void()> destroy;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+    PFN_vkWaitSemaphoresKHR waitForSemaphores = nullptr;
+
+    mutable std::mutex mutex;
+    std::array<Timeline, QUEUE_TYPE_COUNT> timelines;
+    FrameArena scratch{4 * 1024};   // `submit()`'s semaphore arrays
+    std::vector<DeferredDestruction> deferredDestructions;
+    std::vector<DeferredDestruction> readyDestructions;     // `collect()`'s, kept for their capacity
+    std::vector<VkFence> freeFences;
+    std::vector<VkSemaphore> freeSemaphores;
+    std::vector<std::vector<VkSemaphore>> spareSemaphoreLists;  // emptied `consumedSemaphores`, kept for their capacity
+
+    bool isCompleteLocked(TimelinePoint point) {
+        Timeline& timeline = timelines[static_cast<uint32_t>(point.queue)];
+        if (point.value <= timeline.completedValue) {
+            return true;
+        }
+        if (usesTimelineSemaphores()) {
+            getSemaphoreCounterValue(device, timeline.semaphore, &timeline.completedValue);
+        }
+        else {
+            updateFallbackProgress(timeline);
+        }
+        return point.value <= timeline.completedValue;
+    }
+
+    bool isCompleteLocked(const ResourceUse& use) {
+        for (uint32_t i = 0; i < QUEUE_TYPE_COUNT; i++) {
+            if (isCompleteLocked({static_cast<QueueType>(i), use.lastUsed[i]}) == false) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Advances `completedValue` past every leading submission whose fence has signaled.
+    void updateFallbackProgress(Timeline& timeline) {
+        for (auto& pending : timeline.pending) {
+            if (pending.fence == VK_NULL_HANDLE) {
+                continue;
+            }
+            if (vkGetFenceStatus(device, pending.fence) != VK_SUCCESS) {
+                break;
+            }
+            freeFences.push_back(pending.fence);
+            pending.fence = VK_NULL_HANDLE;
+            freeSemaphores.insert(freeSemaphores.end(), pending.consumedSemaphores.begin(), pending.consumedSemaphores.end());
+            pending.consumedSemaphores.clear();
+            timeline.completedValue = pending.value;
+        }
+
+        // A signaled semaphore nobody has waited on yet keeps its entry until the queue's next submission has completed too,
+        // so a submission made in the meantime can still wait on it. Past that, waiters find the point complete and don't
+        // need it. A signaled binary semaphore can't be signaled again, so it's destroyed rather than pooled.
+        size_t retired = 0;
+        while (retired < timeline.pending.size() && timeline.pending[retired].fence == VK_NULL_HANDLE) {
+            PendingSubmission& front = timeline.pending[retired];
+            if (front.crossQueueSemaphore != VK_NULL_HANDLE) {
+                if (front.value >= timeline.completedValue) {
+                    break;
+                }
+                vkDestroySemaphore(device, front.crossQueueSemaphore, nullptr);
+            }
+            spareSemaphoreLists.push_back(std::move(front.consumedSemaphores));
+            retired++;
+        }
+        timeline.pending.erase(timeline.pending.begin(), timeline.pending.begin() + retired);
+    }
+
+    /// Without timeline semaphores, a wait on another submission is a wait on the binary semaphore it signaled.
+    VkSemaphore takeCrossQueueSemaphore(TimelinePoint point) {
+        Timeline& timeline = timelines[static_cast<uint32_t>(point.queue)];
+        for (auto& pending : timeline.pending) {
+            if (pending.value == point.value && pending.crossQueueSemaphore != VK_NULL_HANDLE) {
+                VkSemaphore semaphore = pending.crossQueueSemaphore;
+                pending.crossQueueSemaphore = VK_NULL_HANDLE;
+                return semaphore;
+            }
+        }
+        if (point.value <= timeline.completedValue) {
+            return VK_NULL_HANDLE; // already complete, and nothing was signaled for other queues
+        }
+        throw std::runtime_error("A submission waits on one that wasn't submitted with signalsOtherQueues, or that was "
+                                 "already waited on.");
+    }
+
+    VkFence acquireFence() {
+        if (freeFences.empty() == false) {
+            VkFence fence = freeFences.back();
+            freeFences.pop_back();
+            vkResetFences(device, 1, &fence);
+            return fence;
+        }
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        VkFence fence;
+        VkResult result = vkCreateFence(device, &fenceInfo, nullptr, &fence);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Submission fence was not created. Error code " + std::to_string(result));
+        }
+        return fence;
+    }
+
+    VkSemaphore acquireSemaphore() {
+        if (freeSemaphores.empty() == false) {
+            VkSemaphore semaphore = freeSemaphores.back();
+            freeSemaphores.pop_back();
+            return semaphore;
+        }
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VkSemaphore semaphore;
+        VkResult result = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Cross-queue semaphore was not created. Error code " + std::to_string(result));
+        }
+        return semaphore;
+    }
+};
+
+#endif /* SubmissionScheduler_hpp */
@@ -10,10 +10,122 @@
 #include <vector>
 #include <set>
 #include <optional>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <tuple>
+#include <cctype>
+#include <fstream>
+#include <cstdio>
+#include <thread>
+#include <future>
+#include <new>
+
+#include <sys/resource.h>
+
+#include "MemoryAllocator.hpp"
+#include "StagingRing.hpp"
+#include "FramePacer.hpp"
+#include "FrameProfiler.hpp"
+#include "FrameArena.hpp"
+#include "JobSystem.hpp"
+#include "ParallelRecorder.hpp"
+#include "RenderGraph.hpp"
+#include "PipelineManager.hpp"
+#include "QualityPreset.hpp"
+#include "ShaderLibrary.hpp"
+#include "DescriptorHeap.hpp"
+#include "DynamicResolution.hpp"
+#include "GpuCulling.hpp"
+#include "GpuWorkers.hpp"
+#include "DrawList.hpp"
+#include "AssetStreamer.hpp"
+#include "DeviceHandle.hpp"
+#include "SubmissionScheduler.hpp"
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
+/// Upper bound for `--windows`, e.g. one per display of a control room.
+const uint32_t MAX_WINDOWS = 8;
+
+/// Number of frames the CPU may record ahead of the GPU. Two lets the CPU build frame N+1 while the GPU renders frame N.
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+
+/// Upload budget per frame in flight for the staging ring.
+const VkDeviceSize DEFAULT_STAGING_BYTES_PER_FRAME = 8 * 1024 * 1024;
+
+/// Frames measured by `--benchmark`, after warm-up frames that fill caches and let clocks ramp up.
+const uint32_t DEFAULT_BENCHMARK_FRAMES = 1000;
+const uint32_t DEFAULT_BENCHMARK_WARMUP_FRAMES = 60;
+const uint32_t DEFAULT_BATCH_INSTANCES = 65536;
+const uint32_t DEFAULT_PIPELINE_COMPILE_THREADS = 2;
+const uint32_t DEFAULT_STREAMING_THREADS = 2;
+
+/// Counts heap allocations in `heapAllocationCount` on the threads that draw and record frames (see `countsHeapAllocations`),
+/// so that `FrameProfiler` can tell whether frames allocate. Every plain, aligned and nothrow form of `operator new` is
+/// replaced below; the array forms call them.
+static void* countedAllocation(std::size_t size, std::size_t alignment) noexcept {
+    if (countsHeapAllocations) {
+        heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    size = size == 0 ? 1 : size;
+    if (alignment <= alignof(std::max_align_t)) {
+        return std::malloc(size);
+    }
+    void* pointer = nullptr;
+    return posix_memalign(&pointer, alignment, size) == 0 ? pointer : nullptr;
+}
+
+void* operator new(std::size_t size) {
+    if (void* pointer = countedAllocation(size, 0)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    if (void* pointer = countedAllocation(size, static_cast<std::size_t>(alignment))) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAllocation(size, static_cast<std::size_t>(alignment));
+}
+
+// malloc and posix_memalign memory are both released with free.
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(pointer);
+}
+
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
 };
@@ -55,32 +167,715 @@ bool checkValidationLayerSupport() {
     return true;
 }
 
+/// How the swap chain trades latency against power and tearing.
+/// - LowLatency: IMMEDIATE if available (may tear), then MAILBOX, FIFO_RELAXED, FIFO.
+/// - Balanced: MAILBOX if available, then FIFO. Never tears.
+/// - PowerSaver: FIFO with as few images as possible, so the CPU sleeps on vsync. Meant for running on battery.
+enum class PresentPolicy {
+    LowLatency,
+    Balanced,
+    PowerSaver,
+};
+
+const char* presentPolicyName(PresentPolicy policy) {
+    switch (policy) {
+        case PresentPolicy::LowLatency: return "low-latency";
+        case PresentPolicy::Balanced: return "balanced";
+        case PresentPolicy::PowerSaver: return "power-saver";
+    }
+    return "unknown";
+}
+
+/// One recording worker per core besides the main thread, which records too.
+uint32_t defaultRecordingThreads() {
+    uint32_t cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
+/// Peak resident set size of this process in bytes.
+size_t peakResidentBytes() {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);           // bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;    // kilobytes on Linux
+#endif
+}
+
+const char* presentModeName(VkPresentModeKHR presentMode) {
+    switch (presentMode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "IMMEDIATE";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "MAILBOX";
+        case VK_PRESENT_MODE_FIFO_KHR: return "FIFO";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "FIFO_RELAXED";
+        default: return "UNKNOWN";
+    }
+}
+
+/// Column-major, as GLSL expects.
+using Matrix4 = std::array<float, 16>;
+
+Matrix4 multiply(const Matrix4& a, const Matrix4& b) {
+    Matrix4 result{};
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            for (int i = 0; i < 4; i++) {
+                result[column * 4 + row] += a[i * 4 + row] * b[column * 4 + i];
+            }
+        }
+    }
+    return result;
+}
+
+/// Right-handed perspective projection into Vulkan's clip space: depth in [0, 1] and y pointing down.
+Matrix4 perspective(float verticalFov, float aspect, float near, float far) {
+    float focal = 1.0f / std::tan(verticalFov / 2.0f);
+    Matrix4 result{};
+    result[0] = focal / aspect;
+    result[5] = -focal;
+    result[10] = far / (near - far);
+    result[11] = -1.0f;
+    result[14] = near * far / (near - far);
+    return result;
+}
+
+/// Right-handed view matrix looking from `eye` at `target`, with +y up.
+Matrix4 lookAt(const std::array<float, 3>& eye, const std::array<float, 3>& target) {
+    auto normalize = [](std::array<float, 3> v) {
+        float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        return std::array<float, 3>{v[0] / length, v[1] / length, v[2] / length};
+    };
+    auto cross = [](const std::array<float, 3>& a, const std::array<float, 3>& b) {
+        return std::array<float, 3>{a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    };
+    auto dot = [](const std::array<float, 3>& a, const std::array<float, 3>& b) {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    };
+    
+    std::array<float, 3> forward = normalize({target[0] - eye[0], target[1] - eye[1], target[2] - eye[2]});
+    std::array<float, 3> side = normalize(cross(forward, {0.0f, 1.0f, 0.0f}));
+    std::array<float, 3> up = cross(side, forward);
+    
+    Matrix4 result{};
+    for (int i = 0; i < 3; i++) {
+        result[i * 4 + 0] = side[i];
+        result[i * 4 + 1] = up[i];
+        result[i * 4 + 2] = -forward[i];
+    }
+    result[12] = -dot(side, eye);
+    result[13] = -dot(up, eye);
+    result[14] = dot(forward, eye);
+    result[15] = 1.0f;
+    return result;
+}
+
+/// Settings that can be changed from the command line.
+struct ApplicationOptions {
+    // The preset that frames in flight, staging size and thread counts default to. Picked from the device unless given
+    // with `--quality`; settings given explicitly win over it.
+    std::optional<QualityTier> quality;
+    
+    uint32_t framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    PresentPolicy presentPolicy = PresentPolicy::Balanced;
+    
+    // Delay input sampling until just before it's needed, using present waits; see `FramePacer`.
+    bool framePacing = false;
+    
+    // Forces a GPU by name or UUID instead of picking the best-scoring one. Empty means automatic.
+    std::string device;
+    
+    // Creates a device on every other GPU and runs the scene's probe views there; see `GpuWorkerPool`.
+    bool multiGpu = false;
+    
+    // Directory the pipeline cache blob is read from and written to.
+    std::string pipelineCacheDirectory = ".";
+    
+    VkDeviceSize stagingBytesPerFrame = DEFAULT_STAGING_BYTES_PER_FRAME;
+    
+    // Worker threads that record secondary command buffers alongside the main thread.
+    uint32_t recordingThreads = defaultRecordingThreads();
+    
+    // Background threads that compile pipelines. At least one.
+    uint32_t pipelineCompileThreads = DEFAULT_PIPELINE_COMPILE_THREADS;
+    
+    // Background threads that read and decode `--assets`.
+    uint32_t streamingThreads = DEFAULT_STREAMING_THREADS;
+    
+    // Which of the settings above came from the command line, so the quality preset leaves them alone.
+    bool framesInFlightGiven = false;
+    bool recordingThreadsGiven = false;
+    bool pipelineCompileThreadsGiven = false;
+    
+    // Print the available instance extensions and other details during startup.
+    bool verbose = false;
+    
+    // Print the full timing report every second instead of only updating the window title.
+    bool printFrameTimings = false;
+    
+    // Where every frame's timings are written on exit, as JSON if it ends in .json and CSV otherwise. Empty means no dump.
+    std::string frameTimingsPath;
+    
+    // Size of the window, or of the render targets when offscreen.
+    uint32_t width = WIDTH;
+    uint32_t height = HEIGHT;
+    
+    // Number of windows, all showing the scene and sharing one device. Closing any of them quits.
+    uint32_t windowCount = 1;
+    
+    // The scene's render targets' size relative to the window; see `DynamicResolution`. Defaults to the quality preset's.
+    std::optional<float> renderScale;
+    
+    // GPU frame time the render scale adapts to hold. Zero keeps the scale fixed.
+    double targetGpuMilliseconds = 0.0;
+    
+    // Renders a fixed number of frames, or for `benchmarkSeconds` if that's positive, then writes a JSON report and exits.
+    bool benchmark = false;
+    uint32_t benchmarkFrames = DEFAULT_BENCHMARK_FRAMES;
+    uint32_t benchmarkWarmupFrames = DEFAULT_BENCHMARK_WARMUP_FRAMES;
+    double benchmarkSeconds = 0.0;
+    std::string benchmarkReportPath = "benchmark.json";
+    
+    // The run fails if p99 frame time exceeds this. Zero disables the check.
+    double benchmarkMaxP99Milliseconds = 0.0;
+    
+    // The run fails if the measured frames made more heap allocations than this, across all threads. The default of zero
+    // asserts a steady state that doesn't allocate at all; `--benchmark-max-allocations=none` disables the check.
+    std::optional<uint64_t> benchmarkMaxAllocations = 0;
+    
+    // Renders into plain images with no window, surface or swap chain. Only valid with `benchmark`.
+    bool offscreen = false;
+    
+    // Runs this many visibility queries on every GPU instead of rendering, then writes a report to `benchmarkReportPath`
+    // and exits; see `runComputeBatch()`. Zero renders.
+    uint32_t computeBatchQueries = 0;
+    
+    // Sticks to render pass objects and 1.0 barriers even if dynamic rendering and synchronization2 are available.
+    bool legacyRendering = false;
+    
+    // Directory of the GLSL sources and of any prebuilt `<name>.spv`. SPIR-V compiled from the sources is cached in
+    // `<pipelineCacheDirectory>/shader-cache`.
+    std::string shaderDirectory = "Shaders";
+    
+    // Recompiles shaders whose sources change while running and swaps the affected pipelines in.
+    bool hotReloadShaders = false;
+    
+    // Size of the GPU-driven test scene of cubes, culled and drawn without any CPU work per instance. Zero means no scene.
+    uint32_t sceneInstances = 0;
+    
+    // Number of tumbling cubes submitted every frame through the draw list, one draw each. Zero means none.
+    uint32_t drawListObjects = 0;
+    
+    // Packed asset archive whose every asset is streamed in at startup, while frames keep rendering. Empty means none.
+    std::string assetArchivePath;
+};
+
+/// Parses the command line:
+/// - `--quality=low|medium|high`, `--frames-in-flight=N`, `--present-policy=low-latency|balanced|power-saver`,
+///   `--frame-pacing`, `--device=<name or UUID>`, `--multi-gpu`, `--windows=N`,
+///   `--pipeline-cache-dir=<path>`, `--resolution=<width>x<height>`, `--render-scale=S`, `--target-gpu-ms=X`,
+///   `--recording-threads=N`, `--pipeline-compile-threads=N`
+/// - `--verbose`, `--profile`, `--profile-dump=<path>`
+/// - `--benchmark`, `--benchmark-frames=N`, `--benchmark-seconds=S`, `--benchmark-warmup=N`, `--benchmark-report=<path>`,
+///   `--benchmark-max-p99-ms=X`, `--benchmark-max-allocations=N|none`, `--offscreen`, `--compute-batch=N`
+/// - `--legacy-rendering`, `--shader-dir=<path>`, `--hot-reload-shaders`, `--instances=N`, `--draw-list=N`,
+///   `--assets=<path>`
+/// The device can also be set with the `VULKAN_STARTER_DEVICE` environment variable; the flag wins. Unknown arguments are
+/// reported and ignored.
+ApplicationOptions parseCommandLine(int argc, char* argv[]) {
+    ApplicationOptions options;
+    
+    if (const char* device = std::getenv("VULKAN_STARTER_DEVICE")) {
+        options.device = device;
+    }
+    
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        
+        if (argument.rfind("--quality=", 0) == 0) {
+            std::string value = argument.substr(strlen("--quality="));
+            if (value == qualityTierName(QualityTier::Low)) {
+                options.quality = QualityTier::Low;
+            }
+            else if (value == qualityTierName(QualityTier::Medium)) {
+                options.quality = QualityTier::Medium;
+            }
+            else if (value == qualityTierName(QualityTier::High)) {
+                options.quality = QualityTier::High;
+            }
+            else {
+                throw std::runtime_error("Unknown quality preset " + value + ".");
+            }
+        }
+        else if (argument.rfind("--frames-in-flight=", 0) == 0) {
+            int value = std::atoi(argument.c_str() + strlen("--frames-in-flight="));
+            if (value < 1) {
+                throw std::runtime_error("--frames-in-flight must be at least 1.");
+            }
+            options.framesInFlight = static_cast<uint32_t>(value);
+            options.framesInFlightGiven = true;
+        }
+        else if (argument.rfind("--present-policy=", 0) == 0) {
+            std::string value = argument.substr(strlen("--present-policy="));
+            if (value == presentPolicyName(PresentPolicy::LowLatency)) {
+                options.presentPolicy = PresentPolicy::LowLatency;
+            }
+            else if (value == presentPolicyName(PresentPolicy::Balanced)) {
+                options.presentPolicy = PresentPolicy::Balanced;
+            }
+            else if (value == presentPolicyName(PresentPolicy::PowerSaver)) {
+                options.presentPolicy = PresentPolicy::PowerSaver;
+            }
+            else {
+                throw std::runtime_error("Unknown present policy " + value + ".");
+            }
+        }
+        else if (argument == "--frame-pacing") {
+            options.framePacing = true;
+        }
+        else if (argument.rfind("--windows=", 0) == 0) {
+            int value = std::atoi(argument.c_str() + strlen("--windows="));
+            if (value < 1 || value > static_cast<int>(MAX_WINDOWS)) {
+                throw std::runtime_error("--windows must be between 1 and " + std::to_string(MAX_WINDOWS) + ".");
+            }
+            options.windowCount = static_cast<uint32_t>(value);
+        }
+        else if (argument.rfind("--device=", 0) == 0) {
+            options.device = argument.substr(strlen("--device="));
+        }
+        else if (argument == "--multi-gpu") {
+            options.multiGpu = true;
+        }
+        else if (argument.rfind("--pipeline-cache-dir=", 0) == 0) {
+            options.pipelineCacheDirectory = argument.substr(strlen("--pipeline-cache-dir="));
+        }
+        else if (argument.rfind("--render-scale=", 0) == 0) {
+            float value = static_cast<float>(std::atof(argument.c_str() + strlen("--render-scale=")));
+            if (value < 0.25f || value > 1.0f) {
+                throw std::runtime_error("--render-scale must be between 0.25 and 1.");
+            }
+            options.renderScale = value;
+        }
+        else if (argument.rfind("--target-gpu-ms=", 0) == 0) {
+            options.targetGpuMilliseconds = std::atof(argument.c_str() + strlen("--target-gpu-ms="));
+            if (options.targetGpuMilliseconds <= 0.0) {
+                throw std::runtime_error("--target-gpu-ms must be positive.");
+            }
+        }
+        else if (argument.rfind("--recording-threads=", 0) == 0) {
+            int value = std::atoi(argument.c_str() + strlen("--recording-threads="));
+            if (value < 0) {
+                throw std::runtime_error("--recording-threads can't be negative.");
+            }
+            options.recordingThreads = static_cast<uint32_t>(value);
+            options.recordingThreadsGiven = true;
+        }
+        else if (argument.rfind("--pipeline-compile-threads=", 0) == 0) {
+            int value = std::atoi(argument.c_str() + strlen("--pipeline-compile-threads="));
+            if (value < 1) {
+                throw std::runtime_error("--pipeline-compile-threads must be at least 1.");
+            }
+            options.pipelineCompileThreads = static_cast<uint32_t>(value);
+            options.pipelineCompileThreadsGiven = true;
+        }
+        else if (argument == "--verbose") {
+            options.verbose = true;
+        }
+        else if (argument == "--profile") {
+            options.printFrameTimings = true;
+        }
+        else if (argument.rfind("--profile-dump=", 0) == 0) {
+            options.frameTimingsPath = argument.substr(strlen("--profile-dump="));
+        }
+        else if (argument.rfind("--resolution=", 0) == 0) {
+            unsigned int width = 0, height = 0;
+            if (sscanf(argument.c_str() + strlen("--resolution="), "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+                throw std::runtime_error("--resolution must look like 1920x1080.");
+            }
+            options.width = width;
+            options.height = height;
+        }
+        else if (argument == "--benchmark") {
+            options.benchmark = true;
+        }
+        else if (argument.rfind("--benchmark-frames=", 0) == 0) {
+            int value = std::atoi(argument.c_str() + strlen("--benchmark-frames="));
+            if (value < 1) {
+                throw std::runtime_error("--benchmark-frames must be at least 1.");
+            }
+            options.benchmarkFrames = static_cast<uint32_t>(value);
+        }
+        else if (argument.rfind("--benchmark-seconds=", 0) == 0) {
+            options.benchmarkSeconds = std::atof(argument.c_str() + strlen("--benchmark-seconds="));
+        }
+        else if (argument.rfind("--benchmark-warmup=", 0) == 0) {
+            options.benchmarkWarmupFrames = static_cast<uint32_t>(std::max(0, std::atoi(argument.c_str() + strlen("--benchmark-warmup="))));
+        }
+        else if (argument.rfind("--benchmark-report=", 0) == 0) {
+            options.benchmarkReportPath = argument.substr(strlen("--benchmark-report="));
+        }
+        else if (argument.rfind("--benchmark-max-p99-ms=", 0) == 0) {
+            options.benchmarkMaxP99Milliseconds = std::atof(argument.c_str() + strlen("--benchmark-max-p99-ms="));
+        }
+        else if (argument.rfind("--benchmark-max-allocations=", 0) == 0) {
+            std::string budget = argument.substr(strlen("--benchmark-max-allocations="));
+            if (budget == "none") {
+                options.benchmarkMaxAllocations.reset();
+            }
+            else {
+                options.benchmarkMaxAllocations = std::strtoull(budget.c_str(), nullptr, 10);
+            }
+        }
+        else if (argument == "--offscreen") {
+            options.offscreen = true;
+        }
+        else if (argument.rfind("--compute-batch=", 0) == 0) {
+            long value = std::atol(argument.c_str() + strlen("--compute-batch="));
+            if (value < 1) {
+                throw std::runtime_error("--compute-batch must be at least 1.");
+            }
+            options.computeBatchQueries = static_cast<uint32_t>(value);
+        }
+        else if (argument == "--legacy-rendering") {
+            options.legacyRendering = true;
+        }
+        else if (argument.rfind("--shader-dir=", 0) == 0) {
+            options.shaderDirectory = argument.substr(strlen("--shader-dir="));
+        }
+        else if (argument == "--hot-reload-shaders") {
+            options.hotReloadShaders = true;
+        }
+        else if (argument.rfind("--instances=", 0) == 0) {
+            long value = std::atol(argument.c_str() + strlen("--instances="));
+            if (value < 0) {
+                throw std::runtime_error("--instances can't be negative.");
+            }
+            options.sceneInstances = static_cast<uint32_t>(value);
+        }
+        else if (argument.rfind("--draw-list=", 0) == 0) {
+            long value = std::atol(argument.c_str() + strlen("--draw-list="));
+            if (value < 0) {
+                throw std::runtime_error("--draw-list can't be negative.");
+            }
+            options.drawListObjects = static_cast<uint32_t>(value);
+        }
+        else if (argument.rfind("--assets=", 0) == 0) {
+            options.assetArchivePath = argument.substr(strlen("--assets="));
+        }
+        else {
+            std::cerr << "Ignoring unknown argument " << argument << '\n';
+        }
+    }
+    
+    // Nothing would ever stop an offscreen run that isn't counting frames.
+    if (options.offscreen && options.benchmark == false) {
+        throw std::runtime_error("--offscreen requires --benchmark.");
+    }
+    if (options.offscreen && options.windowCount > 1) {
+        throw std::runtime_error("--windows can't be combined with --offscreen.");
+    }
+    if (options.computeBatchQueries > 0 && (options.offscreen || options.benchmark || options.windowCount > 1)) {
+        throw std::runtime_error("--compute-batch renders nothing and can't be combined with --offscreen, --benchmark or --windows.");
+    }
+    // Both fill the same grid.
+    if (options.drawListObjects > 0 && options.sceneInstances > 0 && options.computeBatchQueries == 0) {
+        throw std::runtime_error("--draw-list can't be combined with --instances.");
+    }
+    
+    return options;
+}
+
 class HelloTriangleApplication {
 public:
-    void run() {
-        initWindow();
+    explicit HelloTriangleApplication(const ApplicationOptions& options) : options(options) {}
+    
+    /// Returns false if a benchmark missed its frame time budget or its report couldn't be written.
+    bool run() {
+        launchTime = FrameProfiler::Clock::now();
+        if (options.computeBatchQueries > 0) {
+            return runComputeBatch();
+        }
+        initWindowAndInstance();
         initVulkan();
         mainLoop();
+        
+        bool passed = true;
+        if (options.benchmark) {
+            passed = writeBenchmarkReport();
+        }
+        
         cleanup();
+        return passed;
     }
 
 private:
     
-    GLFWwindow * window;
+    ApplicationOptions options;
+    
+    // When `run()` started; time to first frame is measured from here.
+    FrameProfiler::Clock::time_point launchTime;
+    double timeToFirstFrameMilliseconds = 0.0;
     VkInstance instance;
     VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    
+    // The version the instance was created with: the loader's, capped at the newest one used here.
+    uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+    
+    // VK_KHR_get_physical_device_properties2 was enabled on the instance, which is needed to read device UUIDs on 1.0.
+    PFN_vkGetPhysicalDeviceProperties2KHR getPhysicalDeviceProperties2 = nullptr;
+    
+    // From Vulkan 1.1 or VK_KHR_get_physical_device_properties2. Null if neither is available.
+    PFN_vkGetPhysicalDeviceFeatures2KHR getPhysicalDeviceFeatures2 = nullptr;
+    
+    // VK_EXT_surface_maintenance1 and VK_KHR_get_surface_capabilities2 were enabled on the instance, which
+    // VK_EXT_swapchain_maintenance1 needs.
+    bool surfaceMaintenance1 = false;
+    
     VkDevice device;
-    VkSurfaceKHR surface;
     VkQueue graphicsQueue;
     VkQueue presentationQueue;
-    VkSwapchainKHR swapChain;
-    std::vector<VkImage> swapChainImages;
-    VkFormat swapChainImageFormat;
-    VkExtent2D swapChainExtent;
-    std::vector<VkImageView> swapChainImageViews;
     
+    // Alias graphicsQueue when the device has no dedicated family for them; see `QueueFamilyIndices`.
+    VkQueue computeQueue;
+    VkQueue transferQueue;
+    
+    // Every submission goes through the scheduler, which tracks each queue's progress and destroys retired resources once
+    // the queues are past them.
+    SubmissionScheduler scheduler;
+    
+    // Seeded from disk at startup and written back in cleanup(), so pipelines compiled in earlier runs aren't compiled again.
+    UniquePipelineCache pipelineCache;
+    
+    // Compiles pipelines in the background through `pipelineCache`. Draws whose pipeline isn't ready use its fallback.
+    PipelineManager pipelineManager;
+    
+    // Where every shader's SPIR-V comes from. Watches the sources with `--hot-reload-shaders`.
+    ShaderLibrary shaderLibrary;
+    
+    // Every sampled image, storage buffer and sampler, bound once per command buffer. Invalid when the device lacks the
+    // descriptor indexing features it needs.
+    DescriptorHeap descriptorHeap;
+    
+    // Sub-allocates all buffer and image memory; see MemoryAllocator.hpp.
+    GpuMemoryAllocator memoryAllocator;
+    
+    // Per-frame upload buffer. Queue uploads after the frame slot is free and before `recordCommandBuffer()`.
+    StagingRing stagingRing;
+    
+    // Records the main pass's secondary command buffers in parallel, one command pool per thread per frame slot.
+    JobSystem jobSystem;
+    ParallelRecorder parallelRecorder;
+    
+    // CPU stage and GPU pass timings. p50/p99 frame time are shown in the window title.
+    FrameProfiler profiler;
+    
+    // Rebuilt every frame by `recordCommandBuffer()`. Owns the render passes, framebuffers and transient images.
+    RenderGraph renderGraph;
+    
+    // Dynamic rendering and synchronization2 entry points enabled by `createLogicalDevice()`, if any.
+    RenderGraph::DeviceFunctions renderingFunctions;
+    PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+    PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+    PFN_vkWaitSemaphoresKHR waitForSemaphores = nullptr;
+    PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+    
+    // Tags presents with ids, measures input-to-display latency and, with `--frame-pacing`, sleeps before input is polled.
+    FramePacer framePacer;
+    
+    // Streams `--assets` on its own threads. `streamedAssets` become ready over the first frames.
+    AssetStreamer assetStreamer;
+    std::vector<AssetHandle> streamedAssets;
+    
+    /// The `--instances` test scene: cubes that are culled and drawn entirely by the GPU. See `GpuCuller`.
+    struct GpuDrivenScene {
+        // Views looking out from the camera's position in four directions, 90 degrees apart. Their visibility is queried
+        // on the other GPUs with `--multi-gpu`.
+        static constexpr uint32_t PROBE_VIEWS = 4;
+        
+        // Bit 0, 1 and 2 of an index select the x, y and z side of the cube's corner.
+        static constexpr uint16_t CUBE_INDICES[36] = {
+            0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,   // -z, +z
+            0, 1, 4, 1, 5, 4,   2, 6, 3, 3, 6, 7,   // -y, +y
+            0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5,   // -x, +x
+        };
+        
+        bool enabled = false;
+        GpuCuller culler;
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        Allocation indexAllocation{};
+        bool indicesUploaded = false;
+        std::vector<uint32_t> vertexShader;
+        std::vector<uint32_t> fragmentShader;
+        PipelineHandle pipeline;
+        Matrix4 viewProjection{};
+        Frustum frustum{};
+        
+        std::vector<float> bounds;                          // every instance's center and radius; only kept for the workers
+        std::array<uint32_t, PROBE_VIEWS> probeVisible{};   // newest visible instance count per probe view
+        std::vector<Frustum> probeView;                     // the one view of the probe query being submitted, reused
+    };
+    GpuDrivenScene scene;
+    
+    /// The `--draw-list` objects: tumbling cubes in the `--instances` grid, pushed into `drawList` one draw each every frame
+    /// and drawn as one instanced draw per material.
+    struct DrawListScene {
+        static constexpr uint32_t MATERIALS = 4;
+        static constexpr float TINTS[MATERIALS][4] = {
+            {0.9f, 0.35f, 0.3f, 1.0f}, {0.3f, 0.8f, 0.4f, 1.0f}, {0.3f, 0.5f, 0.95f, 1.0f}, {0.95f, 0.8f, 0.3f, 1.0f},
+        };
+        
+        bool enabled = false;
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        Allocation indexAllocation{};
+        VkBuffer tintBuffer = VK_NULL_HANDLE;      // each material's tint, at its own storage buffer offset
+        Allocation tintAllocation{};
+        VkDeviceSize tintStride = 0;
+        std::array<uint32_t, MATERIALS> tintIndices{};
+        bool uploaded = false;
+        std::vector<uint32_t> vertexShader;
+        std::vector<uint32_t> fragmentShader;
+        PipelineHandle pipeline;
+        uint32_t mesh = 0;
+        std::array<uint32_t, MATERIALS> materials{};
+        std::vector<GpuCuller::Instance> placements;
+        Matrix4 viewProjection{};
+    };
+    DrawListScene drawObjects;
+    DrawList drawList;
+    
+    // Of the main pass's depth buffer. Undefined while nothing draws with depth, in which case the pass has none.
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    
+    // With `--multi-gpu`, the suitable GPUs other than `physicalDevice` and one device on each, for offscreen work.
+    std::vector<VkPhysicalDevice> workerPhysicalDevices;
+    GpuWorkerPool gpuWorkers;
+    
+    struct SwapChainSupportDetails {
+        VkSurfaceCapabilitiesKHR capabilities;
+        std::vector<VkSurfaceFormatKHR> formats;
+        std::vector<VkPresentModeKHR> presentModes;
+    };
+    
+    /// A window and everything presenting to it takes. `targets[0]` is the main window, or the images standing in for a swap
+    /// chain when offscreen; any others come from `--windows` and share the device, queues, allocator, pipelines and scene
+    /// with it. Replaced swap chains, views and semaphores go to `scheduler.destroyAfter()`, since the frames that used them
+    /// may still be queued.
+    struct PresentTarget {
+        GLFWwindow* window = nullptr;
+        VkSurfaceKHR surface = VK_NULL_HANDLE;
+        SwapChainSupportDetails support;            // of `surface` on the chosen device; empty until the first swap chain
+        UniqueSwapchain swapChain;
+        std::vector<VkImage> images;
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkExtent2D extent{};
+        VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        std::vector<UniqueImageView> imageViews;
+        std::vector<Allocation> offscreenAllocations;
+        
+        // Indexed by frame slot, since every window acquires in every frame.
+        std::vector<UniqueSemaphore> imageAvailableSemaphores;
+        
+        // Indexed by swap chain image rather than frame slot. An image can't be acquired again until its previous present
+        // has finished, so a per-image semaphore is never signaled while the presentation engine is still waiting on it.
+        std::vector<UniqueSemaphore> renderFinishedSemaphores;
+        
+        // Indexed by swap chain image, and signaled once the image's last present is done with its semaphore and swap
+        // chain. Empty without VK_EXT_swapchain_maintenance1.
+        std::vector<UniqueFence> presentFences;
+        
+        // The submission of the frame that last rendered into each image; value 0 if none did.
+        std::vector<TimelinePoint> imagesInFlight;
+        
+        // The scene renders at `renderExtent` and, when that's smaller than `extent`, is blitted up into the image. Only
+        // possible if the images can be blit destinations and their format can be blitted with filtering.
+        VkExtent2D renderExtent{};
+        bool canUpscale = false;
+        
+        // Set by GLFW when the framebuffer changes size. Drivers aren't required to report VK_ERROR_OUT_OF_DATE_KHR on resize.
+        bool framebufferResized = false;
+        
+        // Whether an image was acquired for the frame being recorded, and which.
+        bool acquired = false;
+        uint32_t imageIndex = 0;
+    };
+    std::vector<PresentTarget> targets;
+    
+    /// A replaced swap chain and what presented from it, kept until every fence has signaled and the frames rendering into
+    /// its images have completed. Only used with VK_EXT_swapchain_maintenance1; see `presentRetirementPoint()`.
+    struct RetiredSwapChain {
+        UniqueSwapchain swapChain;
+        std::vector<UniqueImageView> imageViews;
+        std::vector<UniqueSemaphore> renderFinishedSemaphores;
+        std::vector<UniqueFence> presentFences;
+        ResourceUse lastUse;
+    };
+    std::vector<RetiredSwapChain> retiredSwapChains;
+    
+    // Reused by every frame's batched present.
+    struct PresentBatch {
+        std::vector<VkSwapchainKHR> swapchains;
+        std::vector<uint32_t> imageIndices;
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkFence> presentFences;       // one per swap chain, or empty without VK_EXT_swapchain_maintenance1
+        std::vector<VkResult> results;
+        std::vector<PresentTarget*> targets;
+    };
+    PresentBatch presentBatch;
+    
+    // Reused by every frame's graphics submit.
+    SubmissionScheduler::Submission frameSubmission;
+    
+    // Barriers, attachments and other Vulkan struct arrays of the frame being recorded; reset at the start of every frame.
+    FrameArena frameArena;
+    
+    // Scales the scene's render targets in every window alike.
+    DynamicResolution dynamicResolution;
+    uint64_t gpuFrameSamples = 0;   // how many "gpu:frame" samples `dynamicResolution` has been fed
+    uint64_t presentLatencySamples = 0;
+    
+    /// Everything the CPU touches while recording one frame. Each slot is reused only after its last submission completes, so
+    /// the CPU can record into one slot while the GPU is still executing the others.
+    struct FrameData {
+        UniqueCommandPool commandPool;
+        VkCommandBuffer commandBuffer;
+        TimelinePoint submitted;    // the slot's last graphics submission; value 0 until it's first used
+    };
+    std::vector<FrameData> frames;
+    uint32_t currentFrame = 0;
+    
+    // Counts submitted frames.
+    uint64_t frameNumber = 0;
+    
+    // Set when the present policy is switched at runtime; the new present mode takes effect on the next swap chains.
+    bool presentPolicyChanged = false;
+    
+    // How long each startup step took, in milliseconds, in the order they ran.
+    std::vector<std::pair<std::string, double>> startupTimings;
+    
+    // Frames and wall-clock seconds measured by the benchmark, after warm-up.
+    uint64_t benchmarkMeasuredFrames = 0;
+    double benchmarkMeasuredSeconds = 0.0;
+    
+    
+    /// Window creation and instance creation don't depend on each other; the instance only needs GLFW's list of required
+    /// extensions. The instance is created on another thread while the window is created here, since GLFW windows must be
+    /// created on the main thread.
+    void initWindowAndInstance() {
+        targets.resize(options.offscreen ? 1 : options.windowCount);
+        if (options.offscreen == false) {
+            timeStartupStep("initGlfw", [this] { initGlfw(); });
+        }
+        
+        std::future<double> instanceCreated = std::async(std::launch::async, [this] {
+            return measureMilliseconds([this] { createInstance(); });
+        });
+        if (options.offscreen == false) {
+            timeStartupStep("createWindows", [this] { createWindows(); });
+        }
+        startupTimings.emplace_back("createInstance", instanceCreated.get());
+    }
     
-    void initWindow() {
+    void initGlfw() {
         
         int result = glfwInit();
         if (result == GLFW_FALSE) {
@@ -95,32 +890,807 @@ private:
         int major, minor, revision;
         glfwGetVersion(&major, &minor, &revision);
         std::cout << "GLFW Version " << major << "." << minor << "." << revision << '\n';
-        
+    }
+    
+    /// One window per target, all the same size. Extra windows are numbered in their titles.
+    void createWindows() {
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
         
-        window = glfwCreateWindow(WIDTH, HEIGHT, "Welcome to Vulkan", nullptr, nullptr);
+        for (size_t i = 0; i < targets.size(); i++) {
+            std::string title = i == 0 ? "Welcome to Vulkan" : "Welcome to Vulkan (" + std::to_string(i + 1) + ")";
+            GLFWwindow* window = glfwCreateWindow(options.width, options.height, title.c_str(), nullptr, nullptr);
+            if (window == nullptr) {
+                throw std::runtime_error("Window " + std::to_string(i + 1) + " was not created.");
+            }
+            glfwSetWindowUserPointer(window, this);
+            glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+            glfwSetKeyCallback(window, keyCallback);
+            targets[i].window = window;
+        }
+    }
+    
+    static void framebufferResizeCallback(GLFWwindow* window, int /* width */, int /* height */) {
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        for (auto& target : app->targets) {
+            if (target.window == window) {
+                target.framebufferResized = true;
+            }
+        }
+    }
+    
+    /// Keys 1, 2 and 3 switch between the low-latency, balanced and power-saver present policies.
+    static void keyCallback(GLFWwindow* window, int key, int /* scancode */, int action, int /* mods */) {
+        if (action != GLFW_PRESS) {
+            return;
+        }
+        
+        auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+        switch (key) {
+            case GLFW_KEY_1: app->setPresentPolicy(PresentPolicy::LowLatency); break;
+            case GLFW_KEY_2: app->setPresentPolicy(PresentPolicy::Balanced); break;
+            case GLFW_KEY_3: app->setPresentPolicy(PresentPolicy::PowerSaver); break;
+            default: break;
+        }
+    }
+    
+    /// Switches the present policy. The swap chain is rebuilt at the end of the current frame.
+    void setPresentPolicy(PresentPolicy policy) {
+        if (policy != options.presentPolicy) {
+            options.presentPolicy = policy;
+            presentPolicyChanged = true;
+        }
     }
     
     void initVulkan() {
-        createInstance();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
-        createSwapChain();
-        createImageViews();
+        timeStartupStep("createSurfaces", [this] { createSurfaces(); });
+        timeStartupStep("pickPhysicalDevice", [this] { pickPhysicalDevice(); });
+        timeStartupStep("applyQualityPreset", [this] { applyQualityPreset(); });
+        
+        // Reading the pipeline cache from disk only needs to know the device, so it overlaps with device creation.
+        std::future<std::vector<char>> pipelineCacheData = std::async(std::launch::async, [this] {
+            return readPipelineCacheFile();
+        });
+        
+        timeStartupStep("createLogicalDevice", [this] { createLogicalDevice(); });
+        timeStartupStep("createSubmissionScheduler", [this] { createSubmissionScheduler(); });
+        timeStartupStep("createMemoryAllocator", [this] { createMemoryAllocator(); });
+        timeStartupStep("createPipelineCache", [&] { createPipelineCache(pipelineCacheData.get()); });
+        timeStartupStep("createPipelineManager", [this] { createPipelineManager(); });
+        timeStartupStep("createDescriptorHeap", [this] { createDescriptorHeap(); });
+        timeStartupStep("createSwapChains", [this] {
+            for (auto& target : targets) {
+                createSwapChain(target);
+                createImageViews(target);
+                createSwapChainSemaphores(target);
+            }
+        });
+        timeStartupStep("createFrameResources", [this] { createFrameResources(); });
+        timeStartupStep("createStagingRing", [this] { createStagingRing(); });
+        timeStartupStep("createParallelRecorder", [this] { createParallelRecorder(); });
+        timeStartupStep("createFrameProfiler", [this] { createFrameProfiler(); });
+        timeStartupStep("createDynamicResolution", [this] { createDynamicResolution(); });
+        timeStartupStep("createFramePacer", [this] { createFramePacer(); });
+        timeStartupStep("createRenderGraph", [this] { createRenderGraph(); });
+        timeStartupStep("createShaderLibrary", [this] { createShaderLibrary(); });
+        timeStartupStep("createScene", [this] { createScene(); });
+        timeStartupStep("createDrawList", [this] { createDrawList(); });
+        timeStartupStep("createAssetStreamer", [this] { createAssetStreamer(); });
+        timeStartupStep("createGpuWorkers", [this] { createGpuWorkers(); });
+    }
+    
+    template <typename Step>
+    static double measureMilliseconds(Step step) {
+        FrameProfiler::Clock::time_point start = FrameProfiler::Clock::now();
+        step();
+        return std::chrono::duration<double, std::milli>(FrameProfiler::Clock::now() - start).count();
+    }
+    
+    /// Runs one step of startup and records how long it took for the benchmark report.
+    template <typename Step>
+    void timeStartupStep(const char* name, Step step) {
+        startupTimings.emplace_back(name, measureMilliseconds(step));
+    }
+    
+    void createParallelRecorder() {
+        jobSystem.init(options.recordingThreads, [] { FrameProfiler::countAllocationsOnThisThread(); });
+        parallelRecorder.init(device, deviceCapabilities.queueFamilies.graphicsFamily.value(), options.framesInFlight, jobSystem);
+        std::cout << "Recording on " << jobSystem.getThreadCount() << " threads\n";
+    }
+    
+    void createFrameProfiler() {
+        uint32_t graphicsFamily = deviceCapabilities.queueFamilies.graphicsFamily.value();
+        profiler.init(device, deviceCapabilities.properties.limits,
+                      deviceCapabilities.queueFamilyProperties[graphicsFamily].timestampValidBits, options.framesInFlight,
+                      options.benchmark || options.frameTimingsPath.empty() == false);
+    }
+    
+    /// Offscreen runs never present, so there's nothing to pace. With several windows, the main window's presents are the
+    /// ones paced and measured.
+    void createFramePacer() {
+        framePacer.init(device, waitForPresent, options.framePacing);
+        if (options.offscreen == false) {
+            framePacer.setSwapchain(targets.front().swapChain.get());
+        }
+        if (options.framePacing && framePacer.isPacing() == false) {
+            std::cerr << "--frame-pacing needs VK_KHR_present_id and VK_KHR_present_wait. Frames are not paced.\n";
+        }
+        else if (framePacer.isPacing()) {
+            std::cout << "Frame pacing: input is sampled as late as the estimated frame cost allows\n";
+        }
+    }
+    
+    /// What the next frame is expected to take from polling input until its GPU work finishes, from the newest samples.
+    double estimatedFrameCost() const {
+        double cost = 0.0;
+        for (const char* metric : {"cpu:record", "cpu:submit", "gpu:frame"}) {
+            double milliseconds;
+            uint64_t samples;
+            if (profiler.latestSample(metric, milliseconds, samples)) {
+                cost += milliseconds;
+            }
+        }
+        return cost;
+    }
+    
+    /// Adds each newly measured input-to-display latency to the profiler's current frame. Without `--frame-pacing` presents
+    /// are only noticed at the next frame's input poll, so the sample is an upper bound and is recorded under another name.
+    void recordPresentLatency() {
+        double milliseconds;
+        uint64_t measured;
+        if (framePacer.latestLatency(milliseconds, measured) && measured != presentLatencySamples) {
+            presentLatencySamples = measured;
+            profiler.addSample(framePacer.isLatencyExact() ? "latency:input-to-display" : "latency:input-to-display-upper-bound",
+                               milliseconds);
+        }
+    }
+    
+    /// The render scale starts at `--render-scale` or the quality preset's, and adapts only with `--target-gpu-ms` and GPU
+    /// timestamps to measure against.
+    void createDynamicResolution() {
+        float initialScale = options.renderScale.value_or(qualitySettings.resolutionScale);
+        double target = options.targetGpuMilliseconds;
+        
+        uint32_t graphicsFamily = deviceCapabilities.queueFamilies.graphicsFamily.value();
+        if (target > 0.0 && deviceCapabilities.queueFamilyProperties[graphicsFamily].timestampValidBits == 0) {
+            std::cerr << "--target-gpu-ms needs timestamps on the graphics queue. Keeping the render scale fixed.\n";
+            target = 0.0;
+        }
+        
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, targets.front().format, &formatProperties);
+        VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        bool formatBlittable = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+        
+        // Windows that can't take a blit render at full size whatever the scale.
+        bool canUpscale = false;
+        for (auto& presentTarget : targets) {
+            presentTarget.canUpscale = presentTarget.canUpscale && formatBlittable;
+            canUpscale = canUpscale || presentTarget.canUpscale;
+        }
+        if (canUpscale == false) {
+            if (initialScale < 1.0f || target > 0.0) {
+                std::cout << "Render scale: fixed at 100%, the swap chain images can't be blitted to\n";
+            }
+            initialScale = 1.0f;
+            target = 0.0;
+        }
+        
+        dynamicResolution.init(target, initialScale);
+        if (dynamicResolution.isAdaptive() || dynamicResolution.getScale() < 1.0f) {
+            std::cout << "Render scale: " << std::lround(dynamicResolution.getScale() * 100.0f) << "%";
+            if (dynamicResolution.isAdaptive()) {
+                std::cout << ", adapting to hold " << target << " ms of GPU time";
+            }
+            std::cout << '\n';
+        }
+    }
+    
+    /// Feeds the newest GPU frame time to `dynamicResolution` and sizes this frame's render targets in every window. Call
+    /// after the profiler's `beginFrame()`, which collects the timings.
+    void updateRenderExtents() {
+        double gpuMilliseconds;
+        uint64_t samples;
+        if (profiler.latestSample("gpu:frame", gpuMilliseconds, samples) && samples != gpuFrameSamples) {
+            gpuFrameSamples = samples;
+            if (dynamicResolution.addFrameTime(gpuMilliseconds) && options.verbose) {
+                std::cout << "Render scale: " << std::lround(dynamicResolution.getScale() * 100.0f) << "% after "
+                          << gpuMilliseconds << " ms of GPU time\n";
+            }
+        }
+        for (auto& target : targets) {
+            target.renderExtent = target.canUpscale ? dynamicResolution.scaledExtent(target.extent) : target.extent;
+        }
+    }
+    
+    void createRenderGraph() {
+        renderGraph.init(device, memoryAllocator, options.framesInFlight, renderingFunctions, frameArena);
+        renderGraph.setProfiler(&profiler);
+        renderGraph.setVerbose(options.verbose);
+    }
+    
+    void createShaderLibrary() {
+        shaderLibrary.init(options.shaderDirectory, options.pipelineCacheDirectory + "/shader-cache");
+        if (options.hotReloadShaders) {
+            shaderLibrary.startWatching();
+            std::cout << "Watching shader sources in " << options.shaderDirectory << '\n';
+        }
+    }
+    
+    /// Sets up the `--instances` scene: a grid of cubes that the camera orbits, so that part of it is always culled. Every
+    /// cube uses the same 36 indices; the vertex shader makes the corners up from the vertex index. Uploads happen in
+    /// `updateScene()`, since the staging ring drops anything queued before a frame begins.
+    void createScene() {
+        if (options.sceneInstances == 0) {
+            return;
+        }
+        
+        std::string missing;
+        if (descriptorHeap.isValid() == false) {
+            missing = "a descriptor heap";
+        }
+        else if (cmdDrawIndexedIndirectCount == nullptr) {
+            missing = "draw indirect count";
+        }
+        else if (deviceCapabilities.features.drawIndirectFirstInstance == false) {
+            missing = "drawIndirectFirstInstance";
+        }
+        
+        std::vector<uint32_t> cullShader = shaderLibrary.load("cull.comp");
+        scene.vertexShader = shaderLibrary.load("scene.vert");
+        scene.fragmentShader = shaderLibrary.load("scene.frag");
+        if (missing.empty() && (cullShader.empty() || scene.vertexShader.empty() || scene.fragmentShader.empty())) {
+            missing = "cull.comp, scene.vert and scene.frag in " + options.shaderDirectory + ", as SPIR-V or compilable GLSL";
+        }
+        if (missing.empty() == false) {
+            std::cout << "GPU-driven scene disabled: needs " << missing << '\n';
+            return;
+        }
+        
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
+        scene.culler.init(device, memoryAllocator, descriptorHeap, pipelineManager, cullShader, options.framesInFlight,
+                          indices.graphicsFamily.value(), indices.computeFamily.value(), indices.transferFamily.value(),
+                          scheduler, cmdDrawIndexedIndirectCount);
+        
+        // One draw per instance with at most 65535 workgroups of culling, the smallest limit devices have to support.
+        uint32_t instanceCount = std::min(options.sceneInstances, 65535 * GpuCuller::WORKGROUP_SIZE);
+        std::vector<GpuCuller::Instance> instances = sceneGrid(instanceCount);
+        
+        scene.culler.setScene(instances, {{36, 0, 0}});
+        if (options.multiGpu) {
+            for (const auto& instance : instances) {
+                scene.bounds.insert(scene.bounds.end(), instance.center, instance.center + 3);
+                scene.bounds.push_back(instance.radius);
+            }
+        }
+        memoryAllocator.createBuffer(sizeof(GpuDrivenScene::CUBE_INDICES), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     MemoryUsage::GpuOnly, scene.indexBuffer, scene.indexAllocation,
+                                     {indices.graphicsFamily.value(), indices.transferFamily.value()});
+        
+        depthFormat = pickDepthFormat();
+        scene.enabled = true;
+        requestScenePipeline();
+        std::cout << "GPU-driven scene: " << instanceCount << " instances, culled on the "
+                  << (scene.culler.usesComputeQueue() ? "async compute" : "graphics") << " queue\n";
+    }
+    
+    VkFormat pickDepthFormat() const {
+        VkFormat depthCandidates[] = {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM};
+        for (VkFormat format : depthCandidates) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+            if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+                return format;
+            }
+        }
+        return VK_FORMAT_UNDEFINED;
+    }
+    
+    /// Sets up the `--draw-list` objects. Like the scene's, their cube has no vertices, and its indices and the materials'
+    /// tints are uploaded in `updateDrawList()`.
+    void createDrawList() {
+        if (options.drawListObjects == 0) {
+            return;
+        }
+        if (descriptorHeap.isValid() == false) {
+            std::cout << "Draw list disabled: needs a descriptor heap\n";
+            return;
+        }
+        drawObjects.vertexShader = shaderLibrary.load("drawlist.vert");
+        drawObjects.fragmentShader = shaderLibrary.load("scene.frag");
+        if (drawObjects.vertexShader.empty() || drawObjects.fragmentShader.empty()) {
+            std::cout << "Draw list disabled: needs drawlist.vert and scene.frag in " << options.shaderDirectory
+                      << ", as SPIR-V or compilable GLSL\n";
+            return;
+        }
+        
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
+        std::vector<uint32_t> sharingFamilies = {indices.graphicsFamily.value(), indices.transferFamily.value()};
+        drawList.init(memoryAllocator, descriptorHeap, pipelineManager, options.drawListObjects, options.framesInFlight,
+                      sharingFamilies);
+        
+        memoryAllocator.createBuffer(sizeof(GpuDrivenScene::CUBE_INDICES), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     MemoryUsage::GpuOnly, drawObjects.indexBuffer, drawObjects.indexAllocation, sharingFamilies);
+        DrawList::Mesh cube;
+        cube.indexBuffer = drawObjects.indexBuffer;
+        cube.indexCount = 36;
+        drawObjects.mesh = drawList.addMesh(cube);
+        
+        drawObjects.tintStride = std::max<VkDeviceSize>(deviceCapabilities.properties.limits.minStorageBufferOffsetAlignment,
+                                                        sizeof(DrawListScene::TINTS[0]));
+        memoryAllocator.createBuffer(drawObjects.tintStride * DrawListScene::MATERIALS,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::GpuOnly,
+                                     drawObjects.tintBuffer, drawObjects.tintAllocation, sharingFamilies);
+        for (uint32_t i = 0; i < DrawListScene::MATERIALS; i++) {
+            drawObjects.tintIndices[i] = descriptorHeap.registerStorageBuffer(drawObjects.tintBuffer, i * drawObjects.tintStride,
+                                                                              sizeof(DrawListScene::TINTS[0]));
+        }
+        
+        drawObjects.placements = sceneGrid(options.drawListObjects);
+        depthFormat = pickDepthFormat();
+        drawObjects.enabled = true;
+        drawObjects.pipeline = pipelineManager.request(scenePipelineDesc(drawObjects.vertexShader, drawObjects.fragmentShader));
+        for (uint32_t i = 0; i < DrawListScene::MATERIALS; i++) {
+            drawObjects.materials[i] = drawList.addMaterial({drawObjects.pipeline, drawObjects.tintIndices[i]});
+        }
+        std::cout << "Draw list: " << options.drawListObjects << " objects in " << DrawListScene::MATERIALS << " materials\n";
+    }
+    
+    /// A cube of `instanceCount` unit spheres, 3 apart and centered on the origin.
+    static std::vector<GpuCuller::Instance> sceneGrid(uint32_t instanceCount) {
+        uint32_t side = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(instanceCount))));
+        const float spacing = 3.0f;
+        const float offset = (side - 1) * spacing / 2.0f;
+        std::vector<GpuCuller::Instance> instances(instanceCount);
+        for (uint32_t i = 0; i < instanceCount; i++) {
+            instances[i] = {{(i % side) * spacing - offset, ((i / side) % side) * spacing - offset, (i / (side * side)) * spacing - offset},
+                            1.0f, 0};
+        }
+        return instances;
+    }
+    
+    /// Where the camera is when it has orbited `sceneGrid(instanceCount)` by `angle`: far enough out to see all of it, a
+    /// little above it, looking at its center.
+    struct OrbitCamera {
+        std::array<float, 3> eye;
+        float far;
+        Matrix4 viewProjection;
+    };
+    static OrbitCamera orbitCamera(float angle, uint32_t instanceCount, float aspect) {
+        float distance = std::cbrt(static_cast<float>(instanceCount)) * 3.0f * 0.75f + 5.0f;
+        OrbitCamera camera;
+        camera.eye = {distance * std::cos(angle), distance * 0.3f, distance * std::sin(angle)};
+        camera.far = distance * 4.0f;
+        camera.viewProjection = multiply(perspective(1.0f, aspect, 0.1f, camera.far), lookAt(camera.eye, {0.0f, 0.0f, 0.0f}));
+        return camera;
+    }
+    
+    /// The scene's pipeline depends on the swap chain format, so it's requested again whenever the swap chain is rebuilt.
+    /// Requests for an unchanged format return the same pipeline.
+    void requestScenePipeline() {
+        if (scene.enabled) {
+            scene.pipeline = pipelineManager.request(scenePipelineDesc(scene.vertexShader, scene.fragmentShader));
+        }
+        if (drawObjects.enabled) {
+            drawObjects.pipeline = pipelineManager.request(scenePipelineDesc(drawObjects.vertexShader, drawObjects.fragmentShader));
+            setDrawListMaterials();
+        }
+    }
+    
+    /// Every material shares the pipeline and differs only in its tint.
+    void setDrawListMaterials() {
+        for (uint32_t i = 0; i < DrawListScene::MATERIALS; i++) {
+            drawList.setMaterial(drawObjects.materials[i], {drawObjects.pipeline, drawObjects.tintIndices[i]});
+        }
+    }
+    
+    PipelineDesc scenePipelineDesc(const std::vector<uint32_t>& vertexShader, const std::vector<uint32_t>& fragmentShader) {
+        PipelineDesc desc;
+        desc.stages.push_back({VK_SHADER_STAGE_VERTEX_BIT, vertexShader});
+        desc.stages.push_back({VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader});
+        desc.layout = descriptorHeap.getPipelineLayout();
+        desc.cullMode = VK_CULL_MODE_NONE;
+        desc.depthTest = true;
+        desc.depthWrite = true;
+        desc.depthCompare = VK_COMPARE_OP_LESS;
+        desc.colorFormats = {targets.front().format};
+        desc.depthFormat = depthFormat;
+        if (renderGraph.usesDynamicRendering() == false) {
+            desc.renderPass = renderGraph.getCompatibleRenderPass(desc.colorFormats, desc.depthFormat);
+        }
+        return desc;
+    }
+    
+    /// Hands shaders recompiled by `--hot-reload-shaders` to the pipelines built from them, and swaps in the pipelines that
+    /// have finished compiling since. Runs before recording, when every command buffer that used a replaced pipeline has
+    /// already been submitted, so the old pipelines only have to outlive the submissions made so far.
+    void applyShaderReloads() {
+        if (options.hotReloadShaders == false) {
+            return;
+        }
+        
+        bool sceneShadersChanged = false;
+        bool drawListShadersChanged = false;
+        for (auto& reload : shaderLibrary.takeReloads()) {
+            std::cout << "Reloaded " << reload.name << '\n';
+            if (drawObjects.enabled && reload.name == "drawlist.vert") {
+                drawObjects.vertexShader = reload.code;
+                drawListShadersChanged = true;
+            }
+            else if (drawObjects.enabled && reload.name == "scene.frag") {
+                drawObjects.fragmentShader = reload.code;
+                drawListShadersChanged = true;
+            }
+            if (scene.enabled == false) {
+                continue;
+            }
+            if (reload.name == "cull.comp") {
+                scene.culler.reloadShader(reload.code);
+            }
+            else if (reload.name == "scene.vert") {
+                scene.vertexShader = std::move(reload.code);
+                sceneShadersChanged = true;
+            }
+            else if (reload.name == "scene.frag") {
+                scene.fragmentShader = std::move(reload.code);
+                sceneShadersChanged = true;
+            }
+        }
+        if (sceneShadersChanged) {
+            pipelineManager.replace(scene.pipeline, scenePipelineDesc(scene.vertexShader, scene.fragmentShader));
+        }
+        if (drawListShadersChanged) {
+            pipelineManager.replace(drawObjects.pipeline, scenePipelineDesc(drawObjects.vertexShader, drawObjects.fragmentShader));
+        }
+        
+        pipelineManager.applyReplacements([this](VkPipeline retired) {
+            UniquePipeline(device, retired).destroyAfter(scheduler, scheduler.getAllSubmitted());
+        });
+    }
+    
+    /// Queues the scene's uploads and moves the camera. Call once per frame, after the staging ring's `beginFrame()`.
+    void updateScene() {
+        scene.culler.beginFrame(currentFrame);
+        if (scene.indicesUploaded == false) {
+            scene.indicesUploaded = stagingRing.uploadBuffer(GpuDrivenScene::CUBE_INDICES, sizeof(GpuDrivenScene::CUBE_INDICES),
+                                                             scene.indexBuffer);
+        }
+        
+        // After the indices, so they're uploaded no later than the instances the culler waits for.
+        if (scene.indicesUploaded) {
+            scene.culler.upload(stagingRing);
+        }
+        
+        // Advances by frame rather than by time, so benchmark runs see the same views every time.
+        float angle = frameNumber * 0.005f;
+        // Every window shows the same view, framed for the main window.
+        VkExtent2D extent = targets.front().extent;
+        float aspect = static_cast<float>(extent.width) / static_cast<float>(extent.height);
+        OrbitCamera camera = orbitCamera(angle, scene.culler.getInstanceCount(), aspect);
+        scene.viewProjection = camera.viewProjection;
+        scene.frustum = Frustum::fromViewProjection(scene.viewProjection.data());
+        
+        if (gpuWorkers.getWorkerCount() > 0) {
+            submitProbeViews(camera.eye, camera.far);
+        }
+    }
+    
+    /// Pushes every `--draw-list` object into the draw list, from every recording thread, and has it sorted, merged and its
+    /// transforms queued for upload. Call once per frame, after the staging ring's `beginFrame()`.
+    void updateDrawList() {
+        drawList.beginFrame(currentFrame);
+        if (drawObjects.uploaded == false) {
+            std::vector<float> tints(drawObjects.tintStride / sizeof(float) * DrawListScene::MATERIALS, 0.0f);
+            for (uint32_t i = 0; i < DrawListScene::MATERIALS; i++) {
+                std::copy(DrawListScene::TINTS[i], DrawListScene::TINTS[i] + 4, &tints[i * drawObjects.tintStride / sizeof(float)]);
+            }
+            drawObjects.uploaded = stagingRing.uploadBuffer(GpuDrivenScene::CUBE_INDICES, sizeof(GpuDrivenScene::CUBE_INDICES),
+                                                            drawObjects.indexBuffer) &&
+                stagingRing.uploadBuffer(tints.data(), tints.size() * sizeof(float), drawObjects.tintBuffer);
+            if (drawObjects.uploaded == false) {
+                return;
+            }
+        }
+        
+        float angle = frameNumber * 0.005f;
+        VkExtent2D extent = targets.front().extent;
+        float aspect = static_cast<float>(extent.width) / static_cast<float>(extent.height);
+        uint32_t objectCount = static_cast<uint32_t>(drawObjects.placements.size());
+        drawObjects.viewProjection = orbitCamera(angle, objectCount, aspect).viewProjection;
+        
+        // Each object tumbles at its own rate about y, then x.
+        uint32_t chunkCount = jobSystem.getThreadCount();
+        jobSystem.parallelFor(chunkCount, [&](uint32_t chunk, uint32_t) {
+            for (uint32_t i = objectCount * chunk / chunkCount; i < objectCount * (chunk + 1) / chunkCount; i++) {
+                const GpuCuller::Instance& placement = drawObjects.placements[i];
+                float spin = frameNumber * 0.02f * (1.0f + (i % 5) * 0.25f);
+                float ca = std::cos(spin), sa = std::sin(spin);
+                float cb = std::cos(spin * 0.7f), sb = std::sin(spin * 0.7f);
+                const float scale = 1.2f;
+                Matrix4 transform = {
+                    ca * scale, 0.0f, -sa * scale, 0.0f,
+                    sa * sb * scale, cb * scale, ca * sb * scale, 0.0f,
+                    sa * cb * scale, -sb * scale, ca * cb * scale, 0.0f,
+                    placement.center[0], placement.center[1], placement.center[2], 1.0f,
+                };
+                drawList.push(drawObjects.mesh, drawObjects.materials[i % DrawListScene::MATERIALS], transform.data());
+            }
+        });
+        drawList.prepare(stagingRing);
+    }
+    
+    /// Queries each probe view's visibility separately, so the views spread over the workers. A view whose query can't be
+    /// queued this frame keeps its previous count.
+    void submitProbeViews(const std::array<float, 3>& eye, float far) {
+        const float quarterTurn = 1.57079633f;
+        Matrix4 projection = perspective(quarterTurn, 1.0f, 0.1f, far);
+        for (uint32_t i = 0; i < GpuDrivenScene::PROBE_VIEWS; i++) {
+            float direction = i * quarterTurn;
+            Matrix4 view = lookAt(eye, {eye[0] + std::cos(direction), eye[1], eye[2] + std::sin(direction)});
+            Matrix4 viewProjection = multiply(projection, view);
+            scene.probeView.assign(1, Frustum::fromViewProjection(viewProjection.data()));
+            gpuWorkers.submit(scene.probeView, i);
+        }
+    }
+    
+    /// Sets up `--multi-gpu`: one device per other GPU, each with the scene's bounds, so the probe views can be queried there
+    /// while this GPU renders.
+    void createGpuWorkers() {
+        if (options.multiGpu == false) {
+            return;
+        }
+        if (workerPhysicalDevices.empty()) {
+            std::cout << "Multi-GPU: no other suitable GPU, everything runs on the rendering GPU\n";
+            return;
+        }
+        if (scene.enabled == false) {
+            std::cout << "Multi-GPU disabled: the other GPUs query the --instances scene, which isn't running\n";
+            return;
+        }
+        std::vector<uint32_t> visibilityShader = shaderLibrary.load("visibility.comp");
+        if (visibilityShader.empty()) {
+            std::cout << "Multi-GPU disabled: needs visibility.comp in " << options.shaderDirectory
+                      << ", as SPIR-V or compilable GLSL\n";
+            return;
+        }
+        
+        gpuWorkers.init(workerPhysicalDevices, visibilityShader);
+        gpuWorkers.setScene(scene.bounds);
+        for (size_t i = 0; i < gpuWorkers.getWorkerCount(); i++) {
+            std::cout << "GPU worker " << i + 1 << ": " << gpuWorkers.getWorkerName(i) << ", querying "
+                      << GpuDrivenScene::PROBE_VIEWS << " probe views per frame\n";
+        }
+    }
+    
+    /// Takes the probe view counts the workers have finished. Call while the profiler's frame is open, since their GPU times
+    /// are added to it.
+    void collectGpuWorkers() {
+        gpuWorkers.collect(&profiler, [this](uint64_t view, const std::vector<uint32_t>& counts) {
+            scene.probeVisible[view] = counts.front();
+        });
+    }
+    
+    void createStagingRing() {
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
+        stagingRing.init(device, memoryAllocator, options.stagingBytesPerFrame, options.framesInFlight,
+                         indices.graphicsFamily.value(), indices.transferFamily.value(), scheduler, frameArena);
+        stagingRing.beginFrame(0);
+    }
+    
+    /// Opens `--assets` and requests every asset in it. Nothing is read here: the streaming threads fault the mapped pages in
+    /// and copy them into the staging ring during the frames that follow. Up to half of each frame's staging region is used.
+    void createAssetStreamer() {
+        if (options.assetArchivePath.empty()) {
+            return;
+        }
+        
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
+        assetStreamer.init(device, memoryAllocator, stagingRing, &descriptorHeap,
+                           {indices.graphicsFamily.value(), indices.computeFamily.value(), indices.transferFamily.value()},
+                           options.streamingThreads, options.stagingBytesPerFrame / 2);
+        try {
+            assetStreamer.open(options.assetArchivePath);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << " Not streaming assets.\n";
+            assetStreamer.destroy();
+            return;
+        }
+        
+        for (const auto& name : assetStreamer.getAssetNames()) {
+            streamedAssets.push_back(assetStreamer.load(name));
+        }
+        std::cout << "Streaming " << streamedAssets.size() << " assets from " << options.assetArchivePath << '\n';
+    }
+    
+    /// When what the presents queued so far use may be destroyed, without VK_EXT_swapchain_maintenance1. A present can't be
+    /// waited on then, and the graphics submission that rendered its image says nothing about when the presentation engine
+    /// is done with its semaphore or swap chain. So they're kept for another `framesInFlight` graphics submissions, by which
+    /// time the frame loop has waited on frames whose images were acquired after those presents. That's a heuristic, not a
+    /// guarantee: nothing stops a presentation engine from holding on longer. With the extension, `retiredSwapChains` waits
+    /// for the present fences instead.
+    ResourceUse presentRetirementPoint() const {
+        ResourceUse use = scheduler.getAllSubmitted();
+        use.lastUsed[static_cast<uint32_t>(QueueType::Graphics)] += options.framesInFlight;
+        return use;
+    }
+    
+    /// Builds a new swap chain for the target's current window size without stalling the device. The old swap chain, its
+    /// views and its semaphores are destroyed once the presents queued so far are done with them: by
+    /// `collectRetiredSwapChains()` if presents signal fences, or by the scheduler after `presentRetirementPoint()` if not.
+    void recreateSwapChain(PresentTarget& target) {
+        // A minimized window has a zero-sized framebuffer, which isn't a valid swap chain extent. A lone window waits until
+        // it's restored; with several, the others keep rendering and this one is retried every frame.
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(target.window, &width, &height);
+        if ((width == 0 || height == 0) && targets.size() > 1) {
+            target.framebufferResized = true;
+            return;
+        }
+        while ((width == 0 || height == 0) && glfwWindowShouldClose(target.window) == false) {
+            glfwWaitEvents();
+            glfwGetFramebufferSize(target.window, &width, &height);
+        }
+        
+        // The graph's framebuffers referencing the old views are destroyed alongside them.
+        for (auto& imageView : target.imageViews) {
+            renderGraph.releaseImageView(imageView.get());
+        }
+        
+        UniqueSwapchain oldSwapChain = createSwapChain(target);
+        if (deviceCapabilities.swapchainMaintenance1) {
+            RetiredSwapChain& retired = retiredSwapChains.emplace_back();
+            retired.swapChain = std::move(oldSwapChain);
+            retired.imageViews = std::move(target.imageViews);
+            retired.renderFinishedSemaphores = std::move(target.renderFinishedSemaphores);
+            retired.presentFences = std::move(target.presentFences);
+            retired.lastUse = scheduler.getAllSubmitted();
+        }
+        else {
+            ResourceUse lastUse = presentRetirementPoint();
+            for (auto& imageView : target.imageViews) {
+                imageView.destroyAfter(scheduler, lastUse);
+            }
+            for (auto& semaphore : target.renderFinishedSemaphores) {
+                semaphore.destroyAfter(scheduler, lastUse);
+            }
+            oldSwapChain.destroyAfter(scheduler, lastUse);
+        }
+        
+        createImageViews(target);
+        createSwapChainSemaphores(target);
+        requestScenePipeline();
+        target.framebufferResized = false;
     }
     
-    void createImageViews() {
-        swapChainImageViews.resize(swapChainImages.size());
+    /// Destroys the retired swap chains whose presents have all signaled their fences and whose frames have completed. The
+    /// rest are compacted in place, so polling every frame doesn't allocate.
+    void collectRetiredSwapChains() {
+        size_t kept = 0;
+        for (size_t i = 0; i < retiredSwapChains.size(); i++) {
+            RetiredSwapChain& retired = retiredSwapChains[i];
+            bool presented = std::all_of(retired.presentFences.begin(), retired.presentFences.end(),
+                                         [this](const UniqueFence& fence) {
+                return vkGetFenceStatus(device, fence.get()) == VK_SUCCESS;
+            });
+            if (presented && scheduler.isComplete(retired.lastUse)) {
+                // Views before the swap chain whose images they view.
+                retired.presentFences.clear();
+                retired.renderFinishedSemaphores.clear();
+                retired.imageViews.clear();
+                retired.swapChain.reset();
+                continue;
+            }
+            if (kept != i) {
+                retiredSwapChains[kept] = std::move(retired);
+            }
+            kept++;
+        }
+        retiredSwapChains.erase(retiredSwapChains.begin() + kept, retiredSwapChains.end());
+    }
+    
+    void waitForPresentFences(const std::vector<UniqueFence>& fences) {
+        for (const auto& fence : fences) {
+            vkWaitForFences(device, 1, fence.address(), VK_TRUE, UINT64_MAX);
+        }
+    }
+    
+    /// Creates the command pool and command buffer of every frame slot, and every window's acquire semaphore for it. Their
+    /// points start at 0, so the first wait on each slot returns immediately.
+    void createFrameResources() {
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
+        
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        
+        frames.resize(options.framesInFlight);
+        for (auto& frame : frames) {
+            // One pool per slot lets the whole pool be reset at once, which is cheaper than resetting buffers one by one.
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+            
+            VkCommandPool commandPool;
+            VkResult result = vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Command pool was not created. Error code " + std::to_string(result));
+            }
+            frame.commandPool = UniqueCommandPool(device, commandPool);
+            
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+            
+            result = vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Command buffer was not allocated. Error code " + std::to_string(result));
+            }
+            
+            frame.submitted = {};
+        }
+        
+        // Offscreen targets are never acquired.
+        if (options.offscreen) {
+            return;
+        }
+        for (auto& target : targets) {
+            target.imageAvailableSemaphores.clear();
+            for (uint32_t i = 0; i < options.framesInFlight; i++) {
+                VkSemaphore imageAvailableSemaphore;
+                if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS) {
+                    throw std::runtime_error("Frame synchronization objects were not created.");
+                }
+                target.imageAvailableSemaphores.emplace_back(device, imageAvailableSemaphore);
+            }
+        }
+    }
+    
+    /// Creates one render-finished semaphore and, given VK_EXT_swapchain_maintenance1, one present fence per swap chain image,
+    /// and clears the image-to-submission mapping. The fences start signaled, as if each image had already been presented.
+    void createSwapChainSemaphores(PresentTarget& target) {
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        
+        target.renderFinishedSemaphores.clear();
+        for (size_t i = 0; i < target.images.size(); i++) {
+            VkSemaphore semaphore;
+            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+                throw std::runtime_error("Render finished semaphore was not created.");
+            }
+            target.renderFinishedSemaphores.emplace_back(device, semaphore);
+        }
+        
+        target.presentFences.clear();
+        if (deviceCapabilities.swapchainMaintenance1 && options.offscreen == false) {
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            for (size_t i = 0; i < target.images.size(); i++) {
+                VkFence fence;
+                VkResult result = vkCreateFence(device, &fenceInfo, nullptr, &fence);
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Present fence was not created. Error code " + std::to_string(result));
+                }
+                target.presentFences.emplace_back(device, fence);
+            }
+        }
+        
+        target.imagesInFlight.assign(target.images.size(), TimelinePoint{});
+    }
+    
+    void createImageViews(PresentTarget& target) {
+        target.imageViews.clear();
         
         // Iterate over all swap chain images
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
+        for (size_t i = 0; i < target.images.size(); i++) {
             VkImageViewCreateInfo createInfo = {};
             createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.image = swapChainImages[i];
+            createInfo.image = target.images[i];
             createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = swapChainImageFormat;
+            createInfo.format = target.format;
             
             createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
             createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
@@ -133,28 +1703,46 @@ private:
             createInfo.subresourceRange.baseArrayLayer = 0;
             createInfo.subresourceRange.layerCount = 1;
             
-            VkResult result = vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]);
+            VkImageView imageView;
+            VkResult result = vkCreateImageView(device, &createInfo, nullptr, &imageView);
             if (result != VK_SUCCESS) {
                 throw std::runtime_error("Image view was not created.");
             }
+            target.imageViews.emplace_back(device, imageView);
         }
     }
     
-    void createSwapChain() {
-        SwapChainSupportDetails details = querySwapChainSupport(physicalDevice);
+    /// Creates the target's swap chain, or its offscreen images, for the window's current size. Returns the swap chain it
+    /// replaced, which may still be presenting and is the caller's to retire; empty the first time and when offscreen.
+    UniqueSwapchain createSwapChain(PresentTarget& target) {
+        if (options.offscreen) {
+            createOffscreenTargets(target);
+            return {};
+        }
         
+        // Formats and present modes don't change, but the surface's current extent does whenever the window is resized.
+        SwapChainSupportDetails& details = target.support;
+        if (details.formats.empty()) {
+            details = querySwapChainSupport(physicalDevice, target.surface);
+        }
+        else {
+            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, target.surface, &details.capabilities);
+        }
+        
+        // Pipelines are shared between windows, and are built for the main window's format.
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(details.formats);
+        if (&target != &targets.front() && surfaceFormat.format != targets.front().format) {
+            throw std::runtime_error("A window can't use the main window's swap chain format " +
+                                     std::to_string(targets.front().format) + ".");
+        }
         VkPresentModeKHR presentMode = chooseSwapPresentMode(details.presentModes);
-        VkExtent2D extent = chooseSwapExtent(details.capabilities);
+        VkExtent2D extent = chooseSwapExtent(details.capabilities, target.window);
         
-        uint32_t imageCount = details.capabilities.minImageCount + 1;
-        if (details.capabilities.maxImageCount > 0 && imageCount > details.capabilities.maxImageCount) {
-            imageCount = details.capabilities.maxImageCount;
-        }
+        uint32_t imageCount = chooseSwapImageCount(details.capabilities, presentMode);
         
         VkSwapchainCreateInfoKHR createInfo {};
         createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        createInfo.surface = surface;
+        createInfo.surface = target.surface;
         createInfo.minImageCount = imageCount;
         createInfo.imageFormat = surfaceFormat.format;
         createInfo.imageColorSpace = surfaceFormat.colorSpace;
@@ -163,7 +1751,13 @@ private:
         createInfo.imageArrayLayers = 1;
         createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
         
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        // Needed to blit a scaled-down scene into the image.
+        target.canUpscale = (details.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+        if (target.canUpscale) {
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        }
+        
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
         uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentationFamily.value()};
         
         // `imageSharingMode` describes how an image is shared across multiple queue families. If the sharing
@@ -183,37 +1777,132 @@ private:
         createInfo.preTransform = details.capabilities.currentTransform; // Don't change transform
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR; // Ignore alpha channel
         createInfo.clipped = VK_TRUE; // Clip pixels that are obscured from view
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        // Handing over the current swap chain (if any) lets the driver reuse its images. The old one is retired either way and
+        // must still be destroyed by the caller, once the frames presenting from it are done.
+        createInfo.oldSwapchain = target.swapChain.get();
         
-        VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain);
+        VkSwapchainKHR newSwapChain;
+        VkResult result = vkCreateSwapchainKHR(device, &createInfo, nullptr, &newSwapChain);
         if (result != VK_SUCCESS) {
             throw std::runtime_error("Swap chain was not created. Error code " + std::to_string(result));
         }
+        UniqueSwapchain oldSwapChain = std::move(target.swapChain);
+        target.swapChain = UniqueSwapchain(device, newSwapChain);
+        if (&target == &targets.front()) {
+            framePacer.setSwapchain(newSwapChain);
+        }
+        
+        // Get handles to swap chain images
+        uint32_t swapChainImageCount;
+        vkGetSwapchainImagesKHR(device, newSwapChain, &swapChainImageCount, nullptr);
+        target.images.resize(swapChainImageCount);
+        vkGetSwapchainImagesKHR(device, newSwapChain, &swapChainImageCount, target.images.data());
+        
+        target.format = surfaceFormat.format;
+        target.extent = extent;
+        target.presentMode = presentMode;
+        
+        std::cout << "Swap chain";
+        if (targets.size() > 1) {
+            std::cout << " " << (&target - targets.data()) + 1;
+        }
+        std::cout << ": " << presentModeName(presentMode) << " with " << swapChainImageCount << " images ("
+                  << presentPolicyName(options.presentPolicy) << " policy)\n";
         
-        // Get handles to swap chain images
-        uint32_t swapChainImageCount;
-        vkGetSwapchainImagesKHR(device, swapChain, &swapChainImageCount, nullptr);
-        swapChainImages.resize(swapChainImageCount);
-        vkGetSwapchainImagesKHR(device, swapChain, &swapChainImageCount, swapChainImages.data());
+        return oldSwapChain;
+    }
+    
+    /// Stands in for the swap chain when rendering offscreen: one color image per frame in flight, rendered to in turn, so
+    /// the rest of the renderer can treat them as swap chain images.
+    void createOffscreenTargets(PresentTarget& target) {
+        target.format = VK_FORMAT_B8G8R8A8_UNORM; // Must support color attachments on every device
+        target.extent = {options.width, options.height};
         
-        swapChainImageFormat = surfaceFormat.format;
-        swapChainExtent = extent;
+        target.images.resize(options.framesInFlight);
+        target.offscreenAllocations.resize(options.framesInFlight);
+        for (size_t i = 0; i < target.images.size(); i++) {
+            VkImageCreateInfo createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            createInfo.imageType = VK_IMAGE_TYPE_2D;
+            createInfo.format = target.format;
+            createInfo.extent = {target.extent.width, target.extent.height, 1};
+            createInfo.mipLevels = 1;
+            createInfo.arrayLayers = 1;
+            createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            createInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            
+            memoryAllocator.createImage(createInfo, MemoryUsage::GpuOnly, target.images[i], target.offscreenAllocations[i]);
+        }
+        target.canUpscale = true;
         
+        std::cout << "Offscreen: " << target.images.size() << " images of " << target.extent.width << "x"
+                  << target.extent.height << '\n';
     }
     
-    void createSurface() {
-        int result = glfwCreateWindowSurface(instance, window, nullptr, &surface);
-        if (result != VK_SUCCESS) {
-            throw std::runtime_error("Vulkan surface was not created. Error code " + std::to_string(result));
+    void createSurfaces() {
+        // Offscreen runs have no window to present to.
+        if (options.offscreen) {
+            return;
+        }
+        
+        for (auto& target : targets) {
+            int result = glfwCreateWindowSurface(instance, target.window, nullptr, &target.surface);
+            if (result != VK_SUCCESS) {
+                throw std::runtime_error("Vulkan surface was not created. Error code " + std::to_string(result));
+            }
         }
     }
     
-    const std::vector<const char*> deviceExtensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    /// A device extension the program uses. A device without a required one isn't suitable; optional ones are enabled when
+    /// the device has them and everything they depend on.
+    struct DeviceExtension {
+        const char* name;
+        bool required;
+        const char* dependency;     // another entry that must be enabled too, if any
     };
     
+    const std::vector<DeviceExtension> deviceExtensions = {
+        {VK_KHR_SWAPCHAIN_EXTENSION_NAME, true, nullptr},
+        {VK_KHR_PRESENT_ID_EXTENSION_NAME, false, nullptr},
+        {VK_KHR_PRESENT_WAIT_EXTENSION_NAME, false, VK_KHR_PRESENT_ID_EXTENSION_NAME},
+        {VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME, false, nullptr},   // also needs `surfaceMaintenance1`
+    };
+    
+    /// Offscreen runs never present, so they don't need VK_KHR_swapchain, nor any extension of it.
+    std::vector<const char*> requiredDeviceExtensions() {
+        std::vector<const char*> names;
+        for (const DeviceExtension& extension : deviceExtensions) {
+            if (extension.required && options.offscreen == false) {
+                names.push_back(extension.name);
+            }
+        }
+        return names;
+    }
+    
+    /// The optional entries of `deviceExtensions` that `availableExtensions` has, along with their dependencies.
+    std::vector<const char*> supportedOptionalExtensions(const std::set<std::string>& availableExtensions) {
+        std::vector<const char*> names;
+        if (options.offscreen) {
+            return names;
+        }
+        for (const DeviceExtension& extension : deviceExtensions) {
+            bool available = availableExtensions.count(extension.name) != 0 &&
+                (extension.dependency == nullptr || availableExtensions.count(extension.dependency) != 0);
+            if (strcmp(extension.name, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME) == 0) {
+                available = available && surfaceMaintenance1;
+            }
+            if (extension.required == false && available) {
+                names.push_back(extension.name);
+            }
+        }
+        return names;
+    }
+    
     void createLogicalDevice() {
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
         
         // Holds creation info for each queue family required by the device.
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
@@ -222,6 +1911,8 @@ private:
         std::set<uint32_t> uniqueQueueFamilies = {
             indices.graphicsFamily.value(),
             indices.presentationFamily.value(),
+            indices.computeFamily.value(),
+            indices.transferFamily.value(),
         };
         
         float queuePriority = 1.0f; // Queues must have priotity set, even if only one queue.
@@ -241,14 +1932,151 @@ private:
         createInfo.pQueueCreateInfos = queueCreateInfos.data();
         createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
         
-        // Specify the device features to use with this queue family.
-        // Currently, we don't need anything special, so default to false.
-        VkPhysicalDeviceFeatures deviceFeatures{};
-        createInfo.pEnabledFeatures = &deviceFeatures;
+        std::vector<const char*> extensions = requiredDeviceExtensions();
+        
+        // MoltenVK isn't fully conformant and requires this to be enabled whenever it's advertised.
+        if (deviceCapabilities.availableExtensions.count(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME) != 0) {
+            extensions.push_back(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
+        }
+        
+        // Of the core 1.0 features only drawIndirectFirstInstance is used, by GPU culling. Dynamic rendering, synchronization2,
+        // descriptor indexing, draw indirect count and timeline semaphores are enabled through the pNext chain of VkPhysicalDeviceFeatures2, which
+        // then replaces pEnabledFeatures.
+        bool useDescriptorHeap = deviceCapabilities.descriptorIndexing != FeatureSupport::None;
+        bool useDynamicRendering = options.legacyRendering == false && deviceCapabilities.dynamicRendering != FeatureSupport::None;
+        bool useSynchronization2 = options.legacyRendering == false && deviceCapabilities.synchronization2 != FeatureSupport::None;
+        
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        VkPhysicalDeviceVulkan13Features vulkan13{};
+        vulkan13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRendering{};
+        dynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2{};
+        synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+        VkPhysicalDeviceVulkan12Features vulkan12{};
+        vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexing{};
+        descriptorIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphore{};
+        timelineSemaphore.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        VkPhysicalDevicePresentIdFeaturesKHR presentId{};
+        presentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWait{};
+        presentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenance1{};
+        swapchainMaintenance1.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+        
+        if (useDescriptorHeap) {
+            // Query again for the optional non-uniform indexing bits; only the required ones were kept.
+            VkPhysicalDeviceVulkan12Features supported12{};
+            supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexing{};
+            supportedIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+            bool core = deviceCapabilities.descriptorIndexing == FeatureSupport::Core;
+            
+            VkPhysicalDeviceFeatures2 supported{};
+            supported.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            supported.pNext = core ? static_cast<void*>(&supported12) : static_cast<void*>(&supportedIndexing);
+            getPhysicalDeviceFeatures2(physicalDevice, &supported);
+            
+            if (core) {
+                enableDescriptorHeapFeatures(vulkan12, supported12);
+                vulkan12.descriptorIndexing = VK_TRUE;
+            }
+            else {
+                enableDescriptorHeapFeatures(descriptorIndexing, supportedIndexing);
+                descriptorIndexing.pNext = features2.pNext;
+                features2.pNext = &descriptorIndexing;
+                extensions.push_back(VK_KHR_MAINTENANCE_3_EXTENSION_NAME);
+                extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            }
+        }
+        if (deviceCapabilities.drawIndirectCount == FeatureSupport::Core) {
+            vulkan12.drawIndirectCount = VK_TRUE;
+        }
+        else if (deviceCapabilities.drawIndirectCount == FeatureSupport::Extension) {
+            extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+        }
+        if (deviceCapabilities.timelineSemaphore == FeatureSupport::Core) {
+            vulkan12.timelineSemaphore = VK_TRUE;
+        }
+        else if (deviceCapabilities.timelineSemaphore == FeatureSupport::Extension) {
+            timelineSemaphore.timelineSemaphore = VK_TRUE;
+            timelineSemaphore.pNext = features2.pNext;
+            features2.pNext = &timelineSemaphore;
+            extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+        }
+        if (vulkan12.descriptorIndexing || vulkan12.drawIndirectCount || vulkan12.timelineSemaphore) {
+            vulkan12.pNext = features2.pNext;
+            features2.pNext = &vulkan12;
+        }
+        features2.features.drawIndirectFirstInstance = deviceCapabilities.features.drawIndirectFirstInstance;
+        
+        if (useDynamicRendering) {
+            if (deviceCapabilities.dynamicRendering == FeatureSupport::Core) {
+                vulkan13.dynamicRendering = VK_TRUE;
+            }
+            else {
+                dynamicRendering.dynamicRendering = VK_TRUE;
+                dynamicRendering.pNext = features2.pNext;
+                features2.pNext = &dynamicRendering;
+                extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+            }
+        }
+        if (useSynchronization2) {
+            if (deviceCapabilities.synchronization2 == FeatureSupport::Core) {
+                vulkan13.synchronization2 = VK_TRUE;
+            }
+            else {
+                synchronization2.synchronization2 = VK_TRUE;
+                synchronization2.pNext = features2.pNext;
+                features2.pNext = &synchronization2;
+                extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+            }
+        }
+        if (vulkan13.dynamicRendering || vulkan13.synchronization2) {
+            vulkan13.pNext = features2.pNext;
+            features2.pNext = &vulkan13;
+        }
+        
+        // Optional extensions without features are enabled as they are. Present waits are only worth enabling whole, and
+        // swap chain maintenance only with its feature.
+        for (const char* name : deviceCapabilities.optionalExtensions) {
+            bool presentWaitExtension = strcmp(name, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0 ||
+                strcmp(name, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0;
+            bool swapchainMaintenance1Extension = strcmp(name, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME) == 0;
+            if (presentWaitExtension && deviceCapabilities.presentWait == false) {
+                continue;
+            }
+            if (swapchainMaintenance1Extension && deviceCapabilities.swapchainMaintenance1 == false) {
+                continue;
+            }
+            extensions.push_back(name);
+        }
+        if (deviceCapabilities.presentWait) {
+            presentId.presentId = VK_TRUE;
+            presentWait.presentWait = VK_TRUE;
+            presentId.pNext = features2.pNext;
+            presentWait.pNext = &presentId;
+            features2.pNext = &presentWait;
+        }
+        if (deviceCapabilities.swapchainMaintenance1) {
+            swapchainMaintenance1.swapchainMaintenance1 = VK_TRUE;
+            swapchainMaintenance1.pNext = features2.pNext;
+            features2.pNext = &swapchainMaintenance1;
+        }
+        
+        if (features2.pNext != nullptr) {
+            createInfo.pNext = &features2;
+        }
+        else {
+            createInfo.pEnabledFeatures = &features2.features;
+        }
         
         // Enables device extensions
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
         
         // Similar to when creating a vk instance, set up validation layers.
         if (enableValidationLayers) {
@@ -264,12 +2092,337 @@ private:
             throw std::runtime_error("Logical device was not created.");
         }
         
+        loadRenderingFunctions(useDynamicRendering, useSynchronization2);
+        if (deviceCapabilities.drawIndirectCount != FeatureSupport::None) {
+            bool core = deviceCapabilities.drawIndirectCount == FeatureSupport::Core;
+            cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+                vkGetDeviceProcAddr(device, core ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndexedIndirectCountKHR"));
+        }
+        if (deviceCapabilities.timelineSemaphore != FeatureSupport::None) {
+            bool core = deviceCapabilities.timelineSemaphore == FeatureSupport::Core;
+            getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+                vkGetDeviceProcAddr(device, core ? "vkGetSemaphoreCounterValue" : "vkGetSemaphoreCounterValueKHR"));
+            waitForSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+                vkGetDeviceProcAddr(device, core ? "vkWaitSemaphores" : "vkWaitSemaphoresKHR"));
+        }
+        if (deviceCapabilities.presentWait) {
+            waitForPresent = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+        }
+        
         // Presume that queue index is '0' because we're only creating 1 queue for each queue family.
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentationFamily.value(), 0, &presentationQueue);
+        vkGetDeviceQueue(device, indices.computeFamily.value(), 0, &computeQueue);
+        vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+        
+        std::cout << "Queue families: graphics " << indices.graphicsFamily.value()
+                  << ", present " << indices.presentationFamily.value()
+                  << ", compute " << indices.computeFamily.value() << (indices.hasDedicatedCompute() ? " (dedicated)" : "")
+                  << ", transfer " << indices.transferFamily.value() << (indices.hasDedicatedTransfer() ? " (dedicated)" : "")
+                  << '\n';
+    }
+    
+    /// Core entry points are named without the KHR suffix; a 1.3 driver that doesn't expose the extension may not export the
+    /// suffixed names.
+    void loadRenderingFunctions(bool dynamicRendering, bool synchronization2) {
+        renderingFunctions = RenderGraph::DeviceFunctions{};
+        
+        if (dynamicRendering) {
+            bool core = deviceCapabilities.dynamicRendering == FeatureSupport::Core;
+            renderingFunctions.cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+                vkGetDeviceProcAddr(device, core ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR"));
+            renderingFunctions.cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+                vkGetDeviceProcAddr(device, core ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR"));
+            if (renderingFunctions.cmdBeginRendering == nullptr || renderingFunctions.cmdEndRendering == nullptr) {
+                renderingFunctions.cmdBeginRendering = nullptr;
+                renderingFunctions.cmdEndRendering = nullptr;
+            }
+        }
+        if (synchronization2) {
+            bool core = deviceCapabilities.synchronization2 == FeatureSupport::Core;
+            renderingFunctions.cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(
+                vkGetDeviceProcAddr(device, core ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier2KHR"));
+        }
+        
+        std::cout << "Rendering with " << (renderingFunctions.cmdBeginRendering != nullptr ? "dynamic rendering" : "render passes")
+                  << " and " << (renderingFunctions.cmdPipelineBarrier2 != nullptr ? "synchronization2" : "1.0 barriers") << '\n';
+    }
+    
+    void createMemoryAllocator() {
+        memoryAllocator.init(physicalDevice, device);
+    }
+    
+    void createSubmissionScheduler() {
+        scheduler.init(device, {graphicsQueue, computeQueue, transferQueue}, getSemaphoreCounterValue, waitForSemaphores);
+        std::cout << "Tracking queue progress with "
+                  << (scheduler.usesTimelineSemaphores() ? "timeline semaphores" : "fences and binary semaphores") << '\n';
+    }
+    
+    /// The pipeline cache file is named after the vendor and device so machines with several GPUs keep one blob per GPU.
+    std::string pipelineCachePath() {
+        const VkPhysicalDeviceProperties& properties = deviceCapabilities.properties;
+        
+        char name[64];
+        snprintf(name, sizeof(name), "pipeline_cache_%04x_%04x.bin", properties.vendorID, properties.deviceID);
+        return options.pipelineCacheDirectory + "/" + name;
+    }
+    
+    /// Checks that a pipeline cache blob was written by this exact device and driver. Drivers are supposed to reject foreign
+    /// data themselves, but some crash on it instead, so anything but a well-formed header with matching vendor ID, device ID
+    /// and `pipelineCacheUUID` is discarded before it reaches the driver.
+    bool isPipelineCacheCompatible(const std::vector<char>& data) {
+        VkPipelineCacheHeaderVersionOne header;
+        if (data.size() < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        
+        const VkPhysicalDeviceProperties& properties = deviceCapabilities.properties;
+        
+        return header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+            header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+            header.vendorID == properties.vendorID &&
+            header.deviceID == properties.deviceID &&
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+    
+    /// Reads the blob saved by a previous run. Returns nothing if there's none or it isn't compatible with the current device.
+    /// Only reads `deviceCapabilities`, so it's safe to run on another thread during device creation.
+    std::vector<char> readPipelineCacheFile() {
+        std::vector<char> data;
+        
+        std::ifstream file(pipelineCachePath(), std::ios::binary | std::ios::ate);
+        if (file.is_open()) {
+            data.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(data.data(), static_cast<std::streamsize>(data.size()));
+            
+            if (file.good() == false || isPipelineCacheCompatible(data) == false) {
+                std::cout << "Ignoring incompatible pipeline cache " << pipelineCachePath() << '\n';
+                data.clear();
+            }
+        }
+        
+        return data;
+    }
+    
+    /// Creates `pipelineCache`, seeded with `data` from `readPipelineCacheFile()`.
+    void createPipelineCache(const std::vector<char>& data) {
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = data.size();
+        createInfo.pInitialData = data.empty() ? nullptr : data.data();
+        
+        VkPipelineCache cache;
+        VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+        if (result != VK_SUCCESS && data.empty() == false) {
+            // The header looked fine but the driver still didn't like the contents. Start over with an empty cache.
+            createInfo.initialDataSize = 0;
+            createInfo.pInitialData = nullptr;
+            result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+        }
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Pipeline cache was not created. Error code " + std::to_string(result));
+        }
+        pipelineCache = UniquePipelineCache(device, cache);
+        
+        if (data.empty() == false) {
+            std::cout << "Loaded " << data.size() << " bytes of pipeline cache from " << pipelineCachePath() << '\n';
+        }
+    }
+    
+    void createPipelineManager() {
+        pipelineManager.init(device, pipelineCache.get(), options.pipelineCompileThreads);
+    }
+    
+    /// Without descriptor indexing the heap stays invalid and draws have to bind their own descriptor sets.
+    void createDescriptorHeap() {
+        if (deviceCapabilities.descriptorIndexing == FeatureSupport::None) {
+            std::cout << "Descriptor heap: unavailable, the device lacks update-after-bind descriptor indexing\n";
+            return;
+        }
+        
+        descriptorHeap.init(device, deviceCapabilities.descriptorIndexingProperties, options.framesInFlight);
+        
+        DescriptorHeap::Stats stats = descriptorHeap.getStats();
+        std::cout << "Descriptor heap: " << stats.capacity.sampledImages << " sampled images, " << stats.capacity.storageBuffers
+                  << " storage buffers, " << stats.capacity.samplers << " samplers ("
+                  << (deviceCapabilities.descriptorIndexing == FeatureSupport::Core ? "core 1.2" : "VK_EXT_descriptor_indexing")
+                  << ")\n";
+    }
+    
+    /// Writes `pipelineCache` to disk. The blob goes to a temporary file that is then renamed over the old one, so a crash
+    /// mid-write never leaves a truncated cache behind.
+    void savePipelineCache() {
+        size_t size = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache.get(), &size, nullptr) != VK_SUCCESS || size == 0) {
+            return;
+        }
+        
+        std::vector<char> data(size);
+        if (vkGetPipelineCacheData(device, pipelineCache.get(), &size, data.data()) != VK_SUCCESS) {
+            return;
+        }
+        
+        std::string path = pipelineCachePath();
+        std::string temporaryPath = path + ".tmp";
+        
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), static_cast<std::streamsize>(size));
+        file.close();
+        
+        if (file.good() == false || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            std::cerr << "Pipeline cache was not saved to " << path << '\n';
+            std::remove(temporaryPath.c_str());
+        }
+    }
+    
+    struct QueueFamilyIndices {
+        std::optional<uint32_t> graphicsFamily;
+        std::optional<uint32_t> presentationFamily;
+        
+        // Always set when graphicsFamily is. They point at a dedicated family when the device has one, and fall back to the
+        // graphics family otherwise.
+        std::optional<uint32_t> computeFamily;
+        std::optional<uint32_t> transferFamily;
+        
+        bool isComplete() const {
+            return graphicsFamily.has_value() && presentationFamily.has_value();
+        }
+        
+        // True when compute work can run on its own queue family, concurrently with graphics.
+        bool hasDedicatedCompute() const {
+            return computeFamily.has_value() && computeFamily != graphicsFamily;
+        }
+        
+        // True when transfers can run on their own queue family, concurrently with graphics.
+        bool hasDedicatedTransfer() const {
+            return transferFamily.has_value() && transferFamily != graphicsFamily;
+        }
+    };
+    
+    /// How an optional feature can be turned on: not at all, by enabling its extension, or through core Vulkan.
+    enum class FeatureSupport {
+        None,
+        Extension,
+        Core,
+    };
+    
+    /// Everything device selection and setup need to know about a physical device. Queried once per device by
+    /// `queryDeviceCapabilities()`; the chosen device's copy is kept in `deviceCapabilities`.
+    struct DeviceCapabilities {
+        VkPhysicalDevice physicalDevice;
+        VkPhysicalDeviceProperties properties;
+        uint32_t apiVersion;                        // the lower of the device's and the instance's
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        std::vector<VkQueueFamilyProperties> queueFamilyProperties;
+        QueueFamilyIndices queueFamilies;
+        std::set<std::string> availableExtensions;
+        bool extensionsSupported;
+        std::vector<const char*> optionalExtensions;    // see `supportedOptionalExtensions()`
+        FeatureSupport dynamicRendering;
+        FeatureSupport synchronization2;
+        FeatureSupport descriptorIndexing;          // only the subset `DescriptorHeap` relies on
+        FeatureSupport drawIndirectCount;
+        FeatureSupport timelineSemaphore;
+        bool presentWait;                           // VK_KHR_present_id and VK_KHR_present_wait with both their features
+        bool swapchainMaintenance1;                 // VK_EXT_swapchain_maintenance1 with its feature, for present fences
+        VkPhysicalDeviceFeatures features;
+        VkPhysicalDeviceDescriptorIndexingProperties descriptorIndexingProperties; // zeroed unless descriptorIndexing is supported
+        SwapChainSupportDetails swapChainSupport;   // empty when offscreen or the extensions are missing
+        std::string uuid;                           // empty if VK_KHR_get_physical_device_properties2 is unavailable
+    };
+    DeviceCapabilities deviceCapabilities{};
+    
+    // What `applyQualityPreset()` probed and chose. Its resolution scale is the starting render scale unless `--render-scale`
+    // is given; its MSAA sample count is only a recommendation so far, since nothing renders multisampled yet.
+    HardwareReport hardwareReport;
+    QualityTier qualityTier = QualityTier::Medium;
+    QualitySettings qualitySettings;
+    
+    /// What `rateDevice()` found out about a physical device. Devices are ranked by comparing these fields in order.
+    struct DeviceRating {
+        int typeRank;                   // discrete > integrated > virtual > CPU > other
+        int dedicatedQueueFamilies;     // compute-only and transfer-only families, which let work overlap with graphics
+        VkDeviceSize deviceLocalBytes;  // size of the largest device-local heap
+        uint32_t maxImageDimension2D;   // a coarse stand-in for the device's class
+        std::string name;
+        std::string uuid;               // empty if VK_KHR_get_physical_device_properties2 is unavailable
+        VkPhysicalDeviceType type;
+        
+        bool operator<(const DeviceRating& other) const {
+            return std::tie(typeRank, dedicatedQueueFamilies, deviceLocalBytes, maxImageDimension2D) <
+                std::tie(other.typeRank, other.dedicatedQueueFamilies, other.deviceLocalBytes, other.maxImageDimension2D);
+        }
+    };
+    
+    static const char* deviceTypeName(VkPhysicalDeviceType type) {
+        switch (type) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete GPU";
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated GPU";
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual GPU";
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: return "CPU";
+            default: return "other";
+        }
+    }
+    
+    /// Formats a 16-byte UUID as `xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx`.
+    static std::string formatUUID(const uint8_t* uuid) {
+        static const char digits[] = "0123456789abcdef";
+        std::string text;
+        for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+            if (i == 4 || i == 6 || i == 8 || i == 10) {
+                text += '-';
+            }
+            text += digits[uuid[i] >> 4];
+            text += digits[uuid[i] & 0xF];
+        }
+        return text;
+    }
+    
+    /// Lowercases and strips dashes so UUIDs can be compared however they were typed.
+    static std::string normalizeDeviceKey(const std::string& text) {
+        std::string key;
+        for (char c : text) {
+            if (c != '-') {
+                key += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+        }
+        return key;
+    }
+    
+    DeviceRating rateDevice(const DeviceCapabilities& capabilities) {
+        const VkPhysicalDeviceProperties& properties = capabilities.properties;
+        
+        DeviceRating rating{};
+        rating.name = properties.deviceName;
+        rating.type = properties.deviceType;
+        rating.maxImageDimension2D = properties.limits.maxImageDimension2D;
+        
+        switch (properties.deviceType) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: rating.typeRank = 4; break;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: rating.typeRank = 3; break;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: rating.typeRank = 2; break;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU: rating.typeRank = 1; break;
+            default: rating.typeRank = 0; break;
+        }
+        
+        const VkPhysicalDeviceMemoryProperties& memoryProperties = capabilities.memoryProperties;
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            if ((memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0) {
+                rating.deviceLocalBytes = std::max(rating.deviceLocalBytes, memoryProperties.memoryHeaps[i].size);
+            }
+        }
+        
+        const QueueFamilyIndices& indices = capabilities.queueFamilies;
+        rating.dedicatedQueueFamilies = (indices.hasDedicatedCompute() ? 1 : 0) + (indices.hasDedicatedTransfer() ? 1 : 0);
+        rating.uuid = capabilities.uuid;
+        
+        return rating;
     }
     
-    // Get the first device and assign it as our Vulkan Physical Device
+    /// Picks the best suitable device according to `DeviceRating`, unless `options.device` names one by name or UUID.
+    /// Logs every candidate and why the winner was chosen.
     void pickPhysicalDevice() {
         uint32_t deviceCount = 0;
         vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -281,12 +2434,41 @@ private:
         std::vector<VkPhysicalDevice> devices(deviceCount);
         vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
         
-        // Iterate through list of devices and check if suitable.
-        // Use the first suitable device as our Vulkan Physical Device.
+        std::optional<DeviceRating> bestRating;
+        std::optional<DeviceRating> overrideRating;
+        VkPhysicalDevice overrideDevice = VK_NULL_HANDLE;
+        std::string overrideKey = normalizeDeviceKey(options.device);
+        
+        std::vector<DeviceCapabilities> candidates;
         for (const auto& device : devices) {
-            if (isDeviceSuitable(device) == true) {
+            candidates.push_back(queryDeviceCapabilities(device));
+        }
+        
+        for (const auto& capabilities : candidates) {
+            VkPhysicalDevice device = capabilities.physicalDevice;
+            DeviceRating rating = rateDevice(capabilities);
+            bool suitable = isDeviceSuitable(capabilities);
+            
+            std::cout << "GPU candidate: " << rating.name << " (" << deviceTypeName(rating.type) << ", "
+                      << rating.deviceLocalBytes / (1024 * 1024) << " MiB device-local, "
+                      << rating.dedicatedQueueFamilies << " dedicated queue families"
+                      << (rating.uuid.empty() ? "" : ", UUID " + rating.uuid) << ")"
+                      << (suitable ? "" : " - not suitable") << '\n';
+            
+            if (suitable == false) {
+                continue;
+            }
+            
+            bool matchesOverride = !overrideKey.empty() &&
+                (normalizeDeviceKey(rating.name) == overrideKey || normalizeDeviceKey(rating.uuid) == overrideKey);
+            if (matchesOverride && overrideDevice == VK_NULL_HANDLE) {
+                overrideDevice = device;
+                overrideRating = rating;
+            }
+            
+            if (bestRating.has_value() == false || *bestRating < rating) {
                 physicalDevice = device;
-                break;
+                bestRating = rating;
             }
         }
         
@@ -295,89 +2477,355 @@ private:
             throw std::runtime_error("A physical device was not found.");
         }
         
-    }
-    
-    // Checks if the physical device is suitable to run this application.
-    bool isDeviceSuitable(VkPhysicalDevice device) {
-        QueueFamilyIndices indices = findQueueFamilies(device);
+        if (overrideDevice != VK_NULL_HANDLE) {
+            physicalDevice = overrideDevice;
+        }
+        if (options.multiGpu) {
+            pickWorkerDevices(candidates);
+        }
+        for (auto& capabilities : candidates) {
+            if (capabilities.physicalDevice == physicalDevice) {
+                deviceCapabilities = std::move(capabilities);
+            }
+        }
         
-        bool extensionSupported = checkDeviceExtensionSupport(device);
-                
-        bool swapChainAdequate = false;
-        if (extensionSupported) {
-            SwapChainSupportDetails swapchain = querySwapChainSupport(device);
-            swapChainAdequate = !swapchain.formats.empty() && !swapchain.presentModes.empty();
+        if (overrideDevice != VK_NULL_HANDLE) {
+            std::cout << "Using GPU " << overrideRating->name << ": selected by override \"" << options.device << "\"\n";
+            return;
         }
         
+        if (overrideKey.empty() == false) {
+            std::cerr << "No suitable GPU matches \"" << options.device << "\", falling back to automatic selection.\n";
+        }
         
-        return indices.isComplete() && extensionSupported && swapChainAdequate;
+        std::cout << "Using GPU " << bestRating->name << ": highest score (" << deviceTypeName(bestRating->type) << ", "
+                  << bestRating->deviceLocalBytes / (1024 * 1024) << " MiB device-local, "
+                  << bestRating->dedicatedQueueFamilies << " dedicated queue families)\n";
     }
     
-    // Checks if the device has the required extensiosn.
-    // Enumerates the device's extensions, then checks if required extensions are among the list.
-    bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
-        uint32_t extensionCount;
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+    /// The GPUs a compute batch runs on: the one `options.device` names, or else every GPU, leaving out CPU implementations
+    /// when there's something else and any GPU seen a second time through another driver. Only a compute queue is needed.
+    std::vector<VkPhysicalDevice> pickBatchDevices() {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
         
-        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+        std::vector<DeviceCapabilities> candidates;
+        bool haveGpu = false;
+        for (VkPhysicalDevice device : devices) {
+            candidates.push_back(queryDeviceCapabilities(device));
+            haveGpu = haveGpu || candidates.back().properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_CPU;
+        }
         
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+        std::string overrideKey = normalizeDeviceKey(options.device);
+        std::vector<VkPhysicalDevice> chosen;
+        std::set<std::string> uuids;
+        for (const auto& capabilities : candidates) {
+            const VkPhysicalDeviceProperties& properties = capabilities.properties;
+            if (overrideKey.empty() == false) {
+                if (normalizeDeviceKey(properties.deviceName) == overrideKey || normalizeDeviceKey(capabilities.uuid) == overrideKey) {
+                    return {capabilities.physicalDevice};
+                }
+                continue;
+            }
+            if (haveGpu && properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+                continue;
+            }
+            if (capabilities.uuid.empty() == false && uuids.insert(capabilities.uuid).second == false) {
+                continue;
+            }
+            chosen.push_back(capabilities.physicalDevice);
+        }
+        if (overrideKey.empty() == false) {
+            std::cerr << "No GPU matches \"" << options.device << "\", running the batch on every GPU.\n";
+            options.device.clear();
+            return pickBatchDevices();
+        }
+        return chosen;
+    }
+    
+    /// Every GPU but the chosen one can take offscreen work, unless it's a CPU implementation or the chosen GPU again under
+    /// another driver. Workers only compute, so neither a surface nor the renderer's features are needed.
+    void pickWorkerDevices(const std::vector<DeviceCapabilities>& candidates) {
+        std::string chosenUuid;
+        for (const auto& capabilities : candidates) {
+            if (capabilities.physicalDevice == physicalDevice) {
+                chosenUuid = capabilities.uuid;
+            }
+        }
+        for (const auto& capabilities : candidates) {
+            bool sameGpu = capabilities.physicalDevice == physicalDevice ||
+                (chosenUuid.empty() == false && capabilities.uuid == chosenUuid);
+            if (sameGpu == false && capabilities.properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_CPU) {
+                workerPhysicalDevices.push_back(capabilities.physicalDevice);
+            }
+        }
+    }
+    
+    /// Probes the chosen device and the host, logs the report as JSON, and fills in every setting that wasn't given on the
+    /// command line from the preset of the machine's tier, or of `--quality`.
+    void applyQualityPreset() {
+        const QueueFamilyIndices& indices = deviceCapabilities.queueFamilies;
+        uint32_t dedicatedQueueFamilies = (indices.hasDedicatedCompute() ? 1 : 0) + (indices.hasDedicatedTransfer() ? 1 : 0);
+        hardwareReport = probeHardware(deviceCapabilities.properties, deviceCapabilities.memoryProperties,
+                                       deviceCapabilities.apiVersion, dedicatedQueueFamilies, std::thread::hardware_concurrency());
+        qualityTier = options.quality.value_or(hardwareReport.tier);
+        qualitySettings = qualityPreset(qualityTier, hardwareReport);
         
-        for (const auto& extension : availableExtensions) {
-            requiredExtensions.erase(extension.extensionName);
+        if (options.framesInFlightGiven == false) {
+            options.framesInFlight = qualitySettings.framesInFlight;
+        }
+        if (options.recordingThreadsGiven == false) {
+            options.recordingThreads = qualitySettings.recordingThreads;
         }
+        if (options.pipelineCompileThreadsGiven == false) {
+            options.pipelineCompileThreads = qualitySettings.pipelineCompileThreads;
+        }
+        options.stagingBytesPerFrame = qualitySettings.stagingBytesPerFrame;
+        options.streamingThreads = qualitySettings.streamingThreads;
         
-        bool result = requiredExtensions.empty();
+        std::cout << "Hardware report: ";
+        hardwareReport.writeJson(std::cout);
+        std::cout << '\n';
+        std::cout << "Quality preset " << qualityTierName(qualityTier) << (options.quality.has_value() ? " (--quality)" : "")
+                  << ": " << options.framesInFlight << " frames in flight, " << options.stagingBytesPerFrame / (1024 * 1024)
+                  << " MiB staging per frame, " << options.recordingThreads << " recording, " << options.pipelineCompileThreads
+                  << " compile and " << options.streamingThreads << " streaming threads, " << qualitySettings.resolutionScale
+                  << "x resolution; suggests " << qualitySettings.msaaSamples << "x MSAA\n";
+    }
+    
+    // Checks if the physical device is suitable to run this application.
+    bool isDeviceSuitable(const DeviceCapabilities& capabilities) {
+        const SwapChainSupportDetails& swapchain = capabilities.swapChainSupport;
+        bool swapChainAdequate = options.offscreen || (!swapchain.formats.empty() && !swapchain.presentModes.empty());
         
-        return result;
+        return capabilities.queueFamilies.isComplete() && capabilities.extensionsSupported && swapChainAdequate;
     }
     
-    struct QueueFamilyIndices {
-        std::optional<uint32_t> graphicsFamily;
-        std::optional<uint32_t> presentationFamily;
+    // Checks if the device has the required extensions. Optional ones are left to `supportedOptionalExtensions()`.
+    bool checkDeviceExtensionSupport(const std::set<std::string>& availableExtensions) {
+        for (const char* extension : requiredDeviceExtensions()) {
+            if (availableExtensions.count(extension) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    std::set<std::string> queryDeviceExtensions(VkPhysicalDevice device) {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
         
-        bool isComplete() {
-            return graphicsFamily.has_value() && presentationFamily.has_value();
+        std::vector<VkExtensionProperties> extensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+        
+        std::set<std::string> names;
+        for (const auto& extension : extensions) {
+            names.insert(extension.extensionName);
         }
-    };
+        return names;
+    }
     
-    QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
-        QueueFamilyIndices indices;
+    /// True if `features` has everything `DescriptorHeap` needs. Works on VkPhysicalDeviceVulkan12Features and
+    /// VkPhysicalDeviceDescriptorIndexingFeatures, which name these members the same.
+    template <typename Features>
+    static bool supportsDescriptorHeap(const Features& features) {
+        return features.runtimeDescriptorArray && features.descriptorBindingPartiallyBound &&
+            features.descriptorBindingUpdateUnusedWhilePending && features.descriptorBindingSampledImageUpdateAfterBind &&
+            features.descriptorBindingStorageBufferUpdateAfterBind;
+    }
+    
+    /// Turns on what `DescriptorHeap` needs in `features`, plus non-uniform indexing where `supported` has it.
+    template <typename Features>
+    static void enableDescriptorHeapFeatures(Features& features, const Features& supported) {
+        features.runtimeDescriptorArray = VK_TRUE;
+        features.descriptorBindingPartiallyBound = VK_TRUE;
+        features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        features.shaderSampledImageArrayNonUniformIndexing = supported.shaderSampledImageArrayNonUniformIndexing;
+        features.shaderStorageBufferArrayNonUniformIndexing = supported.shaderStorageBufferArrayNonUniformIndexing;
+    }
+    
+    /// Finds out whether dynamic rendering and synchronization2 are in core Vulkan 1.3, and descriptor indexing in core 1.2,
+    /// available as extensions, or missing. Feature queries need Vulkan 1.1 or VK_KHR_get_physical_device_properties2, which
+    /// MoltenVK on older loaders lacks.
+    void queryOptionalFeatures(DeviceCapabilities& capabilities) {
+        capabilities.dynamicRendering = FeatureSupport::None;
+        capabilities.synchronization2 = FeatureSupport::None;
+        capabilities.descriptorIndexing = FeatureSupport::None;
+        capabilities.drawIndirectCount = FeatureSupport::None;
+        capabilities.timelineSemaphore = FeatureSupport::None;
+        capabilities.presentWait = false;
+        capabilities.swapchainMaintenance1 = false;
+        if (getPhysicalDeviceFeatures2 == nullptr || capabilities.apiVersion < VK_API_VERSION_1_1) {
+            return;
+        }
         
-        uint32_t count;
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        VkPhysicalDeviceVulkan13Features vulkan13{};
+        vulkan13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+        VkPhysicalDeviceVulkan12Features vulkan12{};
+        vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRendering{};
+        dynamicRendering.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+        VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2{};
+        synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexing{};
+        descriptorIndexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphore{};
+        timelineSemaphore.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        VkPhysicalDevicePresentIdFeaturesKHR presentId{};
+        presentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWait{};
+        presentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT swapchainMaintenance1{};
+        swapchainMaintenance1.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT;
+        
+        // A feature struct may only be chained if its extension is there. VK_KHR_dynamic_rendering also needs
+        // VK_KHR_depth_stencil_resolve and its dependencies, which are only guaranteed by 1.2, and VK_EXT_descriptor_indexing
+        // needs VK_KHR_maintenance3.
+        bool core13 = capabilities.apiVersion >= VK_API_VERSION_1_3;
+        bool core12 = capabilities.apiVersion >= VK_API_VERSION_1_2;
+        bool dynamicRenderingExtension = core13 == false && core12 &&
+            capabilities.availableExtensions.count(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) != 0;
+        bool synchronization2Extension = core13 == false &&
+            capabilities.availableExtensions.count(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) != 0;
+        bool descriptorIndexingExtension = core12 == false &&
+            capabilities.availableExtensions.count(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) != 0 &&
+            capabilities.availableExtensions.count(VK_KHR_MAINTENANCE_3_EXTENSION_NAME) != 0;
+        bool timelineSemaphoreExtension = core12 == false &&
+            capabilities.availableExtensions.count(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) != 0;
+        const std::vector<const char*>& optional = capabilities.optionalExtensions;
+        bool presentWaitExtensions = std::find_if(optional.begin(), optional.end(), [](const char* name) {
+            return strcmp(name, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0;
+        }) != optional.end();
+        bool swapchainMaintenance1Extension = std::find_if(optional.begin(), optional.end(), [](const char* name) {
+            return strcmp(name, VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME) == 0;
+        }) != optional.end();
+        
+        if (core13) {
+            vulkan13.pNext = features2.pNext;
+            features2.pNext = &vulkan13;
+        }
+        if (core12) {
+            vulkan12.pNext = features2.pNext;
+            features2.pNext = &vulkan12;
+        }
+        if (dynamicRenderingExtension) {
+            dynamicRendering.pNext = features2.pNext;
+            features2.pNext = &dynamicRendering;
+        }
+        if (synchronization2Extension) {
+            synchronization2.pNext = features2.pNext;
+            features2.pNext = &synchronization2;
+        }
+        if (descriptorIndexingExtension) {
+            descriptorIndexing.pNext = features2.pNext;
+            features2.pNext = &descriptorIndexing;
+        }
+        if (timelineSemaphoreExtension) {
+            timelineSemaphore.pNext = features2.pNext;
+            features2.pNext = &timelineSemaphore;
+        }
+        if (presentWaitExtensions) {
+            presentId.pNext = features2.pNext;
+            presentWait.pNext = &presentId;
+            features2.pNext = &presentWait;
+        }
+        if (swapchainMaintenance1Extension) {
+            swapchainMaintenance1.pNext = features2.pNext;
+            features2.pNext = &swapchainMaintenance1;
+        }
+        getPhysicalDeviceFeatures2(capabilities.physicalDevice, &features2);
+        capabilities.presentWait = presentId.presentId && presentWait.presentWait;
+        capabilities.swapchainMaintenance1 = swapchainMaintenance1.swapchainMaintenance1;
         
-        std::vector<VkQueueFamilyProperties> properties(count);
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &count, properties.data());
+        if (core13) {
+            capabilities.dynamicRendering = vulkan13.dynamicRendering ? FeatureSupport::Core : FeatureSupport::None;
+            capabilities.synchronization2 = vulkan13.synchronization2 ? FeatureSupport::Core : FeatureSupport::None;
+        }
+        else {
+            capabilities.dynamicRendering = dynamicRendering.dynamicRendering ? FeatureSupport::Extension : FeatureSupport::None;
+            capabilities.synchronization2 = synchronization2.synchronization2 ? FeatureSupport::Extension : FeatureSupport::None;
+        }
+        if (core12) {
+            capabilities.descriptorIndexing = supportsDescriptorHeap(vulkan12) ? FeatureSupport::Core : FeatureSupport::None;
+            capabilities.drawIndirectCount = vulkan12.drawIndirectCount ? FeatureSupport::Core : FeatureSupport::None;
+            capabilities.timelineSemaphore = vulkan12.timelineSemaphore ? FeatureSupport::Core : FeatureSupport::None;
+        }
+        else {
+            capabilities.descriptorIndexing = supportsDescriptorHeap(descriptorIndexing) ? FeatureSupport::Extension : FeatureSupport::None;
+            
+            // VK_KHR_draw_indirect_count has no feature struct.
+            if (capabilities.availableExtensions.count(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) != 0) {
+                capabilities.drawIndirectCount = FeatureSupport::Extension;
+            }
+            capabilities.timelineSemaphore = timelineSemaphore.timelineSemaphore ? FeatureSupport::Extension : FeatureSupport::None;
+        }
+    }
+    
+    /// Looks at every queue family instead of stopping at the first complete match, so that dedicated compute-only and
+    /// transfer-only families are found even when they're listed after the graphics family.
+    /// A graphics family that can also present is preferred, since that avoids sharing swap chain images between families.
+    QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, const std::vector<VkQueueFamilyProperties>& properties) {
+        QueueFamilyIndices indices;
         
-        // Iterate through properties and check for graphics bit
+        uint32_t count = static_cast<uint32_t>(properties.size());
         for (uint32_t i = 0; i < count; i++) {
-            if (indices.isComplete() == true) {
-                break;
+            VkQueueFlags flags = properties[i].queueFlags;
+            bool graphics = (flags & VK_QUEUE_GRAPHICS_BIT) != 0;
+            bool compute = (flags & VK_QUEUE_COMPUTE_BIT) != 0;
+            bool transfer = (flags & VK_QUEUE_TRANSFER_BIT) != 0;
+            
+            // Without a surface nothing is presented; pretend the graphics family can so it's used for both. With several
+            // windows, one family presents to all of them.
+            VkBool32 presentationSupport = graphics;
+            if (targets.front().surface != VK_NULL_HANDLE) {
+                presentationSupport = VK_TRUE;
+                for (const auto& target : targets) {
+                    VkBool32 supported = VK_FALSE;
+                    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, target.surface, &supported);
+                    presentationSupport = presentationSupport && supported;
+                }
             }
             
-            if ((properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0) {
+            bool haveCombinedFamily = indices.graphicsFamily.has_value() && indices.graphicsFamily == indices.presentationFamily;
+            if (graphics && presentationSupport == true && haveCombinedFamily == false) {
                 indices.graphicsFamily = i;
+                indices.presentationFamily = i;
             }
-            
-            VkBool32 presentationSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupport);
-            if (presentationSupport == true) {
+            if (graphics && indices.graphicsFamily.has_value() == false) {
+                indices.graphicsFamily = i;
+            }
+            if (presentationSupport == true && indices.presentationFamily.has_value() == false) {
                 indices.presentationFamily = i;
             }
+            
+            if (compute && !graphics && indices.computeFamily.has_value() == false) {
+                indices.computeFamily = i;
+            }
+            if (transfer && !graphics && !compute && indices.transferFamily.has_value() == false) {
+                indices.transferFamily = i;
+            }
+        }
+        
+        // Graphics families always support compute and transfer work, so they're a valid fallback.
+        if (indices.graphicsFamily.has_value()) {
+            if (indices.computeFamily.has_value() == false) {
+                indices.computeFamily = indices.graphicsFamily;
+            }
+            if (indices.transferFamily.has_value() == false) {
+                indices.transferFamily = indices.graphicsFamily;
+            }
         }
         
         return indices;
     }
     
-    struct SwapChainSupportDetails {
-        VkSurfaceCapabilitiesKHR capabilities;
-        std::vector<VkSurfaceFormatKHR> formats;
-        std::vector<VkPresentModeKHR> presentModes;
-    };
-    
-    SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device) {
+    SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface) {
         
         SwapChainSupportDetails details = {};
         vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
@@ -399,6 +2847,50 @@ private:
         return details;
     }
     
+    DeviceCapabilities queryDeviceCapabilities(VkPhysicalDevice device) {
+        DeviceCapabilities capabilities{};
+        capabilities.physicalDevice = device;
+        vkGetPhysicalDeviceProperties(device, &capabilities.properties);
+        vkGetPhysicalDeviceFeatures(device, &capabilities.features);
+        capabilities.apiVersion = std::min(capabilities.properties.apiVersion, instanceApiVersion);
+        vkGetPhysicalDeviceMemoryProperties(device, &capabilities.memoryProperties);
+        
+        uint32_t count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+        capabilities.queueFamilyProperties.resize(count);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &count, capabilities.queueFamilyProperties.data());
+        capabilities.queueFamilies = findQueueFamilies(device, capabilities.queueFamilyProperties);
+        
+        capabilities.availableExtensions = queryDeviceExtensions(device);
+        capabilities.extensionsSupported = checkDeviceExtensionSupport(capabilities.availableExtensions);
+        capabilities.optionalExtensions = supportedOptionalExtensions(capabilities.availableExtensions);
+        queryOptionalFeatures(capabilities);
+        if (capabilities.extensionsSupported && options.offscreen == false) {
+            capabilities.swapChainSupport = querySwapChainSupport(device, targets.front().surface);
+        }
+        
+        if (getPhysicalDeviceProperties2 != nullptr) {
+            VkPhysicalDeviceIDProperties idProperties{};
+            idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+            
+            VkPhysicalDeviceProperties2 properties2{};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &idProperties;
+            if (capabilities.descriptorIndexing != FeatureSupport::None) {
+                capabilities.descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+                idProperties.pNext = &capabilities.descriptorIndexingProperties;
+            }
+            getPhysicalDeviceProperties2(device, &properties2);
+            
+            capabilities.uuid = formatUUID(idProperties.deviceUUID);
+            capabilities.descriptorIndexingProperties.pNext = nullptr;
+        }
+        else {
+            capabilities.descriptorIndexing = FeatureSupport::None; // its limits can't be queried
+        }
+        
+        return capabilities;
+    }
     
     /// Searches for a surface with the preferred properties: `VK_FORMAT_B8G8R8A8_SRGB` format and `VK_COLOR_SPACE_SRGB_NONLINEAR_KHR` color space.
     /// If format and color space is not available, then the first available surface format in the list is chosen.
@@ -413,27 +2905,63 @@ private:
     }
     
     
-    /// Searches for a swap chain with `VK_PRESENT_MODE_MAILBOX_KH` presentation mode. If the preferred presentation mode is not available,
-    /// `VK_PRESENT_MODE_FIFO_KHR` is chosen by default because it's guaranteed to be available.
+    /// Picks the first presentation mode in the current `PresentPolicy`'s preference list that the surface supports.
+    /// `VK_PRESENT_MODE_FIFO_KHR` ends every list because it's guaranteed to be available.
     /// - Parameter availablePresentModes: The list of presentation modes available in the device. Passing in as a constant prevents
     ///  modification of the list.
-    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes) {
+    VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+        std::vector<VkPresentModeKHR> preferredModes;
+        switch (options.presentPolicy) {
+            case PresentPolicy::LowLatency:
+                preferredModes = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+                break;
+            case PresentPolicy::Balanced:
+                preferredModes = {VK_PRESENT_MODE_MAILBOX_KHR};
+                break;
+            case PresentPolicy::PowerSaver:
+                break;
+        }
         
-        for (const auto& presentMode : availablePresentModes) {
-            if (presentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-                return presentMode;
+        for (const auto& preferredMode : preferredModes) {
+            if (std::find(availablePresentModes.begin(), availablePresentModes.end(), preferredMode) != availablePresentModes.end()) {
+                return preferredMode;
             }
         }
         
         return VK_PRESENT_MODE_FIFO_KHR;
     }
     
+    /// Chooses how many swap chain images to request for a presentation mode.
+    /// - MAILBOX needs a third image so the CPU always has one to render into while one is displayed and one is queued.
+    /// - FIFO and FIFO_RELAXED also use three so a single slow frame doesn't block the CPU on acquire, except under the
+    ///   power-saver policy, which wants that blocking to keep the CPU asleep.
+    /// - IMMEDIATE never queues, so the minimum is enough.
+    /// The result is clamped to the surface's limits.
+    /// - Parameters:
+    ///   - capabilities: The swap chain's surface capabilities.
+    ///   - presentMode: The presentation mode returned by `chooseSwapPresentMode()`.
+    uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR presentMode) {
+        uint32_t desiredCount = 3;
+        if (presentMode == VK_PRESENT_MODE_IMMEDIATE_KHR ||
+            (presentMode == VK_PRESENT_MODE_FIFO_KHR && options.presentPolicy == PresentPolicy::PowerSaver)) {
+            desiredCount = 2;
+        }
+        
+        uint32_t imageCount = std::max(desiredCount, capabilities.minImageCount);
+        if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
+            imageCount = capabilities.maxImageCount;
+        }
+        
+        return imageCount;
+    }
+    
     /// Specifies the swap chain's image resolution, or "extent". If the `currentExtent` is set to a "special value", which is the maximum value
     /// for an unsigned 32-bit integer, then the actual resolution must be calculated. Otherwise, `currentExtent` is already the optimal resolution
     /// that the window manager specified. To calculate the actual resolution, the GLFW's frame buffer's size is clamped between the swap chain's
     /// min/max image extents.
     /// - Parameter capabilities: The swap chain's surface capabilities.
-    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities) {
+    /// - Parameter window: The window the surface belongs to.
+    VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, GLFWwindow* window) {
         if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max()) {
             return capabilities.currentExtent;
         }
@@ -455,23 +2983,827 @@ private:
     
 
     void mainLoop() {
-        while (glfwWindowShouldClose(window) == false) {
-            glfwPollEvents();
+        uint32_t warmupFramesLeft = options.benchmark ? options.benchmarkWarmupFrames : 0;
+        FrameProfiler::Clock::time_point measureStart = FrameProfiler::Clock::now();
+        
+        while (keepRendering(measureStart, warmupFramesLeft)) {
+            if (options.offscreen == false) {
+                {
+                    FrameProfiler::CpuScope timing(profiler, CpuStage::Pacing);
+                    framePacer.waitBeforeInput(estimatedFrameCost());
+                }
+                glfwPollEvents();
+                framePacer.inputSampled();
+            }
+            drawFrame();
+            
+            if (timeToFirstFrameMilliseconds == 0.0) {
+                timeToFirstFrameMilliseconds = std::chrono::duration<double, std::milli>(FrameProfiler::Clock::now() - launchTime).count();
+                std::cout << "Time to first frame: " << timeToFirstFrameMilliseconds << " ms\n";
+            }
+            
+            if (warmupFramesLeft > 0) {
+                warmupFramesLeft--;
+                if (warmupFramesLeft == 0) {
+                    profiler.resetStatistics();
+                    gpuWorkers.resetStatistics();
+                    measureStart = FrameProfiler::Clock::now();
+                }
+            }
+            else {
+                benchmarkMeasuredFrames++;
+            }
+            
+            if (profiler.isReportDue()) {
+                if (options.offscreen == false) {
+                    std::string title = " - " + profiler.summary() + " ms";
+                    if (dynamicResolution.isAdaptive() || dynamicResolution.getScale() < 1.0f) {
+                        title += " | scale " + std::to_string(std::lround(dynamicResolution.getScale() * 100.0f)) + "%";
+                    }
+                    for (size_t i = 0; i < targets.size(); i++) {
+                        std::string name = i == 0 ? "Welcome to Vulkan" : "Welcome to Vulkan (" + std::to_string(i + 1) + ")";
+                        glfwSetWindowTitle(targets[i].window, (name + title).c_str());
+                    }
+                }
+                if (options.printFrameTimings) {
+                    profiler.printReport(std::cout);
+                }
+            }
+        }
+        benchmarkMeasuredSeconds = std::chrono::duration<double>(FrameProfiler::Clock::now() - measureStart).count();
+        
+        // Let the in-flight frames finish before cleanup() destroys what they use. Presents aren't submissions the scheduler
+        // knows about, so their queue is drained separately.
+        scheduler.waitIdle();
+        if (options.offscreen == false) {
+            vkQueueWaitIdle(presentationQueue);
+        }
+        profiler.flush();
+    }
+    
+    /// False once any window is closed or, when benchmarking, once enough frames or time have been measured. Warm-up frames
+    /// don't count towards either, and `measureStart` only becomes meaningful once they're done.
+    bool keepRendering(FrameProfiler::Clock::time_point measureStart, uint32_t warmupFramesLeft) {
+        for (const auto& target : targets) {
+            if (target.window != nullptr && glfwWindowShouldClose(target.window)) {
+                return false;
+            }
+        }
+        if (options.benchmark == false || warmupFramesLeft > 0) {
+            return true;
+        }
+        if (options.benchmarkSeconds > 0.0) {
+            return std::chrono::duration<double>(FrameProfiler::Clock::now() - measureStart).count() < options.benchmarkSeconds;
+        }
+        return benchmarkMeasuredFrames < options.benchmarkFrames;
+    }
+    
+    /// Writes the benchmark's JSON report to `options.benchmarkReportPath`: frame time percentiles, startup time per step and
+    /// peak memory. Also checks p99 frame time against `options.benchmarkMaxP99Milliseconds` and the measured frames' heap
+    /// allocations against `options.benchmarkMaxAllocations`.
+    /// - Returns: false if a budget was exceeded or the report couldn't be written.
+    bool writeBenchmarkReport() {
+        const VkPhysicalDeviceProperties& properties = deviceCapabilities.properties;
+        
+        MemoryStats memory = memoryAllocator.getStats();
+        FrameProfiler::Percentiles frameTimes = profiler.historyPercentiles(cpuStageName(CpuStage::FrameInterval));
+        bool withinTimeBudget = options.benchmarkMaxP99Milliseconds <= 0.0 || frameTimes.p99 <= options.benchmarkMaxP99Milliseconds;
+        FrameProfiler::AllocationStats allocations = profiler.getAllocationStats();
+        bool withinAllocationBudget = options.benchmarkMaxAllocations.has_value() == false ||
+            allocations.total <= *options.benchmarkMaxAllocations;
+        bool withinBudget = withinTimeBudget && withinAllocationBudget;
+        
+        double startupTotal = 0.0;
+        for (const auto& step : startupTimings) {
+            startupTotal += step.second;
+        }
+        
+        std::ofstream file(options.benchmarkReportPath, std::ios::trunc);
+        if (file.is_open() == false) {
+            std::cerr << "Benchmark report could not be written to " << options.benchmarkReportPath << '\n';
+            return false;
+        }
+        
+        file << "{\n";
+        file << "  \"device\": \"" << properties.deviceName << "\",\n";
+        file << "  \"hardware\": ";
+        hardwareReport.writeJson(file);
+        file << ",\n";
+        file << "  \"quality\": \"" << qualityTierName(qualityTier) << "\",\n";
+        file << "  \"resolution\": [" << targets.front().extent.width << ", " << targets.front().extent.height << "],\n";
+        file << "  \"windows\": " << (options.offscreen ? 0 : targets.size()) << ",\n";
+        file << "  \"renderScale\": " << dynamicResolution.getScale() << ",\n";
+        file << "  \"offscreen\": " << (options.offscreen ? "true" : "false") << ",\n";
+        file << "  \"presentMode\": \"" << (options.offscreen ? "none" : presentModeName(targets.front().presentMode)) << "\",\n";
+        file << "  \"framesInFlight\": " << options.framesInFlight << ",\n";
+        file << "  \"dynamicRendering\": " << (renderingFunctions.cmdBeginRendering != nullptr ? "true" : "false") << ",\n";
+        file << "  \"synchronization2\": " << (renderingFunctions.cmdPipelineBarrier2 != nullptr ? "true" : "false") << ",\n";
+        file << "  \"descriptorHeap\": " << (descriptorHeap.isValid() ? "true" : "false") << ",\n";
+        file << "  \"gpuDrivenInstances\": " << (scene.enabled ? scene.culler.getInstanceCount() : 0) << ",\n";
+        file << "  \"gpuWorkers\": ";
+        gpuWorkers.writeJson(file, benchmarkMeasuredSeconds);
+        file << ",\n";
+        file << "  \"probeVisibleInstances\": [";
+        for (uint32_t i = 0; i < GpuDrivenScene::PROBE_VIEWS; i++) {
+            file << (i == 0 ? "" : ", ") << scene.probeVisible[i];
+        }
+        file << "],\n";
+        DrawList::Stats drawStats = drawList.getStats();
+        file << "  \"drawList\": {\"commands\": " << drawStats.commands << ", \"draws\": " << drawStats.draws
+             << ", \"pipelineChanges\": " << drawStats.pipelineChanges << ", \"descriptorChanges\": "
+             << drawStats.descriptorChanges << ", \"dropped\": " << drawStats.droppedCommands << "},\n";
+        file << "  \"streamedAssets\": " << (assetStreamer.isOpen() ? assetStreamer.getStats().ready : 0) << ",\n";
+        file << "  \"warmupFrames\": " << options.benchmarkWarmupFrames << ",\n";
+        file << "  \"frames\": " << benchmarkMeasuredFrames << ",\n";
+        file << "  \"durationSeconds\": " << benchmarkMeasuredSeconds << ",\n";
+        file << "  \"averageFps\": " << (benchmarkMeasuredSeconds > 0.0 ? benchmarkMeasuredFrames / benchmarkMeasuredSeconds : 0.0) << ",\n";
+        
+        file << "  \"timeToFirstFrameMs\": " << timeToFirstFrameMilliseconds << ",\n";
+        file << "  \"startupMs\": {\n";
+        for (const auto& step : startupTimings) {
+            file << "    \"" << step.first << "\": " << step.second << ",\n";
+        }
+        file << "    \"total\": " << startupTotal << "\n  },\n";
+        
+        file << "  \"frameTimesMs\": ";
+        profiler.writeJsonSummary(file, "  ");
+        file << ",\n";
+        
+        PipelineManager::Stats pipelineStats = pipelineManager.getStats();
+        file << "  \"pipelines\": {\"compiled\": " << pipelineStats.compiled << ", \"failed\": " << pipelineStats.failed
+             << ", \"pending\": " << pipelineStats.pending << ", \"totalCompileMs\": " << pipelineStats.totalCompileMilliseconds
+             << ", \"maxCompileMs\": " << pipelineStats.maxCompileMilliseconds << "},\n";
+        
+        RenderGraph::Stats graphStats = renderGraph.getStats();
+        file << "  \"transientImages\": {\"bytes\": " << graphStats.transientBytes << ", \"unaliasedBytes\": "
+             << graphStats.unaliasedBytes << ", \"lazyBytes\": " << graphStats.lazyBytes << ", \"transientAttachments\": "
+             << graphStats.transientAttachmentCount << ", \"rebuilds\": " << graphStats.transientRebuildCount << "},\n";
+        
+        file << "  \"heapAllocations\": {\"total\": " << allocations.total << ", \"perFrame\": "
+             << (allocations.frames > 0 ? static_cast<double>(allocations.total) / allocations.frames : 0.0)
+             << ", \"maxPerFrame\": " << allocations.maxPerFrame << ", \"framesWithAllocations\": "
+             << allocations.framesWithAllocations << ", \"frameArenaPeakBytes\": " << frameArena.getPeakBytes()
+             << ", \"frameArenaCapacityBytes\": " << frameArena.getCapacity() << "},\n";
+        
+        file << "  \"peakMemory\": {\"gpuReservedBytes\": " << memory.peakBytesReserved
+             << ", \"gpuUsedBytes\": " << memory.bytesUsed << ", \"processResidentBytes\": " << peakResidentBytes() << "},\n";
+        
+        file << "  \"budget\": {\"p99FrameMs\": ";
+        if (options.benchmarkMaxP99Milliseconds > 0.0) {
+            file << options.benchmarkMaxP99Milliseconds;
+        }
+        else {
+            file << "null";
+        }
+        file << ", \"allocations\": ";
+        if (options.benchmarkMaxAllocations.has_value()) {
+            file << *options.benchmarkMaxAllocations;
+        }
+        else {
+            file << "null";
+        }
+        file << ", \"passed\": " << (withinBudget ? "true" : "false") << "}\n}\n";
+        file.close();
+        
+        std::cout << "Benchmark: " << benchmarkMeasuredFrames << " frames in " << benchmarkMeasuredSeconds << " s, frame p50 "
+                  << frameTimes.p50 << " p99 " << frameTimes.p99 << " ms, startup " << startupTotal << " ms. Report written to "
+                  << options.benchmarkReportPath << '\n';
+        
+        if (withinTimeBudget == false) {
+            std::cerr << "Benchmark failed: p99 frame time " << frameTimes.p99 << " ms exceeds the budget of "
+                      << options.benchmarkMaxP99Milliseconds << " ms.\n";
+        }
+        if (withinAllocationBudget == false) {
+            std::cerr << "Benchmark failed: " << allocations.total << " heap allocations in " << allocations.framesWithAllocations
+                      << " of " << allocations.frames << " frames exceed the budget of " << *options.benchmarkMaxAllocations << ".\n";
+        }
+        
+        return withinBudget && file.good();
+    }
+    
+    /// `--compute-batch`: runs the queries on one worker device per GPU from `pickBatchDevices()`, with no window, surface,
+    /// swap chain or rendering device, so GPUs without graphics queues or VK_KHR_swapchain take part too. Cleans up after
+    /// itself.
+    /// - Returns: false if there was nothing to run the batch on or its report couldn't be written.
+    bool runComputeBatch() {
+        // The device queries then take their offscreen paths, which look for no surface.
+        options.offscreen = true;
+        targets.resize(1);
+        createInstance();
+        shaderLibrary.init(options.shaderDirectory, options.pipelineCacheDirectory + "/shader-cache");
+        
+        bool passed = false;
+        std::vector<uint32_t> visibilityShader = shaderLibrary.load("visibility.comp");
+        if (visibilityShader.empty()) {
+            std::cerr << "Compute batch: needs visibility.comp in " << options.shaderDirectory
+                      << ", as SPIR-V or compilable GLSL.\n";
+        }
+        else {
+            gpuWorkers.init(pickBatchDevices(), visibilityShader);
+            if (gpuWorkers.getWorkerCount() == 0) {
+                std::cerr << "Compute batch: no GPU has a compute queue.\n";
+            }
+            else {
+                passed = runVisibilityBatch();
+            }
+        }
+        
+        gpuWorkers.destroy();
+        shaderLibrary.destroy();
+        vkDestroyInstance(instance, nullptr);
+        return passed;
+    }
+    
+    /// Keeps every query slot on every GPU busy until `options.computeBatchQueries` queries of `MAX_VIEWS` views each have
+    /// been read back. Each slot's views are written while the others' queries run and their counts are read back, so the
+    /// host's writes, the dispatches and the readbacks overlap. The views follow the `--instances` orbit camera.
+    bool runVisibilityBatch() {
+        const uint32_t viewsPerQuery = GpuWorkerPool::MAX_VIEWS;
+        uint32_t instanceCount = std::min(options.sceneInstances > 0 ? options.sceneInstances : DEFAULT_BATCH_INSTANCES,
+                                          65535 * GpuWorkerPool::WORKGROUP_SIZE);
+        std::vector<float> bounds;
+        for (const auto& instance : sceneGrid(instanceCount)) {
+            bounds.insert(bounds.end(), instance.center, instance.center + 3);
+            bounds.push_back(instance.radius);
+        }
+        gpuWorkers.setScene(bounds);
+        for (size_t i = 0; i < gpuWorkers.getWorkerCount(); i++) {
+            std::cout << "GPU worker " << i + 1 << ": " << gpuWorkers.getWorkerName(i) << '\n';
+        }
+        
+        float aspect = static_cast<float>(options.width) / static_cast<float>(options.height);
+        std::vector<Frustum> views(viewsPerQuery);
+        uint32_t submitted = 0;
+        uint32_t completed = 0;
+        uint64_t visibleTotal = 0;
+        
+        FrameProfiler::Clock::time_point start = FrameProfiler::Clock::now();
+        while (completed < options.computeBatchQueries) {
+            while (submitted < options.computeBatchQueries && gpuWorkers.hasFreeSlot()) {
+                for (uint32_t i = 0; i < viewsPerQuery; i++) {
+                    float angle = (submitted * viewsPerQuery + i) * 0.005f;
+                    views[i] = Frustum::fromViewProjection(orbitCamera(angle, instanceCount, aspect).viewProjection.data());
+                }
+                gpuWorkers.submit(views, submitted);
+                submitted++;
+            }
+            
+            uint32_t previouslyCompleted = completed;
+            gpuWorkers.collect(nullptr, [&](uint64_t, const std::vector<uint32_t>& counts) {
+                for (uint32_t count : counts) {
+                    visibleTotal += count;
+                }
+                completed++;
+            });
+            if (completed == previouslyCompleted) {
+                gpuWorkers.waitForAny();
+            }
+        }
+        double seconds = std::chrono::duration<double>(FrameProfiler::Clock::now() - start).count();
+        double queriesPerSecond = seconds > 0.0 ? completed / seconds : 0.0;
+        
+        std::ofstream file(options.benchmarkReportPath, std::ios::trunc);
+        if (file.is_open() == false) {
+            std::cerr << "Compute batch report could not be written to " << options.benchmarkReportPath << '\n';
+            return false;
+        }
+        file << "{\n";
+        file << "  \"mode\": \"compute-batch\",\n";
+        file << "  \"instances\": " << instanceCount << ",\n";
+        file << "  \"queries\": " << completed << ",\n";
+        file << "  \"viewsPerQuery\": " << viewsPerQuery << ",\n";
+        file << "  \"durationSeconds\": " << seconds << ",\n";
+        file << "  \"queriesPerSecond\": " << queriesPerSecond << ",\n";
+        file << "  \"viewsPerSecond\": " << queriesPerSecond * viewsPerQuery << ",\n";
+        file << "  \"visibleInstances\": " << visibleTotal << ",\n";
+        file << "  \"gpuWorkers\": ";
+        gpuWorkers.writeJson(file, seconds);
+        file << "\n}\n";
+        file.close();
+        
+        std::cout << "Compute batch: " << completed << " queries of " << viewsPerQuery << " views over " << instanceCount
+                  << " instances in " << seconds << " s, " << queriesPerSecond << " queries/s on "
+                  << gpuWorkers.getWorkerCount() << " GPUs. Report written to " << options.benchmarkReportPath << '\n';
+        return file.good();
+    }
+    
+    /// Acquires a swap chain image, records and submits the frame in the current slot, then queues the image for presentation.
+    /// Only the slot's own last submission is waited on, so up to `framesInFlight` frames can be queued on the GPU at once.
+    void drawFrame() {
+        FrameData& frame = frames[currentFrame];
+        
+        // Wait until the GPU is done with the last frame that used this slot.
+        {
+            FrameProfiler::CpuScope timing(profiler, CpuStage::FenceWait);
+            scheduler.wait(frame.submitted);
+        }
+        // Whatever the last frame put in the arena was copied when it was recorded and submitted.
+        frameArena.reset();
+        profiler.beginFrame(currentFrame);
+        recordPresentLatency();
+        collectGpuWorkers();
+        updateRenderExtents();
+        scheduler.collect();
+        collectRetiredSwapChains();
+        applyShaderReloads();
+        stagingRing.beginFrame(currentFrame);
+        if (assetStreamer.isOpen()) {
+            assetStreamer.beginFrame();
+        }
+        parallelRecorder.beginFrame(currentFrame);
+        renderGraph.beginFrame(frameNumber);
+        if (descriptorHeap.isValid()) {
+            descriptorHeap.beginFrame(frameNumber);
+        }
+        
+        // A window whose swap chain is out of date sits this frame out. The frame is only dropped when no window acquired.
+        uint32_t acquiredCount = 0;
+        {
+            FrameProfiler::CpuScope timing(profiler, CpuStage::Acquire);
+            for (auto& target : targets) {
+                if (acquireImage(target)) {
+                    acquiredCount++;
+                }
+            }
+        }
+        if (acquiredCount == 0) {
+            profiler.endFrame(false);
+            return;
+        }
+        
+        // Only once the frame is known to be drawn: a dropped frame re-begins its staging slot with the uploads it queued
+        // still in it, so preparing the draw list again would queue a second copy of its transforms, and probe queries
+        // would be submitted for a frame nobody sees.
+        if (scene.enabled) {
+            updateScene();
+        }
+        if (drawObjects.enabled) {
+            updateDrawList();
+        }
+        
+        // Streaming threads have been writing into the staging ring since the frame began, through the acquire wait. Their
+        // copies have to be queued before the ring's copies are recorded.
+        if (assetStreamer.isOpen()) {
+            assetStreamer.endFrame();
+        }
+        
+        {
+            FrameProfiler::CpuScope timing(profiler, CpuStage::Record);
+            vkResetCommandPool(device, frame.commandPool.get(), 0);
+            recordCommandBuffer(frame.commandBuffer);
+        }
+        
+        FrameProfiler::CpuScope submitTiming(profiler, CpuStage::Submit);
+        
+        SubmissionScheduler::Submission& submission = frameSubmission;
+        submission.commandBuffers.assign(1, frame.commandBuffer);
+        submission.waits.clear();
+        submission.binaryWaits.clear();
+        submission.binarySignals.clear();
+        
+        // Nothing waits for an offscreen frame except the host.
+        if (options.offscreen == false) {
+            for (auto& target : targets) {
+                if (target.acquired) {
+                    submission.binaryWaits.push_back({target.imageAvailableSemaphores[currentFrame].get(),
+                                                      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT});
+                    submission.binarySignals.push_back(target.renderFinishedSemaphores[target.imageIndex].get());
+                }
+            }
+        }
+        
+        // Uploads on a dedicated transfer queue run alongside the previous frame's rendering; only their consumers wait. The
+        // wait is also what hands the uploaded resources over to graphics.
+        submission.waits.push_back({stagingRing.submit(), StagingRing::CONSUMER_STAGES});
+        
+        // Likewise, culling on the compute queue overlaps with earlier frames; only the indirect draw waits for it.
+        if (scene.enabled) {
+            submission.waits.push_back({scene.culler.submit(scene.frustum), GpuCuller::CONSUMER_STAGES});
+        }
+        
+        frame.submitted = scheduler.submit(QueueType::Graphics, submission);
+        for (auto& target : targets) {
+            if (target.acquired) {
+                target.imagesInFlight[target.imageIndex] = frame.submitted;
+            }
+        }
+        frameNumber++;
+        submitTiming.stop();
+        
+        if (options.offscreen == false) {
+            FrameProfiler::CpuScope timing(profiler, CpuStage::Present);
+            present();
+        }
+        profiler.endFrame(true);
+        
+        currentFrame = (currentFrame + 1) % options.framesInFlight;
+        
+        if (options.offscreen) {
+            return;
+        }
+        for (size_t i = 0; i < presentBatch.targets.size(); i++) {
+            VkResult result = presentBatch.results[i];
+            PresentTarget& target = *presentBatch.targets[i];
+            if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || target.framebufferResized) {
+                recreateSwapChain(target);
+            }
+            else if (result != VK_SUCCESS) {
+                throw std::runtime_error("Swap chain image was not presented. Error code " + std::to_string(result));
+            }
+        }
+        
+        // Windows that weren't presented to are resized when they next fail to acquire; a policy switch applies to all.
+        if (presentPolicyChanged) {
+            for (auto& target : targets) {
+                recreateSwapChain(target);
+            }
+            presentPolicyChanged = false;
+        }
+    }
+    
+    /// Acquires the target's next image into `target.imageIndex`. Returns false, with the swap chain rebuilt, if it was out
+    /// of date. Offscreen targets hand out their images in turn.
+    bool acquireImage(PresentTarget& target) {
+        target.acquired = false;
+        VkResult result;
+        if (options.offscreen) {
+            // The image wait below is all the synchronization offscreen targets need.
+            target.imageIndex = static_cast<uint32_t>(frameNumber % target.images.size());
+            result = VK_SUCCESS;
+        }
+        else {
+            result = vkAcquireNextImageKHR(device, target.swapChain.get(), std::numeric_limits<uint64_t>::max(),
+                                           target.imageAvailableSemaphores[currentFrame].get(), VK_NULL_HANDLE,
+                                           &target.imageIndex);
+        }
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            // Nothing was acquired and the semaphore won't be signaled, so it can be reused as is.
+            recreateSwapChain(target);
+            return false;
+        }
+        else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Swap chain image was not acquired. Error code " + std::to_string(result));
+        }
+        
+        // The swap chain may hand back an image that another slot is still rendering to.
+        scheduler.wait(target.imagesInFlight[target.imageIndex]);
+        target.acquired = true;
+        return true;
+    }
+    
+    /// Presents every acquired image with one vkQueuePresentKHR. Each swap chain's result is left in `presentBatch.results`.
+    void present() {
+        PresentBatch& batch = presentBatch;
+        batch.swapchains.clear();
+        batch.imageIndices.clear();
+        batch.waitSemaphores.clear();
+        batch.presentFences.clear();
+        batch.targets.clear();
+        uint32_t mainTargetIndex = UINT32_MAX;
+        for (auto& target : targets) {
+            if (target.acquired == false) {
+                continue;
+            }
+            if (&target == &targets.front()) {
+                mainTargetIndex = static_cast<uint32_t>(batch.swapchains.size());
+            }
+            batch.swapchains.push_back(target.swapChain.get());
+            batch.imageIndices.push_back(target.imageIndex);
+            batch.waitSemaphores.push_back(target.renderFinishedSemaphores[target.imageIndex].get());
+            batch.targets.push_back(&target);
+            
+            // The image's previous present has almost always finished by the time it's acquired again, so this rarely waits.
+            if (target.presentFences.empty() == false) {
+                VkFence fence = target.presentFences[target.imageIndex].get();
+                VkResult result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+                if (result == VK_SUCCESS) {
+                    result = vkResetFences(device, 1, &fence);
+                }
+                if (result != VK_SUCCESS) {
+                    throw std::runtime_error("Present fence was not reset. Error code " + std::to_string(result));
+                }
+                batch.presentFences.push_back(fence);
+            }
+        }
+        batch.results.assign(batch.swapchains.size(), VK_SUCCESS);
+        
+        VkPresentInfoKHR presentInfo{};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = static_cast<uint32_t>(batch.waitSemaphores.size());
+        presentInfo.pWaitSemaphores = batch.waitSemaphores.data();
+        presentInfo.swapchainCount = static_cast<uint32_t>(batch.swapchains.size());
+        presentInfo.pSwapchains = batch.swapchains.data();
+        presentInfo.pImageIndices = batch.imageIndices.data();
+        presentInfo.pResults = batch.results.data();
+        
+        // Every target has fences or none does, since they all share the device.
+        VkSwapchainPresentFenceInfoEXT presentFenceInfo{};
+        if (batch.presentFences.empty() == false) {
+            presentFenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+            presentFenceInfo.swapchainCount = static_cast<uint32_t>(batch.presentFences.size());
+            presentFenceInfo.pFences = batch.presentFences.data();
+            presentInfo.pNext = &presentFenceInfo;
+        }
+        if (mainTargetIndex != UINT32_MAX) {
+            framePacer.preparePresent(presentInfo, mainTargetIndex);
+        }
+        
+        // Errors that aren't about one swap chain, such as a lost device, are reported for all of them.
+        VkResult result = vkQueuePresentKHR(presentationQueue, &presentInfo);
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR && result != VK_ERROR_OUT_OF_DATE_KHR) {
+            batch.results.assign(batch.swapchains.size(), result);
+        }
+    }
+    
+    /// What the main passes need from the graph to draw the scene. Only set while the culler is active.
+    struct SceneResources {
+        RenderGraph::ResourceHandle drawCommands;
+        RenderGraph::ResourceHandle drawCount;
+    };
+    
+    /// Records one command buffer that renders the scene into every target that acquired an image.
+    void recordCommandBuffer(VkCommandBuffer commandBuffer) {
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        
+        VkResult result = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Command buffer recording did not begin. Error code " + std::to_string(result));
+        }
+        
+        profiler.resetQueries(commandBuffer);
+        profiler.beginGpuScope(commandBuffer, "frame");
+        
+        // Copies can't be recorded inside a render pass.
+        profiler.beginGpuScope(commandBuffer, "uploads");
+        stagingRing.recordCopies(commandBuffer);
+        profiler.endGpuScope(commandBuffer);
+        
+        // Culling runs once, and every window draws from its results.
+        SceneResources sceneResources = scene.enabled ? addScenePasses() : SceneResources{};
+        for (const auto& target : targets) {
+            if (target.acquired) {
+                addTargetPasses(target, sceneResources);
+            }
+        }
+        
+        renderGraph.compile();
+        renderGraph.execute(commandBuffer);
+        profiler.endGpuScope(commandBuffer);
+        
+        result = vkEndCommandBuffer(commandBuffer);
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("Command buffer was not recorded. Error code " + std::to_string(result));
         }
     }
 
+    /// Draws the scene into the target's acquired image.
+    void addTargetPasses(const PresentTarget& target, const SceneResources& sceneResources) {
+        // The graph clears the image at the color attachment output stage, which is also where the submit waits for the
+        // acquire, and leaves it ready for the presentation engine. Offscreen targets are left ready to be copied out instead.
+        VkImageLayout finalLayout = options.offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        uint32_t imageIndex = target.imageIndex;
+        RenderGraph::ResourceHandle backbuffer = renderGraph.importImage(
+            "backbuffer", target.images[imageIndex], target.imageViews[imageIndex].get(), target.format, target.extent,
+            {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED},
+            {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, finalLayout});
+        
+        VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+        
+        // At a lower render scale the main pass draws into its own target, which is then blitted up into the backbuffer.
+        VkExtent2D renderExtent = target.renderExtent;
+        bool upscaled = renderExtent.width != target.extent.width || renderExtent.height != target.extent.height;
+        RenderGraph::ResourceHandle sceneColor = upscaled ? renderGraph.createImage("scene-color", target.format, renderExtent)
+                                                          : backbuffer;
+        
+        // One chunk per recording thread. The secondaries are recorded in the pass's callback, where what they inherit from
+        // the graph's render pass or dynamic rendering instance is known; the pass itself accepts nothing but
+        // vkCmdExecuteCommands.
+        RenderGraph::PassBuilder mainPass = renderGraph.addPass("main-pass");
+        mainPass.colorAttachment(sceneColor, VK_ATTACHMENT_LOAD_OP_CLEAR, clearColor)
+            .secondaryCommandBuffers()
+            .execute([this, renderExtent](const RenderGraph::PassContext& context) {
+                uint32_t chunkCount = jobSystem.getThreadCount();
+                const std::vector<VkCommandBuffer>& secondaries = parallelRecorder.recordRenderPass(
+                    *context.inheritance, chunkCount, [&](VkCommandBuffer secondary, uint32_t chunk) {
+                        recordMainPassChunk(secondary, chunk, chunkCount, renderExtent);
+                    });
+                vkCmdExecuteCommands(context.commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+            });
+        if (depthFormat != VK_FORMAT_UNDEFINED) {
+            VkClearValue clearDepth{};
+            clearDepth.depthStencil = {1.0f, 0};
+            mainPass.depthStencilAttachment(renderGraph.createImage("depth", depthFormat, renderExtent),
+                                            VK_ATTACHMENT_LOAD_OP_CLEAR, clearDepth);
+        }
+        if (sceneResources.drawCommands.isValid()) {
+            mainPass.read(sceneResources.drawCommands, ResourceUsage::IndirectBuffer)
+                .read(sceneResources.drawCount, ResourceUsage::IndirectBuffer);
+        }
+        if (upscaled) {
+            addUpscalePass(sceneColor, renderExtent, backbuffer, target.extent);
+        }
+    }
+    
+    /// Blits all of `source` over the whole of `destination` with linear filtering.
+    void addUpscalePass(RenderGraph::ResourceHandle source, VkExtent2D sourceExtent, RenderGraph::ResourceHandle destination,
+                        VkExtent2D destinationExtent) {
+        renderGraph.addPass("upscale")
+            .read(source, ResourceUsage::TransferSource)
+            .write(destination, ResourceUsage::TransferDestination)
+            .execute([source, destination, sourceExtent, destinationExtent](const RenderGraph::PassContext& context) {
+                VkImageBlit region{};
+                region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+                region.srcOffsets[1] = {static_cast<int32_t>(sourceExtent.width), static_cast<int32_t>(sourceExtent.height), 1};
+                region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+                region.dstOffsets[1] = {static_cast<int32_t>(destinationExtent.width), static_cast<int32_t>(destinationExtent.height), 1};
+                vkCmdBlitImage(context.commandBuffer, context.image(source), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               context.image(destination), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+            });
+    }
+    
+    /// Declares the scene's draw buffers. Without a dedicated compute family the culling is a pass of the graph, added here
+    /// so that it runs before the main passes.
+    SceneResources addScenePasses() {
+        SceneResources resources;
+        if (scene.culler.isActive() == false) {
+            return resources;
+        }
+        
+        // Last read by the previous frame in this slot, which has completed. On the compute queue, the submit's semaphore wait
+        // orders the culling's writes before the draw.
+        const ResourceState unused = {0, 0, VK_IMAGE_LAYOUT_UNDEFINED};
+        resources.drawCommands = renderGraph.importBuffer("draw-commands", scene.culler.getDrawCommands(), unused);
+        resources.drawCount = renderGraph.importBuffer("draw-count", scene.culler.getDrawCount(), unused);
+        
+        if (scene.culler.usesComputeQueue() == false) {
+            renderGraph.addPass("gpu-cull")
+                .write(resources.drawCommands, ResourceUsage::StorageBufferWrite)
+                .write(resources.drawCount, ResourceUsage::StorageBufferWrite)
+                .execute([this](const RenderGraph::PassContext& context) {
+                    scene.culler.record(context.commandBuffer, scene.frustum);
+                });
+        }
+        return resources;
+    }
+    
+    /// Records share `chunk` of `chunkCount` of the main pass's draws. Runs on any recording thread, concurrently with the
+    /// other chunks, so it may only touch `commandBuffer` and read-only state.
+    void recordMainPassChunk(VkCommandBuffer commandBuffer, uint32_t chunk, uint32_t chunkCount, VkExtent2D extent) {
+        // Bindings don't carry over from the primary, so each secondary binds the heap once up front. Pipelines created with
+        // `descriptorHeap.getPipelineLayout()` keep it bound across pipeline switches.
+        if (descriptorHeap.isValid()) {
+            descriptorHeap.bind(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS);
+        }
+        
+        // Draws get their pipeline from `pipelineManager.get()` and are skipped while it returns VK_NULL_HANDLE. Each draw
+        // passes its heap indices with `descriptorHeap.pushConstants()`.
+        if (chunk == 0 && scene.enabled && scene.culler.isActive()) {
+            recordSceneDraw(commandBuffer, extent);
+        }
+        
+        // The draw list's batches are shared out between the chunks.
+        if (drawObjects.enabled) {
+            VkViewport viewport{0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f};
+            VkRect2D scissor{{0, 0}, extent};
+            vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+            vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+            drawList.record(commandBuffer, drawObjects.viewProjection.data(), chunk, chunkCount);
+        }
+    }
+    
+    /// The whole scene is one indirect draw, whatever its size, over all of `extent`.
+    void recordSceneDraw(VkCommandBuffer commandBuffer, VkExtent2D extent) {
+        VkPipeline pipeline = pipelineManager.get(scene.pipeline);
+        if (pipeline == VK_NULL_HANDLE) {
+            return;
+        }
+        
+        struct SceneConstants {
+            Matrix4 viewProjection;
+            uint32_t boundsIndex;
+        } constants{scene.viewProjection, scene.culler.getBoundsIndex()};
+        
+        VkViewport viewport{0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f};
+        VkRect2D scissor{{0, 0}, extent};
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+        vkCmdBindIndexBuffer(commandBuffer, scene.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        descriptorHeap.pushConstants(commandBuffer, &constants, sizeof(constants));
+        scene.culler.draw(commandBuffer);
+    }
+    
     void cleanup() {
         
-        for (auto imageView : swapChainImageViews) {
-            vkDestroyImageView(device, imageView, nullptr);
+        frames.clear(); // destroying a command pool also frees its command buffer
+        
+        // The presents still need their semaphores and swap chains until their fences signal.
+        for (const auto& target : targets) {
+            waitForPresentFences(target.presentFences);
+        }
+        for (const auto& retired : retiredSwapChains) {
+            waitForPresentFences(retired.presentFences);
+        }
+        retiredSwapChains.clear();
+        for (auto& target : targets) {
+            target.imageAvailableSemaphores.clear();
+            target.renderFinishedSemaphores.clear();
+            target.presentFences.clear();
+        }
+        
+        parallelRecorder.destroy();
+        jobSystem.destroy();
+        
+        renderGraph.destroy();
+        scheduler.destroy(); // runs the deferred destructions, e.g. of retired swap chains
+        
+        for (auto& target : targets) {
+            target.imageViews.clear();
+            target.swapChain.reset();
+            for (size_t i = 0; i < target.offscreenAllocations.size(); i++) {
+                memoryAllocator.destroyImage(target.images[i], target.offscreenAllocations[i]);
+            }
+        }
+        
+        if (scene.enabled) {
+            scene.culler.destroy();
+            gpuWorkers.destroy();
+            memoryAllocator.destroyBuffer(scene.indexBuffer, scene.indexAllocation);
+        }
+        if (drawObjects.enabled) {
+            DrawList::Stats drawStats = drawList.getStats();
+            std::cout << "Draw list: " << drawStats.commands << " draws pushed per frame, recorded as " << drawStats.draws
+                      << " draw calls, " << drawStats.pipelineChanges << " pipeline and " << drawStats.descriptorChanges
+                      << " descriptor changes\n";
+            drawList.destroy();
+            for (uint32_t index : drawObjects.tintIndices) {
+                descriptorHeap.releaseStorageBuffer(index);
+            }
+            memoryAllocator.destroyBuffer(drawObjects.tintBuffer, drawObjects.tintAllocation);
+            memoryAllocator.destroyBuffer(drawObjects.indexBuffer, drawObjects.indexAllocation);
+        }
+        if (assetStreamer.isOpen()) {
+            AssetStreamer::Stats streamingStats = assetStreamer.getStats();
+            std::cout << "Assets: " << streamingStats.ready << " of " << streamingStats.requested << " streamed, "
+                      << streamingStats.failed << " failed, " << streamingStats.bytesStaged / (1024 * 1024) << " MiB staged\n";
+            streamedAssets.clear();
+            assetStreamer.destroy();
+        }
+        
+        ShaderLibrary::Stats shaderStats = shaderLibrary.getStats();
+        shaderLibrary.destroy();
+        if (shaderStats.compiled + shaderStats.failed > 0 || options.hotReloadShaders) {
+            std::cout << "Shaders: " << shaderStats.cacheHits << " from cache, " << shaderStats.compiled << " compiled ("
+                      << shaderStats.totalCompileMilliseconds << " ms), " << shaderStats.failed << " failed, "
+                      << shaderStats.reloaded << " reloaded\n";
+        }
+        
+        // Compile threads write to the pipeline cache, so they have to stop before it's saved.
+        PipelineManager::Stats pipelineStats = pipelineManager.getStats();
+        pipelineManager.destroy();
+        if (descriptorHeap.isValid()) {
+            descriptorHeap.destroy();
+        }
+        if (pipelineStats.requested > 0) {
+            std::cout << "Pipelines: " << pipelineStats.compiled << " compiled, " << pipelineStats.failed << " failed, "
+                      << pipelineStats.deduplicated << " duplicate requests, slowest " << pipelineStats.maxCompileMilliseconds
+                      << " ms\n";
+        }
+        
+        savePipelineCache();
+        pipelineCache.reset();
+        
+        if (options.frameTimingsPath.empty() == false) {
+            // Losing the dump isn't worth leaking the device over.
+            try {
+                profiler.writeDump(options.frameTimingsPath);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << '\n';
+            }
         }
+        profiler.printReport(std::cout);
+        profiler.destroy();
+        
+        stagingRing.destroy();
+        memoryAllocator.printStats(std::cout);
+        memoryAllocator.destroy();
         
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        if (liveDeviceHandles != 0) {
+            std::cerr << "Leaked " << liveDeviceHandles << " device handles.\n";
+        }
         vkDestroyDevice(device, nullptr);
-        vkDestroySurfaceKHR(instance, surface, nullptr);
+        for (auto& target : targets) {
+            vkDestroySurfaceKHR(instance, target.surface, nullptr);
+        }
         vkDestroyInstance(instance, nullptr);
-        glfwDestroyWindow(window);
-        glfwTerminate();
+        if (options.offscreen == false) {
+            for (auto& target : targets) {
+                glfwDestroyWindow(target.window);
+            }
+            glfwTerminate();
+        }
     }
     
     void createInstance() {
@@ -487,7 +3819,17 @@ private:
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 1);
         appInfo.pEngineName = "No Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        
+        // Ask for the newest version the loader supports, up to 1.3. A 1.0 loader doesn't export vkEnumerateInstanceVersion,
+        // and must be given 1.0.
+        auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(
+            vkGetInstanceProcAddr(VK_NULL_HANDLE, "vkEnumerateInstanceVersion"));
+        uint32_t loaderVersion = VK_API_VERSION_1_0;
+        if (enumerateInstanceVersion != nullptr) {
+            enumerateInstanceVersion(&loaderVersion);
+        }
+        instanceApiVersion = std::min(loaderVersion, static_cast<uint32_t>(VK_API_VERSION_1_3));
+        appInfo.apiVersion = instanceApiVersion;
         
         // Required info about the instance.
         VkInstanceCreateInfo createInfo{};
@@ -501,10 +3843,13 @@ private:
         createInfo.pApplicationInfo = &appInfo;
         
         // Extensions are necessary to interface the hardware API to window system
+        // GLFW isn't initialized for offscreen runs, which need no window system extensions.
         uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
-                
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        const char** glfwExtensions = nullptr;
+        
+        if (options.offscreen == false && options.computeBatchQueries == 0) {
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        }
         
         // Required for MacOS to avoid VK_ERROR_INCOMPATIBLE_DRIVER
         std::vector<const char*> requiredExtensions;
@@ -513,8 +3858,6 @@ private:
         }
         requiredExtensions.emplace_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
         createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
-        createInfo.enabledExtensionCount = (uint32_t) requiredExtensions.size();
-        createInfo.ppEnabledExtensionNames = requiredExtensions.data();
         // ---
         
         // Provide data about extensions to user
@@ -522,11 +3865,42 @@ private:
         vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
         std::vector<VkExtensionProperties> extensions(extensionCount);
         vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
-        std::cout << "Available extensions:\n";
+        if (options.verbose) {
+            std::cout << "Available extensions:\n";
+        }
+        bool properties2Supported = false;
+        bool surfaceCapabilities2Supported = false;
+        bool surfaceMaintenance1Supported = false;
         for (const auto& extension : extensions) {
-            std::cout << '\t' << extension.extensionName << '\n';
+            if (options.verbose) {
+                std::cout << '\t' << extension.extensionName << '\n';
+            }
+            if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+                properties2Supported = true;
+            }
+            else if (strcmp(extension.extensionName, VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME) == 0) {
+                surfaceCapabilities2Supported = true;
+            }
+            else if (strcmp(extension.extensionName, VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME) == 0) {
+                surfaceMaintenance1Supported = true;
+            }
+        }
+        
+        // Optional. Lets device selection read the device UUID.
+        if (properties2Supported) {
+            requiredExtensions.emplace_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+        }
+        
+        // Optional, and only with a window system. Lets presents signal fences; see `presentRetirementPoint()`.
+        surfaceMaintenance1 = glfwExtensions != nullptr && surfaceCapabilities2Supported && surfaceMaintenance1Supported;
+        if (surfaceMaintenance1) {
+            requiredExtensions.emplace_back(VK_KHR_GET_SURFACE_CAPABILITIES_2_EXTENSION_NAME);
+            requiredExtensions.emplace_back(VK_EXT_SURFACE_MAINTENANCE_1_EXTENSION_NAME);
         }
         
+        createInfo.enabledExtensionCount = (uint32_t) requiredExtensions.size();
+        createInfo.ppEnabledExtensionNames = requiredExtensions.data();
+        
         createInfo.enabledLayerCount = 0;
         
         // Create Vulkan instance
@@ -534,14 +3908,26 @@ private:
         if ( result != VK_SUCCESS) {
             throw std::runtime_error("Failed to create instance.");
         }
+        
+        if (properties2Supported) {
+            getPhysicalDeviceProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+                vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR"));
+            getPhysicalDeviceFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+                vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+        }
+        else if (instanceApiVersion >= VK_API_VERSION_1_1) {
+            getPhysicalDeviceFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+                vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2"));
+        }
     }
 };
 
-int main() {
-    HelloTriangleApplication app;
-
+int main(int argc, char* argv[]) {
     try {
-        app.run();
+        HelloTriangleApplication app(parseCommandLine(argc, argv));
+        if (app.run() == false) {
+            return EXIT_FAILURE;
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;